@@ -40,6 +40,7 @@
 #endif
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #ifdef HAVE_DIRENT_H
@@ -85,6 +86,7 @@
 const struct option longopts[] = {
     { "error-on-no-fonts", 0,                 0, 'E' },
     { "force",             0,                 0, 'f' },
+    { "jobs",              required_argument, 0, 'j' },
     { "really-force",      0,                 0, 'r' },
     { "sysroot",           required_argument, 0, 'y' },
     { "system-only",       0,                 0, 's' },
@@ -105,10 +107,10 @@ usage (char *program, int error)
 {
     FILE *file = error ? stderr : stdout;
 #if HAVE_GETOPT_LONG
-    fprintf (file, _("usage: %s [-EfrsvVh] [-y SYSROOT] [--error-on-no-fonts] [--force|--really-force] [--sysroot=SYSROOT] [--system-only] [--verbose] [--version] [--help] [dirs]\n"),
+    fprintf (file, _("usage: %s [-EfrsvVh] [-j JOBS] [-y SYSROOT] [--error-on-no-fonts] [--force|--really-force] [--jobs=JOBS] [--sysroot=SYSROOT] [--system-only] [--verbose] [--version] [--help] [dirs]\n"),
                      program);
 #else
-    fprintf (file, _("usage: %s [-EfrsvVh] [-y SYSROOT] [dirs]\n"),
+    fprintf (file, _("usage: %s [-EfrsvVh] [-j JOBS] [-y SYSROOT] [dirs]\n"),
                      program);
 #endif
     fprintf (file, _("Build font information caches in [dirs]\n"
@@ -117,6 +119,7 @@ usage (char *program, int error)
 #if HAVE_GETOPT_LONG
     fprintf (file, _("  -E, --error-on-no-fonts  raise an error if no fonts in a directory\n"));
     fprintf (file, _("  -f, --force              scan directories with apparently valid caches\n"));
+    fprintf (file, _("  -j, --jobs=JOBS          scan up to JOBS directories at once (0 for all processors)\n"));
     fprintf (file, _("  -r, --really-force       erase all existing caches, then rescan\n"));
     fprintf (file, _("  -s, --system-only        scan system-wide directories only\n"));
     fprintf (file, _("  -y, --sysroot=SYSROOT    prepend SYSROOT to all paths for scanning\n"));
@@ -127,6 +130,7 @@ usage (char *program, int error)
     fprintf (file, _("  -E         (error-on-no-fonts)\n"));
     fprintf (file, _("                       raise an error if no fonts in a directory\n"));
     fprintf (file, _("  -f         (force)   scan directories with apparently valid caches\n"));
+    fprintf (file, _("  -j JOBS    (jobs)    scan up to JOBS directories at once (0 for all processors)\n"));
     fprintf (file, _("  -r,   (really force) erase all existing caches, then rescan\n"));
     fprintf (file, _("  -s         (system)  scan system-wide directories only\n"));
     fprintf (file, _("  -y SYSROOT (sysroot) prepend SYSROOT to all paths for scanning\n"));
@@ -138,6 +142,8 @@ usage (char *program, int error)
 }
 
 static FcStrSet *processed_dirs;
+/* Directories whose cache was just built by FcDirCacheReadDirs */
+static FcStrSet *rebuilt_dirs;
 
 static int
 scanDirs (FcStrList *list, FcConfig *config, FcBool force, FcBool really_force, FcBool verbose, FcBool error_on_no_fonts, int *changed)
@@ -148,7 +154,7 @@ scanDirs (FcStrList *list, FcConfig *config, FcBool force, FcBool really_force,
     FcStrList     *sublist;
     FcCache       *cache;
     struct stat    statb;
-    FcBool         was_valid, was_processed = FcFalse;
+    FcBool         was_valid, was_rebuilt, was_processed = FcFalse;
     int            i;
     const FcChar8 *sysroot = FcConfigGetSysRoot (config);
 
@@ -209,21 +215,25 @@ scanDirs (FcStrList *list, FcConfig *config, FcBool force, FcBool really_force,
 	}
 	was_processed = FcTrue;
 
-	if (really_force) {
+	was_rebuilt = rebuilt_dirs && FcStrSetMember (rebuilt_dirs, dir);
+	if (really_force && !was_rebuilt) {
 	    FcDirCacheUnlink (dir, config);
 	}
 
 	cache = NULL;
 	was_valid = FcFalse;
-	if (!force) {
+	if (!force || was_rebuilt) {
 	    cache = FcDirCacheLoad (dir, config, NULL);
-	    if (cache)
+	    if (cache && was_rebuilt)
+		(*changed)++;
+	    else if (cache)
 		was_valid = FcTrue;
 	}
 
 	if (!cache) {
 	    (*changed)++;
-	    cache = FcDirCacheRead (dir, FcTrue, config);
+	    /* Unless forced, fonts are only queried from the changed files */
+	    cache = FcDirCacheRead (dir, force, config);
 	    if (!cache) {
 		fprintf (stderr, _("\"%s\": scanning error\n"), dir);
 		ret++;
@@ -305,6 +315,7 @@ main (int argc, char **argv)
     FcBool     really_force = FcFalse;
     FcBool     systemOnly = FcFalse;
     FcBool     error_on_no_fonts = FcFalse;
+    int        jobs = 1;
     FcConfig  *config;
     FcChar8   *sysroot = NULL;
     int        i;
@@ -315,9 +326,9 @@ main (int argc, char **argv)
 
     setlocale (LC_ALL, "");
 #  if HAVE_GETOPT_LONG
-    while ((c = getopt_long (argc, argv, "Efrsy:Vvh", longopts, NULL)) != -1)
+    while ((c = getopt_long (argc, argv, "Efj:rsy:Vvh", longopts, NULL)) != -1)
 #  else
-    while ((c = getopt (argc, argv, "Efrsy:Vvh")) != -1)
+    while ((c = getopt (argc, argv, "Efj:rsy:Vvh")) != -1)
 #  endif
     {
 	switch (c) {
@@ -330,6 +341,19 @@ main (int argc, char **argv)
 	case 'f':
 	    force = FcTrue;
 	    break;
+	case 'j': {
+	    char *end = NULL;
+	    long  n;
+
+	    errno = 0;
+	    n = strtol (optarg, &end, 10);
+	    if (end == optarg || *end != 0 || errno || n < 0 || n > INT_MAX) {
+		fprintf (stderr, "Invalid number of jobs: %s\n", optarg);
+		usage (argv[0], 1);
+	    }
+	    jobs = (int)n;
+	    break;
+	}
 	case 's':
 	    systemOnly = FcTrue;
 	    break;
@@ -367,6 +391,8 @@ main (int argc, char **argv)
 	fprintf (stderr, _("%s: Can't initialize font config library\n"), argv[0]);
 	return 1;
     }
+    /* Setting it current builds the missing caches already */
+    FcConfigSetThreads (config, jobs);
     FcConfigSetCurrent (config);
 
     if (argv[i]) {
@@ -402,9 +428,32 @@ main (int argc, char **argv)
 	}
 	FcStrListFirst (list);
     }
+    /*
+     * Build the caches on several threads first, then go through them
+     * in order as before, so that the messages and errors are the same
+     */
     changed = 0;
+    if (jobs != 1) {
+	const FcChar8 *dir;
+
+	dirs = FcStrSetCreate();
+	if (!dirs) {
+	    fprintf (stderr, _("Out of Memory\n"));
+	    return 1;
+	}
+	while ((dir = FcStrListNext (list)))
+	    FcStrSetAdd (dirs, dir);
+	FcStrListFirst (list);
+	rebuilt_dirs = FcDirCacheReadDirs (dirs, force, config);
+	FcStrSetDestroy (dirs);
+	/* Without knowing which, some caches may have been written */
+	if (!rebuilt_dirs)
+	    changed++;
+    }
     ret = scanDirs (list, config, force, really_force, verbose, error_on_no_fonts, &changed);
     FcStrListDone (list);
+    if (rebuilt_dirs)
+	FcStrSetDestroy (rebuilt_dirs);
 
     /*
      * Try to create CACHEDIR.TAG anyway.
@@ -417,6 +466,14 @@ main (int argc, char **argv)
 
     cleanCacheDirectories (config, verbose);
 
+    /* Let applications load the fonts from one cache file */
+    if (FcCacheWriteAggregate (config) && verbose)
+	printf ("%s: %s\n", argv[0], _("wrote aggregate cache"));
+
+    /* Let applications skip parsing the configuration files */
+    if (FcConfigWriteSnapshot (config) && verbose)
+	printf ("%s: %s\n", argv[0], _("wrote configuration snapshot"));
+
     FcConfigDestroy (config);
     FcFini();
     /*
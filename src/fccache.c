@@ -429,35 +429,56 @@ FcDirCacheProcess (FcConfig *config, const FcChar8 *dir,
 #define FC_CACHE_MIN_MMAP 1024
 
 /*
- * Skip list element, make sure the 'next' pointer is the last thing
- * in the structure, it will be allocated large enough to hold all
- * of the necessary pointers
+ * One entry for each cache in use, allocated on insertion and freed
+ * once the last reference to the cache is gone
  */
 
-typedef struct _FcCacheSkip FcCacheSkip;
-
-struct _FcCacheSkip {
-    FcCache     *cache;
-    FcRef        ref;
-    intptr_t     size;
-    void        *allocated;
-    dev_t        cache_dev;
-    ino_t        cache_ino;
-    time_t       cache_mtime;
-    long         cache_mtime_nano;
-    FcCacheSkip *next[1];
+typedef struct _FcCacheEntry FcCacheEntry;
+
+struct _FcCacheEntry {
+    FcCache          *cache;
+    FcRef             ref;
+    intptr_t          size;
+    void             *allocated;
+    FcCacheAggregate *aggregate; /* holding the cache, or NULL */
+    dev_t             cache_dev;
+    ino_t             cache_ino;
+    time_t            cache_mtime;
+    long              cache_mtime_nano;
 };
 
 /*
- * The head of the skip list; pointers for every possible level
- * in the skip list, plus the largest level in the list
+ * The caches in use sorted by address, so that the cache holding an
+ * object can be found without locking.  A table is never changed once
+ * published; inserting or removing a cache publishes a copy under
+ * cache_lock.  The bounds of each cache are copied into the table so
+ * that lookups never touch the entries of caches about to be freed.
  */
 
-#define FC_CACHE_MAX_LEVEL 16
+typedef struct _FcCacheRange {
+    const char   *start;
+    const char   *end;
+    FcCacheEntry *entry;
+} FcCacheRange;
+
+typedef struct _FcCacheTable FcCacheTable;
+
+struct _FcCacheTable {
+    FcCacheTable *retired; /* next table waiting to be freed */
+    int           num;
+    FcCacheRange  ranges[FLEXIBLE_ARRAY_MEMBER];
+};
+
+static FcCacheTable *fcCacheTable;
+
+/*
+ * Threads looking up fcCacheTable; tables replaced while this isn't
+ * zero are kept until it is
+ */
+static fc_atomic_int_t fcCacheReaders;
 
 /* Protected by cache_lock below */
-static FcCacheSkip *fcCacheChains[FC_CACHE_MAX_LEVEL];
-static int          fcCacheMaxLevel;
+static FcCacheTable *fcCacheRetired;
 
 static FcMutex *cache_lock;
 
@@ -477,8 +498,6 @@ retry:
 	}
 
 	FcMutexLock (lock);
-	/* Initialize random state */
-	FcRandom();
 	return;
     }
     FcMutexLock (lock);
@@ -504,195 +523,236 @@ free_lock (void)
 }
 
 /*
- * Generate a random level number, distributed
- * so that each level is 1/4 as likely as the one before
- *
- * Note that level numbers run 1 <= level <= MAX_LEVEL
+ * Find the first range in 'table' not below 'object'
  */
 static int
-random_level (void)
+FcCacheTableSearch (const FcCacheTable *table, const void *object)
 {
-    /* tricky bit -- each bit is '1' 75% of the time */
-    long int bits = FcRandom() | FcRandom();
-    int      level = 0;
+    int low = 0, high = table->num, mid;
 
-    while (++level < FC_CACHE_MAX_LEVEL) {
-	if (bits & 1)
-	    break;
-	bits >>= 1;
+    while (low < high) {
+	mid = (low + high) >> 1;
+	if ((const char *)object >= table->ranges[mid].end)
+	    low = mid + 1;
+	else
+	    high = mid;
     }
-    return level;
+    return low;
+}
+
+static FcCacheTable *
+FcCacheTableCreate (int num)
+{
+    FcCacheTable *table;
+
+    table = malloc (sizeof (FcCacheTable) + num * sizeof (FcCacheRange));
+    if (!table)
+	return NULL;
+    table->retired = NULL;
+    table->num = num;
+
+    return table;
 }
 
 /*
- * Insert cache into the list
+ * Replace the table, freeing the tables replaced before once no
+ * thread can still be looking at them
  */
-static FcBool
-FcCacheInsert (FcCache *cache, struct stat *cache_stat)
+static void
+FcCacheTablePublishUnlocked (FcCacheTable *table)
 {
-    FcCacheSkip **update[FC_CACHE_MAX_LEVEL];
-    FcCacheSkip  *s, **next;
-    int           i, level;
+    FcCacheTable *old = fc_atomic_ptr_get (&fcCacheTable);
 
-    lock_cache();
-
-    /*
-     * Find links along each chain
-     */
-    next = fcCacheChains;
-    for (i = fcCacheMaxLevel; --i >= 0;) {
-	for (; (s = next[i]); next = s->next)
-	    if (s->cache > cache)
-		break;
-	update[i] = &next[i];
+    (void)fc_atomic_ptr_cmpexch (&fcCacheTable, old, table);
+    if (old) {
+	old->retired = fcCacheRetired;
+	fcCacheRetired = old;
     }
-
-    /*
-     * Create new list element
-     */
-    level = random_level();
-    if (level > fcCacheMaxLevel) {
-	level = fcCacheMaxLevel + 1;
-	update[fcCacheMaxLevel] = &fcCacheChains[fcCacheMaxLevel];
-	fcCacheMaxLevel = level;
+    /* Read-modify-write, to be ordered after the lookups it counts */
+    if (fc_atomic_int_add (fcCacheReaders, 0) == 0) {
+	while ((old = fcCacheRetired)) {
+	    fcCacheRetired = old->retired;
+	    free (old);
+	}
     }
+}
 
-    s = malloc (sizeof (FcCacheSkip) + (level - 1) * sizeof (FcCacheSkip *));
-    if (!s) {
-	unlock_cache();
+/*
+ * Insert cache into the table
+ */
+static FcBool
+FcCacheInsertUnlocked (FcCache *cache, struct stat *cache_stat, FcCacheAggregate *aggregate)
+{
+    FcCacheTable *old = fc_atomic_ptr_get (&fcCacheTable), *table;
+    FcCacheEntry *e;
+    int           num = old ? old->num : 0, i;
+
+    e = malloc (sizeof (FcCacheEntry));
+    if (!e)
+	return FcFalse;
+    table = FcCacheTableCreate (num + 1);
+    if (!table) {
+	free (e);
 	return FcFalse;
     }
 
-    s->cache = cache;
-    s->size = cache->size;
-    s->allocated = NULL;
-    FcRefInit (&s->ref, 1);
+    e->cache = cache;
+    e->size = cache->size;
+    e->allocated = NULL;
+    e->aggregate = aggregate;
+    FcRefInit (&e->ref, 1);
     if (cache_stat) {
-	s->cache_dev = cache_stat->st_dev;
-	s->cache_ino = cache_stat->st_ino;
-	s->cache_mtime = cache_stat->st_mtime;
+	e->cache_dev = cache_stat->st_dev;
+	e->cache_ino = cache_stat->st_ino;
+	e->cache_mtime = cache_stat->st_mtime;
 #ifdef HAVE_STRUCT_STAT_ST_MTIM
-	s->cache_mtime_nano = cache_stat->st_mtim.tv_nsec;
+	e->cache_mtime_nano = cache_stat->st_mtim.tv_nsec;
 #else
-	s->cache_mtime_nano = 0;
+	e->cache_mtime_nano = 0;
 #endif
     } else {
-	s->cache_dev = 0;
-	s->cache_ino = 0;
-	s->cache_mtime = 0;
-	s->cache_mtime_nano = 0;
+	e->cache_dev = 0;
+	e->cache_ino = 0;
+	e->cache_mtime = 0;
+	e->cache_mtime_nano = 0;
     }
 
-    /*
-     * Insert into all fcCacheChains
-     */
-    for (i = 0; i < level; i++) {
-	s->next[i] = *update[i];
-	*update[i] = s;
-    }
+    i = old ? FcCacheTableSearch (old, cache) : 0;
+    if (i > 0)
+	memcpy (table->ranges, old->ranges, i * sizeof (FcCacheRange));
+    table->ranges[i].start = (const char *)cache;
+    table->ranges[i].end = (const char *)cache + cache->size;
+    table->ranges[i].entry = e;
+    if (i < num)
+	memcpy (table->ranges + i + 1, old->ranges + i, (num - i) * sizeof (FcCacheRange));
+    FcCacheTablePublishUnlocked (table);
 
-    unlock_cache();
     return FcTrue;
 }
 
-static FcCacheSkip *
+static FcBool
+FcCacheInsert (FcCache *cache, struct stat *cache_stat)
+{
+    FcBool ret;
+
+    lock_cache();
+    ret = FcCacheInsertUnlocked (cache, cache_stat, NULL);
+    unlock_cache();
+
+    return ret;
+}
+
+static FcCacheEntry *
 FcCacheFindByAddrUnlocked (void *object)
 {
+    FcCacheTable *table = fc_atomic_ptr_get (&fcCacheTable);
     int           i;
-    FcCacheSkip **next = fcCacheChains;
-    FcCacheSkip  *s;
 
-    if (!object)
+    if (!object || !table)
 	return NULL;
-
-    /*
-     * Walk chain pointers one level at a time
-     */
-    for (i = fcCacheMaxLevel; --i >= 0;)
-	while (next[i] && (char *)object >= ((char *)next[i]->cache + next[i]->size))
-	    next = next[i]->next;
-    /*
-     * Here we are
-     */
-    s = next[0];
-    if (s && (char *)object < ((char *)s->cache + s->size))
-	return s;
+    i = FcCacheTableSearch (table, object);
+    if (i < table->num && (const char *)object >= table->ranges[i].start)
+	return table->ranges[i].entry;
     return NULL;
 }
 
-static FcCacheSkip *
+/*
+ * Find the cache holding 'object' without locking; the entry stays
+ * valid as long as the caller holds a reference to the cache
+ */
+static FcCacheEntry *
 FcCacheFindByAddr (void *object)
 {
-    FcCacheSkip *ret;
-    lock_cache();
+    FcCacheEntry *ret;
+
+    fc_atomic_int_add (fcCacheReaders, 1);
     ret = FcCacheFindByAddrUnlocked (object);
-    unlock_cache();
+    fc_atomic_int_add (fcCacheReaders, -1);
     return ret;
 }
 
-static void
+/*
+ * Remove cache from the table; failing that, the cache is kept in
+ * use rather than freed under readers
+ */
+static FcBool
 FcCacheRemoveUnlocked (FcCache *cache)
 {
-    FcCacheSkip **update[FC_CACHE_MAX_LEVEL];
-    FcCacheSkip  *s, **next;
+    FcCacheTable *old = fc_atomic_ptr_get (&fcCacheTable), *table;
+    FcCacheEntry *e;
+    void         *allocated, *next;
     int           i;
-    void         *allocated;
 
-    /*
-     * Find links along each chain
-     */
-    next = fcCacheChains;
-    for (i = fcCacheMaxLevel; --i >= 0;) {
-	for (; (s = next[i]); next = s->next)
-	    if (s->cache >= cache)
-		break;
-	update[i] = &next[i];
-    }
-    s = next[0];
-    for (i = 0; i < fcCacheMaxLevel && *update[i] == s; i++)
-	*update[i] = s->next[i];
-    while (fcCacheMaxLevel > 0 && fcCacheChains[fcCacheMaxLevel - 1] == NULL)
-	fcCacheMaxLevel--;
+    if (!old)
+	return FcFalse;
+    i = FcCacheTableSearch (old, cache);
+    if (i == old->num || old->ranges[i].start != (const char *)cache)
+	return FcFalse;
+    e = old->ranges[i].entry;
 
-    if (s) {
-	allocated = s->allocated;
-	while (allocated) {
-	    /* First element in allocated chunk is the free list */
-	    next = *(void **)allocated;
-	    free (allocated);
-	    allocated = next;
-	}
-	free (s);
+    table = FcCacheTableCreate (old->num - 1);
+    if (!table)
+	return FcFalse;
+    memcpy (table->ranges, old->ranges, i * sizeof (FcCacheRange));
+    memcpy (table->ranges + i, old->ranges + i + 1, (old->num - i - 1) * sizeof (FcCacheRange));
+    FcCacheTablePublishUnlocked (table);
+
+    allocated = e->allocated;
+    while (allocated) {
+	/* First element in allocated chunk is the free list */
+	next = *(void **)allocated;
+	free (allocated);
+	allocated = next;
     }
+    free (e);
+
+    return FcTrue;
 }
 
 static FcCache *
 FcCacheFindByStat (struct stat *cache_stat)
 {
-    FcCacheSkip *s;
+    FcCacheTable *table;
+    FcCacheEntry *e;
+    int           i;
 
     lock_cache();
-    for (s = fcCacheChains[0]; s; s = s->next[0])
-	if (s->cache_dev == cache_stat->st_dev &&
-	    s->cache_ino == cache_stat->st_ino &&
-	    s->cache_mtime == cache_stat->st_mtime) {
+    table = fc_atomic_ptr_get (&fcCacheTable);
+    for (i = 0; table && i < table->num; i++) {
+	e = table->ranges[i].entry;
+	if (e->cache_dev == cache_stat->st_dev &&
+	    e->cache_ino == cache_stat->st_ino &&
+	    e->cache_mtime == cache_stat->st_mtime) {
 #ifdef HAVE_STRUCT_STAT_ST_MTIM
-	    if (s->cache_mtime_nano != cache_stat->st_mtim.tv_nsec)
+	    if (e->cache_mtime_nano != cache_stat->st_mtim.tv_nsec)
 		continue;
 #endif
-	    FcRefInc (&s->ref);
+	    FcRefInc (&e->ref);
 	    unlock_cache();
-	    return s->cache;
+	    return e->cache;
 	}
+    }
     unlock_cache();
     return NULL;
 }
 
 static void
-FcDirCacheDisposeUnlocked (FcCache *cache)
+FcCacheAggregateReleaseUnlocked (FcCacheAggregate *aggregate);
+
+static void
+FcDirCacheDisposeUnlocked (FcCacheEntry *entry)
 {
-    FcCacheRemoveUnlocked (cache);
+    FcCache          *cache = entry->cache;
+    FcCacheAggregate *aggregate = entry->aggregate;
+
+    if (!FcCacheRemoveUnlocked (cache))
+	return;
 
+    /* Unmapped with the rest of the aggregate cache file */
+    if (aggregate) {
+	FcCacheAggregateReleaseUnlocked (aggregate);
+	return;
+    }
     switch (cache->magic) {
     case FC_CACHE_MAGIC_ALLOC:
 	free (cache);
@@ -710,40 +770,49 @@ FcDirCacheDisposeUnlocked (FcCache *cache)
 void
 FcCacheObjectReference (void *object)
 {
-    FcCacheSkip *skip = FcCacheFindByAddr (object);
+    FcCacheEntry *entry = FcCacheFindByAddr (object);
 
-    if (skip)
-	FcRefInc (&skip->ref);
+    if (entry)
+	FcRefInc (&entry->ref);
 }
 
 void
 FcCacheObjectDereference (void *object)
 {
-    FcCacheSkip *skip;
+    FcCacheEntry *entry = FcCacheFindByAddr (object);
+    FcCache      *cache;
 
+    if (!entry)
+	return;
+    cache = entry->cache;
+    if (FcRefDec (&entry->ref) != 1)
+	return;
+
+    /*
+     * The cache may have been looked up by its file and referenced
+     * again, or even released again and freed, before taking the lock
+     */
     lock_cache();
-    skip = FcCacheFindByAddrUnlocked (object);
-    if (skip) {
-	if (FcRefDec (&skip->ref) == 1)
-	    FcDirCacheDisposeUnlocked (skip->cache);
-    }
+    entry = FcCacheFindByAddrUnlocked (cache);
+    if (entry && entry->cache == cache && entry->ref.count == 0)
+	FcDirCacheDisposeUnlocked (entry);
     unlock_cache();
 }
 
 void *
 FcCacheAllocate (FcCache *cache, size_t len)
 {
-    FcCacheSkip *skip;
+    FcCacheEntry *entry;
     void        *allocated = NULL;
 
     lock_cache();
-    skip = FcCacheFindByAddrUnlocked (cache);
-    if (skip) {
+    entry = FcCacheFindByAddrUnlocked (cache);
+    if (entry) {
 	void *chunk = malloc (sizeof (void *) + len);
 	if (chunk) {
 	    /* First element in allocated chunk is the free list */
-	    *(void **)chunk = skip->allocated;
-	    skip->allocated = chunk;
+	    *(void **)chunk = entry->allocated;
+	    entry->allocated = chunk;
 	    /* Return the rest */
 	    allocated = ((FcChar8 *)chunk) + sizeof (void *);
 	}
@@ -755,20 +824,26 @@ FcCacheAllocate (FcCache *cache, size_t len)
 void
 FcCacheFini (void)
 {
-    int    i;
-    FcBool res = FcTrue;
+    FcCacheTable *table = fc_atomic_ptr_get (&fcCacheTable);
+    FcCacheEntry *e;
+    int           i;
 
-    for (i = 0; i < FC_CACHE_MAX_LEVEL; i++) {
-	if (fcCacheChains[i] != NULL) {
-	    res = FcFalse;
-	    if (FcDebug() & FC_DBG_CACHE) {
-		FcCacheSkip *s = fcCacheChains[i];
-		fprintf (stderr, "Fontconfig error: not freed %p (dir: %s, refcount %" FC_ATOMIC_INT_FORMAT ")\n", s->cache, FcCacheDir (s->cache), s->ref.count);
+    if (table && table->num) {
+	if (FcDebug() & FC_DBG_CACHE) {
+	    for (i = 0; i < table->num; i++) {
+		e = table->ranges[i].entry;
+		fprintf (stderr, "Fontconfig error: not freed %p (dir: %s, refcount %" FC_ATOMIC_INT_FORMAT ")\n", e->cache, FcCacheDir (e->cache), e->ref.count);
 	    }
 	}
+	return;
+    }
+    if (table && fc_atomic_ptr_cmpexch (&fcCacheTable, table, NULL))
+	free (table);
+    while ((table = fcCacheRetired)) {
+	fcCacheRetired = table->retired;
+	free (table);
     }
-    if (res)
-	free_lock();
+    free_lock();
 }
 
 static FcBool
@@ -977,6 +1052,29 @@ FcCacheOffsetsValid (FcCache *cache)
 	}
     }
 
+    if (cache->files) {
+	FcCacheFiles *files;
+	FcChar8      *name;
+
+	if (cache->files < 0 || cache->files > cache->size - (intptr_t)sizeof (FcCacheFiles) ||
+	    cache->files % sizeof (intptr_t) != 0)
+	    return FcFalse;
+	files = FcOffsetMember (cache, files, FcCacheFiles);
+	if (files->magic != FC_CACHE_MAGIC_FILES || files->num < 0 ||
+	    files->num > (end - (char *)files->files) / (intptr_t)sizeof (FcCacheFile))
+	    return FcFalse;
+	for (i = 0; i < files->num; i++) {
+	    if (files->files[i].name < base - (char *)files ||
+	        files->files[i].name >= end - (char *)files ||
+	        files->files[i].font < 0 || files->files[i].nfont < 0 ||
+	        !fs || files->files[i].nfont > fs->nfont - files->files[i].font)
+		return FcFalse;
+	    name = FcOffsetToPtr (files, files->files[i].name, FcChar8);
+	    if (memchr (name, '\0', end - (char *)name) == NULL)
+		return FcFalse;
+	}
+    }
+
     return FcTrue;
 }
 
@@ -984,7 +1082,7 @@ FcCacheOffsetsValid (FcCache *cache)
  * Map a cache file into memory
  */
 static FcCache *
-FcDirCacheMapFd (FcConfig *config, int fd, struct stat *fd_stat, struct stat *dir_stat)
+FcDirCacheMapFd (FcConfig *config, int fd, struct stat *fd_stat, struct stat *dir_stat, FcBool any_time)
 {
     FcCache *cache;
     FcBool   allocated = FcFalse;
@@ -994,7 +1092,7 @@ FcDirCacheMapFd (FcConfig *config, int fd, struct stat *fd_stat, struct stat *di
 	return NULL;
     cache = FcCacheFindByStat (fd_stat);
     if (cache) {
-	if (FcCacheTimeValid (config, cache, dir_stat))
+	if (any_time || FcCacheTimeValid (config, cache, dir_stat))
 	    return cache;
 	else if (FcCacheIsNewVersion (config, cache)) {
 	    /* Re-use if cache was generated by newer version of fontconfig
@@ -1048,7 +1146,8 @@ FcDirCacheMapFd (FcConfig *config, int fd, struct stat *fd_stat, struct stat *di
         cache->version < FC_CACHE_VERSION_NUMBER ||
         cache->size != (intptr_t)fd_stat->st_size ||
         !FcCacheOffsetsValid (cache) ||
-        (!FcCacheTimeValid (config, cache, dir_stat) &&
+        (!any_time &&
+         !FcCacheTimeValid (config, cache, dir_stat) &&
          !FcCacheIsNewVersion (config, cache)) ||
         !FcCacheInsert (cache, fd_stat)) {
 	if (allocated)
@@ -1073,10 +1172,10 @@ FcDirCacheMapFd (FcConfig *config, int fd, struct stat *fd_stat, struct stat *di
 void
 FcDirCacheReference (FcCache *cache, int nref)
 {
-    FcCacheSkip *skip = FcCacheFindByAddr (cache);
+    FcCacheEntry *entry = FcCacheFindByAddr (cache);
 
-    if (skip)
-	FcRefAdd (&skip->ref, nref);
+    if (entry)
+	FcRefAdd (&entry->ref, nref);
 }
 
 void
@@ -1088,7 +1187,7 @@ FcDirCacheUnload (FcCache *cache)
 static FcBool
 FcDirCacheMapHelper (FcConfig *config, int fd, struct stat *fd_stat, struct stat *dir_stat, struct timeval *latest_cache_mtime, void *closure)
 {
-    FcCache       *cache = FcDirCacheMapFd (config, fd, fd_stat, dir_stat);
+    FcCache       *cache = FcDirCacheMapFd (config, fd, fd_stat, dir_stat, FcFalse);
     struct timeval cache_mtime, zero_mtime = { 0, 0 }, dir_mtime;
 
     if (!cache)
@@ -1127,6 +1226,302 @@ FcDirCacheMapHelper (FcConfig *config, int fd, struct stat *fd_stat, struct stat
     return FcTrue;
 }
 
+/*
+ * An aggregate cache file holds the caches of many directories, as
+ * written by FcCacheWriteAggregate, so that loading all the fonts
+ * maps one file rather than one per directory.  A directory table
+ * sorted by name follows the header; each cache is validated like
+ * a cache file of its own before use.
+ */
+#define FC_CACHE_AGGREGATE_NAME  "fonts-" FC_ARCHITECTURE ".aggregate-" FC_CACHE_VERSION
+#define FC_CACHE_AGGREGATE_ALIGN 16
+
+typedef struct _FcCacheAggregateHeader {
+    unsigned int magic;   /* FC_CACHE_MAGIC_AGGREGATE */
+    int          version; /* FC_CACHE_VERSION_NUMBER */
+    intptr_t     size;    /* size of file */
+    intptr_t     table;   /* offset to directory table */
+    int          ndir;    /* number of directories */
+    int          pad;
+} FcCacheAggregateHeader;
+
+typedef struct _FcCacheAggregateEntry {
+    intptr_t dir;   /* offset to dir name */
+    intptr_t cache; /* offset to the cache of dir */
+    intptr_t size;  /* size of the cache */
+} FcCacheAggregateEntry;
+
+struct _FcCacheAggregate {
+    FcCacheAggregateHeader *header;
+    FcBool                  allocated;
+    int                     ref; /* protected by cache_lock */
+};
+
+static void
+FcCacheAggregateReleaseUnlocked (FcCacheAggregate *aggregate)
+{
+    if (--aggregate->ref > 0)
+	return;
+    if (aggregate->allocated)
+	free (aggregate->header);
+    else {
+#if defined(HAVE_MMAP) || defined(__CYGWIN__)
+	munmap (aggregate->header, aggregate->header->size);
+#elif defined(_WIN32)
+	UnmapViewOfFile (aggregate->header);
+#endif
+    }
+    free (aggregate);
+}
+
+static FcBool
+FcCacheAggregateValid (FcCacheAggregateHeader *header, off_t size)
+{
+    FcCacheAggregateEntry *table;
+    char                  *base = (char *)header;
+    int                    i;
+
+    if (header->magic != FC_CACHE_MAGIC_AGGREGATE ||
+        header->version != FC_CACHE_VERSION_NUMBER ||
+        header->size != (intptr_t)size ||
+        header->ndir < 0 ||
+        header->table < (intptr_t)sizeof (FcCacheAggregateHeader) ||
+        header->table % sizeof (intptr_t) != 0 ||
+        header->ndir > (header->size - header->table) / (intptr_t)sizeof (FcCacheAggregateEntry))
+	return FcFalse;
+    table = (FcCacheAggregateEntry *)(base + header->table);
+    for (i = 0; i < header->ndir; i++) {
+	if (table[i].dir <= 0 || table[i].dir >= header->size ||
+	    !memchr (base + table[i].dir, '\0', header->size - table[i].dir) ||
+	    table[i].cache <= 0 || table[i].cache % FC_CACHE_AGGREGATE_ALIGN != 0 ||
+	    table[i].size < (intptr_t)sizeof (FcCache) ||
+	    table[i].size > header->size - table[i].cache)
+	    return FcFalse;
+	if (i > 0 && strcmp (base + table[i - 1].dir, base + table[i].dir) >= 0)
+	    return FcFalse;
+    }
+    return FcTrue;
+}
+
+static FcCacheAggregate *
+FcCacheAggregateOpen (const FcChar8 *file)
+{
+    FcCacheAggregate       *aggregate;
+    FcCacheAggregateHeader *header = NULL;
+    FcBool                  allocated = FcFalse;
+    struct stat             file_stat;
+    int                     fd;
+
+    fd = FcDirCacheOpenFile (file, &file_stat);
+    if (fd < 0)
+	return NULL;
+    if (file_stat.st_size > INTPTR_MAX ||
+        file_stat.st_size < (off_t)sizeof (FcCacheAggregateHeader))
+	goto bail;
+    if (FcCacheIsMmapSafe (fd)) {
+#if defined(HAVE_MMAP) || defined(__CYGWIN__)
+	header = mmap (0, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (header == MAP_FAILED)
+	    header = NULL;
+#elif defined(_WIN32)
+	HANDLE hFileMap;
+
+	hFileMap = CreateFileMapping ((HANDLE)_get_osfhandle (fd), NULL,
+	                              PAGE_READONLY, 0, 0, NULL);
+	if (hFileMap != NULL) {
+	    header = MapViewOfFile (hFileMap, FILE_MAP_READ, 0, 0,
+	                            file_stat.st_size);
+	    CloseHandle (hFileMap);
+	}
+#endif
+    }
+    if (!header) {
+	header = malloc (file_stat.st_size);
+	if (!header)
+	    goto bail;
+	if (read (fd, header, file_stat.st_size) != file_stat.st_size) {
+	    free (header);
+	    goto bail;
+	}
+	allocated = FcTrue;
+    }
+    aggregate = malloc (sizeof (FcCacheAggregate));
+    if (!aggregate || !FcCacheAggregateValid (header, file_stat.st_size)) {
+	if (FcDebug() & FC_DBG_CACHE)
+	    printf ("FcCacheAggregateOpen file \"%s\" invalid\n", file);
+	free (aggregate);
+	if (allocated)
+	    free (header);
+	else {
+#if defined(HAVE_MMAP) || defined(__CYGWIN__)
+	    munmap (header, file_stat.st_size);
+#elif defined(_WIN32)
+	    UnmapViewOfFile (header);
+#endif
+	}
+	goto bail;
+    }
+    close (fd);
+    aggregate->header = header;
+    aggregate->allocated = allocated;
+    aggregate->ref = 1;
+    if (FcDebug() & FC_DBG_CACHE)
+	printf ("FcCacheAggregateOpen file \"%s\" %d dirs\n", file, header->ndir);
+
+    return aggregate;
+
+bail:
+    close (fd);
+    return NULL;
+}
+
+void
+FcCacheAggregatesDestroy (FcCacheAggregate **aggregates)
+{
+    int i;
+
+    if (!aggregates)
+	return;
+    lock_cache();
+    for (i = 0; aggregates[i]; i++)
+	FcCacheAggregateReleaseUnlocked (aggregates[i]);
+    unlock_cache();
+    free (aggregates);
+}
+
+/*
+ * The aggregate cache files of the cache directories of 'config',
+ * opened once and kept until the cache directories change
+ */
+static FcCacheAggregate **
+FcDirCacheGetAggregates (FcConfig *config)
+{
+    FcCacheAggregate **aggregates;
+    const FcChar8     *sysroot;
+    FcChar8           *file;
+    int                i, n = 0;
+
+    aggregates = fc_atomic_ptr_get (&config->cache_aggregates);
+    if (aggregates)
+	return aggregates;
+
+    aggregates = malloc ((config->cacheDirs->num + 1) * sizeof (FcCacheAggregate *));
+    if (!aggregates)
+	return NULL;
+    sysroot = FcConfigGetSysRoot (config);
+    for (i = 0; i < config->cacheDirs->num; i++) {
+	if (sysroot)
+	    file = FcStrBuildFilename (sysroot, config->cacheDirs->strs[i], FC_CACHE_AGGREGATE_NAME, NULL);
+	else
+	    file = FcStrBuildFilename (config->cacheDirs->strs[i], FC_CACHE_AGGREGATE_NAME, NULL);
+	if (!file)
+	    continue;
+	if ((aggregates[n] = FcCacheAggregateOpen (file)))
+	    n++;
+	FcStrFree (file);
+    }
+    aggregates[n] = NULL;
+    if (!fc_atomic_ptr_cmpexch (&config->cache_aggregates, NULL, aggregates)) {
+	FcCacheAggregatesDestroy (aggregates);
+	aggregates = fc_atomic_ptr_get (&config->cache_aggregates);
+    }
+    return aggregates;
+}
+
+static FcCacheAggregateEntry *
+FcCacheAggregateFind (FcCacheAggregate *aggregate, const FcChar8 *dir)
+{
+    FcCacheAggregateHeader *header = aggregate->header;
+    FcCacheAggregateEntry  *table = (FcCacheAggregateEntry *)((char *)header + header->table);
+    int                     low = 0, high = header->ndir - 1, mid, c;
+
+    while (low <= high) {
+	mid = (low + high) >> 1;
+	c = strcmp ((const char *)dir, (char *)header + table[mid].dir);
+	if (c == 0)
+	    return &table[mid];
+	if (c < 0)
+	    high = mid - 1;
+	else
+	    low = mid + 1;
+    }
+    return NULL;
+}
+
+/*
+ * Look for the cache of 'dir' in the aggregate cache files; the
+ * per-directory cache files are only needed for directories that
+ * are missing or out of date there
+ */
+static FcCache *
+FcDirCacheLoadAggregate (FcConfig *config, const FcChar8 *dir)
+{
+    FcCacheAggregate     **aggregates;
+    FcCacheAggregateEntry *entry;
+    FcCacheEntry          *e;
+    FcCache               *cache;
+    struct stat            dir_stat;
+    const FcChar8         *sysroot;
+    FcChar8               *d;
+    int                    i;
+
+    aggregates = FcDirCacheGetAggregates (config);
+    if (!aggregates || !aggregates[0])
+	return NULL;
+
+    sysroot = FcConfigGetSysRoot (config);
+    if (sysroot)
+	d = FcStrBuildFilename (sysroot, dir, NULL);
+    else
+	d = FcStrCopy (dir);
+    if (!d)
+	return NULL;
+    if (FcStatChecksum (d, &dir_stat) < 0) {
+	FcStrFree (d);
+	return NULL;
+    }
+    FcStrFree (d);
+
+    for (i = 0; aggregates[i]; i++) {
+	entry = FcCacheAggregateFind (aggregates[i], dir);
+	if (!entry)
+	    continue;
+	cache = (FcCache *)((char *)aggregates[i]->header + entry->cache);
+	if (cache->magic != FC_CACHE_MAGIC_MMAP ||
+	    cache->version < FC_CACHE_VERSION_NUMBER ||
+	    cache->size != entry->size ||
+	    (!FcCacheTimeValid (config, cache, &dir_stat) &&
+	     !FcCacheIsNewVersion (config, cache)))
+	    continue;
+
+	lock_cache();
+	e = FcCacheFindByAddrUnlocked (cache);
+	if (e && e->cache == cache) {
+	    FcRefInc (&e->ref);
+	    unlock_cache();
+	    return cache;
+	}
+	unlock_cache();
+	/* Checked once, when the cache is first used */
+	if (!FcCacheOffsetsValid (cache))
+	    continue;
+	lock_cache();
+	e = FcCacheFindByAddrUnlocked (cache);
+	if (e && e->cache == cache)
+	    FcRefInc (&e->ref);
+	else if (FcCacheInsertUnlocked (cache, NULL, aggregates[i]))
+	    aggregates[i]->ref++;
+	else
+	    cache = NULL;
+	unlock_cache();
+	if (cache && (FcDebug() & FC_DBG_CACHE))
+	    printf ("FcDirCacheLoadAggregate dir \"%s\"\n", dir);
+	if (cache)
+	    return cache;
+    }
+    return NULL;
+}
+
 FcCache *
 FcDirCacheLoad (const FcChar8 *dir, FcConfig *config, FcChar8 **cache_file)
 {
@@ -1135,7 +1530,11 @@ FcDirCacheLoad (const FcChar8 *dir, FcConfig *config, FcChar8 **cache_file)
     config = FcConfigReference (config);
     if (!config)
 	return NULL;
-    if (!FcDirCacheProcess (config, dir,
+    /* Only a cache file of its own can be named to the caller */
+    if (!cache_file)
+	cache = FcDirCacheLoadAggregate (config, dir);
+    if (!cache &&
+        !FcDirCacheProcess (config, dir,
                             FcDirCacheMapHelper,
                             &cache, cache_file))
 	cache = NULL;
@@ -1160,7 +1559,7 @@ FcDirCacheLoadFile (const FcChar8 *cache_file, struct stat *file_stat)
 	return NULL;
     fd = FcDirCacheOpenFile (cache_file, file_stat);
     if (fd >= 0) {
-	cache = FcDirCacheMapFd (config, fd, file_stat, NULL);
+	cache = FcDirCacheMapFd (config, fd, file_stat, NULL, FcFalse);
 	close (fd);
     }
     FcConfigDestroy (config);
@@ -1168,6 +1567,45 @@ FcDirCacheLoadFile (const FcChar8 *cache_file, struct stat *file_stat)
     return cache;
 }
 
+static FcBool
+FcDirCacheMapPreviousHelper (FcConfig *config, int fd, struct stat *fd_stat, struct stat *dir_stat, struct timeval *latest_cache_mtime FC_UNUSED, void *closure)
+{
+    FcCache *cache;
+
+    if (*((FcCache **)closure))
+	return FcFalse;
+    cache = FcDirCacheMapFd (config, fd, fd_stat, dir_stat, FcTrue);
+    if (!cache)
+	return FcFalse;
+    *((FcCache **)closure) = cache;
+    return FcTrue;
+}
+
+/*
+ * Load the cache of 'dir' even though the directory changed since, to
+ * take the fonts of the files that did not change from.  Only caches
+ * recording their files and written by this version are of use.
+ */
+FcCache *
+FcDirCacheLoadPrevious (const FcChar8 *dir, FcConfig *config)
+{
+    FcCache *cache = NULL;
+    int64_t  version = (FC_VERSION_MAJOR << 24) +
+                      (FC_VERSION_MINOR << 12) +
+                      FC_VERSION_MICRO;
+
+    if (!FcDirCacheProcess (config, dir,
+                            FcDirCacheMapPreviousHelper,
+                            &cache, NULL))
+	return NULL;
+    if (!cache->files || cache->fc_version != version) {
+	FcDirCacheUnload (cache);
+	return NULL;
+    }
+
+    return cache;
+}
+
 static int
 FcDirChecksum (struct stat *statb)
 {
@@ -1267,18 +1705,154 @@ FcDirCacheValid (const FcChar8 *dir)
     return ret;
 }
 
+FcDirFiles *
+FcDirFilesCreate (void)
+{
+    FcDirFiles *files = malloc (sizeof (FcDirFiles));
+
+    if (!files)
+	return NULL;
+    files->names = FcStrSetCreateEx (FCSS_ALLOW_DUPLICATES | FCSS_GROW_BY_64);
+    if (!files->names) {
+	free (files);
+	return NULL;
+    }
+    files->files = NULL;
+    files->size = 0;
+
+    return files;
+}
+
+void
+FcDirFilesDestroy (FcDirFiles *files)
+{
+    if (!files)
+	return;
+    FcStrSetDestroy (files->names);
+    free (files->files);
+    free (files);
+}
+
+/*
+ * Record that the file 'name' of the directory gave 'nfont' fonts,
+ * starting at 'font'.  Files are added in the order of their names.
+ */
+FcBool
+FcDirFilesAdd (FcDirFiles *files, const FcChar8 *name, const struct stat *statb, int font, int nfont)
+{
+    FcCacheFile *file;
+    int          num = files->names->num;
+
+    if (num == files->size) {
+	int size = files->size ? files->size * 2 : 64;
+
+	file = realloc (files->files, size * sizeof (FcCacheFile));
+	if (!file)
+	    return FcFalse;
+	files->files = file;
+	files->size = size;
+    }
+    if (!FcStrSetAdd (files->names, name))
+	return FcFalse;
+    file = &files->files[num];
+    file->name = 0;
+    file->font = font;
+    file->nfont = nfont;
+    file->dev = statb->st_dev;
+    file->ino = statb->st_ino;
+    file->size = statb->st_size;
+    file->mtime = statb->st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    file->mtime_nano = statb->st_mtim.tv_nsec;
+#else
+    file->mtime_nano = 0;
+#endif
+
+    return FcTrue;
+}
+
+static FcDirFiles *
+FcDirFilesFromCache (FcCache *cache)
+{
+    FcCacheFiles *cached;
+    FcDirFiles   *files;
+    int           i;
+
+    if (!cache->files)
+	return NULL;
+    cached = FcOffsetMember (cache, files, FcCacheFiles);
+    files = FcDirFilesCreate();
+    if (!files)
+	return NULL;
+    files->files = malloc (cached->num * sizeof (FcCacheFile));
+    if (cached->num && !files->files)
+	goto bail;
+    files->size = cached->num;
+    for (i = 0; i < cached->num; i++) {
+	if (!FcStrSetAdd (files->names, FcOffsetToPtr (cached, cached->files[i].name, FcChar8)))
+	    goto bail;
+	files->files[i] = cached->files[i];
+    }
+
+    return files;
+
+bail:
+    FcDirFilesDestroy (files);
+    return NULL;
+}
+
+/*
+ * Find what the cache recorded about the file 'name' of its directory
+ */
+const FcCacheFile *
+FcDirCacheFindFile (FcCache *cache, const FcChar8 *name)
+{
+    FcCacheFiles *files;
+    int           low = 0, high, mid, c;
+
+    if (!cache->files)
+	return NULL;
+    files = FcOffsetMember (cache, files, FcCacheFiles);
+    high = files->num - 1;
+    while (low <= high) {
+	mid = (low + high) >> 1;
+	c = strcmp ((const char *)name, (const char *)FcOffsetToPtr (files, files->files[mid].name, FcChar8));
+	if (c == 0)
+	    return &files->files[mid];
+	if (c < 0)
+	    high = mid - 1;
+	else
+	    low = mid + 1;
+    }
+    return NULL;
+}
+
+FcBool
+FcCacheFileUnchanged (const FcCacheFile *file, const struct stat *statb)
+{
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    if (file->mtime_nano != statb->st_mtim.tv_nsec)
+	return FcFalse;
+#endif
+    return file->dev == (int64_t)statb->st_dev &&
+           file->ino == (int64_t)statb->st_ino &&
+           file->size == (int64_t)statb->st_size &&
+           file->mtime == (int64_t)statb->st_mtime;
+}
+
 /*
  * Build a cache structure from the given contents
  */
 FcCache *
-FcDirCacheBuild (FcFontSet *set, const FcChar8 *dir, struct stat *dir_stat, FcStrSet *dirs)
+FcDirCacheBuild (FcFontSet *set, const FcChar8 *dir, struct stat *dir_stat, FcStrSet *dirs, FcDirFiles *files)
 {
-    FcSerialize *serialize = FcSerializeCreate();
-    FcCache     *cache;
-    int          i;
-    FcChar8     *dir_serialize;
-    intptr_t    *dirs_serialize;
-    FcFontSet   *set_serialize;
+    FcSerialize  *serialize = FcSerializeCreate();
+    FcCache      *cache;
+    int           i;
+    FcChar8      *dir_serialize;
+    intptr_t     *dirs_serialize;
+    FcFontSet    *set_serialize;
+    FcCacheFiles *files_serialize;
 
     if (!serialize)
 	return NULL;
@@ -1305,6 +1879,16 @@ FcDirCacheBuild (FcFontSet *set, const FcChar8 *dir, struct stat *dir_stat, FcSt
     if (!FcFontSetSerializeAlloc (serialize, set))
 	goto bail1;
 
+    /*
+     * Files
+     */
+    if (files) {
+	FcSerializeAlloc (serialize, files, sizeof (FcCacheFiles) + files->names->num * sizeof (FcCacheFile));
+	for (i = 0; i < files->names->num; i++)
+	    if (!FcStrSerializeAlloc (serialize, files->names->strs[i]))
+		goto bail1;
+    }
+
     /* Serialize layout complete. Now allocate space and fill it */
     cache = malloc (serialize->size);
     if (!cache)
@@ -1354,6 +1938,25 @@ FcDirCacheBuild (FcFontSet *set, const FcChar8 *dir, struct stat *dir_stat, FcSt
 	goto bail2;
     cache->set = FcPtrToOffset (cache, set_serialize);
 
+    /*
+     * Serialize files
+     */
+    if (files) {
+	files_serialize = FcSerializePtr (serialize, files);
+	if (!files_serialize)
+	    goto bail2;
+	files_serialize->magic = FC_CACHE_MAGIC_FILES;
+	files_serialize->num = files->names->num;
+	for (i = 0; i < files->names->num; i++) {
+	    FcChar8 *n_serialize = FcStrSerialize (serialize, files->names->strs[i]);
+	    if (!n_serialize)
+		goto bail2;
+	    files_serialize->files[i] = files->files[i];
+	    files_serialize->files[i].name = FcPtrToOffset (files_serialize, n_serialize);
+	}
+	cache->files = FcPtrToOffset (cache, files_serialize);
+    }
+
     FcSerializeDestroy (serialize);
 
     FcCacheInsert (cache, NULL);
@@ -1372,44 +1975,36 @@ FcDirCacheRebuild (FcCache *cache, struct stat *dir_stat, FcStrSet *dirs)
 {
     FcCache       *newp;
     FcFontSet     *set = FcFontSetDeserialize (FcCacheSet (cache));
+    FcDirFiles    *files = FcDirFilesFromCache (cache);
     const FcChar8 *dir = FcCacheDir (cache);
 
-    newp = FcDirCacheBuild (set, dir, dir_stat, dirs);
+    newp = FcDirCacheBuild (set, dir, dir_stat, dirs, files);
+    FcDirFilesDestroy (files);
     FcFontSetDestroy (set);
 
     return newp;
 }
 
-/* write serialized state to the cache file */
-FcBool
-FcDirCacheWrite (FcCache *cache, FcConfig *config)
+/*
+ * Find the first directory in the list of cache directories which is
+ * writable, creating it if needed
+ */
+static FcChar8 *
+FcDirCacheWritableDir (FcConfig *config)
 {
-    FcChar8       *dir = FcCacheDir (cache);
-    FcChar8        cache_base[CACHEBASE_LEN];
-    FcChar8       *cache_hashed;
-    int            fd;
-    FcAtomic      *atomic;
     FcStrList     *list;
     FcChar8       *cache_dir = NULL;
     FcChar8       *test_dir, *d = NULL;
-    FcCacheSkip   *skip;
-    struct stat    cache_stat;
-    unsigned int   magic;
-    int            written;
     const FcChar8 *sysroot = FcConfigGetSysRoot (config);
     FcStrSet      *cpath;
 
-    /*
-     * Write it to the first directory in the list which is writable
-     */
-
     cpath = FcStrSetCreateEx (FCSS_GROW_BY_64);
     if (!cpath)
-	return FcFalse;
+	return NULL;
     list = FcStrListCreate (config->cacheDirs);
     if (!list) {
 	FcStrSetDestroy (cpath);
-	return FcFalse;
+	return NULL;
     }
     while ((test_dir = FcStrListNext (list))) {
 	if (d)
@@ -1462,6 +2057,29 @@ FcDirCacheWrite (FcCache *cache, FcConfig *config)
 	FcStrFree (d);
     FcStrSetDestroy (cpath);
     FcStrListDone (list);
+
+    return cache_dir;
+}
+
+/* write serialized state to the cache file */
+FcBool
+FcDirCacheWrite (FcCache *cache, FcConfig *config)
+{
+    FcChar8     *dir = FcCacheDir (cache);
+    FcChar8      cache_base[CACHEBASE_LEN];
+    FcChar8     *cache_hashed;
+    int          fd;
+    FcAtomic    *atomic;
+    FcChar8     *cache_dir;
+    FcCacheEntry *entry;
+    struct stat  cache_stat;
+    unsigned int magic;
+    int          written;
+
+    /*
+     * Write it to the first directory in the list which is writable
+     */
+    cache_dir = FcDirCacheWritableDir (config);
     if (!cache_dir)
 	return FcFalse;
 
@@ -1515,14 +2133,14 @@ FcDirCacheWrite (FcCache *cache, FcConfig *config)
      */
     if (cache->size < FC_CACHE_MIN_MMAP && FcStat (cache_hashed, &cache_stat)) {
 	lock_cache();
-	if ((skip = FcCacheFindByAddrUnlocked (cache))) {
-	    skip->cache_dev = cache_stat.st_dev;
-	    skip->cache_ino = cache_stat.st_ino;
-	    skip->cache_mtime = cache_stat.st_mtime;
+	if ((entry = FcCacheFindByAddrUnlocked (cache))) {
+	    entry->cache_dev = cache_stat.st_dev;
+	    entry->cache_ino = cache_stat.st_ino;
+	    entry->cache_mtime = cache_stat.st_mtime;
 #ifdef HAVE_STRUCT_STAT_ST_MTIM
-	    skip->cache_mtime_nano = cache_stat.st_mtim.tv_nsec;
+	    entry->cache_mtime_nano = cache_stat.st_mtim.tv_nsec;
 #else
-	    skip->cache_mtime_nano = 0;
+	    entry->cache_mtime_nano = 0;
 #endif
 	}
 	unlock_cache();
@@ -1544,6 +2162,155 @@ bail1:
     return FcFalse;
 }
 
+typedef struct _FcCacheAggregateDir {
+    const FcChar8 *dir;
+    FcCache       *cache;
+} FcCacheAggregateDir;
+
+static int
+FcCacheAggregateDirCmp (const void *a, const void *b)
+{
+    return strcmp ((const char *)((const FcCacheAggregateDir *)a)->dir,
+                   (const char *)((const FcCacheAggregateDir *)b)->dir);
+}
+
+#define FC_CACHE_AGGREGATE_ALIGNED(n) (((n) + FC_CACHE_AGGREGATE_ALIGN - 1) & ~(intptr_t)(FC_CACHE_AGGREGATE_ALIGN - 1))
+
+FcBool
+FcCacheWriteAggregate (FcConfig *config)
+{
+    FcStrSet               *dirs;
+    FcCacheAggregateDir    *entries = NULL, *e;
+    int                     nentry = 0, sentry = 0, i, j;
+    FcCache                *cache;
+    FcChar8                *cache_dir, *file = NULL;
+    FcAtomic               *atomic;
+    char                   *buf = NULL;
+    FcCacheAggregateHeader *header;
+    FcCacheAggregateEntry  *table;
+    intptr_t                size, offset;
+    int                     fd;
+    FcBool                  ret = FcFalse;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return FcFalse;
+    dirs = FcStrSetCreate();
+    if (!dirs)
+	goto bail0;
+    for (i = 0; i < config->fontDirs->num; i++)
+	if (!FcStrSetAdd (dirs, config->fontDirs->strs[i]))
+	    goto bail1;
+
+    /*
+     * Load the cache of every directory, adding subdirectories to
+     * the list as their parents are loaded
+     */
+    for (i = 0; i < dirs->num; i++) {
+	cache = FcDirCacheLoad (dirs->strs[i], config, NULL);
+	if (!cache)
+	    continue;
+	for (j = 0; j < cache->dirs_count; j++)
+	    if (!FcStrSetAdd (dirs, FcCacheSubdir (cache, j))) {
+		FcDirCacheUnload (cache);
+		goto bail1;
+	    }
+	if (nentry == sentry) {
+	    sentry = sentry ? sentry * 2 : 64;
+	    e = realloc (entries, sentry * sizeof (FcCacheAggregateDir));
+	    if (!e) {
+		FcDirCacheUnload (cache);
+		goto bail1;
+	    }
+	    entries = e;
+	}
+	entries[nentry].dir = dirs->strs[i];
+	entries[nentry].cache = cache;
+	nentry++;
+    }
+    if (!nentry)
+	goto bail1;
+    qsort (entries, nentry, sizeof (FcCacheAggregateDir), FcCacheAggregateDirCmp);
+
+    /* Header, directory table and names, then the caches */
+    size = FC_CACHE_AGGREGATE_ALIGNED (sizeof (FcCacheAggregateHeader)) +
+           nentry * sizeof (FcCacheAggregateEntry);
+    for (i = 0; i < nentry; i++)
+	size += strlen ((const char *)entries[i].dir) + 1;
+    size = FC_CACHE_AGGREGATE_ALIGNED (size);
+    for (i = 0; i < nentry; i++)
+	size += FC_CACHE_AGGREGATE_ALIGNED (entries[i].cache->size);
+    buf = calloc (1, size);
+    if (!buf)
+	goto bail1;
+    header = (FcCacheAggregateHeader *)buf;
+    header->magic = FC_CACHE_MAGIC_AGGREGATE;
+    header->version = FC_CACHE_VERSION_NUMBER;
+    header->size = size;
+    header->table = FC_CACHE_AGGREGATE_ALIGNED (sizeof (FcCacheAggregateHeader));
+    header->ndir = nentry;
+    table = (FcCacheAggregateEntry *)(buf + header->table);
+    offset = header->table + nentry * sizeof (FcCacheAggregateEntry);
+    for (i = 0; i < nentry; i++) {
+	table[i].dir = offset;
+	strcpy (buf + offset, (const char *)entries[i].dir);
+	offset += strlen ((const char *)entries[i].dir) + 1;
+    }
+    offset = FC_CACHE_AGGREGATE_ALIGNED (offset);
+    for (i = 0; i < nentry; i++) {
+	cache = entries[i].cache;
+	table[i].cache = offset;
+	table[i].size = cache->size;
+	memcpy (buf + offset, cache, cache->size);
+	/* Caches read rather than mapped are marked allocated */
+	((FcCache *)(buf + offset))->magic = FC_CACHE_MAGIC_MMAP;
+	offset += FC_CACHE_AGGREGATE_ALIGNED (cache->size);
+    }
+
+    cache_dir = FcDirCacheWritableDir (config);
+    if (!cache_dir)
+	goto bail2;
+    file = FcStrBuildFilename (cache_dir, FC_CACHE_AGGREGATE_NAME, NULL);
+    FcStrFree (cache_dir);
+    if (!file)
+	goto bail2;
+    if (FcDebug() & FC_DBG_CACHE)
+	printf ("FcCacheWriteAggregate file \"%s\" %d dirs\n", file, nentry);
+
+    atomic = FcAtomicCreate (file);
+    if (!atomic)
+	goto bail2;
+    if (!FcAtomicLock (atomic))
+	goto bail3;
+    fd = FcOpen ((char *)FcAtomicNewFile (atomic), O_RDWR | O_CREAT | O_BINARY, 0666);
+    if (fd == -1)
+	goto bail4;
+    if (write (fd, buf, size) != size) {
+	perror ("write cache");
+	close (fd);
+	goto bail4;
+    }
+    close (fd);
+    ret = FcAtomicReplaceOrig (atomic);
+bail4:
+    FcAtomicUnlock (atomic);
+bail3:
+    FcAtomicDestroy (atomic);
+bail2:
+    if (file)
+	FcStrFree (file);
+    free (buf);
+bail1:
+    for (i = 0; i < nentry; i++)
+	FcDirCacheUnload (entries[i].cache);
+    free (entries);
+    FcStrSetDestroy (dirs);
+bail0:
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
 FcBool
 FcDirCacheClean (const FcChar8 *cache_dir, FcBool verbose)
 {
@@ -31,6 +31,9 @@
 #  include <dirent.h>
 #endif
 #include <sys/types.h>
+#if !defined(_WIN32) && defined(HAVE_PTHREAD)
+#  include <sched.h>
+#endif
 
 #if defined(_WIN32) && !defined(R_OK)
 #  define R_OK 4
@@ -43,6 +46,17 @@
 static FcConfig *_fcConfig; /* MT-safe */
 static FcMutex  *_lock;
 
+/* FcConfigReference (NULL) runs without taking _lock.  A reader announces
+ * itself on the active one of the two counters below while it loads
+ * _fcConfig and bumps the reference count.  After replacing _fcConfig,
+ * FcConfigSetCurrent points new readers at the other counter and waits
+ * for the old one to drain; doing that for both counters guarantees no
+ * reader still holds the old pointer without a reference to it, so it
+ * may be released afterwards.
+ */
+static fc_atomic_int_t  _config_reader_count[2];
+static fc_atomic_int_t *_config_readers = &_config_reader_count[0];
+
 static void
 lock_config (void)
 {
@@ -85,6 +99,35 @@ free_lock (void)
     }
 }
 
+static void
+FcConfigYield (void)
+{
+#if defined(_WIN32)
+    SwitchToThread();
+#elif defined(HAVE_PTHREAD)
+    sched_yield();
+#endif
+}
+
+/* Waits until every reader which may have seen the previous value of
+ * _fcConfig is done with it.  Called with _lock held.
+ */
+static void
+FcConfigSynchronizeReaders (void)
+{
+    fc_atomic_int_t *readers, *next;
+    int              i;
+
+    for (i = 0; i < 2; i++) {
+	readers = fc_atomic_ptr_get (&_config_readers);
+	next = readers == &_config_reader_count[0] ? &_config_reader_count[1] : &_config_reader_count[0];
+	(void)fc_atomic_ptr_cmpexch (&_config_readers, readers, next);
+	/* Read through a RMW so the reader's decrement synchronizes with us */
+	while (fc_atomic_int_add (*readers, 0) != 0)
+	    FcConfigYield();
+    }
+}
+
 static FcConfig *
 FcConfigEnsure (void)
 {
@@ -191,8 +234,16 @@ FcConfigCreate (void)
 	goto bail9;
 
     config->maxObjects = 0;
-    for (set = FcSetSystem; set <= FcSetApplication; set++)
+    for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++)
+	config->rule_code[k] = NULL;
+    config->glob_code = NULL;
+    config->accept_filter = NULL;
+    config->reject_filter = NULL;
+    config->cache_aggregates = NULL;
+    for (set = FcSetSystem; set <= FcSetApplication; set++) {
 	config->fonts[set] = 0;
+	config->match_index[set] = NULL;
+    }
 
     config->rescanTime = time (0);
     config->rescanInterval = 30;
@@ -217,7 +268,14 @@ FcConfigCreate (void)
     config->desktop_name = NULL;
 
     config->prefer_app_fonts = FcFalse;
+    config->nthreads = 1;
     config->warns = 0;
+    config->match_cache = NULL;
+    config->subst_cache = NULL;
+    config->snapshot = NULL;
+    config->parse_job = NULL;
+    config->watch = NULL;
+    config->changes = NULL;
 
     FcRefInit (&config->ref, 1);
     FcObjectInit();
@@ -274,14 +332,20 @@ FcConfigNewestFile (FcStrSet *files)
 FcBool
 FcConfigUptoDate (FcConfig *config)
 {
-    FcFileTime config_time, config_dir_time, font_time;
-    time_t     now = time (0);
-    FcBool     ret = FcTrue;
+    FcFileTime   config_time, config_dir_time, font_time;
+    time_t       now = time (0);
+    FcBool       ret = FcTrue;
+    unsigned int serial;
 
     config = FcConfigReference (config);
     if (!config)
 	return FcFalse;
 
+    /* Nothing needs to be looked at when nothing happened */
+    if (FcConfigWatchUnchanged (config, &serial)) {
+	config->rescanTime = now;
+	goto bail;
+    }
     config_time = FcConfigNewestFile (config->configFiles);
     config_dir_time = FcConfigNewestFile (config->configDirs);
     font_time = FcConfigNewestFile (config->fontDirs);
@@ -302,6 +366,7 @@ FcConfigUptoDate (FcConfig *config)
 	}
     }
     config->rescanTime = now;
+    FcConfigWatchChecked (config, serial);
 bail:
     FcConfigDestroy (config);
 
@@ -330,26 +395,32 @@ FcConfig *
 FcConfigReference (FcConfig *config)
 {
     if (!config) {
-	/* lock during obtaining the value from _fcConfig and count up refcount there,
-	 * there are the race between them.
+	fc_atomic_int_t *readers;
+
+	/* Stay registered as a reader between obtaining the value from
+	 * _fcConfig and counting up its refcount, so FcConfigSetCurrent
+	 * can't release it in between.
 	 */
-	lock_config();
     retry:
+	readers = fc_atomic_ptr_get (&_config_readers);
+	fc_atomic_int_add (*readers, 1);
 	config = fc_atomic_ptr_get (&_fcConfig);
+	if (config)
+	    FcRefInc (&config->ref);
+	fc_atomic_int_add (*readers, -1);
 	if (!config) {
+	    /* The first lock_config() initializes the random state too;
+	     * keep doing that before loading anything.
+	     */
+	    lock_config();
 	    unlock_config();
-
 	    config = FcInitLoadConfigAndFonts();
 	    lock_config();
-	    if (!config)
-		goto retry;
-	    if (!fc_atomic_ptr_cmpexch (&_fcConfig, NULL, config)) {
+	    if (config && !fc_atomic_ptr_cmpexch (&_fcConfig, NULL, config))
 		FcConfigDestroy (config);
-		goto retry;
-	    }
+	    unlock_config();
+	    goto retry;
 	}
-	FcRefInc (&config->ref);
-	unlock_config();
     } else
 	FcRefInc (&config->ref);
 
@@ -367,6 +438,8 @@ FcConfigDestroy (FcConfig *config)
 	if (FcRefDec (&config->ref) != 1)
 	    return;
 
+	/* Stops the thread calling change listeners first */
+	FcChangesDestroy (config->changes);
 	FcObjectFini();
 	(void)fc_atomic_ptr_cmpexch (&_fcConfig, config, NULL);
 
@@ -378,14 +451,21 @@ FcConfigDestroy (FcConfig *config)
 	FcStrSetDestroy (config->rejectGlobs);
 	FcFontSetDestroy (config->acceptPatterns);
 	FcFontSetDestroy (config->rejectPatterns);
+	FcGlobCodeDestroy (config->glob_code);
+	FcListFilterDestroy (config->accept_filter);
+	FcListFilterDestroy (config->reject_filter);
+	FcCacheAggregatesDestroy (config->cache_aggregates);
 
 	for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++)
 	    FcPtrListDestroy (config->subst[k]);
+	FcConfigClearRuleCode (config);
 	FcPtrListDestroy (config->rulesetList);
 	FcStrSetDestroy (config->availConfigFiles);
-	for (set = FcSetSystem; set <= FcSetApplication; set++)
+	for (set = FcSetSystem; set <= FcSetApplication; set++) {
 	    if (config->fonts[set])
 		FcFontSetDestroy (config->fonts[set]);
+	    FcMatchIndexDestroy (config->match_index[set]);
+	}
 
 	page = config->expr_pool;
 	while (page) {
@@ -409,6 +489,10 @@ FcConfigDestroy (FcConfig *config)
 	    FcStrFree (config->prgname);
 	if (config->desktop_name)
 	    FcStrFree (config->desktop_name);
+	FcMatchCacheDestroy (config->match_cache);
+	FcMatchCacheDestroy (config->subst_cache);
+	FcSnapshotSourcesDestroy (config->snapshot);
+	FcWatchDestroy (config->watch);
 
 	free (config);
     }
@@ -483,6 +567,10 @@ FcConfigAddCache (FcConfig *config, FcCache *cache,
 		nref++;
 	}
 	FcDirCacheReference (cache, nref);
+	if (nref) {
+	    FcConfigUpdateMatchIndex (config, set);
+	    FcMatchCacheClear (config->match_cache);
+	}
     }
 
     /*
@@ -559,6 +647,13 @@ FcConfigBuildFonts (FcConfig *config)
 
     FcConfigSetFonts (config, fonts, FcSetSystem);
 
+    /* Build the missing caches on all the threads allowed first */
+    if (config->nthreads > 1) {
+	FcStrSet *rebuilt = FcDirCacheReadDirs (config->fontDirs, FcFalse, config);
+
+	if (rebuilt)
+	    FcStrSetDestroy (rebuilt);
+    }
     if (!FcConfigAddDirList (config, FcSetSystem, config->fontDirs)) {
 	ret = FcFalse;
 	goto bail;
@@ -596,6 +691,7 @@ retry:
 
     if (!fc_atomic_ptr_cmpexch (&_fcConfig, cfg, config))
 	goto retry;
+    FcConfigSynchronizeReaders();
     unlock_config();
     if (cfg)
 	FcConfigDestroy (cfg);
@@ -746,7 +842,10 @@ FcBool
 FcConfigAddCacheDir (FcConfig      *config,
                      const FcChar8 *d)
 {
-    return FcStrSetAddFilename (config->cacheDirs, d);
+    if (!FcStrSetAddFilename (config->cacheDirs, d))
+	return FcFalse;
+    FcConfigClearCacheAggregates (config);
+    return FcTrue;
 }
 
 FcStrList *
@@ -818,6 +917,9 @@ FcConfigSetFonts (FcConfig  *config,
     if (config->fonts[set])
 	FcFontSetDestroy (config->fonts[set]);
     config->fonts[set] = fonts;
+    FcMatchIndexDestroy (config->match_index[set]);
+    config->match_index[set] = NULL;
+    FcMatchCacheClear (config->match_cache);
 }
 
 FcConfig *
@@ -1253,15 +1355,218 @@ FcConfigCompareValue (const FcValue *left_o,
 #define FcDoubleRound(d)  FcDoubleFloor ((d) + 0.5)
 #define FcDoubleTrunc(d)  ((d) >= 0 ? _FcDoubleFloor (d) : -_FcDoubleFloor (-(d)))
 
+/*
+ * The operators of FcConfigEvaluate, shared with the compiled rules.
+ * They leave their operands alone; the result is a new value.
+ */
 static FcValue
-FcConfigEvaluate (FcPattern *p, FcPattern *p_pat, FcObject object, FcMatchKind kind, FcExpr *e)
+FcConfigEvaluateMatrix (FcValue xx, FcValue xy, FcValue yx, FcValue yy)
 {
-    FcValue                v, vl, vr, vle, vre;
+    FcValue  v;
+    FcMatrix m;
+
+    v.type = FcTypeMatrix;
+    xx = FcConfigPromote (xx, v, NULL);
+    xy = FcConfigPromote (xy, v, NULL);
+    yx = FcConfigPromote (yx, v, NULL);
+    yy = FcConfigPromote (yy, v, NULL);
+    if (xx.type == FcTypeDouble && xy.type == FcTypeDouble &&
+        yx.type == FcTypeDouble && yy.type == FcTypeDouble) {
+	m.xx = xx.u.d;
+	m.xy = xy.u.d;
+	m.yx = yx.u.d;
+	m.yy = yy.u.d;
+	v.u.m = &m;
+    } else
+	v.type = FcTypeVoid;
+    return FcValueSave (v);
+}
+
+static FcValue
+FcConfigEvaluateArith (FcOp op, FcValue vl, FcValue vr)
+{
+    FcValue                v, vle, vre;
     FcMatrix              *m;
     FcChar8               *str;
-    FcOp                   op = FC_OP_GET_OP (e->op);
     FcValuePromotionBuffer buf1, buf2;
 
+    vle = FcConfigPromote (vl, vr, &buf1);
+    vre = FcConfigPromote (vr, vle, &buf2);
+    if (vle.type == vre.type) {
+	switch ((int)vle.type) {
+	case FcTypeDouble:
+	    switch ((int)op) {
+	    case FcOpPlus:
+		v.type = FcTypeDouble;
+		v.u.d = vle.u.d + vre.u.d;
+		break;
+	    case FcOpMinus:
+		v.type = FcTypeDouble;
+		v.u.d = vle.u.d - vre.u.d;
+		break;
+	    case FcOpTimes:
+		v.type = FcTypeDouble;
+		v.u.d = vle.u.d * vre.u.d;
+		break;
+	    case FcOpDivide:
+		v.type = FcTypeDouble;
+		v.u.d = vle.u.d / vre.u.d;
+		break;
+	    default:
+		v.type = FcTypeVoid;
+		break;
+	    }
+	    if (v.type == FcTypeDouble &&
+	        v.u.d == (double)(int)v.u.d) {
+		v.type = FcTypeInteger;
+		v.u.i = (int)v.u.d;
+	    }
+	    break;
+	case FcTypeBool:
+	    switch ((int)op) {
+	    case FcOpOr:
+		v.type = FcTypeBool;
+		v.u.b = vle.u.b || vre.u.b;
+		break;
+	    case FcOpAnd:
+		v.type = FcTypeBool;
+		v.u.b = vle.u.b && vre.u.b;
+		break;
+	    default:
+		v.type = FcTypeVoid;
+		break;
+	    }
+	    break;
+	case FcTypeString:
+	    switch ((int)op) {
+	    case FcOpPlus:
+		v.type = FcTypeString;
+		str = FcStrPlus (vle.u.s, vre.u.s);
+		v.u.s = FcStrCopy (str);
+		FcStrFree (str);
+
+		if (!v.u.s)
+		    v.type = FcTypeVoid;
+		break;
+	    default:
+		v.type = FcTypeVoid;
+		break;
+	    }
+	    break;
+	case FcTypeMatrix:
+	    switch ((int)op) {
+	    case FcOpTimes:
+		v.type = FcTypeMatrix;
+		m = malloc (sizeof (FcMatrix));
+		if (m) {
+		    FcMatrixMultiply (m, vle.u.m, vre.u.m);
+		    v.u.m = m;
+		} else {
+		    v.type = FcTypeVoid;
+		}
+		break;
+	    default:
+		v.type = FcTypeVoid;
+		break;
+	    }
+	    break;
+	case FcTypeCharSet:
+	    switch ((int)op) {
+	    case FcOpPlus:
+		v.type = FcTypeCharSet;
+		v.u.c = FcCharSetUnion (vle.u.c, vre.u.c);
+		if (!v.u.c)
+		    v.type = FcTypeVoid;
+		break;
+	    case FcOpMinus:
+		v.type = FcTypeCharSet;
+		v.u.c = FcCharSetSubtract (vle.u.c, vre.u.c);
+		if (!v.u.c)
+		    v.type = FcTypeVoid;
+		break;
+	    default:
+		v.type = FcTypeVoid;
+		break;
+	    }
+	    break;
+	case FcTypeLangSet:
+	    switch ((int)op) {
+	    case FcOpPlus:
+		v.type = FcTypeLangSet;
+		v.u.l = FcLangSetUnion (vle.u.l, vre.u.l);
+		if (!v.u.l)
+		    v.type = FcTypeVoid;
+		break;
+	    case FcOpMinus:
+		v.type = FcTypeLangSet;
+		v.u.l = FcLangSetSubtract (vle.u.l, vre.u.l);
+		if (!v.u.l)
+		    v.type = FcTypeVoid;
+		break;
+	    default:
+		v.type = FcTypeVoid;
+		break;
+	    }
+	    break;
+	default:
+	    v.type = FcTypeVoid;
+	    break;
+	}
+    } else
+	v.type = FcTypeVoid;
+    return v;
+}
+
+static FcValue
+FcConfigEvaluateUnary (FcOp op, FcValue vl)
+{
+    FcValue v;
+
+    if (op == FcOpNot) {
+	if (vl.type == FcTypeBool) {
+	    v.type = FcTypeBool;
+	    v.u.b = !vl.u.b;
+	} else
+	    v.type = FcTypeVoid;
+	return v;
+    }
+    switch ((int)vl.type) {
+    case FcTypeInteger:
+	v = vl;
+	break;
+    case FcTypeDouble:
+	v.type = FcTypeInteger;
+	switch ((int)op) {
+	case FcOpFloor:
+	    v.u.i = FcDoubleFloor (vl.u.d);
+	    break;
+	case FcOpCeil:
+	    v.u.i = FcDoubleCeil (vl.u.d);
+	    break;
+	case FcOpRound:
+	    v.u.i = FcDoubleRound (vl.u.d);
+	    break;
+	case FcOpTrunc:
+	    v.u.i = FcDoubleTrunc (vl.u.d);
+	    break;
+	default:
+	    v.type = FcTypeVoid;
+	    break;
+	}
+	break;
+    default:
+	v.type = FcTypeVoid;
+	break;
+    }
+    return v;
+}
+
+static FcValue
+FcConfigEvaluate (FcPattern *p, FcPattern *p_pat, FcObject object, FcMatchKind kind, FcExpr *e)
+{
+    FcValue v, vl, vr;
+    FcOp    op = FC_OP_GET_OP (e->op);
+
     switch ((int)op) {
     case FcOpInteger:
 	v.type = FcTypeInteger;
@@ -1276,25 +1581,12 @@ FcConfigEvaluate (FcPattern *p, FcPattern *p_pat, FcObject object, FcMatchKind k
 	v.u.s = e->u.sval;
 	v = FcValueSave (v);
 	break;
-    case FcOpMatrix: {
-	FcMatrix m;
-	FcValue  xx, xy, yx, yy;
-	v.type = FcTypeMatrix;
-	xx = FcConfigPromote (FcConfigEvaluate (p, p_pat, object, kind, e->u.mexpr->xx), v, NULL);
-	xy = FcConfigPromote (FcConfigEvaluate (p, p_pat, object, kind, e->u.mexpr->xy), v, NULL);
-	yx = FcConfigPromote (FcConfigEvaluate (p, p_pat, object, kind, e->u.mexpr->yx), v, NULL);
-	yy = FcConfigPromote (FcConfigEvaluate (p, p_pat, object, kind, e->u.mexpr->yy), v, NULL);
-	if (xx.type == FcTypeDouble && xy.type == FcTypeDouble &&
-	    yx.type == FcTypeDouble && yy.type == FcTypeDouble) {
-	    m.xx = xx.u.d;
-	    m.xy = xy.u.d;
-	    m.yx = yx.u.d;
-	    m.yy = yy.u.d;
-	    v.u.m = &m;
-	} else
-	    v.type = FcTypeVoid;
-	v = FcValueSave (v);
-    } break;
+    case FcOpMatrix:
+	v = FcConfigEvaluateMatrix (FcConfigEvaluate (p, p_pat, object, kind, e->u.mexpr->xx),
+	                            FcConfigEvaluate (p, p_pat, object, kind, e->u.mexpr->xy),
+	                            FcConfigEvaluate (p, p_pat, object, kind, e->u.mexpr->yx),
+	                            FcConfigEvaluate (p, p_pat, object, kind, e->u.mexpr->yy));
+	break;
     case FcOpCharSet:
 	v.type = FcTypeCharSet;
 	v.u.c = e->u.cval;
@@ -1369,208 +1661,17 @@ FcConfigEvaluate (FcPattern *p, FcPattern *p_pat, FcObject object, FcMatchKind k
     case FcOpDivide:
 	vl = FcConfigEvaluate (p, p_pat, object, kind, e->u.tree.left);
 	vr = FcConfigEvaluate (p, p_pat, object, kind, e->u.tree.right);
-	vle = FcConfigPromote (vl, vr, &buf1);
-	vre = FcConfigPromote (vr, vle, &buf2);
-	if (vle.type == vre.type) {
-	    switch ((int)vle.type) {
-	    case FcTypeDouble:
-		switch ((int)op) {
-		case FcOpPlus:
-		    v.type = FcTypeDouble;
-		    v.u.d = vle.u.d + vre.u.d;
-		    break;
-		case FcOpMinus:
-		    v.type = FcTypeDouble;
-		    v.u.d = vle.u.d - vre.u.d;
-		    break;
-		case FcOpTimes:
-		    v.type = FcTypeDouble;
-		    v.u.d = vle.u.d * vre.u.d;
-		    break;
-		case FcOpDivide:
-		    v.type = FcTypeDouble;
-		    v.u.d = vle.u.d / vre.u.d;
-		    break;
-		default:
-		    v.type = FcTypeVoid;
-		    break;
-		}
-		if (v.type == FcTypeDouble &&
-		    v.u.d == (double)(int)v.u.d) {
-		    v.type = FcTypeInteger;
-		    v.u.i = (int)v.u.d;
-		}
-		break;
-	    case FcTypeBool:
-		switch ((int)op) {
-		case FcOpOr:
-		    v.type = FcTypeBool;
-		    v.u.b = vle.u.b || vre.u.b;
-		    break;
-		case FcOpAnd:
-		    v.type = FcTypeBool;
-		    v.u.b = vle.u.b && vre.u.b;
-		    break;
-		default:
-		    v.type = FcTypeVoid;
-		    break;
-		}
-		break;
-	    case FcTypeString:
-		switch ((int)op) {
-		case FcOpPlus:
-		    v.type = FcTypeString;
-		    str = FcStrPlus (vle.u.s, vre.u.s);
-		    v.u.s = FcStrCopy (str);
-		    FcStrFree (str);
-
-		    if (!v.u.s)
-			v.type = FcTypeVoid;
-		    break;
-		default:
-		    v.type = FcTypeVoid;
-		    break;
-		}
-		break;
-	    case FcTypeMatrix:
-		switch ((int)op) {
-		case FcOpTimes:
-		    v.type = FcTypeMatrix;
-		    m = malloc (sizeof (FcMatrix));
-		    if (m) {
-			FcMatrixMultiply (m, vle.u.m, vre.u.m);
-			v.u.m = m;
-		    } else {
-			v.type = FcTypeVoid;
-		    }
-		    break;
-		default:
-		    v.type = FcTypeVoid;
-		    break;
-		}
-		break;
-	    case FcTypeCharSet:
-		switch ((int)op) {
-		case FcOpPlus:
-		    v.type = FcTypeCharSet;
-		    v.u.c = FcCharSetUnion (vle.u.c, vre.u.c);
-		    if (!v.u.c)
-			v.type = FcTypeVoid;
-		    break;
-		case FcOpMinus:
-		    v.type = FcTypeCharSet;
-		    v.u.c = FcCharSetSubtract (vle.u.c, vre.u.c);
-		    if (!v.u.c)
-			v.type = FcTypeVoid;
-		    break;
-		default:
-		    v.type = FcTypeVoid;
-		    break;
-		}
-		break;
-	    case FcTypeLangSet:
-		switch ((int)op) {
-		case FcOpPlus:
-		    v.type = FcTypeLangSet;
-		    v.u.l = FcLangSetUnion (vle.u.l, vre.u.l);
-		    if (!v.u.l)
-			v.type = FcTypeVoid;
-		    break;
-		case FcOpMinus:
-		    v.type = FcTypeLangSet;
-		    v.u.l = FcLangSetSubtract (vle.u.l, vre.u.l);
-		    if (!v.u.l)
-			v.type = FcTypeVoid;
-		    break;
-		default:
-		    v.type = FcTypeVoid;
-		    break;
-		}
-		break;
-	    default:
-		v.type = FcTypeVoid;
-		break;
-	    }
-	} else
-	    v.type = FcTypeVoid;
+	v = FcConfigEvaluateArith (op, vl, vr);
 	FcValueDestroy (vl);
 	FcValueDestroy (vr);
 	break;
     case FcOpNot:
-	vl = FcConfigEvaluate (p, p_pat, object, kind, e->u.tree.left);
-	switch ((int)vl.type) {
-	case FcTypeBool:
-	    v.type = FcTypeBool;
-	    v.u.b = !vl.u.b;
-	    break;
-	default:
-	    v.type = FcTypeVoid;
-	    break;
-	}
-	FcValueDestroy (vl);
-	break;
     case FcOpFloor:
-	vl = FcConfigEvaluate (p, p_pat, object, kind, e->u.tree.left);
-	switch ((int)vl.type) {
-	case FcTypeInteger:
-	    v = vl;
-	    break;
-	case FcTypeDouble:
-	    v.type = FcTypeInteger;
-	    v.u.i = FcDoubleFloor (vl.u.d);
-	    break;
-	default:
-	    v.type = FcTypeVoid;
-	    break;
-	}
-	FcValueDestroy (vl);
-	break;
     case FcOpCeil:
-	vl = FcConfigEvaluate (p, p_pat, object, kind, e->u.tree.left);
-	switch ((int)vl.type) {
-	case FcTypeInteger:
-	    v = vl;
-	    break;
-	case FcTypeDouble:
-	    v.type = FcTypeInteger;
-	    v.u.i = FcDoubleCeil (vl.u.d);
-	    break;
-	default:
-	    v.type = FcTypeVoid;
-	    break;
-	}
-	FcValueDestroy (vl);
-	break;
     case FcOpRound:
-	vl = FcConfigEvaluate (p, p_pat, object, kind, e->u.tree.left);
-	switch ((int)vl.type) {
-	case FcTypeInteger:
-	    v = vl;
-	    break;
-	case FcTypeDouble:
-	    v.type = FcTypeInteger;
-	    v.u.i = FcDoubleRound (vl.u.d);
-	    break;
-	default:
-	    v.type = FcTypeVoid;
-	    break;
-	}
-	FcValueDestroy (vl);
-	break;
     case FcOpTrunc:
 	vl = FcConfigEvaluate (p, p_pat, object, kind, e->u.tree.left);
-	switch ((int)vl.type) {
-	case FcTypeInteger:
-	    v = vl;
-	    break;
-	case FcTypeDouble:
-	    v.type = FcTypeInteger;
-	    v.u.i = FcDoubleTrunc (vl.u.d);
-	    break;
-	default:
-	    v.type = FcTypeVoid;
-	    break;
-	}
+	v = FcConfigEvaluateUnary (op, vl);
 	FcValueDestroy (vl);
 	break;
     default:
@@ -1597,9 +1698,10 @@ typedef struct
 } FamilyTable;
 
 static FcBool
-FamilyTableLookup (FamilyTable   *table,
-                   FcOp           _op,
-                   const FcChar8 *s)
+FamilyTableLookup (FamilyTable    *table,
+                   FcOp            _op,
+                   const FcChar8  *s,
+                   const FcChar32 *hashp)
 {
     FamilyTableEntry *fe;
     int               flags = FC_OP_GET_FLAGS (_op);
@@ -1610,6 +1712,8 @@ FamilyTableLookup (FamilyTable   *table,
     else
 	hash = table->family_hash;
 
+    if (hashp)
+	return FcHashTableFindWithHash (hash, (const void *)s, *hashp, (void **)&fe);
     return FcHashTableFind (hash, (const void *)s, (void **)&fe);
 }
 
@@ -1696,9 +1800,54 @@ FamilyTableClear (FamilyTable *table)
 	FcHashTableDestroy (table->family_hash);
 }
 
+/*
+ * Compare one value of the match expression of test 't' with the
+ * pattern values, updating the value matched so far in 'ret'.
+ * 'hash' is the family table hash of 'value' when already known.
+ */
 static FcValueList *
-FcConfigMatchValueList (FcPattern   *p,
-                        FcPattern   *p_pat,
+FcConfigMatchValue (const FcTest   *t,
+                    const FcValue  *value,
+                    const FcChar32 *hash,
+                    FcValueList    *values,
+                    FamilyTable    *table,
+                    FcValueList    *ret)
+{
+    FcValueList *v;
+    FcOp         op;
+
+    if (t->object == FC_FAMILY_OBJECT && table) {
+	op = FC_OP_GET_OP (t->op);
+	if (op == FcOpEqual || op == FcOpListing) {
+	    if (!FamilyTableLookup (table, t->op, FcValueString (value), hash))
+		return 0;
+	}
+	if (op == FcOpNotEqual && t->qual == FcQualAll) {
+	    if (!FamilyTableLookup (table, t->op, FcValueString (value), hash))
+		return values;
+	    return 0;
+	}
+    }
+    for (v = values; v; v = FcValueListNext (v)) {
+	/* Compare the pattern value to the match expression value */
+	if (FcConfigCompareValue (&v->value, t->op, value)) {
+	    if (!ret)
+		ret = v;
+	    if (t->qual != FcQualAll)
+		break;
+	} else {
+	    if (t->qual == FcQualAll) {
+		ret = 0;
+		break;
+	    }
+	}
+    }
+    return ret;
+}
+
+static FcValueList *
+FcConfigMatchValueList (FcPattern   *p,
+                        FcPattern   *p_pat,
                         FcObject     object,
                         FcMatchKind  kind,
                         FcTest      *t,
@@ -1708,8 +1857,6 @@ FcConfigMatchValueList (FcPattern   *p,
     FcValueList *ret = 0;
     FcExpr      *e = t->expr;
     FcValue      value;
-    FcValueList *v;
-    FcOp         op;
 
     while (e) {
 	/* Compute the value of the match expression */
@@ -1720,38 +1867,7 @@ FcConfigMatchValueList (FcPattern   *p,
 	    value = FcConfigEvaluate (p, p_pat, object, kind, e);
 	    e = 0;
 	}
-
-	if (t->object == FC_FAMILY_OBJECT && table) {
-	    op = FC_OP_GET_OP (t->op);
-	    if (op == FcOpEqual || op == FcOpListing) {
-		if (!FamilyTableLookup (table, t->op, FcValueString (&value))) {
-		    ret = 0;
-		    goto done;
-		}
-	    }
-	    if (op == FcOpNotEqual && t->qual == FcQualAll) {
-		ret = 0;
-		if (!FamilyTableLookup (table, t->op, FcValueString (&value))) {
-		    ret = values;
-		}
-		goto done;
-	    }
-	}
-	for (v = values; v; v = FcValueListNext (v)) {
-	    /* Compare the pattern value to the match expression value */
-	    if (FcConfigCompareValue (&v->value, t->op, &value)) {
-		if (!ret)
-		    ret = v;
-		if (t->qual != FcQualAll)
-		    break;
-	    } else {
-		if (t->qual == FcQualAll) {
-		    ret = 0;
-		    break;
-		}
-	    }
-	}
-    done:
+	ret = FcConfigMatchValue (t, &value, NULL, values, table, ret);
 	FcValueDestroy (value);
     }
     return ret;
@@ -1885,72 +2001,1299 @@ FcConfigDel (FcValueListPtr *head,
 	FamilyTableDel (table, FcValueString (&position->value));
     }
 
-    for (prev = head; *prev != NULL; prev = &(*prev)->next) {
-	if (*prev == position) {
-	    *prev = position->next;
-	    position->next = NULL;
-	    FcValueListDestroy (position);
-	    break;
+    for (prev = head; *prev != NULL; prev = &(*prev)->next) {
+	if (*prev == position) {
+	    *prev = position->next;
+	    position->next = NULL;
+	    FcValueListDestroy (position);
+	    break;
+	}
+    }
+}
+
+static void
+FcConfigPatternAdd (FcPattern   *p,
+                    FcObject     object,
+                    FcValueList *list,
+                    FcBool       append,
+                    FamilyTable *table)
+{
+    if (list) {
+	FcPatternElt *e = FcPatternObjectInsertElt (p, object);
+
+	if (!e)
+	    return;
+	FcConfigAdd (&e->values, 0, append, list, object, table);
+    }
+}
+
+/*
+ * Delete all values associated with a field
+ */
+static void
+FcConfigPatternDel (FcPattern   *p,
+                    FcObject     object,
+                    FamilyTable *table)
+{
+    FcPatternElt *e = FcPatternObjectFindElt (p, object);
+    if (!e)
+	return;
+    while (e->values != NULL)
+	FcConfigDel (&e->values, e->values, object, table);
+}
+
+static void
+FcConfigPatternCanon (FcPattern *p,
+                      FcObject   object)
+{
+    FcPatternElt *e = FcPatternObjectFindElt (p, object);
+    if (!e)
+	return;
+    if (e->values == NULL)
+	FcPatternObjectDel (p, object);
+}
+
+/*
+ * Apply an edit of 'object' with the values 'l'.  'elt' and 'value'
+ * locate the pattern value matched by the tests of the rule, if any.
+ */
+static void
+FcConfigApplyEdit (FcPattern    *p,
+                   FcObject      object,
+                   FcOp          op,
+                   FcValueList  *l,
+                   FcPatternElt *elt,
+                   FcValueList **value,
+                   FamilyTable  *table)
+{
+    switch (FC_OP_GET_OP (op)) {
+    case FcOpAssign:
+	/*
+	 * If there was a test, then replace the matched
+	 * value with the new list of values
+	 */
+	if (*value) {
+	    FcValueList *thisValue = *value;
+	    FcValueList *nextValue = l;
+
+	    /*
+	     * Append the new list of values after the current value
+	     */
+	    FcConfigAdd (&elt->values, thisValue, FcTrue, l, object, table);
+	    /*
+	     * Delete the marked value
+	     */
+	    if (thisValue)
+		FcConfigDel (&elt->values, thisValue, FC_OBJ_ID (object), table);
+	    /*
+	     * Adjust a pointer into the value list to ensure
+	     * future edits occur at the same place
+	     */
+	    *value = nextValue;
+	    break;
+	}
+	/* fall through ... */
+    case FcOpAssignReplace:
+	/*
+	 * Delete all of the values and insert
+	 * the new set
+	 */
+	FcConfigPatternDel (p, object, table);
+	FcConfigPatternAdd (p, object, l, FcTrue, table);
+	/*
+	 * Adjust a pointer into the value list as they no
+	 * longer point to anything valid
+	 */
+	*value = NULL;
+	break;
+    case FcOpPrepend:
+	if (*value) {
+	    FcConfigAdd (&elt->values, *value, FcFalse, l, object, table);
+	    break;
+	}
+	/* fall through ... */
+    case FcOpPrependFirst:
+	FcConfigPatternAdd (p, object, l, FcFalse, table);
+	break;
+    case FcOpAppend:
+	if (*value) {
+	    FcConfigAdd (&elt->values, *value, FcTrue, l, object, table);
+	    break;
+	}
+	/* fall through ... */
+    case FcOpAppendLast:
+	FcConfigPatternAdd (p, object, l, FcTrue, table);
+	break;
+    case FcOpDelete:
+	if (*value) {
+	    FcConfigDel (&elt->values, *value, FC_OBJ_ID (object), table);
+	    FcValueListDestroy (l);
+	    break;
+	}
+	/* fall through ... */
+    case FcOpDeleteAll:
+	FcConfigPatternDel (p, object, table);
+	FcValueListDestroy (l);
+	break;
+    default:
+	FcValueListDestroy (l);
+	break;
+    }
+    /*
+     * Now go through the pattern and eliminate
+     * any properties without data
+     */
+    FcConfigPatternCanon (p, object);
+}
+
+/*
+ * Compiled substitution rules.
+ *
+ * Walking the FcRuleSet, FcRule and FcExpr trees costs more than the
+ * tests and edits themselves, so the rules of each match kind are
+ * lowered to a flat program when the configuration has been loaded:
+ *
+ *  - a rule becomes a FcRuleInsn marking its start followed by one
+ *    for each test and edit, with the objects of the rule mapped to
+ *    slots numbered from 0;
+ *  - each value of a test or edit becomes a FcRuleValue, either a
+ *    constant or a range of FcExprInsn run on a small value stack;
+ *  - expressions not looking at a pattern are evaluated once while
+ *    compiling, so most values end up as constants;
+ *  - rules are indexed by the object, and for string equality the
+ *    constants, their first test needs, so that only the rules which
+ *    may match the objects and values of the pattern are visited.
+ *
+ * The trees are still walked when FC_DEBUG has EDIT set, as that
+ * traces every step.
+ */
+typedef enum _FcExprCode {
+    FcExprCodeValue,     /* push consts[arg] */
+    FcExprCodeField,     /* push object arg of the pattern tested or edited */
+    FcExprCodeFieldPat,  /* push object arg of p_pat */
+    FcExprCodeFieldFont, /* <name target="font"> in a pattern rule */
+    FcExprCodeMatrix,    /* replace four values by a matrix */
+    FcExprCodeCompare,   /* replace two values by their comparison */
+    FcExprCodeArith,     /* replace two values by FcConfigEvaluateArith */
+    FcExprCodeUnary,     /* replace a value by FcConfigEvaluateUnary */
+    FcExprCodeQuest,     /* pop a condition, jump to arg if false; the
+                          * insn before arg jumps past the else branch */
+    FcExprCodeJump       /* jump to arg */
+} FcExprCode;
+
+typedef struct _FcExprInsn {
+    FcExprCode code;
+    FcOp       op;
+    int        arg;
+} FcExprInsn;
+
+typedef struct _FcRuleValue {
+    FcValue  value;  /* if ncode is 0 */
+    FcBool   hashed; /* constant family name of a test */
+    FcChar32 hash;   /* its family table hash */
+    int      code;
+    int      ncode;
+} FcRuleValue;
+
+typedef struct _FcRuleInsn {
+    FcRuleType     type; /* FcRuleUnknown starts a rule */
+    int            slot; /* number of slots of a rule */
+    int            next; /* where the next rule starts */
+    FcObject       object;
+    FcOp           op;
+    const FcTest  *test;
+    FcBool         pat;  /* the test looks at p_pat */
+    FcBool         bind; /* the test locates the values edited */
+    FcValueBinding binding;
+    int            value;
+    int            nvalue;
+    FcChar32      *dispatch; /* rules the constants edited may make match */
+    FcBool         dynamic;  /* the values edited need looking up */
+} FcRuleInsn;
+
+/*
+ * Rules whose first test needs an object of the pattern, so that
+ * they are only run when the object is there.  Rules whose first test
+ * compares strings for equality with constants are found by looking
+ * up the values of the pattern in 'table'.  Its keys ignore blanks
+ * even for tests that do not, which only makes a few more rules run.
+ */
+typedef struct _FcRuleDispatch {
+    FcChar32    *present; /* rules needing the object */
+    FcHashTable *table;   /* constant -> rules needing it */
+} FcRuleDispatch;
+
+struct _FcRuleCode {
+    FcMatchKind     kind;
+    FcRuleInsn     *insns;
+    int             ninsn;
+    FcRuleValue    *values;
+    int             nvalue;
+    FcExprInsn     *exprs;
+    int             nexpr;
+    FcValue        *consts;
+    int             nconst;
+    int             nslot;  /* most slots of a rule */
+    int             depth;  /* deepest value stack */
+    FcBool          family; /* some test needs the family table */
+    int            *rules;  /* first insn of each rule */
+    int             nrule;
+    int             nword;  /* size of the rule bitmaps */
+    FcChar32       *always; /* rules run for any pattern */
+    FcRuleDispatch *dispatch[2]; /* by object of the pattern tested and of p_pat */
+    int             nobject;
+};
+
+typedef struct _FcRuleCodeSizes {
+    int insns;
+    int values;
+    int exprs;
+    int consts;
+    int depth; /* stack depth of the code compiled so far */
+} FcRuleCodeSizes;
+
+typedef struct _FcRuleSlot {
+    FcPatternElt *elt;
+    FcValueList  *value;
+    FcObject      tst;
+} FcRuleSlot;
+
+typedef struct _FcRuleStack {
+    FcValue value;
+    FcBool  owned;
+} FcRuleStack;
+
+#define FC_RULE_CODE_LOCAL 16
+
+static void *
+FcRuleCodeGrow (void *array, int n, int *size, size_t elt)
+{
+    int s;
+
+    if (n < *size)
+	return array;
+    s = *size ? *size * 2 : 16;
+    array = realloc (array, s * elt);
+    if (array)
+	*size = s;
+    return array;
+}
+
+static int
+FcRuleCodeAddInsn (FcRuleCode *code, FcRuleCodeSizes *sizes)
+{
+    FcRuleInsn *insns = FcRuleCodeGrow (code->insns, code->ninsn, &sizes->insns, sizeof (FcRuleInsn));
+
+    if (!insns)
+	return -1;
+    code->insns = insns;
+    memset (&insns[code->ninsn], 0, sizeof (FcRuleInsn));
+    return code->ninsn++;
+}
+
+static int
+FcRuleCodeAddExpr (FcRuleCode *code, FcRuleCodeSizes *sizes, FcExprCode c, FcOp op, int arg)
+{
+    FcExprInsn *exprs = FcRuleCodeGrow (code->exprs, code->nexpr, &sizes->exprs, sizeof (FcExprInsn));
+
+    if (!exprs)
+	return -1;
+    code->exprs = exprs;
+    exprs[code->nexpr].code = c;
+    exprs[code->nexpr].op = op;
+    exprs[code->nexpr].arg = arg;
+    return code->nexpr++;
+}
+
+/* Whether FcConfigEvaluate of 'e' looks at the patterns */
+static FcBool
+FcExprUsesPattern (const FcExpr *e)
+{
+    switch ((int)FC_OP_GET_OP (e->op)) {
+    case FcOpField:
+	return FcTrue;
+    case FcOpMatrix:
+	return (FcExprUsesPattern (e->u.mexpr->xx) ||
+	        FcExprUsesPattern (e->u.mexpr->xy) ||
+	        FcExprUsesPattern (e->u.mexpr->yx) ||
+	        FcExprUsesPattern (e->u.mexpr->yy));
+    case FcOpQuest:
+	return (FcExprUsesPattern (e->u.tree.left) ||
+	        FcExprUsesPattern (e->u.tree.right->u.tree.left) ||
+	        FcExprUsesPattern (e->u.tree.right->u.tree.right));
+    case FcOpEqual:
+    case FcOpNotEqual:
+    case FcOpLess:
+    case FcOpLessEqual:
+    case FcOpMore:
+    case FcOpMoreEqual:
+    case FcOpContains:
+    case FcOpNotContains:
+    case FcOpListing:
+    case FcOpOr:
+    case FcOpAnd:
+    case FcOpPlus:
+    case FcOpMinus:
+    case FcOpTimes:
+    case FcOpDivide:
+	if (FcExprUsesPattern (e->u.tree.right))
+	    return FcTrue;
+	/* fall through */
+    case FcOpNot:
+    case FcOpFloor:
+    case FcOpCeil:
+    case FcOpRound:
+    case FcOpTrunc:
+	return FcExprUsesPattern (e->u.tree.left);
+    default:
+	return FcFalse;
+    }
+}
+
+static FcBool
+FcRuleCodeCompileExpr (FcRuleCode      *code,
+                       FcRuleCodeSizes *sizes,
+                       FcObject         object,
+                       FcExpr          *e)
+{
+    FcOp       op = FC_OP_GET_OP (e->op);
+    FcExprCode c;
+    FcValue   *consts;
+    int        quest, jump;
+
+    if (!FcExprUsesPattern (e)) {
+	consts = FcRuleCodeGrow (code->consts, code->nconst, &sizes->consts, sizeof (FcValue));
+	if (!consts)
+	    return FcFalse;
+	code->consts = consts;
+	consts[code->nconst] = FcConfigEvaluate (NULL, NULL, object, code->kind, e);
+	if (FcRuleCodeAddExpr (code, sizes, FcExprCodeValue, op, code->nconst++) < 0)
+	    return FcFalse;
+	goto push;
+    }
+    switch ((int)op) {
+    case FcOpField:
+	if (code->kind == FcMatchFont && e->u.name.kind == FcMatchPattern)
+	    c = FcExprCodeFieldPat;
+	else if (code->kind == FcMatchPattern && e->u.name.kind == FcMatchFont)
+	    c = FcExprCodeFieldFont;
+	else
+	    c = FcExprCodeField;
+	if (FcRuleCodeAddExpr (code, sizes, c, op, e->u.name.object) < 0)
+	    return FcFalse;
+	goto push;
+    case FcOpMatrix:
+	if (!FcRuleCodeCompileExpr (code, sizes, object, e->u.mexpr->xx) ||
+	    !FcRuleCodeCompileExpr (code, sizes, object, e->u.mexpr->xy) ||
+	    !FcRuleCodeCompileExpr (code, sizes, object, e->u.mexpr->yx) ||
+	    !FcRuleCodeCompileExpr (code, sizes, object, e->u.mexpr->yy) ||
+	    FcRuleCodeAddExpr (code, sizes, FcExprCodeMatrix, op, 0) < 0)
+	    return FcFalse;
+	sizes->depth -= 3;
+	return FcTrue;
+    case FcOpQuest:
+	if (!FcRuleCodeCompileExpr (code, sizes, object, e->u.tree.left))
+	    return FcFalse;
+	sizes->depth--;
+	quest = FcRuleCodeAddExpr (code, sizes, FcExprCodeQuest, op, 0);
+	if (quest < 0 ||
+	    !FcRuleCodeCompileExpr (code, sizes, object, e->u.tree.right->u.tree.left))
+	    return FcFalse;
+	/* only one of the branches pushes its value */
+	sizes->depth--;
+	jump = FcRuleCodeAddExpr (code, sizes, FcExprCodeJump, op, 0);
+	if (jump < 0)
+	    return FcFalse;
+	code->exprs[quest].arg = code->nexpr;
+	if (!FcRuleCodeCompileExpr (code, sizes, object, e->u.tree.right->u.tree.right))
+	    return FcFalse;
+	code->exprs[jump].arg = code->nexpr;
+	return FcTrue;
+    case FcOpEqual:
+    case FcOpNotEqual:
+    case FcOpLess:
+    case FcOpLessEqual:
+    case FcOpMore:
+    case FcOpMoreEqual:
+    case FcOpContains:
+    case FcOpNotContains:
+    case FcOpListing:
+	/* FcConfigCompareValue wants the flags too */
+	op = e->op;
+	c = FcExprCodeCompare;
+	goto binary;
+    case FcOpOr:
+    case FcOpAnd:
+    case FcOpPlus:
+    case FcOpMinus:
+    case FcOpTimes:
+    case FcOpDivide:
+	c = FcExprCodeArith;
+    binary:
+	if (!FcRuleCodeCompileExpr (code, sizes, object, e->u.tree.left) ||
+	    !FcRuleCodeCompileExpr (code, sizes, object, e->u.tree.right) ||
+	    FcRuleCodeAddExpr (code, sizes, c, op, 0) < 0)
+	    return FcFalse;
+	sizes->depth--;
+	return FcTrue;
+    default:
+	/* FcOpNot, FcOpFloor, FcOpCeil, FcOpRound and FcOpTrunc */
+	return (FcRuleCodeCompileExpr (code, sizes, object, e->u.tree.left) &&
+	        FcRuleCodeAddExpr (code, sizes, FcExprCodeUnary, op, 0) >= 0);
+    }
+push:
+    if (++sizes->depth > code->depth)
+	code->depth = sizes->depth;
+    return FcTrue;
+}
+
+/*
+ * Add the values of the comma separated list 'e' to instruction 'insn'
+ */
+static FcBool
+FcRuleCodeCompileValues (FcRuleCode      *code,
+                         FcRuleCodeSizes *sizes,
+                         int              insn,
+                         FcObject         object,
+                         FcExpr          *e)
+{
+    FcRuleValue  *values;
+    FcRuleValue  *rv;
+    FcExpr       *value;
+    const FcTest *test;
+
+    code->insns[insn].value = code->nvalue;
+    while (e) {
+	if (FC_OP_GET_OP (e->op) == FcOpComma) {
+	    value = e->u.tree.left;
+	    e = e->u.tree.right;
+	} else {
+	    value = e;
+	    e = NULL;
+	}
+	values = FcRuleCodeGrow (code->values, code->nvalue, &sizes->values, sizeof (FcRuleValue));
+	if (!values)
+	    return FcFalse;
+	code->values = values;
+	rv = &values[code->nvalue++];
+	code->insns[insn].nvalue++;
+	rv->ncode = 0;
+	rv->hashed = FcFalse;
+	if (!FcExprUsesPattern (value)) {
+	    rv->value = FcConfigEvaluate (NULL, NULL, object, code->kind, value);
+	    test = code->insns[insn].test;
+	    if (test && object == FC_FAMILY_OBJECT && rv->value.type == FcTypeString) {
+		rv->hashed = FcTrue;
+		if (FC_OP_GET_FLAGS (test->op) & FcOpFlagIgnoreBlanks)
+		    rv->hash = FcStrHashIgnoreBlanksAndCase (rv->value.u.s);
+		else
+		    rv->hash = FcStrHashIgnoreCase (rv->value.u.s);
+	    }
+	    continue;
+	}
+	rv->value.type = FcTypeVoid;
+	rv->code = code->nexpr;
+	sizes->depth = 0;
+	if (!FcRuleCodeCompileExpr (code, sizes, object, value))
+	    return FcFalse;
+	rv->ncode = code->nexpr - rv->code;
+    }
+    return FcTrue;
+}
+
+static int
+FcRuleCodeSlot (const FcRuleCode *code, int start, FcObject object)
+{
+    int i;
+
+    for (i = start + 1; i < code->ninsn - 1; i++) {
+	if (FC_OBJ_ID (code->insns[i].object) == FC_OBJ_ID (object))
+	    return code->insns[i].slot;
+    }
+    return code->insns[start].slot++;
+}
+
+static FcBool
+FcRuleCodeCompileRule (FcRuleCode      *code,
+                       FcRuleCodeSizes *sizes,
+                       FcRule          *r)
+{
+    FcRuleInsn *insn;
+    int         start, i;
+
+    start = FcRuleCodeAddInsn (code, sizes);
+    if (start < 0)
+	return FcFalse;
+    for (; r; r = r->next) {
+	if (r->type != FcRuleTest && r->type != FcRuleEdit)
+	    continue;
+	i = FcRuleCodeAddInsn (code, sizes);
+	if (i < 0)
+	    return FcFalse;
+	insn = &code->insns[i];
+	insn->type = r->type;
+	if (r->type == FcRuleTest) {
+	    insn->object = r->u.test->object;
+	    insn->op = r->u.test->op;
+	    insn->test = r->u.test;
+	    insn->pat = code->kind == FcMatchFont && r->u.test->kind == FcMatchPattern;
+	    insn->bind = code->kind == r->u.test->kind;
+	    if (insn->object == FC_FAMILY_OBJECT && !insn->pat)
+		code->family = FcTrue;
+	} else {
+	    insn->object = r->u.edit->object;
+	    insn->op = r->u.edit->op;
+	    insn->binding = r->u.edit->binding;
+	}
+	insn->slot = FcRuleCodeSlot (code, start, insn->object);
+	if (!FcRuleCodeCompileValues (code, sizes, i, FC_OBJ_ID (insn->object),
+	                              r->type == FcRuleTest ? r->u.test->expr : r->u.edit->expr))
+	    return FcFalse;
+    }
+    code->insns[start].next = code->ninsn;
+    if (code->insns[start].slot > code->nslot)
+	code->nslot = code->insns[start].slot;
+    return FcTrue;
+}
+
+static FcChar32 *
+FcRuleCodeBits (const FcRuleCode *code, FcChar32 **bits)
+{
+    if (!*bits)
+	*bits = calloc (code->nword, sizeof (FcChar32));
+    return *bits;
+}
+
+#define FcRuleCodeSetBit(bits, i) ((bits)[(i) >> 5] |= 1U << ((i) & 31))
+
+static void
+FcRuleCodeOr (FcChar32 *set, const FcChar32 *bits, int nword)
+{
+    int i;
+
+    for (i = 0; i < nword; i++)
+	set[i] |= bits[i];
+}
+
+/*
+ * Whether the values of test 'insn' are constants the strings in the
+ * pattern can be looked up with
+ */
+static FcBool
+FcRuleCodeIsStringEqual (const FcRuleCode *code, const FcRuleInsn *insn)
+{
+    FcObject object = FC_OBJ_ID (insn->object);
+    FcOp     op = FC_OP_GET_OP (insn->op);
+    int      i;
+
+    if (op != FcOpEqual && op != FcOpListing)
+	return FcFalse;
+    if (FC_OP_GET_FLAGS (insn->op) & ~FcOpFlagIgnoreBlanks)
+	return FcFalse;
+    /* objects holding nothing but strings */
+    if (!FcObjectValidType (object, FcTypeString) ||
+        FcObjectValidType (object, FcTypeLangSet))
+	return FcFalse;
+    for (i = 0; i < insn->nvalue; i++) {
+	if (code->values[insn->value + i].ncode ||
+	    code->values[insn->value + i].value.type != FcTypeString)
+	    return FcFalse;
+    }
+    return insn->nvalue > 0;
+}
+
+static FcBool
+FcRuleCodeIndexValues (FcRuleCode       *code,
+                       FcRuleDispatch   *d,
+                       const FcRuleInsn *insn,
+                       int               rule)
+{
+    const FcChar8 *s;
+    FcChar32      *bits;
+    int            i;
+
+    if (!d->table) {
+	d->table = FcHashTableCreate ((FcHashFunc)FcStrHashIgnoreBlanksAndCase,
+	                              (FcCompareFunc)FcStrCmpIgnoreBlanksAndCase,
+	                              (FcCopyFunc)copy_string,
+	                              NULL,
+	                              free,
+	                              free);
+	if (!d->table)
+	    return FcFalse;
+    }
+    for (i = 0; i < insn->nvalue; i++) {
+	s = code->values[insn->value + i].value.u.s;
+	if (!FcHashTableFind (d->table, s, (void **)&bits)) {
+	    bits = calloc (code->nword, sizeof (FcChar32));
+	    if (!bits)
+		return FcFalse;
+	    if (!FcHashTableAdd (d->table, (void *)s, bits)) {
+		free (bits);
+		return FcFalse;
+	    }
+	}
+	FcRuleCodeSetBit (bits, rule);
+    }
+    return FcTrue;
+}
+
+/*
+ * Find the rules edit 'insn' may make match, as far as its values
+ * are constants
+ */
+static FcBool
+FcRuleCodeIndexEdit (FcRuleCode *code, FcRuleInsn *insn)
+{
+    FcObject           object = FC_OBJ_ID (insn->object);
+    FcRuleDispatch    *d;
+    const FcRuleValue *rv;
+    FcChar32          *bits;
+    int                i;
+
+    if ((int)object >= code->nobject)
+	return FcTrue;
+    d = &code->dispatch[0][object];
+    if (d->present) {
+	if (!FcRuleCodeBits (code, &insn->dispatch))
+	    return FcFalse;
+	FcRuleCodeOr (insn->dispatch, d->present, code->nword);
+    }
+    if (!d->table)
+	return FcTrue;
+    for (i = 0; i < insn->nvalue; i++) {
+	rv = &code->values[insn->value + i];
+	if (rv->ncode)
+	    insn->dynamic = FcTrue;
+	else if (rv->value.type == FcTypeString &&
+	         FcHashTableFind (d->table, rv->value.u.s, (void **)&bits)) {
+	    if (!FcRuleCodeBits (code, &insn->dispatch))
+		return FcFalse;
+	    FcRuleCodeOr (insn->dispatch, bits, code->nword);
+	}
+    }
+    return FcTrue;
+}
+
+/*
+ * Build the rule bitmaps of each object their first test needs, and
+ * the tables of the constants they compare strings with, so that
+ * running the rules only visits the ones which may match
+ */
+static FcBool
+FcRuleCodeIndex (FcRuleCode *code)
+{
+    const FcRuleInsn *insn;
+    FcRuleDispatch   *d;
+    int               i, rule;
+
+    for (i = 0; i < code->ninsn; i = code->insns[i].next)
+	code->nrule++;
+    if (!code->nrule)
+	return FcTrue;
+    code->nword = (code->nrule + 31) / 32;
+    for (i = 0; i < code->ninsn; i++) {
+	if (code->insns[i].type == FcRuleTest &&
+	    (int)FC_OBJ_ID (code->insns[i].object) >= code->nobject)
+	    code->nobject = FC_OBJ_ID (code->insns[i].object) + 1;
+    }
+    code->rules = malloc (code->nrule * sizeof (int));
+    code->always = calloc (code->nword, sizeof (FcChar32));
+    code->dispatch[0] = calloc (code->nobject, sizeof (FcRuleDispatch));
+    code->dispatch[1] = calloc (code->nobject, sizeof (FcRuleDispatch));
+    if (!code->rules || !code->always || !code->dispatch[0] || !code->dispatch[1])
+	return FcFalse;
+
+    for (i = 0, rule = 0; i < code->ninsn; i = code->insns[i].next, rule++) {
+	code->rules[rule] = i;
+	insn = &code->insns[i + 1];
+	/*
+	 * Only the first test is looked at, so that a rule skipped
+	 * fails at the same test it would have failed when run
+	 */
+	if (i + 1 == code->insns[i].next ||
+	    insn->type != FcRuleTest ||
+	    insn->test->qual == FcQualAll) {
+	    FcRuleCodeSetBit (code->always, rule);
+	    continue;
+	}
+	d = &code->dispatch[insn->pat][FC_OBJ_ID (insn->object)];
+	if (FcRuleCodeIsStringEqual (code, insn)) {
+	    if (!FcRuleCodeIndexValues (code, d, insn, rule))
+		return FcFalse;
+	} else {
+	    if (!FcRuleCodeBits (code, &d->present))
+		return FcFalse;
+	    FcRuleCodeSetBit (d->present, rule);
+	}
+    }
+    for (i = 0; i < code->ninsn; i++) {
+	if (code->insns[i].type == FcRuleEdit &&
+	    !FcRuleCodeIndexEdit (code, &code->insns[i]))
+	    return FcFalse;
+    }
+    return FcTrue;
+}
+
+static void
+FcRuleDispatchDestroy (FcRuleDispatch *dispatch, int n)
+{
+    int i;
+
+    if (!dispatch)
+	return;
+    for (i = 0; i < n; i++) {
+	free (dispatch[i].present);
+	if (dispatch[i].table)
+	    FcHashTableDestroy (dispatch[i].table);
+    }
+    free (dispatch);
+}
+
+static void
+FcRuleCodeDestroy (FcRuleCode *code)
+{
+    int i;
+
+    if (!code)
+	return;
+    for (i = 0; i < code->ninsn; i++)
+	free (code->insns[i].dispatch);
+    FcRuleDispatchDestroy (code->dispatch[0], code->nobject);
+    FcRuleDispatchDestroy (code->dispatch[1], code->nobject);
+    free (code->rules);
+    free (code->always);
+    for (i = 0; i < code->nvalue; i++) {
+	if (!code->values[i].ncode)
+	    FcValueDestroy (code->values[i].value);
+    }
+    for (i = 0; i < code->nconst; i++)
+	FcValueDestroy (code->consts[i]);
+    free (code->insns);
+    free (code->values);
+    free (code->exprs);
+    free (code->consts);
+    free (code);
+}
+
+static FcRuleCode *
+FcRuleCodeCompile (FcConfig *config, FcMatchKind kind)
+{
+    FcRuleCode     *code;
+    FcRuleCodeSizes sizes;
+    FcPtrListIter   iter, iter2;
+    FcRuleSet      *rs;
+
+    code = calloc (1, sizeof (FcRuleCode));
+    if (!code)
+	return NULL;
+    memset (&sizes, 0, sizeof (sizes));
+    code->kind = kind;
+    FcPtrListIterInit (config->subst[kind], &iter);
+    for (; FcPtrListIterIsValid (config->subst[kind], &iter); FcPtrListIterNext (config->subst[kind], &iter)) {
+	rs = (FcRuleSet *)FcPtrListIterGetValue (config->subst[kind], &iter);
+	FcPtrListIterInit (rs->subst[kind], &iter2);
+	for (; FcPtrListIterIsValid (rs->subst[kind], &iter2); FcPtrListIterNext (rs->subst[kind], &iter2)) {
+	    if (!FcRuleCodeCompileRule (code, &sizes, (FcRule *)FcPtrListIterGetValue (rs->subst[kind], &iter2))) {
+		FcRuleCodeDestroy (code);
+		return NULL;
+	    }
+	}
+    }
+    if (!FcRuleCodeIndex (code)) {
+	FcRuleCodeDestroy (code);
+	return NULL;
+    }
+    return code;
+}
+
+static void
+FcRuleStackPop (FcRuleStack *s)
+{
+    if (s->owned)
+	FcValueDestroy (s->value);
+}
+
+/*
+ * Evaluate 'rv' against 'p', the pattern tested or edited.  Unless
+ * 'owned' comes back true, the value still belongs to the patterns
+ * or the code.
+ */
+static FcValue
+FcRuleCodeEvaluate (const FcRuleCode  *code,
+                    const FcRuleValue *rv,
+                    FcPattern         *p,
+                    FcPattern         *p_pat,
+                    FcRuleStack       *stack,
+                    FcBool            *owned)
+{
+    const FcExprInsn *pc, *end;
+    FcRuleStack      *sp = stack;
+    FcValue           v;
+
+    if (!rv->ncode) {
+	*owned = FcFalse;
+	return rv->value;
+    }
+    pc = code->exprs + rv->code;
+    end = pc + rv->ncode;
+    while (pc < end) {
+	switch (pc->code) {
+	case FcExprCodeValue:
+	    sp->value = code->consts[pc->arg];
+	    sp->owned = FcFalse;
+	    sp++;
+	    break;
+	case FcExprCodeField:
+	case FcExprCodeFieldPat:
+	    if (FcResultMatch != FcPatternObjectGet (pc->code == FcExprCodeField ? p : p_pat,
+	                                             pc->arg, 0, &sp->value))
+		sp->value.type = FcTypeVoid;
+	    sp->owned = FcFalse;
+	    sp++;
+	    break;
+	case FcExprCodeFieldFont:
+	    fprintf (stderr,
+	             "Fontconfig warning: <name> tag has target=\"font\" in a <match target=\"pattern\">.\n");
+	    sp->value.type = FcTypeVoid;
+	    sp->owned = FcFalse;
+	    sp++;
+	    break;
+	case FcExprCodeMatrix:
+	    sp -= 4;
+	    v = FcConfigEvaluateMatrix (sp[0].value, sp[1].value, sp[2].value, sp[3].value);
+	    FcRuleStackPop (&sp[0]);
+	    FcRuleStackPop (&sp[1]);
+	    FcRuleStackPop (&sp[2]);
+	    FcRuleStackPop (&sp[3]);
+	    sp->value = v;
+	    sp->owned = FcTrue;
+	    sp++;
+	    break;
+	case FcExprCodeCompare:
+	    sp -= 2;
+	    v.type = FcTypeBool;
+	    v.u.b = FcConfigCompareValue (&sp[0].value, pc->op, &sp[1].value);
+	    FcRuleStackPop (&sp[0]);
+	    FcRuleStackPop (&sp[1]);
+	    sp->value = v;
+	    sp->owned = FcFalse;
+	    sp++;
+	    break;
+	case FcExprCodeArith:
+	    sp -= 2;
+	    v = FcConfigEvaluateArith (pc->op, sp[0].value, sp[1].value);
+	    FcRuleStackPop (&sp[0]);
+	    FcRuleStackPop (&sp[1]);
+	    sp->value = v;
+	    sp->owned = FcTrue;
+	    sp++;
+	    break;
+	case FcExprCodeUnary:
+	    v = FcConfigEvaluateUnary (pc->op, sp[-1].value);
+	    FcRuleStackPop (&sp[-1]);
+	    sp[-1].value = v;
+	    sp[-1].owned = FcFalse;
+	    break;
+	case FcExprCodeQuest:
+	    sp--;
+	    v = sp->value;
+	    FcRuleStackPop (sp);
+	    if (v.type != FcTypeBool) {
+		sp->value.type = FcTypeVoid;
+		sp->owned = FcFalse;
+		sp++;
+		pc = code->exprs + code->exprs[pc->arg - 1].arg;
+		continue;
+	    }
+	    if (!v.u.b) {
+		pc = code->exprs + pc->arg;
+		continue;
+	    }
+	    break;
+	case FcExprCodeJump:
+	    pc = code->exprs + pc->arg;
+	    continue;
+	}
+	pc++;
+    }
+    *owned = stack->owned;
+    return stack->value;
+}
+
+static FcValueList *
+FcRuleCodeMatch (const FcRuleCode *code,
+                 const FcRuleInsn *insn,
+                 FcPattern        *m,
+                 FcPattern        *p_pat,
+                 FcValueList      *values,
+                 FamilyTable      *table,
+                 FcRuleStack      *stack)
+{
+    FcValueList       *ret = 0;
+    const FcRuleValue *rv;
+    FcValue            value;
+    FcBool             owned;
+    int                i;
+
+    for (i = 0; i < insn->nvalue; i++) {
+	rv = &code->values[insn->value + i];
+	value = FcRuleCodeEvaluate (code, rv, m, p_pat, stack, &owned);
+	ret = FcConfigMatchValue (insn->test, &value,
+	                          rv->hashed ? &rv->hash : NULL,
+	                          values, table, ret);
+	if (owned)
+	    FcValueDestroy (value);
+    }
+    return ret;
+}
+
+static FcValueList *
+FcRuleCodeValues (const FcRuleCode *code,
+                  const FcRuleInsn *insn,
+                  FcPattern        *p,
+                  FcPattern        *p_pat,
+                  FcRuleStack      *stack)
+{
+    FcValueList *head = NULL, **tail = &head, *l;
+    FcValue      value;
+    FcBool       owned;
+    int          i;
+
+    for (i = 0; i < insn->nvalue; i++) {
+	value = FcRuleCodeEvaluate (code, &code->values[insn->value + i], p, p_pat, stack, &owned);
+	if (!owned)
+	    value = FcValueSave (value);
+	if (value.type == FcTypeVoid)
+	    continue;
+	l = (FcValueList *)malloc (sizeof (FcValueList));
+	if (!l) {
+	    FcValueDestroy (value);
+	    break;
+	}
+	l->value = value;
+	l->binding = insn->binding;
+	l->next = NULL;
+	*tail = l;
+	tail = &l->next;
+    }
+    return head;
+}
+
+/*
+ * Add the rules which may match 'values' of 'object' to 'set'
+ */
+static void
+FcRuleCodeDispatch (const FcRuleCode     *code,
+                    const FcRuleDispatch *dispatch,
+                    FcObject              object,
+                    FcValueListPtr        values,
+                    FcChar32             *set)
+{
+    const FcRuleDispatch *d;
+    FcValueListPtr        l;
+    FcChar32             *bits;
+
+    if ((int)object >= code->nobject)
+	return;
+    d = &dispatch[object];
+    if (d->present)
+	FcRuleCodeOr (set, d->present, code->nword);
+    if (!d->table)
+	return;
+    for (l = values; l; l = FcValueListNext (l)) {
+	if (l->value.type == FcTypeString &&
+	    FcHashTableFind (d->table, FcValueString (&l->value), (void **)&bits))
+	    FcRuleCodeOr (set, bits, code->nword);
+    }
+}
+
+static void
+FcRuleCodeDispatchPattern (const FcRuleCode     *code,
+                           const FcRuleDispatch *dispatch,
+                           FcPattern            *p,
+                           FcChar32             *set)
+{
+    FcPatternElt *e = FcPatternElts (p);
+    int           i;
+
+    for (i = 0; i < p->num; i++)
+	FcRuleCodeDispatch (code, dispatch, FC_OBJ_ID (e[i].object), FcPatternEltValues (&e[i]), set);
+}
+
+/*
+ * Same as the rule loop of FcConfigSubstituteRules, down to which
+ * family table the edits keep up to date.
+ */
+static FcBool
+FcRuleCodeRun (const FcRuleCode *code, FcPattern *p, FcPattern *p_pat)
+{
+    FcRuleSlot        local_slots[FC_RULE_CODE_LOCAL], *slots = local_slots, *slot;
+    FcRuleStack       local_stack[FC_RULE_CODE_LOCAL], *stack = local_stack;
+    FcChar32          local_set[FC_RULE_CODE_LOCAL], *set = local_set;
+    FamilyTable       data, *table = NULL;
+    const FcRuleInsn *insn;
+    FcPattern        *m;
+    FcPatternElt     *e;
+    FcValueList      *vl, *l;
+    int               i, next, rule, last = -1;
+    FcBool            retval = FcFalse;
+
+    if (code->nslot > FC_RULE_CODE_LOCAL) {
+	slots = malloc (code->nslot * sizeof (FcRuleSlot));
+	if (!slots)
+	    goto bail;
+    }
+    if (code->depth > FC_RULE_CODE_LOCAL) {
+	stack = malloc (code->depth * sizeof (FcRuleStack));
+	if (!stack)
+	    goto bail;
+    }
+    if (code->nword > FC_RULE_CODE_LOCAL) {
+	set = malloc (code->nword * sizeof (FcChar32));
+	if (!set)
+	    goto bail;
+    }
+    if (code->family) {
+	FamilyTableInit (&data, p);
+	table = &data;
+    }
+    if (code->nrule) {
+	memcpy (set, code->always, code->nword * sizeof (FcChar32));
+	FcRuleCodeDispatchPattern (code, code->dispatch[0], p, set);
+	if (p_pat)
+	    FcRuleCodeDispatchPattern (code, code->dispatch[1], p_pat, set);
+    }
+    /*
+     * Edits only add rules to 'set', for the values they add may
+     * make the first test of later rules match
+     */
+    for (rule = 0; rule < code->nrule; rule++) {
+	if (!set[rule >> 5]) {
+	    rule |= 31;
+	    continue;
+	}
+	if (!(set[rule >> 5] & (1U << (rule & 31))))
+	    continue;
+	i = code->rules[rule];
+	/* the rule before failed at its first test, which sets 'table' */
+	if (rule != last + 1)
+	    table = code->insns[code->rules[rule - 1] + 1].pat || !code->family ? NULL : &data;
+	last = rule;
+	next = code->insns[i].next;
+	memset (slots, 0, code->insns[i].slot * sizeof (FcRuleSlot));
+	for (i++; i < next; i++) {
+	    insn = &code->insns[i];
+	    slot = &slots[insn->slot];
+	    if (insn->type == FcRuleTest) {
+		if (insn->pat) {
+		    m = p_pat;
+		    table = NULL;
+		} else {
+		    m = p;
+		    table = code->family ? &data : NULL;
+		}
+		e = m ? FcPatternObjectFindElt (m, insn->object) : NULL;
+		if (!slot->elt && insn->bind) {
+		    slot->elt = e;
+		    slot->tst = insn->object;
+		}
+		/*
+		 * If there's no such field in the font,
+		 * then FcQualAll matches while FcQualAny does not
+		 */
+		if (!e) {
+		    if (insn->test->qual == FcQualAll) {
+			slot->value = NULL;
+			continue;
+		    }
+		    break;
+		}
+		vl = FcRuleCodeMatch (code, insn, m, p_pat, e->values, table, stack);
+		if (!slot->value && insn->bind)
+		    slot->value = vl;
+		if (!vl ||
+		    (insn->test->qual == FcQualFirst && vl != e->values) ||
+		    (insn->test->qual == FcQualNotFirst && vl == e->values))
+		    break;
+	    } else {
+		l = FcRuleCodeValues (code, insn, p, p_pat, stack);
+		if (slot->tst && code->kind != FcMatchScan)
+		    slot->elt = FcPatternObjectFindElt (p, slot->tst);
+		if (insn->dispatch)
+		    FcRuleCodeOr (set, insn->dispatch, code->nword);
+		if (insn->dynamic)
+		    FcRuleCodeDispatch (code, code->dispatch[0], FC_OBJ_ID (insn->object), l, set);
+		FcConfigApplyEdit (p, insn->object, insn->op, l, slot->elt, &slot->value, table);
+	    }
+	}
+    }
+    if (code->family)
+	FamilyTableClear (&data);
+    retval = FcTrue;
+bail:
+    if (set != local_set)
+	free (set);
+    if (slots != local_slots)
+	free (slots);
+    if (stack != local_stack)
+	free (stack);
+
+    return retval;
+}
+
+static FcRuleCode *
+FcConfigGetRuleCode (FcConfig *config, FcMatchKind kind)
+{
+    FcRuleCode *code;
+
+    code = fc_atomic_ptr_get (&config->rule_code[kind]);
+    if (!code) {
+	code = FcRuleCodeCompile (config, kind);
+	if (!code)
+	    return NULL;
+	if (!fc_atomic_ptr_cmpexch (&config->rule_code[kind], NULL, code)) {
+	    FcRuleCodeDestroy (code);
+	    code = fc_atomic_ptr_get (&config->rule_code[kind]);
+	}
+    }
+    return code;
+}
+
+static FcGlobCode *
+FcConfigGetGlobCode (FcConfig *config)
+{
+    FcGlobCode *code;
+
+    code = fc_atomic_ptr_get (&config->glob_code);
+    if (!code) {
+	code = FcGlobCodeCreate (config->acceptGlobs, config->rejectGlobs);
+	if (!code)
+	    return NULL;
+	if (!fc_atomic_ptr_cmpexch (&config->glob_code, NULL, code)) {
+	    FcGlobCodeDestroy (code);
+	    code = fc_atomic_ptr_get (&config->glob_code);
+	}
+    }
+    return code;
+}
+
+/*
+ * Drop the compiled globs when globs are added to 'config'
+ */
+void
+FcConfigClearGlobCode (FcConfig *config)
+{
+    FcGlobCodeDestroy (config->glob_code);
+    config->glob_code = NULL;
+}
+
+static FcListFilter *
+FcConfigGetListFilter (FcConfig *config, FcBool accept)
+{
+    FcListFilter **filterp = accept ? &config->accept_filter : &config->reject_filter;
+    FcListFilter  *filter;
+
+    filter = fc_atomic_ptr_get (filterp);
+    if (!filter) {
+	filter = FcListFilterCreate (accept ? config->acceptPatterns : config->rejectPatterns);
+	if (!filter)
+	    return NULL;
+	if (!fc_atomic_ptr_cmpexch (filterp, NULL, filter)) {
+	    FcListFilterDestroy (filter);
+	    filter = fc_atomic_ptr_get (filterp);
 	}
     }
+    return filter;
 }
 
-static void
-FcConfigPatternAdd (FcPattern   *p,
-                    FcObject     object,
-                    FcValueList *list,
-                    FcBool       append,
-                    FamilyTable *table)
+/*
+ * Drop the indexes of the font patterns when patterns are added
+ * to 'config'
+ */
+void
+FcConfigClearListFilters (FcConfig *config)
 {
-    if (list) {
-	FcPatternElt *e = FcPatternObjectInsertElt (p, object);
+    FcListFilterDestroy (config->accept_filter);
+    config->accept_filter = NULL;
+    FcListFilterDestroy (config->reject_filter);
+    config->reject_filter = NULL;
+}
 
-	if (!e)
-	    return;
-	FcConfigAdd (&e->values, 0, append, list, object, table);
-    }
+/*
+ * Drop the aggregate cache files when cache directories are added
+ * to 'config'
+ */
+void
+FcConfigClearCacheAggregates (FcConfig *config)
+{
+    FcCacheAggregatesDestroy (config->cache_aggregates);
+    config->cache_aggregates = NULL;
 }
 
 /*
- * Delete all values associated with a field
+ * Compile the substitution rules, the file name globs and the font
+ * patterns of 'config', at the end of loading it rather than on the
+ * first use
  */
-static void
-FcConfigPatternDel (FcPattern   *p,
-                    FcObject     object,
-                    FamilyTable *table)
+void
+FcConfigCompileRules (FcConfig *config)
 {
-    FcPatternElt *e = FcPatternObjectFindElt (p, object);
-    if (!e)
+    FcMatchKind k;
+
+    if (!config)
 	return;
-    while (e->values != NULL)
-	FcConfigDel (&e->values, e->values, object, table);
+    for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++)
+	(void)FcConfigGetRuleCode (config, k);
+    (void)FcConfigGetGlobCode (config);
+    (void)FcConfigGetListFilter (config, FcTrue);
+    (void)FcConfigGetListFilter (config, FcFalse);
 }
 
-static void
-FcConfigPatternCanon (FcPattern *p,
-                      FcObject   object)
+/*
+ * Drop the compiled rules and the results of substituting with them
+ * when rules are added to 'config'
+ */
+void
+FcConfigClearRuleCode (FcConfig *config)
 {
-    FcPatternElt *e = FcPatternObjectFindElt (p, object);
-    if (!e)
-	return;
-    if (e->values == NULL)
-	FcPatternObjectDel (p, object);
+    FcMatchKind k;
+
+    for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++) {
+	FcRuleCodeDestroy (config->rule_code[k]);
+	config->rule_code[k] = NULL;
+    }
+    FcMatchCacheClear (config->subst_cache);
 }
 
-FcBool
-FcConfigSubstituteWithPat (FcConfig   *config,
-                           FcPattern  *p,
-                           FcPattern  *p_pat,
-                           FcMatchKind kind)
+/*
+ * Replace the contents of 'p' by the cached 'result'
+ */
+static FcBool
+FcConfigSubstituteCopy (FcPattern *p, FcPattern *result)
+{
+    while (FcPatternObjectCount (p) > 0)
+	FcPatternObjectDel (p, FcPatternElts (p)[FcPatternObjectCount (p) - 1].object);
+
+    return FcPatternAppend (p, result);
+}
+
+/*
+ * Walk the rule trees of 'config'.  This is what FcRuleCodeRun does
+ * too, with all the FC_DBG_EDIT output.
+ */
+static FcBool
+FcConfigSubstituteRules (FcConfig   *config,
+                         FcPattern  *p,
+                         FcPattern  *p_pat,
+                         FcMatchKind kind)
 {
-    FcValue        v;
-    FcPtrList     *s;
+    FcPtrList     *s = config->subst[kind];
     FcPtrListIter  iter, iter2;
     FcRule        *r;
     FcRuleSet     *rs;
     FcValueList   *l, **value = NULL, *vl;
     FcPattern     *m;
-    FcStrSet      *strs;
     FcObject       object = FC_INVALID_OBJECT;
     FcPatternElt **elt = NULL, *e;
     int            i, nobjs;
@@ -1959,68 +3302,6 @@ FcConfigSubstituteWithPat (FcConfig   *config,
     FamilyTable    data;
     FamilyTable   *table = &data;
 
-    if (kind < FcMatchKindBegin || kind >= FcMatchKindEnd)
-	return FcFalse;
-
-    config = FcConfigReference (config);
-    if (!config)
-	return FcFalse;
-
-    s = config->subst[kind];
-    if (kind == FcMatchPattern) {
-	strs = FcConfigGetDefaultLangs (config);
-	if (strs) {
-	    FcStrList *l = FcStrListCreate (strs);
-	    FcChar8   *lang;
-	    FcValue    v;
-	    FcLangSet *lsund = FcLangSetCreate();
-
-	    FcLangSetAdd (lsund, (const FcChar8 *)"und");
-	    FcStrSetDestroy (strs);
-	    while (l && (lang = FcStrListNext (l))) {
-		FcPatternElt *e = FcPatternObjectFindElt (p, FC_LANG_OBJECT);
-
-		if (e) {
-		    FcValueListPtr ll;
-
-		    for (ll = FcPatternEltValues (e); ll; ll = FcValueListNext (ll)) {
-			FcValue vv = FcValueCanonicalize (&ll->value);
-
-			if (vv.type == FcTypeLangSet) {
-			    FcLangSet *ls = FcLangSetCreate();
-			    FcBool     b;
-
-			    FcLangSetAdd (ls, lang);
-			    b = FcLangSetContains (vv.u.l, ls);
-			    FcLangSetDestroy (ls);
-			    if (b)
-				goto bail_lang;
-			    if (FcLangSetContains (vv.u.l, lsund))
-				goto bail_lang;
-			} else {
-			    if (FcStrCmpIgnoreCase (vv.u.s, lang) == 0)
-				goto bail_lang;
-			    if (FcStrCmpIgnoreCase (vv.u.s, (const FcChar8 *)"und") == 0)
-				goto bail_lang;
-			}
-		    }
-		}
-		v.type = FcTypeString;
-		v.u.s = lang;
-
-		FcPatternObjectAddWithBinding (p, FC_LANG_OBJECT, v, FcValueBindingWeak, FcTrue);
-	    }
-	bail_lang:
-	    FcStrListDone (l);
-	    FcLangSetDestroy (lsund);
-	}
-	if (FcPatternObjectGet (p, FC_PRGNAME_OBJECT, 0, &v) == FcResultNoMatch) {
-	    FcChar8 *prgname = FcConfigGetPrgname (config);
-	    if (prgname)
-		FcPatternObjectAddString (p, FC_PRGNAME_OBJECT, prgname);
-	}
-    }
-
     nobjs = FC_MAX_BASE_OBJECT + config->maxObjects + 2;
     value = (FcValueList **)malloc (SIZEOF_VOID_P * nobjs);
     if (!value) {
@@ -2134,84 +3415,7 @@ FcConfigSubstituteWithPat (FcConfig   *config,
 		    if (tst[object] && (tst[object]->kind == FcMatchFont || kind == FcMatchPattern))
 			elt[object] = FcPatternObjectFindElt (p, tst[object]->object);
 
-		    switch (FC_OP_GET_OP (r->u.edit->op)) {
-		    case FcOpAssign:
-			/*
-			 * If there was a test, then replace the matched
-			 * value with the new list of values
-			 */
-			if (value[object]) {
-			    FcValueList *thisValue = value[object];
-			    FcValueList *nextValue = l;
-
-			    /*
-			     * Append the new list of values after the current value
-			     */
-			    FcConfigAdd (&elt[object]->values, thisValue, FcTrue, l, r->u.edit->object, table);
-			    /*
-			     * Delete the marked value
-			     */
-			    if (thisValue)
-				FcConfigDel (&elt[object]->values, thisValue, object, table);
-			    /*
-			     * Adjust a pointer into the value list to ensure
-			     * future edits occur at the same place
-			     */
-			    value[object] = nextValue;
-			    break;
-			}
-			/* fall through ... */
-		    case FcOpAssignReplace:
-			/*
-			 * Delete all of the values and insert
-			 * the new set
-			 */
-			FcConfigPatternDel (p, r->u.edit->object, table);
-			FcConfigPatternAdd (p, r->u.edit->object, l, FcTrue, table);
-			/*
-			 * Adjust a pointer into the value list as they no
-			 * longer point to anything valid
-			 */
-			value[object] = NULL;
-			break;
-		    case FcOpPrepend:
-			if (value[object]) {
-			    FcConfigAdd (&elt[object]->values, value[object], FcFalse, l, r->u.edit->object, table);
-			    break;
-			}
-			/* fall through ... */
-		    case FcOpPrependFirst:
-			FcConfigPatternAdd (p, r->u.edit->object, l, FcFalse, table);
-			break;
-		    case FcOpAppend:
-			if (value[object]) {
-			    FcConfigAdd (&elt[object]->values, value[object], FcTrue, l, r->u.edit->object, table);
-			    break;
-			}
-			/* fall through ... */
-		    case FcOpAppendLast:
-			FcConfigPatternAdd (p, r->u.edit->object, l, FcTrue, table);
-			break;
-		    case FcOpDelete:
-			if (value[object]) {
-			    FcConfigDel (&elt[object]->values, value[object], object, table);
-			    FcValueListDestroy (l);
-			    break;
-			}
-			/* fall through ... */
-		    case FcOpDeleteAll:
-			FcConfigPatternDel (p, r->u.edit->object, table);
-			FcValueListDestroy (l);
-			break;
-		    default:
-			FcValueListDestroy (l);
-			break;
-		    }
-		    /*
-		     * Now go through the pattern and eliminate
-		     * any properties without data
-		     */
-		    FcConfigPatternCanon (p, r->u.edit->object);
+		    FcConfigApplyEdit (p, r->u.edit->object, r->u.edit->op, l, elt[object], &value[object], table);
 
 		    if (FcDebug() & FC_DBG_EDIT) {
 			printf ("FcConfigSubstitute edit");
@@ -2235,6 +3439,118 @@ bail1:
 	free (value);
     if (tst)
 	free (tst);
+
+    return retval;
+}
+
+FcBool
+FcConfigSubstituteWithPat (FcConfig   *config,
+                           FcPattern  *p,
+                           FcPattern  *p_pat,
+                           FcMatchKind kind)
+{
+    FcValue       v;
+    FcStrSet     *strs;
+    FcRuleCode   *code = NULL;
+    FcMatchCache *cache = NULL;
+    FcPattern    *key = NULL, *result;
+    unsigned int  serial;
+    FcBool        retval;
+
+    if (kind < FcMatchKindBegin || kind >= FcMatchKindEnd)
+	return FcFalse;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return FcFalse;
+
+    if (kind == FcMatchPattern) {
+	strs = FcConfigGetDefaultLangs (config);
+	if (strs) {
+	    FcStrList *l = FcStrListCreate (strs);
+	    FcChar8   *lang;
+	    FcValue    v;
+	    FcLangSet *lsund = FcLangSetCreate();
+
+	    FcLangSetAdd (lsund, (const FcChar8 *)"und");
+	    FcStrSetDestroy (strs);
+	    while (l && (lang = FcStrListNext (l))) {
+		FcPatternElt *e = FcPatternObjectFindElt (p, FC_LANG_OBJECT);
+
+		if (e) {
+		    FcValueListPtr ll;
+
+		    for (ll = FcPatternEltValues (e); ll; ll = FcValueListNext (ll)) {
+			FcValue vv = FcValueCanonicalize (&ll->value);
+
+			if (vv.type == FcTypeLangSet) {
+			    FcLangSet *ls = FcLangSetCreate();
+			    FcBool     b;
+
+			    FcLangSetAdd (ls, lang);
+			    b = FcLangSetContains (vv.u.l, ls);
+			    FcLangSetDestroy (ls);
+			    if (b)
+				goto bail_lang;
+			    if (FcLangSetContains (vv.u.l, lsund))
+				goto bail_lang;
+			} else {
+			    if (FcStrCmpIgnoreCase (vv.u.s, lang) == 0)
+				goto bail_lang;
+			    if (FcStrCmpIgnoreCase (vv.u.s, (const FcChar8 *)"und") == 0)
+				goto bail_lang;
+			}
+		    }
+		}
+		v.type = FcTypeString;
+		v.u.s = lang;
+
+		FcPatternObjectAddWithBinding (p, FC_LANG_OBJECT, v, FcValueBindingWeak, FcTrue);
+	    }
+	bail_lang:
+	    FcStrListDone (l);
+	    FcLangSetDestroy (lsund);
+	}
+	if (FcPatternObjectGet (p, FC_PRGNAME_OBJECT, 0, &v) == FcResultNoMatch) {
+	    FcChar8 *prgname = FcConfigGetPrgname (config);
+	    if (prgname)
+		FcPatternObjectAddString (p, FC_PRGNAME_OBJECT, prgname);
+	}
+    }
+
+    /*
+     * The rules only look at the patterns, so once the default
+     * languages and program name have been added, the result only
+     * depends on 'p'
+     */
+    if (kind == FcMatchPattern && !p_pat && !(FcDebug() & FC_DBG_EDIT))
+	cache = fc_atomic_ptr_get (&config->subst_cache);
+    if (cache) {
+	result = FcMatchCacheLookup (cache, p, &serial);
+	if (result) {
+	    retval = FcConfigSubstituteCopy (p, result);
+	    FcPatternDestroy (result);
+	    goto bail;
+	}
+	key = FcPatternDuplicate (p);
+    }
+
+    if (!(FcDebug() & FC_DBG_EDIT))
+	code = FcConfigGetRuleCode (config, kind);
+    if (code)
+	retval = FcRuleCodeRun (code, p, p_pat);
+    else
+	retval = FcConfigSubstituteRules (config, p, p_pat, kind);
+
+    if (key) {
+	result = retval ? FcPatternDuplicate (p) : NULL;
+	if (result) {
+	    FcMatchCacheInsertKey (cache, key, result, serial);
+	    FcPatternDestroy (result);
+	} else
+	    FcPatternDestroy (key);
+    }
+bail:
     FcConfigDestroy (config);
 
     return retval;
@@ -2248,6 +3564,32 @@ FcConfigSubstitute (FcConfig   *config,
     return FcConfigSubstituteWithPat (config, p, 0, kind);
 }
 
+FcBool
+FcConfigSetSubstituteCacheSize (FcConfig *config, int size)
+{
+    FcBool ret;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return FcFalse;
+    ret = FcMatchCacheSetSize (&config->subst_cache, size);
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+void
+FcConfigGetSubstituteCacheStats (FcConfig      *config,
+                                 unsigned long *hits,
+                                 unsigned long *misses)
+{
+    config = FcConfigReference (config);
+    FcMatchCacheGetStats (config ? fc_atomic_ptr_get (&config->subst_cache) : NULL,
+                          hits, misses);
+    if (config)
+	FcConfigDestroy (config);
+}
+
 #if defined(_WIN32)
 
 static FcChar8 fontconfig_path[1000] = "";       /* MT-dontcare */
@@ -2748,6 +4090,8 @@ FcConfigAppFontAddFile (FcConfig      *config,
 	ret = FcFalse;
 	goto bail;
     }
+    FcConfigUpdateMatchIndex (config, FcSetApplication);
+    FcMatchCacheClear (config->match_cache);
     if ((sublist = FcStrListCreate (subdirs))) {
 	while ((subdir = FcStrListNext (sublist))) {
 	    FcConfigAppFontAddDir (config, subdir);
@@ -2828,6 +4172,18 @@ FcConfigPreferAppFont (FcConfig *config, FcBool flag)
     FcConfigDestroy (config);
 }
 
+void
+FcConfigSetThreads (FcConfig *config, int nthreads)
+{
+    config = FcConfigReference (config);
+    if (!config)
+	return;
+
+    config->nthreads = nthreads > 0 ? nthreads : FcWorkersDefault();
+
+    FcConfigDestroy (config);
+}
+
 void
 FcConfigSetWarningFlags (FcConfig *config, int warn, FcBool flag)
 {
@@ -2922,6 +4278,7 @@ FcConfigGlobAdd (FcConfig      *config,
 	return FcFalse;
 
     ret = FcStrSetAdd (set, s);
+    FcConfigClearGlobCode (config);
     FcStrFree (realglob);
     FcStrFree (cwd);
     return ret;
@@ -2943,6 +4300,11 @@ FcBool
 FcConfigAcceptFilename (FcConfig      *config,
                         const FcChar8 *filename)
 {
+    FcGlobCode *code = FcConfigGetGlobCode (config);
+    FcBool      accept;
+
+    if (code && FcGlobCodeAccept (code, filename, &accept))
+	return accept;
     if (FcConfigGlobsMatch (config->acceptGlobs, filename))
 	return FcTrue;
     if (FcConfigGlobsMatch (config->rejectGlobs, filename))
@@ -2961,15 +4323,24 @@ FcConfigPatternsAdd (FcConfig  *config,
 {
     FcFontSet *set = accept ? config->acceptPatterns : config->rejectPatterns;
 
+    FcConfigClearListFilters (config);
     return FcFontSetAdd (set, pattern);
 }
 
 static FcBool
-FcConfigPatternsMatch (const FcFontSet *patterns,
+FcConfigPatternsMatch (FcConfig        *config,
+                       FcBool           accept,
                        const FcPattern *font)
 {
-    int i;
+    const FcFontSet *patterns = accept ? config->acceptPatterns : config->rejectPatterns;
+    FcListFilter    *filter;
+    int              i;
 
+    if (!patterns->nfont)
+	return FcFalse;
+    filter = FcConfigGetListFilter (config, accept);
+    if (filter)
+	return FcListFilterMatchAny (filter, font);
     for (i = 0; i < patterns->nfont; i++)
 	if (FcListPatternMatchAny (patterns->fonts[i], font))
 	    return FcTrue;
@@ -2980,9 +4351,9 @@ FcBool
 FcConfigAcceptFont (FcConfig        *config,
                     const FcPattern *font)
 {
-    if (FcConfigPatternsMatch (config->acceptPatterns, font))
+    if (FcConfigPatternsMatch (config, FcTrue, font))
 	return FcTrue;
-    if (FcConfigPatternsMatch (config->rejectPatterns, font))
+    if (FcConfigPatternsMatch (config, FcFalse, font))
 	return FcFalse;
     return FcTrue;
 }
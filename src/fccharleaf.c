@@ -0,0 +1,436 @@
+/* Copyright (C) 2026 fontconfig Authors */
+/* SPDX-License-Identifier: HPND */
+
+#include "fcint.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <immintrin.h>
+#  define FC_LEAF_X86 1
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define FC_LEAF_NEON 1
+#endif
+
+/*
+ * Kernels operating on a single 256-bit FcCharLeaf, used by the set
+ * algebra and counting functions of fccharset.c.  The best ones for
+ * the CPU are picked the first time they're needed; FC_CHARSET_KERNEL
+ * may name another one ("scalar", "sse2", "avx2" or "neon") to compare
+ * them.
+ */
+
+static FcChar32
+FcLeafPopCount (FcChar32 c1)
+{
+#if __GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4)
+    return __builtin_popcount (c1);
+#else
+    /* hackmem 169 */
+    FcChar32 c2 = (c1 >> 1) & 033333333333;
+    c2 = c1 - c2 - ((c2 >> 1) & 033333333333);
+    return (((c2 + (c2 >> 3)) & 030707070707) % 077);
+#endif
+}
+
+static FcChar32
+FcLeafCountScalar (const FcCharLeaf *a)
+{
+    FcChar32 count = 0;
+    int      i;
+
+    for (i = 0; i < 256 / 32; i++)
+	count += FcLeafPopCount (a->map[i]);
+    return count;
+}
+
+static FcChar32
+FcLeafIntersectCountScalar (const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    FcChar32 count = 0;
+    int      i;
+
+    for (i = 0; i < 256 / 32; i++)
+	count += FcLeafPopCount (a->map[i] & b->map[i]);
+    return count;
+}
+
+static FcChar32
+FcLeafSubtractCountScalar (const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    FcChar32 count = 0;
+    int      i;
+
+    for (i = 0; i < 256 / 32; i++)
+	count += FcLeafPopCount (a->map[i] & ~b->map[i]);
+    return count;
+}
+
+static FcBool
+FcLeafIsSubsetScalar (const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    int i;
+
+    for (i = 0; i < 256 / 32; i++)
+	if (a->map[i] & ~b->map[i])
+	    return FcFalse;
+    return FcTrue;
+}
+
+static FcBool
+FcLeafIntersectScalar (FcCharLeaf *result, const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    FcBool nonempty = FcFalse;
+    int    i;
+
+    for (i = 0; i < 256 / 32; i++)
+	if ((result->map[i] = a->map[i] & b->map[i]))
+	    nonempty = FcTrue;
+    return nonempty;
+}
+
+static FcBool
+FcLeafSubtractScalar (FcCharLeaf *result, const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    FcBool nonempty = FcFalse;
+    int    i;
+
+    for (i = 0; i < 256 / 32; i++)
+	if ((result->map[i] = a->map[i] & ~b->map[i]))
+	    nonempty = FcTrue;
+    return nonempty;
+}
+
+static void
+FcLeafUnionScalar (FcCharLeaf *result, const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    int i;
+
+    for (i = 0; i < 256 / 32; i++)
+	result->map[i] = a->map[i] | b->map[i];
+}
+
+static const FcCharLeafKernels FcLeafScalar = {
+    "scalar",
+    FcLeafCountScalar,
+    FcLeafIntersectCountScalar,
+    FcLeafSubtractCountScalar,
+    FcLeafIsSubsetScalar,
+    FcLeafIntersectScalar,
+    FcLeafSubtractScalar,
+    FcLeafUnionScalar,
+};
+
+#ifdef FC_LEAF_X86
+/* Leaves are only 4-byte aligned, hence the unaligned loads and stores */
+#  define FC_LEAF_SSE2 __attribute__ ((target ("sse2")))
+#  define FC_LEAF_AVX2 __attribute__ ((target ("avx2")))
+
+/* Bit count of each 64-bit half of 'v' */
+static FC_LEAF_SSE2 __m128i
+FcLeafPopCount128 (__m128i v)
+{
+    const __m128i m1 = _mm_set1_epi8 (0x55);
+    const __m128i m2 = _mm_set1_epi8 (0x33);
+    const __m128i m4 = _mm_set1_epi8 (0x0f);
+
+    v = _mm_sub_epi8 (v, _mm_and_si128 (_mm_srli_epi16 (v, 1), m1));
+    v = _mm_add_epi8 (_mm_and_si128 (v, m2), _mm_and_si128 (_mm_srli_epi16 (v, 2), m2));
+    v = _mm_and_si128 (_mm_add_epi8 (v, _mm_srli_epi16 (v, 4)), m4);
+    return _mm_sad_epu8 (v, _mm_setzero_si128());
+}
+
+static FC_LEAF_SSE2 FcChar32
+FcLeafSum128 (__m128i lo, __m128i hi)
+{
+    __m128i s = _mm_add_epi64 (FcLeafPopCount128 (lo), FcLeafPopCount128 (hi));
+
+    return _mm_cvtsi128_si32 (s) + _mm_cvtsi128_si32 (_mm_srli_si128 (s, 8));
+}
+
+static FC_LEAF_SSE2 FcBool
+FcLeafNonEmpty128 (__m128i lo, __m128i hi)
+{
+    __m128i z = _mm_cmpeq_epi8 (_mm_or_si128 (lo, hi), _mm_setzero_si128());
+
+    return _mm_movemask_epi8 (z) != 0xffff;
+}
+
+#  define FcLeafLoad128(l, i) _mm_loadu_si128 ((const __m128i *)(l)->map + (i))
+#  define FcLeafStore128(l, i, v) _mm_storeu_si128 ((__m128i *)(l)->map + (i), (v))
+
+static FC_LEAF_SSE2 FcChar32
+FcLeafCountSSE2 (const FcCharLeaf *a)
+{
+    return FcLeafSum128 (FcLeafLoad128 (a, 0), FcLeafLoad128 (a, 1));
+}
+
+static FC_LEAF_SSE2 FcChar32
+FcLeafIntersectCountSSE2 (const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    return FcLeafSum128 (_mm_and_si128 (FcLeafLoad128 (a, 0), FcLeafLoad128 (b, 0)),
+                         _mm_and_si128 (FcLeafLoad128 (a, 1), FcLeafLoad128 (b, 1)));
+}
+
+static FC_LEAF_SSE2 FcChar32
+FcLeafSubtractCountSSE2 (const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    return FcLeafSum128 (_mm_andnot_si128 (FcLeafLoad128 (b, 0), FcLeafLoad128 (a, 0)),
+                         _mm_andnot_si128 (FcLeafLoad128 (b, 1), FcLeafLoad128 (a, 1)));
+}
+
+static FC_LEAF_SSE2 FcBool
+FcLeafIsSubsetSSE2 (const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    return !FcLeafNonEmpty128 (_mm_andnot_si128 (FcLeafLoad128 (b, 0), FcLeafLoad128 (a, 0)),
+                               _mm_andnot_si128 (FcLeafLoad128 (b, 1), FcLeafLoad128 (a, 1)));
+}
+
+static FC_LEAF_SSE2 FcBool
+FcLeafIntersectSSE2 (FcCharLeaf *result, const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    __m128i lo = _mm_and_si128 (FcLeafLoad128 (a, 0), FcLeafLoad128 (b, 0));
+    __m128i hi = _mm_and_si128 (FcLeafLoad128 (a, 1), FcLeafLoad128 (b, 1));
+
+    FcLeafStore128 (result, 0, lo);
+    FcLeafStore128 (result, 1, hi);
+    return FcLeafNonEmpty128 (lo, hi);
+}
+
+static FC_LEAF_SSE2 FcBool
+FcLeafSubtractSSE2 (FcCharLeaf *result, const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    __m128i lo = _mm_andnot_si128 (FcLeafLoad128 (b, 0), FcLeafLoad128 (a, 0));
+    __m128i hi = _mm_andnot_si128 (FcLeafLoad128 (b, 1), FcLeafLoad128 (a, 1));
+
+    FcLeafStore128 (result, 0, lo);
+    FcLeafStore128 (result, 1, hi);
+    return FcLeafNonEmpty128 (lo, hi);
+}
+
+static FC_LEAF_SSE2 void
+FcLeafUnionSSE2 (FcCharLeaf *result, const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    __m128i lo = _mm_or_si128 (FcLeafLoad128 (a, 0), FcLeafLoad128 (b, 0));
+    __m128i hi = _mm_or_si128 (FcLeafLoad128 (a, 1), FcLeafLoad128 (b, 1));
+
+    FcLeafStore128 (result, 0, lo);
+    FcLeafStore128 (result, 1, hi);
+}
+
+static const FcCharLeafKernels FcLeafSSE2 = {
+    "sse2",
+    FcLeafCountSSE2,
+    FcLeafIntersectCountSSE2,
+    FcLeafSubtractCountSSE2,
+    FcLeafIsSubsetSSE2,
+    FcLeafIntersectSSE2,
+    FcLeafSubtractSSE2,
+    FcLeafUnionSSE2,
+};
+
+#  define FcLeafLoad256(l) _mm256_loadu_si256 ((const __m256i *)(l)->map)
+#  define FcLeafStore256(l, v) _mm256_storeu_si256 ((__m256i *)(l)->map, (v))
+
+/* Nibble lookup, summing the bytes of each 64-bit quarter */
+static FC_LEAF_AVX2 FcChar32
+FcLeafSum256 (__m256i v)
+{
+    const __m256i lut = _mm256_setr_epi8 (0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i m4 = _mm256_set1_epi8 (0x0f);
+    __m256i       c;
+    __m128i       s;
+
+    c = _mm256_add_epi8 (_mm256_shuffle_epi8 (lut, _mm256_and_si256 (v, m4)),
+                         _mm256_shuffle_epi8 (lut, _mm256_and_si256 (_mm256_srli_epi16 (v, 4), m4)));
+    c = _mm256_sad_epu8 (c, _mm256_setzero_si256());
+    s = _mm_add_epi64 (_mm256_castsi256_si128 (c), _mm256_extracti128_si256 (c, 1));
+    return _mm_cvtsi128_si32 (s) + _mm_cvtsi128_si32 (_mm_srli_si128 (s, 8));
+}
+
+static FC_LEAF_AVX2 FcChar32
+FcLeafCountAVX2 (const FcCharLeaf *a)
+{
+    return FcLeafSum256 (FcLeafLoad256 (a));
+}
+
+static FC_LEAF_AVX2 FcChar32
+FcLeafIntersectCountAVX2 (const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    return FcLeafSum256 (_mm256_and_si256 (FcLeafLoad256 (a), FcLeafLoad256 (b)));
+}
+
+static FC_LEAF_AVX2 FcChar32
+FcLeafSubtractCountAVX2 (const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    return FcLeafSum256 (_mm256_andnot_si256 (FcLeafLoad256 (b), FcLeafLoad256 (a)));
+}
+
+static FC_LEAF_AVX2 FcBool
+FcLeafIsSubsetAVX2 (const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    /* Carry set when a & ~b is all zeros */
+    return _mm256_testc_si256 (FcLeafLoad256 (b), FcLeafLoad256 (a));
+}
+
+static FC_LEAF_AVX2 FcBool
+FcLeafIntersectAVX2 (FcCharLeaf *result, const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    __m256i r = _mm256_and_si256 (FcLeafLoad256 (a), FcLeafLoad256 (b));
+
+    FcLeafStore256 (result, r);
+    return !_mm256_testz_si256 (r, r);
+}
+
+static FC_LEAF_AVX2 FcBool
+FcLeafSubtractAVX2 (FcCharLeaf *result, const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    __m256i r = _mm256_andnot_si256 (FcLeafLoad256 (b), FcLeafLoad256 (a));
+
+    FcLeafStore256 (result, r);
+    return !_mm256_testz_si256 (r, r);
+}
+
+static FC_LEAF_AVX2 void
+FcLeafUnionAVX2 (FcCharLeaf *result, const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    FcLeafStore256 (result, _mm256_or_si256 (FcLeafLoad256 (a), FcLeafLoad256 (b)));
+}
+
+static const FcCharLeafKernels FcLeafAVX2 = {
+    "avx2",
+    FcLeafCountAVX2,
+    FcLeafIntersectCountAVX2,
+    FcLeafSubtractCountAVX2,
+    FcLeafIsSubsetAVX2,
+    FcLeafIntersectAVX2,
+    FcLeafSubtractAVX2,
+    FcLeafUnionAVX2,
+};
+#endif /* FC_LEAF_X86 */
+
+#ifdef FC_LEAF_NEON
+#  define FcLeafLoad8x16(l, i) vld1q_u8 ((const uint8_t *)(l)->map + 16 * (i))
+#  define FcLeafStore8x16(l, i, v) vst1q_u8 ((uint8_t *)(l)->map + 16 * (i), (v))
+
+/* Each half counts at most 128 bits, which still fits the byte sums */
+static FcChar32
+FcLeafSumNEON (uint8x16_t lo, uint8x16_t hi)
+{
+    return vaddvq_u8 (vcntq_u8 (lo)) + vaddvq_u8 (vcntq_u8 (hi));
+}
+
+static FcChar32
+FcLeafCountNEON (const FcCharLeaf *a)
+{
+    return FcLeafSumNEON (FcLeafLoad8x16 (a, 0), FcLeafLoad8x16 (a, 1));
+}
+
+static FcChar32
+FcLeafIntersectCountNEON (const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    return FcLeafSumNEON (vandq_u8 (FcLeafLoad8x16 (a, 0), FcLeafLoad8x16 (b, 0)),
+                          vandq_u8 (FcLeafLoad8x16 (a, 1), FcLeafLoad8x16 (b, 1)));
+}
+
+static FcChar32
+FcLeafSubtractCountNEON (const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    return FcLeafSumNEON (vbicq_u8 (FcLeafLoad8x16 (a, 0), FcLeafLoad8x16 (b, 0)),
+                          vbicq_u8 (FcLeafLoad8x16 (a, 1), FcLeafLoad8x16 (b, 1)));
+}
+
+static FcBool
+FcLeafIsSubsetNEON (const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    uint8x16_t r = vorrq_u8 (vbicq_u8 (FcLeafLoad8x16 (a, 0), FcLeafLoad8x16 (b, 0)),
+                             vbicq_u8 (FcLeafLoad8x16 (a, 1), FcLeafLoad8x16 (b, 1)));
+
+    return vmaxvq_u8 (r) == 0;
+}
+
+static FcBool
+FcLeafIntersectNEON (FcCharLeaf *result, const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    uint8x16_t lo = vandq_u8 (FcLeafLoad8x16 (a, 0), FcLeafLoad8x16 (b, 0));
+    uint8x16_t hi = vandq_u8 (FcLeafLoad8x16 (a, 1), FcLeafLoad8x16 (b, 1));
+
+    FcLeafStore8x16 (result, 0, lo);
+    FcLeafStore8x16 (result, 1, hi);
+    return vmaxvq_u8 (vorrq_u8 (lo, hi)) != 0;
+}
+
+static FcBool
+FcLeafSubtractNEON (FcCharLeaf *result, const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    uint8x16_t lo = vbicq_u8 (FcLeafLoad8x16 (a, 0), FcLeafLoad8x16 (b, 0));
+    uint8x16_t hi = vbicq_u8 (FcLeafLoad8x16 (a, 1), FcLeafLoad8x16 (b, 1));
+
+    FcLeafStore8x16 (result, 0, lo);
+    FcLeafStore8x16 (result, 1, hi);
+    return vmaxvq_u8 (vorrq_u8 (lo, hi)) != 0;
+}
+
+static void
+FcLeafUnionNEON (FcCharLeaf *result, const FcCharLeaf *a, const FcCharLeaf *b)
+{
+    FcLeafStore8x16 (result, 0, vorrq_u8 (FcLeafLoad8x16 (a, 0), FcLeafLoad8x16 (b, 0)));
+    FcLeafStore8x16 (result, 1, vorrq_u8 (FcLeafLoad8x16 (a, 1), FcLeafLoad8x16 (b, 1)));
+}
+
+static const FcCharLeafKernels FcLeafNEON = {
+    "neon",
+    FcLeafCountNEON,
+    FcLeafIntersectCountNEON,
+    FcLeafSubtractCountNEON,
+    FcLeafIsSubsetNEON,
+    FcLeafIntersectNEON,
+    FcLeafSubtractNEON,
+    FcLeafUnionNEON,
+};
+#endif /* FC_LEAF_NEON */
+
+static const FcCharLeafKernels *
+FcCharLeafSelectKernels (void)
+{
+    const FcCharLeafKernels *supported[4];
+    const char              *env = getenv ("FC_CHARSET_KERNEL");
+    int                      n = 0, i;
+
+    /* Best first */
+#ifdef FC_LEAF_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports ("avx2"))
+	supported[n++] = &FcLeafAVX2;
+    if (__builtin_cpu_supports ("sse2"))
+	supported[n++] = &FcLeafSSE2;
+#endif
+#ifdef FC_LEAF_NEON
+    supported[n++] = &FcLeafNEON;
+#endif
+    supported[n++] = &FcLeafScalar;
+
+    if (env) {
+	for (i = 0; i < n; i++) {
+	    if (!strcmp (env, supported[i]->name))
+		return supported[i];
+	}
+    }
+    return supported[0];
+}
+
+const FcCharLeafKernels *
+FcCharLeafGetKernels (void)
+{
+    static void             *static_kernels;
+    const FcCharLeafKernels *kernels;
+
+    kernels = fc_atomic_ptr_get (&static_kernels);
+    if (!kernels) {
+	kernels = FcCharLeafSelectKernels();
+	(void)fc_atomic_ptr_cmpexch (&static_kernels, NULL, (void *)kernels);
+    }
+    return kernels;
+}
@@ -442,24 +442,10 @@ bail0:
     return 0;
 }
 
-static FcBool
-FcCharSetIntersectLeaf (FcCharLeaf       *result,
-                        const FcCharLeaf *al,
-                        const FcCharLeaf *bl)
-{
-    int    i;
-    FcBool nonempty = FcFalse;
-
-    for (i = 0; i < 256 / 32; i++)
-	if ((result->map[i] = al->map[i] & bl->map[i]))
-	    nonempty = FcTrue;
-    return nonempty;
-}
-
 FcCharSet *
 FcCharSetIntersect (const FcCharSet *a, const FcCharSet *b)
 {
-    return FcCharSetOperate (a, b, FcCharSetIntersectLeaf, FcFalse, FcFalse);
+    return FcCharSetOperate (a, b, FcCharLeafGetKernels()->intersect, FcFalse, FcFalse);
 }
 
 static FcBool
@@ -467,10 +453,7 @@ FcCharSetUnionLeaf (FcCharLeaf       *result,
                     const FcCharLeaf *al,
                     const FcCharLeaf *bl)
 {
-    int i;
-
-    for (i = 0; i < 256 / 32; i++)
-	result->map[i] = al->map[i] | bl->map[i];
+    FcCharLeafGetKernels()->unite (result, al, bl);
     return FcTrue;
 }
 
@@ -483,8 +466,9 @@ FcCharSetUnion (const FcCharSet *a, const FcCharSet *b)
 FcBool
 FcCharSetMerge (FcCharSet *a, const FcCharSet *b, FcBool *changed)
 {
-    int      ai = 0, bi = 0;
-    FcChar16 an, bn;
+    const FcCharLeafKernels *kernels = FcCharLeafGetKernels();
+    int                      ai = 0, bi = 0;
+    FcChar16                 an, bn;
 
     if (!a || !b)
 	return FcFalse;
@@ -516,7 +500,7 @@ FcCharSetMerge (FcCharSet *a, const FcCharSet *b, FcBool *changed)
 		    return FcFalse;
 	    } else {
 		FcCharLeaf *al = FcCharSetLeaf (a, ai);
-		FcCharSetUnionLeaf (al, al, bl);
+		kernels->unite (al, al, bl);
 	    }
 
 	    ai++;
@@ -527,24 +511,10 @@ FcCharSetMerge (FcCharSet *a, const FcCharSet *b, FcBool *changed)
     return FcTrue;
 }
 
-static FcBool
-FcCharSetSubtractLeaf (FcCharLeaf       *result,
-                       const FcCharLeaf *al,
-                       const FcCharLeaf *bl)
-{
-    int    i;
-    FcBool nonempty = FcFalse;
-
-    for (i = 0; i < 256 / 32; i++)
-	if ((result->map[i] = al->map[i] & ~bl->map[i]))
-	    nonempty = FcTrue;
-    return nonempty;
-}
-
 FcCharSet *
 FcCharSetSubtract (const FcCharSet *a, const FcCharSet *b)
 {
-    return FcCharSetOperate (a, b, FcCharSetSubtractLeaf, FcTrue, FcFalse);
+    return FcCharSetOperate (a, b, FcCharLeafGetKernels()->subtract, FcTrue, FcFalse);
 }
 
 FcBool
@@ -560,35 +530,19 @@ FcCharSetHasChar (const FcCharSet *fcs, FcChar32 ucs4)
     return (leaf->map[(ucs4 & 0xff) >> 5] & (1U << (ucs4 & 0x1f))) != 0;
 }
 
-static FcChar32
-FcCharSetPopCount (FcChar32 c1)
-{
-#if __GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4)
-    return __builtin_popcount (c1);
-#else
-    /* hackmem 169 */
-    FcChar32 c2 = (c1 >> 1) & 033333333333;
-    c2 = c1 - c2 - ((c2 >> 1) & 033333333333);
-    return (((c2 + (c2 >> 3)) & 030707070707) % 077);
-#endif
-}
-
 FcChar32
 FcCharSetIntersectCount (const FcCharSet *a, const FcCharSet *b)
 {
-    FcCharSetIter ai, bi;
-    FcChar32      count = 0;
+    const FcCharLeafKernels *kernels = FcCharLeafGetKernels();
+    FcCharSetIter            ai, bi;
+    FcChar32                 count = 0;
 
     if (a && b) {
 	FcCharSetIterStart (a, &ai);
 	FcCharSetIterStart (b, &bi);
 	while (ai.leaf && bi.leaf) {
 	    if (ai.ucs4 == bi.ucs4) {
-		FcChar32 *am = ai.leaf->map;
-		FcChar32 *bm = bi.leaf->map;
-		int       i = 256 / 32;
-		while (i--)
-		    count += FcCharSetPopCount (*am++ & *bm++);
+		count += kernels->intersect_count (ai.leaf, bi.leaf);
 		FcCharSetIterNext (a, &ai);
 	    } else if (ai.ucs4 < bi.ucs4) {
 		ai.ucs4 = bi.ucs4;
@@ -606,17 +560,13 @@ FcCharSetIntersectCount (const FcCharSet *a, const FcCharSet *b)
 FcChar32
 FcCharSetCount (const FcCharSet *a)
 {
-    FcCharSetIter ai;
-    FcChar32      count = 0;
+    const FcCharLeafKernels *kernels = FcCharLeafGetKernels();
+    FcCharSetIter            ai;
+    FcChar32                 count = 0;
 
     if (a) {
-	for (FcCharSetIterStart (a, &ai); ai.leaf; FcCharSetIterNext (a, &ai)) {
-	    int       i = 256 / 32;
-	    FcChar32 *am = ai.leaf->map;
-
-	    while (i--)
-		count += FcCharSetPopCount (*am++);
-	}
+	for (FcCharSetIterStart (a, &ai); ai.leaf; FcCharSetIterNext (a, &ai))
+	    count += kernels->count (ai.leaf);
     }
     return count;
 }
@@ -624,24 +574,19 @@ FcCharSetCount (const FcCharSet *a)
 FcChar32
 FcCharSetSubtractCount (const FcCharSet *a, const FcCharSet *b)
 {
-    FcCharSetIter ai, bi;
-    FcChar32      count = 0;
+    const FcCharLeafKernels *kernels = FcCharLeafGetKernels();
+    FcCharSetIter            ai, bi;
+    FcChar32                 count = 0;
 
     if (a && b) {
 	FcCharSetIterStart (a, &ai);
 	FcCharSetIterStart (b, &bi);
 	while (ai.leaf) {
 	    if (ai.ucs4 <= bi.ucs4) {
-		FcChar32 *am = ai.leaf->map;
-		int       i = 256 / 32;
-		if (ai.ucs4 == bi.ucs4) {
-		    FcChar32 *bm = bi.leaf->map;
-		    while (i--)
-			count += FcCharSetPopCount (*am++ & ~*bm++);
-		} else {
-		    while (i--)
-			count += FcCharSetPopCount (*am++);
-		}
+		if (ai.ucs4 == bi.ucs4)
+		    count += kernels->subtract_count (ai.leaf, bi.leaf);
+		else
+		    count += kernels->count (ai.leaf);
 		FcCharSetIterNext (a, &ai);
 	    } else if (bi.leaf) {
 		bi.ucs4 = ai.ucs4;
@@ -658,13 +603,15 @@ FcCharSetSubtractCount (const FcCharSet *a, const FcCharSet *b)
 FcBool
 FcCharSetIsSubset (const FcCharSet *a, const FcCharSet *b)
 {
-    int      ai, bi;
-    FcChar16 an, bn;
+    const FcCharLeafKernels *kernels;
+    int                      ai, bi;
+    FcChar16                 an, bn;
 
     if (a == b)
 	return FcTrue;
     if (!a || !b)
 	return FcFalse;
+    kernels = FcCharLeafGetKernels();
     bi = 0;
     ai = 0;
     while (ai < a->num && bi < b->num) {
@@ -674,18 +621,14 @@ FcCharSetIsSubset (const FcCharSet *a, const FcCharSet *b)
 	 * Check matching pages
 	 */
 	if (an == bn) {
-	    FcChar32 *am = FcCharSetLeaf (a, ai)->map;
-	    FcChar32 *bm = FcCharSetLeaf (b, bi)->map;
+	    FcCharLeaf *al = FcCharSetLeaf (a, ai);
+	    FcCharLeaf *bl = FcCharSetLeaf (b, bi);
 
-	    if (am != bm) {
-		int i = 256 / 32;
-		/*
-		 * Does am have any bits not in bm?
-		 */
-		while (i--)
-		    if (*am++ & ~*bm++)
-			return FcFalse;
-	    }
+	    /*
+	     * Does al have any bits not in bl?
+	     */
+	    if (al != bl && !kernels->is_subset (al, bl))
+		return FcFalse;
 	    ai++;
 	    bi++;
 	}
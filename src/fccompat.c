@@ -253,10 +253,11 @@ FcMakeDirectory (const FcChar8 *dir)
     parent = FcStrDirname (dir);
     if (!parent)
 	return FcFalse;
+    /* Someone else creating it at the same time is as good */
     if (access ((char *)parent, F_OK) == 0)
-	ret = mkdir ((char *)dir, 0755) == 0 && chmod ((char *)dir, 0755) == 0;
+	ret = (mkdir ((char *)dir, 0755) == 0 || errno == EEXIST) && chmod ((char *)dir, 0755) == 0;
     else if (access ((char *)parent, F_OK) == -1)
-	ret = FcMakeDirectory (parent) && (mkdir ((char *)dir, 0755) == 0) && chmod ((char *)dir, 0755) == 0;
+	ret = FcMakeDirectory (parent) && (mkdir ((char *)dir, 0755) == 0 || errno == EEXIST) && chmod ((char *)dir, 0755) == 0;
     else
 	ret = FcFalse;
     FcStrFree (parent);
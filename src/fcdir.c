@@ -201,12 +201,160 @@ cmpstringp (const void *p1, const void *p2)
     return strcmp (*(char **)p1, *(char **)p2);
 }
 
-FcBool
-FcDirScanConfig (FcFontSet     *set,
-                 FcStrSet      *dirs,
-                 const FcChar8 *dir,
-                 FcBool         force, /* XXX unused */
-                 FcConfig      *config)
+/* A file of a directory whose fonts may be queried on a worker */
+typedef struct _FcDirScanJob {
+    const FcChar8 *file;
+    const FcChar8 *name;
+    struct stat    statb;
+    FcFontSet     *set; /* the fonts queried, or NULL if left to the scan */
+} FcDirScanJob;
+
+/* Moves the fonts queried by 'job' to the end of 'set' */
+static FcBool
+FcDirScanJobAdd (FcFontSet *set, FcDirScanJob *job)
+{
+    FcBool ret = FcTrue;
+    int    i;
+
+    for (i = 0; i < job->set->nfont; i++) {
+	if (ret && FcFontSetAdd (set, job->set->fonts[i]))
+	    continue;
+	FcPatternDestroy (job->set->fonts[i]);
+	ret = FcFalse;
+    }
+    job->set->nfont = 0;
+
+    return ret;
+}
+
+/*
+ * Scan the fonts of one file of a directory, recording the file in
+ * 'files' and taking its fonts from 'previous' when it is unchanged,
+ * or from 'job' when a worker queried them already
+ */
+static FcBool
+FcDirScanFile (FcFontSet     *set,
+               FcStrSet      *dirs,
+               const FcChar8 *file,
+               const FcChar8 *name,
+               FcConfig      *config,
+               FcCache       *previous,
+               FcDirFiles    *files,
+               FcDirScanJob  *job)
+{
+    const FcCacheFile *prev;
+    FcFontSet         *prev_set;
+    struct stat        statb;
+    int                font = set->nfont, i;
+
+    if (job && job->set) {
+	/* Recording the times from before the query */
+	if (!FcDirScanJobAdd (set, job))
+	    return FcFalse;
+	return FcDirFilesAdd (files, name, &job->statb, font, set->nfont - font);
+    }
+    if (FcStat (file, &statb) != 0 || S_ISDIR (statb.st_mode))
+	return FcFileScanConfig (set, dirs, file, config);
+
+    prev = previous ? FcDirCacheFindFile (previous, name) : NULL;
+    if (prev && FcCacheFileUnchanged (prev, &statb)) {
+	if (FcDebug() & FC_DBG_SCAN)
+	    printf ("\tUnchanged file %s\n", file);
+	prev_set = FcCacheSet (previous);
+	for (i = prev->font; i < prev->font + prev->nfont; i++)
+	    if (!FcFontSetAdd (set, FcPatternDuplicate (FcFontSetFont (prev_set, i))))
+		return FcFalse;
+    } else {
+	/* Files giving no fonts are recorded too, not to query them again */
+	FcFileScanConfig (set, dirs, file, config);
+    }
+
+    return FcDirFilesAdd (files, name, &statb, font, set->nfont - font);
+}
+
+typedef struct _FcDirScanWork {
+    FcConfig       *config;
+    FcCache        *previous;
+    FcDirScanJob   *jobs;
+    int             njob;
+    fc_atomic_int_t next;
+} FcDirScanWork;
+
+static void
+FcDirScanWorker (void *closure, int worker FC_UNUSED)
+{
+    FcDirScanWork     *w = closure;
+    const FcCacheFile *prev;
+    int                j;
+
+    while ((j = fc_atomic_int_add (w->next, 1)) < w->njob) {
+	FcDirScanJob *job = &w->jobs[j];
+
+	/* Directories and unchanged files cost nothing to the scan */
+	if (FcStat (job->file, &job->statb) != 0 || S_ISDIR (job->statb.st_mode))
+	    continue;
+	prev = w->previous ? FcDirCacheFindFile (w->previous, job->name) : NULL;
+	if (prev && FcCacheFileUnchanged (prev, &job->statb))
+	    continue;
+	job->set = FcFontSetCreate();
+	if (job->set)
+	    FcFileScanFontConfig (job->set, job->file, w->config);
+    }
+}
+
+/*
+ * Query the fonts of the sorted 'files' on up to 'nthreads' threads,
+ * each file opened by FreeType on its own, for the scan to add them in
+ * order.  Returns NULL when the files are better scanned one by one.
+ */
+static FcDirScanJob *
+FcDirScanJobsRun (FcStrSet *files,
+                  size_t    base,
+                  FcConfig *config,
+                  FcCache  *previous,
+                  int       nthreads)
+{
+    FcDirScanWork w;
+    int           i;
+
+    /* Keeping the messages of each file together */
+    if (nthreads <= 1 || files->num <= 1 ||
+        (FcDebug() & (FC_DBG_SCAN | FC_DBG_SCANV)) ||
+        !(w.jobs = calloc (files->num, sizeof (FcDirScanJob))))
+	return NULL;
+    w.config = config;
+    w.previous = previous;
+    w.njob = files->num;
+    w.next = 0;
+    for (i = 0; i < w.njob; i++) {
+	w.jobs[i].file = files->strs[i];
+	w.jobs[i].name = files->strs[i] + base;
+    }
+    FcWorkersRun (FC_MIN (nthreads, w.njob), FcDirScanWorker, &w);
+
+    return w.jobs;
+}
+
+static void
+FcDirScanJobsDestroy (FcDirScanJob *jobs, int njob)
+{
+    int i;
+
+    for (i = 0; i < njob; i++)
+	if (jobs[i].set)
+	    FcFontSetDestroy (jobs[i].set);
+    free (jobs);
+}
+
+static FcBool
+FcDirScanConfigFiles (FcFontSet     *set,
+                      FcStrSet      *dirs,
+                      const FcChar8 *dir,
+                      FcBool         force,
+                      FcConfig      *config,
+                      FcCache       *previous,
+                      FcDirFiles    *dir_files,
+                      int            nthreads)
 {
     DIR           *d;
     struct dirent *e;
@@ -215,6 +363,7 @@ FcDirScanConfig (FcFontSet     *set,
     FcChar8       *base;
     const FcChar8 *sysroot = FcConfigGetSysRoot (config);
     FcBool         ret = FcTrue;
+    FcDirScanJob  *jobs = NULL, *job;
     int            i;
 
     if (!force)
@@ -282,8 +431,20 @@ FcDirScanConfig (FcFontSet     *set,
     /*
      * Scan file files to build font patterns
      */
-    for (i = 0; i < files->num; i++)
-	FcFileScanConfig (set, dirs, files->strs[i], config);
+    if (set)
+	jobs = FcDirScanJobsRun (files, base - file_prefix, config, previous, nthreads);
+    for (i = 0; i < files->num; i++) {
+	job = jobs ? &jobs[i] : NULL;
+	if (set && dir_files)
+	    FcDirScanFile (set, dirs, files->strs[i], files->strs[i] + (base - file_prefix),
+	                   config, previous, dir_files, job);
+	else if (job && job->set)
+	    FcDirScanJobAdd (set, job);
+	else
+	    FcFileScanConfig (set, dirs, files->strs[i], config);
+    }
+    if (jobs)
+	FcDirScanJobsDestroy (jobs, files->num);
 
 bail2:
     FcStrSetDestroy (files);
@@ -298,6 +459,16 @@ bail:
     return ret;
 }
 
+FcBool
+FcDirScanConfig (FcFontSet     *set,
+                 FcStrSet      *dirs,
+                 const FcChar8 *dir,
+                 FcBool         force, /* XXX unused */
+                 FcConfig      *config)
+{
+    return FcDirScanConfigFiles (set, dirs, dir, force, config, NULL, NULL, 1);
+}
+
 FcBool
 FcDirScan (FcFontSet     *set,
            FcStrSet      *dirs,
@@ -322,13 +493,16 @@ FcDirScan (FcFontSet     *set,
 }
 
 /*
- * Scan the specified directory and construct a cache of its contents
+ * Scan the specified directory and construct a cache of its contents,
+ * querying only the files changed since 'previous' if given, on up to
+ * 'nthreads' threads
  */
 FcCache *
-FcDirCacheScan (const FcChar8 *dir, FcConfig *config)
+FcDirCacheScan (const FcChar8 *dir, FcConfig *config, FcCache *previous, int nthreads)
 {
     FcStrSet      *dirs;
     FcFontSet     *set;
+    FcDirFiles    *files;
     FcCache       *cache = NULL;
     struct stat    dir_stat;
     const FcChar8 *sysroot = FcConfigGetSysRoot (config);
@@ -360,6 +534,8 @@ FcDirCacheScan (const FcChar8 *dir, FcConfig *config)
     dirs = FcStrSetCreateEx (FCSS_GROW_BY_64);
     if (!dirs)
 	goto bail1;
+    /* Not recording the files only costs the next scan */
+    files = FcDirFilesCreate();
 
 #ifndef _WIN32
     fd = FcDirCacheLock (dir, config);
@@ -368,13 +544,13 @@ FcDirCacheScan (const FcChar8 *dir, FcConfig *config)
      * Scan the dir
      */
     /* Do not pass sysroot here. FcDirScanConfig() do take care of it */
-    if (!FcDirScanConfig (set, dirs, dir, FcTrue, config))
+    if (!FcDirScanConfigFiles (set, dirs, dir, FcTrue, config, previous, files, nthreads))
 	goto bail2;
 
     /*
      * Build the cache object
      */
-    cache = FcDirCacheBuild (set, dir, &dir_stat, dirs);
+    cache = FcDirCacheBuild (set, dir, &dir_stat, dirs, files);
     if (!cache)
 	goto bail2;
 
@@ -387,6 +563,7 @@ bail2:
 #ifndef _WIN32
     FcDirCacheUnlock (fd);
 #endif
+    FcDirFilesDestroy (files);
     FcStrSetDestroy (dirs);
 bail1:
     FcFontSetDestroy (set);
@@ -461,29 +638,164 @@ bail:
     return newp;
 }
 
-/*
- * Read (or construct) the cache for a directory
- */
-FcCache *
-FcDirCacheRead (const FcChar8 *dir, FcBool force, FcConfig *config)
+static FcCache *
+FcDirCacheReadThreads (const FcChar8 *dir, FcBool force, FcConfig *config, int nthreads)
 {
-    FcCache *cache = NULL;
+    FcCache *cache = NULL, *previous = NULL;
 
     config = FcConfigReference (config);
     /* Try to use existing cache file */
-    if (!force)
+    if (!force) {
 	cache = FcDirCacheLoad (dir, config, NULL);
+	/* Or at least the fonts of the files which did not change */
+	if (!cache && config)
+	    previous = FcDirCacheLoadPrevious (dir, config);
+    }
 
     /* Not using existing cache file, construct new cache */
     if (!cache) {
 	FcDirCacheDeleteUUID (dir, config);
-	cache = FcDirCacheScan (dir, config);
+	cache = FcDirCacheScan (dir, config, previous, nthreads);
     }
+    if (previous)
+	FcDirCacheUnload (previous);
     FcConfigDestroy (config);
 
     return cache;
 }
 
+/*
+ * Read (or construct) the cache for a directory
+ */
+FcCache *
+FcDirCacheRead (const FcChar8 *dir, FcBool force, FcConfig *config)
+{
+    FcCache *cache;
+
+    config = FcConfigReference (config);
+    cache = FcDirCacheReadThreads (dir, force, config, config ? config->nthreads : 1);
+    FcConfigDestroy (config);
+
+    return cache;
+}
+
+typedef struct _FcDirCacheReadWork {
+    FcConfig *config;
+    FcBool    force;
+    FcMutex   lock;
+    FcStrSet *dirs;    /* every directory queued, in order */
+    int       next;    /* first one no worker took yet */
+    int       busy;    /* workers which may queue more */
+    FcStrSet *rebuilt; /* directories which had to be scanned */
+    FcBool    failed;
+} FcDirCacheReadWork;
+
+static void
+FcDirCacheReadWorker (void *closure, int worker FC_UNUSED)
+{
+    FcDirCacheReadWork *w = closure;
+    const FcChar8      *sysroot = FcConfigGetSysRoot (w->config);
+    const FcChar8      *dir;
+    FcChar8            *d;
+    FcCache            *cache;
+    FcBool              rebuilt;
+    int                 i, nthreads;
+
+    FcMutexLock (&w->lock);
+    for (;;) {
+	/* Others may still find subdirectories */
+	while (w->next == w->dirs->num && w->busy) {
+	    FcMutexUnlock (&w->lock);
+	    FcWorkersPause();
+	    FcMutexLock (&w->lock);
+	}
+	if (w->next == w->dirs->num)
+	    break;
+	dir = w->dirs->strs[w->next++];
+	/* The files of a directory scanned alone get all the threads */
+	nthreads = w->busy == 0 && w->next == w->dirs->num ? w->config->nthreads : 1;
+	w->busy++;
+	FcMutexUnlock (&w->lock);
+
+	cache = NULL;
+	rebuilt = FcFalse;
+	if (sysroot)
+	    d = FcStrBuildFilename (sysroot, dir, NULL);
+	else
+	    d = FcStrCopy (dir);
+	if (d && FcFileIsDir (d) && FcConfigAcceptFilename (w->config, dir)) {
+	    if (!w->force)
+		cache = FcDirCacheLoad (dir, w->config, NULL);
+	    if (!cache) {
+		cache = FcDirCacheReadThreads (dir, w->force, w->config, nthreads);
+		rebuilt = FcTrue;
+	    }
+	}
+	if (d)
+	    FcStrFree (d);
+
+	FcMutexLock (&w->lock);
+	w->busy--;
+	if (!cache)
+	    continue;
+	if (rebuilt && !FcStrSetAdd (w->rebuilt, dir))
+	    w->failed = FcTrue;
+	/* A directory queued twice would be locked by two workers */
+	for (i = 0; i < FcCacheNumSubdir (cache); i++)
+	    if (!FcStrSetAdd (w->dirs, FcCacheSubdir (cache, i)))
+		w->failed = FcTrue;
+	FcDirCacheUnload (cache);
+    }
+    FcMutexUnlock (&w->lock);
+}
+
+/*
+ * Read (or construct) the caches of the directories in 'dirs' and of all
+ * the subdirectories they list, several at once on the threads allowed
+ * to 'config'.  Each directory is taken off a single queue by one worker
+ * only: the locks of FcDirCacheLock are held by the process, and would
+ * not keep two of its threads from scanning the same directory.
+ */
+FcStrSet *
+FcDirCacheReadDirs (FcStrSet *dirs, FcBool force, FcConfig *config)
+{
+    FcDirCacheReadWork w;
+    FcStrSet          *ret = NULL;
+    int                i;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return NULL;
+    w.config = config;
+    w.force = force;
+    FcMutexInit (&w.lock);
+    w.next = 0;
+    w.busy = 0;
+    w.failed = FcFalse;
+    w.dirs = FcStrSetCreateEx (FCSS_GROW_BY_64);
+    w.rebuilt = FcStrSetCreateEx (FCSS_GROW_BY_64);
+    if (!w.dirs || !w.rebuilt)
+	goto bail;
+    for (i = 0; i < dirs->num; i++)
+	if (!FcStrSetAdd (w.dirs, dirs->strs[i]))
+	    goto bail;
+
+    FcWorkersRun (config->nthreads, FcDirCacheReadWorker, &w);
+    if (w.failed)
+	goto bail;
+    ret = w.rebuilt;
+    w.rebuilt = NULL;
+bail:
+    if (w.rebuilt)
+	FcStrSetDestroy (w.rebuilt);
+    if (w.dirs)
+	FcStrSetDestroy (w.dirs);
+    FcMutexFinish (&w.lock);
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
 FcBool
 FcDirSave (FcFontSet *set FC_UNUSED, FcStrSet *dirs FC_UNUSED, const FcChar8 *dir FC_UNUSED)
 {
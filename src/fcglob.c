@@ -0,0 +1,382 @@
+/* Copyright (C) 2026 fontconfig Authors */
+/* SPDX-License-Identifier: HPND */
+
+#include "fcint.h"
+
+/*
+ * The <acceptfont> and <rejectfont> globs of a configuration compiled
+ * into one automaton, so that each file name is classified in a single
+ * pass over it rather than by FcStrGlobMatch with every glob in turn.
+ *
+ * Each glob is a row of NFA states: state j means its first j '?' or
+ * literal characters have been matched, and loops on any byte when a
+ * '*' comes before the next one.  The DFA states are sets of those,
+ * built ahead of time over classes of bytes no glob tells apart.  Sets
+ * after which nothing read can change the outcome are not expanded.
+ */
+
+/* Past this, the globs are matched one by one */
+#define FC_GLOB_MAX_STATES 4096
+
+#define FC_GLOB_ACCEPTED 1 /* an accept glob matches what was read */
+#define FC_GLOB_REJECTED 2 /* a reject glob does */
+#define FC_GLOB_DECIDED  4 /* nothing read next changes the outcome */
+
+/* Sets of NFA states, nword words each, before the masks of each class */
+enum {
+    FC_GLOB_LOOP,       /* kept by any byte */
+    FC_GLOB_ANY,        /* left by any byte, for '?' */
+    FC_GLOB_IN_ACCEPT,  /* in an accept glob */
+    FC_GLOB_END_ACCEPT, /* the ends of accept globs */
+    FC_GLOB_END_REJECT, /* the ends of reject globs */
+    FC_GLOB_NMASK
+};
+
+typedef struct _FcGlobNfa {
+    int       nstate;
+    int       nword;
+    uint64_t *masks; /* FC_GLOB_NMASK, then one per class */
+} FcGlobNfa;
+
+struct _FcGlobCode {
+    int      nstate; /* 0 when there were too many */
+    int      nclass;
+    FcChar8  klass[256];
+    int     *next;  /* nstate rows of nclass states */
+    FcChar8 *flags; /* of each state */
+};
+
+typedef struct _FcGlobDfa {
+    int       nstate;
+    int       size;
+    uint64_t *sets;
+    FcChar8  *flags;
+    int      *hash;
+    int       nhash;
+    int       decided[FC_GLOB_DECIDED * 2]; /* the one state for those flags */
+} FcGlobDfa;
+
+#define FC_GLOB_MASK(nfa, m) (&(nfa)->masks[(m) * (nfa)->nword])
+#define FC_GLOB_SET(set, s)  ((set)[(s) / 64] |= (uint64_t)1 << ((s) % 64))
+#define FC_GLOB_HAS(set, s)  (((set)[(s) / 64] >> ((s) % 64)) & 1)
+
+/*
+ * FcStrGlobMatch only lets a run of '*' at the end of a glob match
+ * something when there are several of them, as though it were "?*"
+ */
+static FcBool
+FcGlobTrailingStars (const FcChar8 *s)
+{
+    size_t n = strspn ((const char *)s, "*");
+
+    return n > 1 && !s[n];
+}
+
+/* The most states the globs may need */
+static int
+FcGlobNfaCount (const FcStrSet *globs)
+{
+    const FcChar8 *s;
+    int            i, n = 0;
+
+    for (i = 0; i < globs->num; i++) {
+	for (s = globs->strs[i]; *s; s++)
+	    if (*s != '*' || FcGlobTrailingStars (s))
+		n++;
+	n++;
+    }
+    return n;
+}
+
+static void
+FcGlobNfaAdd (FcGlobNfa      *nfa,
+              FcGlobCode     *code,
+              const FcStrSet *globs,
+              FcBool          accept)
+{
+    const FcChar8 *s;
+    int            i, n;
+
+    for (i = 0; i < globs->num; i++) {
+	n = nfa->nstate++;
+	for (s = globs->strs[i]; *s; s++) {
+	    if (accept)
+		FC_GLOB_SET (FC_GLOB_MASK (nfa, FC_GLOB_IN_ACCEPT), n);
+	    if (*s == '*' && FcGlobTrailingStars (s)) {
+		FC_GLOB_SET (FC_GLOB_MASK (nfa, FC_GLOB_ANY), n);
+		n = nfa->nstate++;
+		FC_GLOB_SET (FC_GLOB_MASK (nfa, FC_GLOB_LOOP), n);
+		break;
+	    }
+	    if (*s == '*') {
+		FC_GLOB_SET (FC_GLOB_MASK (nfa, FC_GLOB_LOOP), n);
+		continue;
+	    }
+	    if (*s == '?')
+		FC_GLOB_SET (FC_GLOB_MASK (nfa, FC_GLOB_ANY), n);
+	    else
+		FC_GLOB_SET (FC_GLOB_MASK (nfa, FC_GLOB_NMASK + code->klass[*s]), n);
+	    n = nfa->nstate++;
+	}
+	if (accept)
+	    FC_GLOB_SET (FC_GLOB_MASK (nfa, FC_GLOB_IN_ACCEPT), n);
+	FC_GLOB_SET (FC_GLOB_MASK (nfa, accept ? FC_GLOB_END_ACCEPT : FC_GLOB_END_REJECT), n);
+    }
+}
+
+static FcChar8
+FcGlobSetFlags (const FcGlobNfa *nfa, const uint64_t *set)
+{
+    const uint64_t *loop = FC_GLOB_MASK (nfa, FC_GLOB_LOOP);
+    const uint64_t *in_accept = FC_GLOB_MASK (nfa, FC_GLOB_IN_ACCEPT);
+    const uint64_t *end_accept = FC_GLOB_MASK (nfa, FC_GLOB_END_ACCEPT);
+    const uint64_t *end_reject = FC_GLOB_MASK (nfa, FC_GLOB_END_REJECT);
+    uint64_t        any = 0, accepting = 0, sticky_reject = 0;
+    FcChar8         flags = 0;
+    int             w;
+
+    for (w = 0; w < nfa->nword; w++) {
+	any |= set[w];
+	accepting |= set[w] & in_accept[w];
+	if (set[w] & end_accept[w])
+	    flags |= FC_GLOB_ACCEPTED;
+	if (set[w] & end_reject[w])
+	    flags |= FC_GLOB_REJECTED;
+	/* A glob ending with '*' goes on matching whatever follows */
+	if (set[w] & end_accept[w] & loop[w])
+	    flags |= FC_GLOB_DECIDED;
+	sticky_reject |= set[w] & end_reject[w] & loop[w];
+    }
+    if (!accepting && (sticky_reject || !any))
+	flags |= FC_GLOB_DECIDED;
+
+    return flags;
+}
+
+static uint32_t
+FcGlobSetHash (const uint64_t *set, int nword)
+{
+    uint64_t h = 0;
+    int      i;
+
+    for (i = 0; i < nword; i++)
+	h = (h ^ set[i]) * 0x100000001b3ULL;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+/*
+ * Returns the DFA state for 'set', adding it if it is new, or -1
+ */
+static int
+FcGlobDfaState (FcGlobDfa *dfa, const FcGlobNfa *nfa, const uint64_t *set)
+{
+    FcChar8 flags = FcGlobSetFlags (nfa, set);
+    int     nword = nfa->nword, i = 0, n;
+
+    /* Decided sets only differ in their outcome */
+    if (flags & FC_GLOB_DECIDED) {
+	if (dfa->decided[flags] >= 0)
+	    return dfa->decided[flags];
+    } else {
+	i = FcGlobSetHash (set, nword) & (dfa->nhash - 1);
+	for (; dfa->hash[i] >= 0; i = (i + 1) & (dfa->nhash - 1)) {
+	    n = dfa->hash[i];
+	    if (!memcmp (&dfa->sets[n * nword], set, nword * sizeof (uint64_t)))
+		return n;
+	}
+    }
+    if (dfa->nstate == FC_GLOB_MAX_STATES)
+	return -1;
+    if (dfa->nstate == dfa->size) {
+	int       size = dfa->size ? dfa->size * 2 : 64;
+	uint64_t *sets = realloc (dfa->sets, (size_t)size * nword * sizeof (uint64_t));
+	FcChar8  *f;
+
+	if (!sets)
+	    return -1;
+	dfa->sets = sets;
+	f = realloc (dfa->flags, size);
+	if (!f)
+	    return -1;
+	dfa->flags = f;
+	dfa->size = size;
+    }
+    n = dfa->nstate++;
+    memcpy (&dfa->sets[n * nword], set, nword * sizeof (uint64_t));
+    dfa->flags[n] = flags;
+    if (flags & FC_GLOB_DECIDED)
+	dfa->decided[flags] = n;
+    else
+	dfa->hash[i] = n;
+    return n;
+}
+
+/* Adds to 'to' the states after those of 'from' in 'mask' */
+static void
+FcGlobSetStep (uint64_t *to, const uint64_t *from, const uint64_t *mask, int nword)
+{
+    uint64_t carry = 0, m;
+    int      w;
+
+    for (w = 0; w < nword; w++) {
+	m = from[w] & mask[w];
+	to[w] |= (m << 1) | carry;
+	carry = m >> 63;
+    }
+}
+
+static FcBool
+FcGlobCodeBuild (FcGlobCode *code, const FcGlobNfa *nfa)
+{
+    const uint64_t *loop = FC_GLOB_MASK (nfa, FC_GLOB_LOOP);
+    const uint64_t *end_accept = FC_GLOB_MASK (nfa, FC_GLOB_END_ACCEPT);
+    const uint64_t *end_reject = FC_GLOB_MASK (nfa, FC_GLOB_END_REJECT);
+    FcGlobDfa       dfa;
+    uint64_t       *base, *set;
+    int            *next;
+    int             nword = nfa->nword, nrow = 0, i, c, w, n;
+    FcBool          ret = FcFalse;
+
+    memset (&dfa, 0, sizeof (dfa));
+    for (i = 0; i < FC_GLOB_DECIDED * 2; i++)
+	dfa.decided[i] = -1;
+    dfa.nhash = 2 * FC_GLOB_MAX_STATES;
+    dfa.hash = malloc (dfa.nhash * sizeof (int));
+    base = calloc (2 * nword, sizeof (uint64_t));
+    if (!dfa.hash || !base)
+	goto bail;
+    for (i = 0; i < dfa.nhash; i++)
+	dfa.hash[i] = -1;
+
+    /* Start in the first state of every glob */
+    set = base + nword;
+    for (i = 0; i < nfa->nstate; i++)
+	if (i == 0 || FC_GLOB_HAS (end_accept, i - 1) || FC_GLOB_HAS (end_reject, i - 1))
+	    FC_GLOB_SET (set, i);
+    if (FcGlobDfaState (&dfa, nfa, set) < 0)
+	goto bail;
+
+    for (i = 0; i < dfa.nstate; i++) {
+	if (i == nrow) {
+	    nrow = dfa.size;
+	    next = realloc (code->next, (size_t)nrow * code->nclass * sizeof (int));
+	    if (!next)
+		goto bail;
+	    code->next = next;
+	}
+	/* Nothing is read past a decided state */
+	if (dfa.flags[i] & FC_GLOB_DECIDED) {
+	    for (c = 0; c < code->nclass; c++)
+		code->next[i * code->nclass + c] = i;
+	    continue;
+	}
+	/* Where any byte leads, then what each class adds */
+	for (w = 0; w < nword; w++)
+	    base[w] = dfa.sets[i * nword + w] & loop[w];
+	FcGlobSetStep (base, &dfa.sets[i * nword], FC_GLOB_MASK (nfa, FC_GLOB_ANY), nword);
+	for (c = 0; c < code->nclass; c++) {
+	    memcpy (set, base, nword * sizeof (uint64_t));
+	    /* dfa.sets moves as states are added */
+	    FcGlobSetStep (set, &dfa.sets[i * nword], FC_GLOB_MASK (nfa, FC_GLOB_NMASK + c), nword);
+	    n = FcGlobDfaState (&dfa, nfa, set);
+	    if (n < 0)
+		goto bail;
+	    code->next[i * code->nclass + c] = n;
+	}
+    }
+
+    code->flags = dfa.flags;
+    dfa.flags = NULL;
+    code->nstate = dfa.nstate;
+    ret = FcTrue;
+bail:
+    if (!ret) {
+	free (code->next);
+	code->next = NULL;
+    }
+    free (base);
+    free (dfa.sets);
+    free (dfa.flags);
+    free (dfa.hash);
+
+    return ret;
+}
+
+FcGlobCode *
+FcGlobCodeCreate (const FcStrSet *accept, const FcStrSet *reject)
+{
+    const FcStrSet *globs[2] = { accept, reject };
+    const FcChar8  *s;
+    FcGlobCode     *code;
+    FcGlobNfa       nfa;
+    int             i, j;
+
+    code = calloc (1, sizeof (FcGlobCode));
+    if (!code)
+	return NULL;
+
+    /* Bytes in no glob share class 0, each other byte has its own */
+    code->nclass = 1;
+    for (j = 0; j < 2; j++) {
+	for (i = 0; i < globs[j]->num; i++)
+	    for (s = globs[j]->strs[i]; *s; s++)
+		if (*s != '*' && *s != '?' && !code->klass[*s])
+		    code->klass[*s] = code->nclass++;
+    }
+
+    nfa.nstate = 0;
+    nfa.nword = (FcGlobNfaCount (accept) + FcGlobNfaCount (reject)) / 64 + 1;
+    nfa.masks = calloc ((size_t)(FC_GLOB_NMASK + code->nclass) * nfa.nword, sizeof (uint64_t));
+    if (!nfa.masks) {
+	free (code);
+	return NULL;
+    }
+    FcGlobNfaAdd (&nfa, code, accept, FcTrue);
+    FcGlobNfaAdd (&nfa, code, reject, FcFalse);
+
+    /* Falls back to matching one glob at a time when it didn't fit */
+    (void)FcGlobCodeBuild (code, &nfa);
+    if (FcDebug() & FC_DBG_CONFIG)
+	printf ("Compiled %d globs into %d states\n",
+	        accept->num + reject->num, code->nstate);
+    free (nfa.masks);
+
+    return code;
+}
+
+void
+FcGlobCodeDestroy (FcGlobCode *code)
+{
+    if (!code)
+	return;
+    free (code->next);
+    free (code->flags);
+    free (code);
+}
+
+/*
+ * Sets 'accept' to what the globs decide for 'filename', as
+ * FcConfigAcceptFilename does; FcFalse if they could not be compiled
+ */
+FcBool
+FcGlobCodeAccept (const FcGlobCode *code,
+                  const FcChar8    *filename,
+                  FcBool           *accept)
+{
+    const FcChar8 *s;
+    int            state = 0;
+    FcChar8        flags;
+
+    if (!code->nstate)
+	return FcFalse;
+    for (s = filename; *s && !(code->flags[state] & FC_GLOB_DECIDED); s++)
+	state = code->next[state * code->nclass + code->klass[*s]];
+    flags = code->flags[state];
+    *accept = (flags & FC_GLOB_ACCEPTED) || !(flags & FC_GLOB_REJECTED);
+
+    return FcTrue;
+}
+
+#define __fcglob__
+#include "fcaliastail.h"
+#undef __fcglob__
@@ -96,9 +96,21 @@ FcBool
 FcHashTableFind (FcHashTable *table,
                  const void  *key,
                  void       **value)
+{
+    return FcHashTableFindWithHash (table, key, table->hash_func (key), value);
+}
+
+/*
+ * Like FcHashTableFind, for callers that already know what the
+ * table's hash function returns for 'key'
+ */
+FcBool
+FcHashTableFindWithHash (FcHashTable *table,
+                         const void  *key,
+                         FcChar32     hash,
+                         void       **value)
 {
     FcHashBucket *bucket;
-    FcChar32      hash = table->hash_func (key);
 
     for (bucket = table->buckets[hash % FC_HASH_SIZE]; bucket; bucket = bucket->next) {
 	if (!table->compare_func (bucket->key, key)) {
@@ -108,13 +108,17 @@ FcInitLoadOwnConfig (FcConfig *config)
 
     FcInitDebug();
 
-    if (!FcConfigParseAndLoad (config, 0, FcTrue)) {
-	const FcChar8 *sysroot = FcConfigGetSysRoot (config);
-	FcConfig      *fallback = FcInitFallbackConfigWithFilter (config, sysroot);
+    if (!FcConfigLoadSnapshot (config)) {
+	FcConfigSnapshotBegin (config);
+	if (!FcConfigParseAndLoad (config, 0, FcTrue)) {
+	    const FcChar8 *sysroot = FcConfigGetSysRoot (config);
+	    FcConfig      *fallback = FcInitFallbackConfigWithFilter (config, sysroot);
 
-	return fallback;
+	    return fallback;
+	}
+	(void)FcConfigParseOnly (config, (const FcChar8 *)FC_TEMPLATEDIR, FcFalse);
+	FcConfigSnapshotEnd (config);
     }
-    (void)FcConfigParseOnly (config, (const FcChar8 *)FC_TEMPLATEDIR, FcFalse);
 
     if (config->cacheDirs && config->cacheDirs->num == 0) {
 	FcChar8 *prefix, *p;
@@ -398,6 +398,18 @@ typedef struct _FcCharLeaf {
     FcChar32 map[256 / 32];
 } FcCharLeaf;
 
+/* Kernels for the FcCharLeaf set algebra, see fccharleaf.c */
+typedef struct _FcCharLeafKernels {
+    const char *name;
+    FcChar32 (*count) (const FcCharLeaf *a);
+    FcChar32 (*intersect_count) (const FcCharLeaf *a, const FcCharLeaf *b);
+    FcChar32 (*subtract_count) (const FcCharLeaf *a, const FcCharLeaf *b);
+    FcBool (*is_subset) (const FcCharLeaf *a, const FcCharLeaf *b);
+    FcBool (*intersect) (FcCharLeaf *result, const FcCharLeaf *a, const FcCharLeaf *b);
+    FcBool (*subtract) (FcCharLeaf *result, const FcCharLeaf *a, const FcCharLeaf *b);
+    void (*unite) (FcCharLeaf *result, const FcCharLeaf *a, const FcCharLeaf *b);
+} FcCharLeafKernels;
+
 struct _FcCharSet {
     FcRef    ref; /* reference count */
     int      num; /* size of leaves and numbers arrays */
@@ -453,7 +465,7 @@ struct _FcCache {
     intptr_t     dir;        /* offset to dir name */
     intptr_t     dirs;       /* offset to subdirs */
     int          dirs_count; /* number of subdir strings */
-    int          pad1;
+    int          files;      /* offset to the files of dir, or 0 */
     intptr_t     set;      /* offset to font set */
     int          checksum; /* checksum of directory state */
     int          pad2;
@@ -466,6 +478,35 @@ struct _FcCache {
 #define FcCacheDir(c)       FcOffsetMember (c, dir, FcChar8)
 #define FcCacheDirs(c)      FcOffsetMember (c, dirs, intptr_t)
 #define FcCacheSet(c)       FcOffsetMember (c, set, FcFontSet)
+
+/*
+ * What the cache of a directory records about each of its files, so
+ * that scanning the directory again only queries the files that
+ * changed
+ */
+typedef struct _FcCacheFile {
+    intptr_t name;  /* offset to the file name, relative to the table */
+    int      font;  /* index of the first font of the file */
+    int      nfont; /* number of fonts of the file */
+    int64_t  dev;
+    int64_t  ino;
+    int64_t  size;
+    int64_t  mtime;
+    int64_t  mtime_nano;
+} FcCacheFile;
+
+typedef struct _FcCacheFiles {
+    int         magic; /* FC_CACHE_MAGIC_FILES */
+    int         num;   /* sorted by name */
+    FcCacheFile files[FLEXIBLE_ARRAY_MEMBER];
+} FcCacheFiles;
+
+/* The same while scanning a directory */
+typedef struct _FcDirFiles {
+    FcStrSet    *names;
+    FcCacheFile *files;
+    int          size;
+} FcDirFiles;
 #define FcCacheSubdir(c, i) FcOffsetToPtr (FcCacheDirs (c),    \
                                            FcCacheDirs (c)[i], \
                                            FcChar8)
@@ -545,6 +586,8 @@ typedef struct _FcCaseFold {
 
 #define FC_CACHE_MAGIC_MMAP  0xFC02FC04
 #define FC_CACHE_MAGIC_ALLOC 0xFC02FC05
+#define FC_CACHE_MAGIC_AGGREGATE 0xFC02FC06
+#define FC_CACHE_MAGIC_FILES     0xFC02FC07
 
 struct _FcAtomic {
     FcChar8 *file; /* original file name */
@@ -553,6 +596,20 @@ struct _FcAtomic {
     FcChar8 *tmp;  /* tmpfile name (used for locking) */
 };
 
+typedef struct _FcMatchCache FcMatchCache;
+typedef struct _FcMatchIndex FcMatchIndex;
+typedef struct _FcRuleCode   FcRuleCode;
+typedef struct _FcGlobCode   FcGlobCode;
+typedef struct _FcListFilter FcListFilter;
+typedef struct _FcCacheAggregate FcCacheAggregate;
+typedef struct _FcSnapshotSources FcSnapshotSources;
+
+typedef struct _FcParseJob FcParseJob;
+
+typedef struct _FcWatch FcWatch;
+
+typedef struct _FcChanges FcChanges;
+
 struct _FcConfig {
     /*
      * File names loaded from the configuration -- saved here as the
@@ -586,6 +643,11 @@ struct _FcConfig {
      */
     FcPtrList *subst[FcMatchKindEnd];
     int        maxObjects; /* maximum number of tests in all substs */
+    /*
+     * The same substitutions compiled for FcConfigSubstituteWithPat,
+     * dropped whenever rules are added
+     */
+    FcRuleCode *rule_code[FcMatchKindEnd];
     /*
      * List of patterns used to control font file selection
      */
@@ -593,6 +655,23 @@ struct _FcConfig {
     FcStrSet  *rejectGlobs;
     FcFontSet *acceptPatterns;
     FcFontSet *rejectPatterns;
+    /*
+     * The globs compiled for FcConfigAcceptFilename, dropped
+     * whenever globs are added
+     */
+    FcGlobCode *glob_code;
+    /*
+     * The same for FcConfigAcceptFont, dropped whenever
+     * patterns are added
+     */
+    FcListFilter *accept_filter;
+    FcListFilter *reject_filter;
+    /*
+     * The aggregate cache files found in the cache directories,
+     * mapped on the first cache load and dropped whenever cache
+     * directories are added
+     */
+    FcCacheAggregate **cache_aggregates;
     /*
      * The set of fonts loaded from the listed directories; the
      * order within the set does not determine the font selection,
@@ -600,6 +679,11 @@ struct _FcConfig {
      * match preferrentially
      */
     FcFontSet *fonts[FcSetApplication + 1];
+    /*
+     * Columnar copies of the most commonly matched values of each
+     * font set, kept up to date as fonts are added
+     */
+    FcMatchIndex *match_index[FcSetApplication + 1];
     /*
      * Fontconfig can periodically rescan the system configuration
      * and font directories.  This rescanning occurs when font
@@ -630,6 +714,19 @@ struct _FcConfig {
     FcChar8  *desktop_name;  /* Current desktop name */
 
     int warns; /* Bitfield of warning flags (FC_WARN_*) controlling which warnings to emit */
+
+    FcMatchCache *match_cache; /* Optional cache of FcFontMatch results */
+    FcMatchCache *subst_cache; /* Optional cache of FcConfigSubstitute results */
+
+    int nthreads; /* Threads FcFontSort, parsing and caching may use, 1 for none */
+
+    FcSnapshotSources *snapshot; /* Files the configuration was parsed from, for FcConfigWriteSnapshot */
+
+    FcParseJob *parse_job; /* Set while one file of a config dir is parsed into this on a worker */
+
+    FcWatch *watch; /* Notices changes to the files FcConfigUptoDate checks */
+
+    FcChanges *changes; /* Change listeners and the generation */
 };
 
 typedef struct _FcFileTime {
@@ -720,10 +817,10 @@ typedef enum _FcLocaleMask {
 /* fccache.c */
 
 FcPrivate FcCache *
-FcDirCacheScan (const FcChar8 *dir, FcConfig *config);
+FcDirCacheScan (const FcChar8 *dir, FcConfig *config, FcCache *previous, int nthreads);
 
 FcPrivate FcCache *
-FcDirCacheBuild (FcFontSet *set, const FcChar8 *dir, struct stat *dir_stat, FcStrSet *dirs);
+FcDirCacheBuild (FcFontSet *set, const FcChar8 *dir, struct stat *dir_stat, FcStrSet *dirs, FcDirFiles *files);
 
 FcPrivate FcCache *
 FcDirCacheRebuild (FcCache *cache, struct stat *dir_stat, FcStrSet *dirs);
@@ -731,6 +828,24 @@ FcDirCacheRebuild (FcCache *cache, struct stat *dir_stat, FcStrSet *dirs);
 FcPrivate FcBool
 FcDirCacheWrite (FcCache *cache, FcConfig *config);
 
+FcPrivate FcCache *
+FcDirCacheLoadPrevious (const FcChar8 *dir, FcConfig *config);
+
+FcPrivate const FcCacheFile *
+FcDirCacheFindFile (FcCache *cache, const FcChar8 *name);
+
+FcPrivate FcBool
+FcCacheFileUnchanged (const FcCacheFile *file, const struct stat *statb);
+
+FcPrivate FcDirFiles *
+FcDirFilesCreate (void);
+
+FcPrivate void
+FcDirFilesDestroy (FcDirFiles *files);
+
+FcPrivate FcBool
+FcDirFilesAdd (FcDirFiles *files, const FcChar8 *name, const struct stat *statb, int font, int nfont);
+
 FcPrivate FcBool
 FcDirCacheCreateTagFile (const FcChar8 *cache_dir);
 
@@ -749,6 +864,9 @@ FcCacheFini (void);
 FcPrivate void
 FcDirCacheReference (FcCache *cache, int nref);
 
+FcPrivate void
+FcCacheAggregatesDestroy (FcCacheAggregate **aggregates);
+
 FcPrivate int
 FcDirCacheLock (const FcChar8 *dir,
                 FcConfig      *config);
@@ -779,6 +897,21 @@ FcConfigXdgDataDirs (void);
 FcPrivate FcExpr *
 FcConfigAllocExpr (FcConfig *config);
 
+FcPrivate void
+FcConfigCompileRules (FcConfig *config);
+
+FcPrivate void
+FcConfigClearRuleCode (FcConfig *config);
+
+FcPrivate void
+FcConfigClearGlobCode (FcConfig *config);
+
+FcPrivate void
+FcConfigClearListFilters (FcConfig *config);
+
+FcPrivate void
+FcConfigClearCacheAggregates (FcConfig *config);
+
 FcPrivate FcBool
 FcConfigAddConfigDir (FcConfig      *config,
                       const FcChar8 *d);
@@ -895,6 +1028,10 @@ FcLangSetSerializeAlloc (FcSerialize *serialize, const FcLangSet *l);
 FcPrivate FcLangSet *
 FcLangSetSerialize (FcSerialize *serialize, const FcLangSet *l);
 
+/* fccharleaf.c */
+FcPrivate const FcCharLeafKernels *
+FcCharLeafGetKernels (void);
+
 /* fccharset.c */
 FcPrivate FcCharSet *
 FcCharSetPromote (FcValuePromotionBuffer *vbuf);
@@ -1235,6 +1372,18 @@ FcFontSetDeserialize (const FcFontSet *set);
 FcPrivate uint32_t
 FcGenericAliasGetClassification (const char *family);
 
+/* fcglob.c */
+FcPrivate FcGlobCode *
+FcGlobCodeCreate (const FcStrSet *accept, const FcStrSet *reject);
+
+FcPrivate void
+FcGlobCodeDestroy (FcGlobCode *code);
+
+FcPrivate FcBool
+FcGlobCodeAccept (const FcGlobCode *code,
+                  const FcChar8    *filename,
+                  FcBool           *accept);
+
 /* fcplist.c */
 FcPrivate FcPtrList *
 FcPtrListCreate (FcDestroyFunc func);
@@ -1278,6 +1427,19 @@ FcInitLoadOwnConfig (FcConfig *config);
 FcPrivate FcConfig *
 FcInitLoadOwnConfigAndFonts (FcConfig *config);
 
+/* fcwatch.c */
+FcPrivate void
+FcWatchDestroy (FcWatch *watch);
+
+FcPrivate void
+FcChangesDestroy (FcChanges *changes);
+
+FcPrivate FcBool
+FcConfigWatchUnchanged (FcConfig *config, unsigned int *serial);
+
+FcPrivate void
+FcConfigWatchChecked (FcConfig *config, unsigned int serial);
+
 /* fcxml.c */
 FcPrivate void
 FcConfigPathFini (void);
@@ -1317,6 +1479,11 @@ FcLangSetFromCharSet (const FcCharSet *charset,
 FcPrivate FcLangResult
 FcLangCompare (const FcChar8 *s1, const FcChar8 *s2);
 
+FcPrivate void
+FcLangGetMatchMaps (const FcChar8 *lang,
+                    FcChar32      *equal,
+                    FcChar32      *territory);
+
 FcPrivate FcLangSet *
 FcLangSetPromote (const FcChar8 *lang, FcValuePromotionBuffer *buf);
 
@@ -1344,7 +1511,45 @@ FcPrivate FcBool
 FcListPatternMatchAny (const FcPattern *p,
                        const FcPattern *font);
 
+FcPrivate FcListFilter *
+FcListFilterCreate (const FcFontSet *patterns);
+
+FcPrivate void
+FcListFilterDestroy (FcListFilter *filter);
+
+FcPrivate FcBool
+FcListFilterMatchAny (const FcListFilter *filter,
+                      const FcPattern    *font);
+
 /* fcmatch.c */
+FcPrivate void
+FcMatchCacheDestroy (FcMatchCache *cache);
+
+FcPrivate void
+FcMatchCacheClear (FcMatchCache *cache);
+
+FcPrivate FcPattern *
+FcMatchCacheLookup (FcMatchCache *cache, FcPattern *p, unsigned int *serial);
+
+FcPrivate void
+FcMatchCacheInsert (FcMatchCache *cache, FcPattern *p, FcPattern *best, unsigned int serial);
+
+FcPrivate void
+FcMatchCacheInsertKey (FcMatchCache *cache, FcPattern *key, FcPattern *best, unsigned int serial);
+
+FcPrivate FcBool
+FcMatchCacheSetSize (FcMatchCache **cachep, int size);
+
+FcPrivate void
+FcMatchCacheGetStats (FcMatchCache  *cache,
+                      unsigned long *hits,
+                      unsigned long *misses);
+
+FcPrivate void
+FcMatchIndexDestroy (FcMatchIndex *index);
+
+FcPrivate void
+FcConfigUpdateMatchIndex (FcConfig *config, FcSetName set);
 
 /* fcname.c */
 
@@ -1551,6 +1756,37 @@ FcRangeSerializeAlloc (FcSerialize *serialize, const FcRange *r);
 FcPrivate FcRange *
 FcRangeSerialize (FcSerialize *serialize, const FcRange *r);
 
+/* fcsnapshot.c */
+
+FcPrivate void
+FcConfigSnapshotBegin (FcConfig *config);
+
+FcPrivate void
+FcConfigSnapshotAddSource (FcConfig      *config,
+                           const FcChar8 *name,
+                           const FcChar8 *path);
+
+FcPrivate void
+FcConfigSnapshotUsesCwd (FcConfig *config);
+
+FcPrivate void
+FcConfigSnapshotInvalidate (FcConfig *config);
+
+FcPrivate void
+FcConfigSnapshotFork (FcConfig *config, FcConfig *scratch);
+
+FcPrivate void
+FcConfigSnapshotJoin (FcConfig *config, FcConfig *scratch);
+
+FcPrivate void
+FcConfigSnapshotEnd (FcConfig *config);
+
+FcPrivate FcBool
+FcConfigLoadSnapshot (FcConfig *config);
+
+FcPrivate void
+FcSnapshotSourcesDestroy (FcSnapshotSources *sources);
+
 /* fcstat.c */
 
 FcPrivate int
@@ -1681,6 +1917,20 @@ FcStrSerializeAlloc (FcSerialize *serialize, const FcChar8 *str);
 FcPrivate FcChar8 *
 FcStrSerialize (FcSerialize *serialize, const FcChar8 *str);
 
+/* fcthread.c */
+typedef void (*FcWorkFunc) (void *closure, int worker);
+
+FcPrivate int
+FcWorkersDefault (void);
+
+FcPrivate int
+FcWorkersRun (int        nworker,
+              FcWorkFunc func,
+              void      *closure);
+
+FcPrivate void
+FcWorkersPause (void);
+
 /* fcobjs.c */
 FcPrivate void
 FcObjectInit (void);
@@ -1731,6 +1981,12 @@ FcHashTableFind (FcHashTable *table,
                  const void  *key,
                  void       **value);
 
+FcPrivate FcBool
+FcHashTableFindWithHash (FcHashTable *table,
+                         const void  *key,
+                         FcChar32     hash,
+                         void       **value);
+
 FcPrivate FcBool
 FcHashTableAdd (FcHashTable *table,
                 void        *key,
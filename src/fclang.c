@@ -629,6 +629,51 @@ FcLangSetHasLang (const FcLangSet *ls, const FcChar8 *lang)
     return best;
 }
 
+/*
+ * Compute the bitmaps FcLangSetHasLang would consult for 'lang'.
+ * A langset without extra languages has 'lang' if its map intersects
+ * 'equal', or has it in a different territory if its map intersects
+ * 'territory'.  Both maps hold NUM_LANG_SET_MAP words.
+ */
+void
+FcLangGetMatchMaps (const FcChar8 *lang,
+                    FcChar32      *equal,
+                    FcChar32      *territory)
+{
+    int          id, i, bit;
+    FcLangResult r;
+
+    memset (equal, 0, NUM_LANG_SET_MAP * sizeof (FcChar32));
+    memset (territory, 0, NUM_LANG_SET_MAP * sizeof (FcChar32));
+    id = FcLangSetIndex (lang);
+    if (id < 0)
+	id = -id - 1;
+    else {
+	bit = fcLangCharSetIndices[id];
+	equal[bit >> 5] |= ((FcChar32)1U << (bit & 0x1f));
+    }
+    for (i = id - 1; i >= 0; i--) {
+	r = FcLangCompare (lang, fcLangCharSets[i].lang);
+	if (r == FcLangDifferentLang)
+	    break;
+	bit = fcLangCharSetIndices[i];
+	if (r == FcLangEqual)
+	    equal[bit >> 5] |= ((FcChar32)1U << (bit & 0x1f));
+	else
+	    territory[bit >> 5] |= ((FcChar32)1U << (bit & 0x1f));
+    }
+    for (i = id; i < NUM_LANG_CHAR_SET; i++) {
+	r = FcLangCompare (lang, fcLangCharSets[i].lang);
+	if (r == FcLangDifferentLang)
+	    break;
+	bit = fcLangCharSetIndices[i];
+	if (r == FcLangEqual)
+	    equal[bit >> 5] |= ((FcChar32)1U << (bit & 0x1f));
+	else
+	    territory[bit >> 5] |= ((FcChar32)1U << (bit & 0x1f));
+    }
+}
+
 static FcLangResult
 FcLangSetCompareStrSet (const FcLangSet *ls, FcStrSet *set)
 {
@@ -225,6 +225,200 @@ FcListPatternMatchAny (const FcPattern *p,
     return FcTrue;
 }
 
+/*
+ * An index over a set of patterns for FcListFilterMatchAny.  A pattern
+ * with a string for an object holding nothing but strings, like family
+ * or fontformat, is filed under the first such string, since fonts
+ * without it can't match; the rest are tried with every font.
+ */
+typedef struct _FcListFilterBucket {
+    int         npattern;
+    int         size;
+    FcPattern **patterns;
+} FcListFilterBucket;
+
+typedef struct _FcListFilterKey {
+    FcObject     object;
+    FcHashTable *table; /* string -> FcListFilterBucket */
+} FcListFilterKey;
+
+struct _FcListFilter {
+    int              nkey;
+    FcListFilterKey *keys;
+    int              nrest;
+    FcPattern      **rest;
+};
+
+static void
+FcListFilterBucketDestroy (FcListFilterBucket *bucket)
+{
+    free (bucket->patterns);
+    free (bucket);
+}
+
+static FcBool
+FcListFilterBucketAdd (FcListFilterBucket *bucket, FcPattern *p)
+{
+    if (bucket->npattern == bucket->size) {
+	int         size = bucket->size ? bucket->size * 2 : 4;
+	FcPattern **patterns = realloc (bucket->patterns, size * sizeof (FcPattern *));
+
+	if (!patterns)
+	    return FcFalse;
+	bucket->patterns = patterns;
+	bucket->size = size;
+    }
+    bucket->patterns[bucket->npattern++] = p;
+    return FcTrue;
+}
+
+/*
+ * The string 'p' can be filed under, or NULL
+ */
+static const FcChar8 *
+FcListFilterKeyString (const FcPattern *p, FcObject *object)
+{
+    FcPatternElt *pe;
+    FcValue       v;
+    int           i;
+
+    for (i = 0; i < p->num; i++) {
+	pe = &FcPatternElts (p)[i];
+	/* Skipped by FcListPatternMatchAny */
+	if (pe->object == FC_NAMELANG_OBJECT)
+	    continue;
+	if (!FcObjectValidType (pe->object, FcTypeString) ||
+	    FcObjectValidType (pe->object, FcTypeLangSet))
+	    continue;
+	v = FcValueCanonicalize (&FcPatternEltValues (pe)->value);
+	if (v.type == FcTypeString) {
+	    *object = pe->object;
+	    return v.u.s;
+	}
+    }
+    return NULL;
+}
+
+static FcBool
+FcListFilterAdd (FcListFilter *filter, FcPattern *p)
+{
+    FcListFilterBucket *bucket;
+    FcListFilterKey    *key;
+    const FcChar8      *s;
+    FcObject            object;
+    int                 i;
+
+    s = FcListFilterKeyString (p, &object);
+    if (!s) {
+	filter->rest[filter->nrest++] = p;
+	return FcTrue;
+    }
+    for (i = 0; i < filter->nkey; i++)
+	if (filter->keys[i].object == object)
+	    break;
+    key = &filter->keys[i];
+    if (i == filter->nkey) {
+	key->object = object;
+	key->table = FcHashTableCreate ((FcHashFunc)FcStrHashIgnoreBlanksAndCase,
+	                                (FcCompareFunc)FcStrCmpIgnoreBlanksAndCase,
+	                                NULL,
+	                                NULL,
+	                                NULL,
+	                                (FcDestroyFunc)FcListFilterBucketDestroy);
+	if (!key->table)
+	    return FcFalse;
+	filter->nkey++;
+    }
+    if (!FcHashTableFind (key->table, s, (void **)&bucket)) {
+	bucket = calloc (1, sizeof (FcListFilterBucket));
+	if (!bucket)
+	    return FcFalse;
+	if (!FcHashTableAdd (key->table, (void *)s, bucket)) {
+	    free (bucket);
+	    return FcFalse;
+	}
+    }
+    return FcListFilterBucketAdd (bucket, p);
+}
+
+/*
+ * Index 'patterns', which must be kept as they are for as long as the
+ * index is used
+ */
+FcListFilter *
+FcListFilterCreate (const FcFontSet *patterns)
+{
+    FcListFilter *filter;
+    int           i;
+
+    filter = calloc (1, sizeof (FcListFilter));
+    if (!filter)
+	return NULL;
+    if (patterns->nfont) {
+	filter->keys = calloc (patterns->nfont, sizeof (FcListFilterKey));
+	filter->rest = malloc (patterns->nfont * sizeof (FcPattern *));
+	if (!filter->keys || !filter->rest)
+	    goto bail;
+    }
+    for (i = 0; i < patterns->nfont; i++)
+	if (!FcListFilterAdd (filter, patterns->fonts[i]))
+	    goto bail;
+
+    return filter;
+
+bail:
+    FcListFilterDestroy (filter);
+    return NULL;
+}
+
+void
+FcListFilterDestroy (FcListFilter *filter)
+{
+    int i;
+
+    if (!filter)
+	return;
+    for (i = 0; i < filter->nkey; i++)
+	FcHashTableDestroy (filter->keys[i].table);
+    free (filter->keys);
+    free (filter->rest);
+    free (filter);
+}
+
+/*
+ * FcTrue iff any of the patterns indexed by 'filter' matches 'font',
+ * as FcListPatternMatchAny finds
+ */
+FcBool
+FcListFilterMatchAny (const FcListFilter *filter,
+                      const FcPattern    *font)
+{
+    FcListFilterBucket *bucket;
+    FcPatternElt       *fe;
+    FcValueListPtr      l;
+    FcValue             v;
+    int                 i, j;
+
+    for (i = 0; i < filter->nrest; i++)
+	if (FcListPatternMatchAny (filter->rest[i], font))
+	    return FcTrue;
+    for (i = 0; i < filter->nkey; i++) {
+	fe = FcPatternObjectFindElt (font, filter->keys[i].object);
+	if (!fe)
+	    continue;
+	for (l = FcPatternEltValues (fe); l; l = FcValueListNext (l)) {
+	    v = FcValueCanonicalize (&l->value);
+	    if (v.type != FcTypeString ||
+	        !FcHashTableFind (filter->keys[i].table, v.u.s, (void **)&bucket))
+		continue;
+	    for (j = 0; j < bucket->npattern; j++)
+		if (FcListPatternMatchAny (bucket->patterns[j], font))
+		    return FcTrue;
+	}
+    }
+    return FcFalse;
+}
+
 static FcChar32
 FcListMatrixHash (const FcMatrix *m)
 {
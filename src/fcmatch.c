@@ -521,15 +521,144 @@ typedef struct
     double weak_value;
 } FamilyEntry;
 
+/*
+ * Columns of a FcMatchIndex.  Each one mirrors the values of one
+ * object with a matcher, for every font of the indexed set.
+ */
+typedef enum _FcMatchIndexColumn {
+    FC_INDEX_FAMILY,
+    FC_INDEX_STYLE,
+    FC_INDEX_LANG,
+    FC_INDEX_SLANT,
+    FC_INDEX_WEIGHT,
+    FC_INDEX_WIDTH,
+    FC_INDEX_SIZE,
+    FC_INDEX_PIXEL_SIZE,
+    FC_INDEX_SPACING,
+    FC_INDEX_FONTVERSION,
+    FC_INDEX_ORDER,
+    FC_INDEX_SCALABLE,
+    FC_INDEX_OUTLINE,
+    FC_INDEX_COLOR,
+    FC_INDEX_VARIABLE,
+    FC_INDEX_SYMBOL,
+    FC_INDEX_DECORATIVE,
+    FC_INDEX_NAMED_INSTANCE,
+    FC_INDEX_FONT_HAS_HINT,
+    FC_INDEX_ANTIALIAS,
+    FC_INDEX_END
+} FcMatchIndexColumn;
+
+/* Columns held in FcMatchIndex.begin/end */
+#define FC_INDEX_NUMBER_BEGIN FC_INDEX_SLANT
+#define FC_INDEX_BOOL_BEGIN   FC_INDEX_SCALABLE
+
+static const FcObject _FcMatchIndexObjects[FC_INDEX_END] = {
+    FC_FAMILY_OBJECT,
+    FC_STYLE_OBJECT,
+    FC_LANG_OBJECT,
+    FC_SLANT_OBJECT,
+    FC_WEIGHT_OBJECT,
+    FC_WIDTH_OBJECT,
+    FC_SIZE_OBJECT,
+    FC_PIXEL_SIZE_OBJECT,
+    FC_SPACING_OBJECT,
+    FC_FONTVERSION_OBJECT,
+    FC_ORDER_OBJECT,
+    FC_SCALABLE_OBJECT,
+    FC_OUTLINE_OBJECT,
+    FC_COLOR_OBJECT,
+    FC_VARIABLE_OBJECT,
+    FC_SYMBOL_OBJECT,
+    FC_DECORATIVE_OBJECT,
+    FC_NAMED_INSTANCE_OBJECT,
+    FC_FONT_HAS_HINT_OBJECT,
+    FC_ANTIALIAS_OBJECT,
+};
+
+typedef enum _FcMatchIndexState {
+    FcMatchIndexAbsent,  /* the font has no value for the object */
+    FcMatchIndexSimple,  /* the value is held in the column */
+    FcMatchIndexComplex, /* anything else, scored from the pattern */
+} FcMatchIndexState;
+
+typedef struct _FcMatchIndexNames {
+    FcHashTable *table; /* folded name -> id */
+    int          nname;
+    int         *first; /* ids of row f are ids[first[f]] .. ids[first[f + 1] - 1] */
+    int         *ids;
+    int          nid;
+    int          sid;
+} FcMatchIndexNames;
+
+typedef struct _FcMatchIndexRows {
+    int  nrow;
+    int  srow;
+    int *rows;
+} FcMatchIndexRows;
+
+struct _FcMatchIndex {
+    const FcFontSet  *set;   /* font set the rows were taken from */
+    int               nfont; /* number of rows */
+    int               sfont; /* number of allocated rows */
+    FcChar8          *state[FC_INDEX_END];
+    double           *begin[FC_INDEX_END]; /* numeric columns only */
+    double           *end[FC_INDEX_END];
+    FcMatchIndexNames names[FC_INDEX_STYLE + 1]; /* family and style */
+    FcChar32         *lang; /* NUM_LANG_SET_MAP words per row */
+    FcMatchIndexRows *family_rows; /* rows listing each family id */
+    int               sfamily_rows;
+};
+
+typedef struct _FcMatchIndexFamily {
+    int    id;
+    double strong_value;
+    double weak_value;
+} FcMatchIndexFamily;
+
 typedef struct
 {
     FcHashTable *family_hash;
+    /*
+     * Pattern values prepared for the FcMatchIndex being scored;
+     * columns in 'skip' are scored from the index instead of through
+     * FcCompareValueList.
+     */
+    const FcMatchIndex  *index;
+    FcChar32             skip;
+    const FcPatternElt  *elts[FC_INDEX_END];
+    int                  columns[PRI_END]; /* column scoring each priority, or -1 */
+    const FcPatternElt  *rest[PRI_END];    /* elements without a column, in object order */
+    int                  nrest;
+    int                  nvalue[FC_INDEX_END];
+    double              *begin[FC_INDEX_END];
+    double              *end[FC_INDEX_END];
+    int                 *style_ids;
+    FcMatchIndexFamily  *families;
+    int                  nfamily;
+    FcChar32            *lang_equal;
+    FcChar32            *lang_territory;
+    void                *buffer;
+    /* Pattern elements with a matcher, by strong priority */
+    const FcPatternElt  *priority_elts[PRI_END];
 } FcCompareData;
 
+typedef struct _FcSortNode {
+    FcPattern *pattern;
+    double     score[PRI_END];
+    double     lang; /* score[PRI_LANG] before the language pass */
+    int        rank; /* orders nodes with equal scores */
+} FcSortNode;
+
+/* Number of fonts scored at once from a FcMatchIndex */
+#define FC_MATCH_BLOCK 64
+
 static void
 FcCompareDataClear (FcCompareData *data)
 {
     FcHashTableDestroy (data->family_hash);
+    if (data->buffer)
+	free (data->buffer);
 }
 
 static void
@@ -571,6 +700,21 @@ FcCompareDataInit (FcPattern     *pat,
     }
 
     data->family_hash = table;
+    data->index = NULL;
+    data->skip = 0;
+    data->buffer = NULL;
+    for (i = 0; i < FC_INDEX_END; i++)
+	data->elts[i] = FcPatternObjectFindElt (pat, _FcMatchIndexObjects[i]);
+    for (i = 0; i < PRI_END; i++)
+	data->priority_elts[i] = NULL;
+    for (i = 0; i < pat->num; i++) {
+	const FcMatcher *match;
+
+	elt = &FcPatternElts (pat)[i];
+	match = FcObjectToMatcher (elt->object, FcFalse);
+	if (match)
+	    data->priority_elts[match->strong] = elt;
+    }
 }
 
 static FcBool
@@ -616,6 +760,29 @@ FcCompareFamilies (FcPattern     *pat,
     return FcTrue;
 }
 
+static FcBool
+FcCompareElt (FcPattern          *pat,
+              const FcPatternElt *elt_i1,
+              FcPattern          *fnt,
+              const FcPatternElt *elt_i2,
+              double             *value,
+              FcResult           *result,
+              FcCompareData      *data)
+{
+    if (elt_i1->object == FC_FAMILY_OBJECT && data->family_hash)
+	return FcCompareFamilies (pat, FcPatternEltValues (elt_i1),
+	                          fnt, FcPatternEltValues (elt_i2),
+	                          value, result,
+	                          data->family_hash);
+    else {
+	const FcMatcher *match = FcObjectToMatcher (elt_i1->object, FcFalse);
+	return FcCompareValueList (elt_i1->object, match,
+	                           FcPatternEltValues (elt_i1),
+	                           FcPatternEltValues (elt_i2),
+	                           NULL, value, NULL, result);
+    }
+}
+
 /*
  * Return a value indicating the distance between the two lists of
  * values
@@ -644,20 +811,8 @@ FcCompare (FcPattern     *pat,
 	    i2++;
 	else if (i < 0)
 	    i1++;
-	else if (elt_i1->object == FC_FAMILY_OBJECT && data->family_hash) {
-	    if (!FcCompareFamilies (pat, FcPatternEltValues (elt_i1),
-	                            fnt, FcPatternEltValues (elt_i2),
-	                            value, result,
-	                            data->family_hash))
-		return FcFalse;
-	    i1++;
-	    i2++;
-	} else {
-	    const FcMatcher *match = FcObjectToMatcher (elt_i1->object, FcFalse);
-	    if (!FcCompareValueList (elt_i1->object, match,
-	                             FcPatternEltValues (elt_i1),
-	                             FcPatternEltValues (elt_i2),
-	                             NULL, value, NULL, result))
+	else {
+	    if (!FcCompareElt (pat, elt_i1, fnt, elt_i2, value, result, data))
 		return FcFalse;
 	    i1++;
 	    i2++;
@@ -666,341 +821,2636 @@ FcCompare (FcPattern     *pat,
     return FcTrue;
 }
 
-FcPattern *
-FcFontRenderPrepare (FcConfig  *config,
-                     FcPattern *pat,
-                     FcPattern *font)
-{
-    FcPattern    *newp;
-    int           i;
-    FcPatternElt *fe, *pe;
-    FcValue       v;
-    FcResult      result;
-    FcBool        variable = FcFalse;
-    FcStrBuf      variations;
+/*
+ * Like FcCompare, but score the pattern elements in priority order and
+ * give up on the font as soon as the priorities known so far are worse
+ * than 'bound'.  The values of a font given up on are only complete up
+ * to the priority it lost on, which is all the lexicographic comparison
+ * against 'bound' looks at.
+ */
 
-    assert (pat != NULL);
-    assert (font != NULL);
+static FcBool
+FcCompareBounded (FcPattern     *pat,
+                  FcPattern     *fnt,
+                  double        *value,
+                  const double  *bound,
+                  FcResult      *result,
+                  FcCompareData *data)
+{
+    const FcPatternElt *elt_i1, *elt_i2;
+    int                 i, done = 0;
+    FcBool              better = FcFalse;
 
-    FcPatternObjectGetBool (font, FC_VARIABLE_OBJECT, 0, &variable);
-    assert (variable != FcDontCare);
-    if (variable)
-	FcStrBufInit (&variations, NULL, 0);
+    for (i = 0; i < PRI_END; i++)
+	value[i] = 0.0;
 
-    newp = FcPatternCreate();
-    if (!newp)
-	return NULL;
-    for (i = 0; i < font->num; i++) {
-	fe = &FcPatternElts (font)[i];
-	if (fe->object == FC_FAMILYLANG_OBJECT ||
-	    fe->object == FC_STYLELANG_OBJECT ||
-	    fe->object == FC_FULLNAMELANG_OBJECT) {
-	    /* ignore those objects. we need to deal with them
-	     * another way */
+    for (i = 0; i < PRI_END; i++) {
+	elt_i1 = data->priority_elts[i];
+	if (!elt_i1)
 	    continue;
+	/* Priorities below i can't change any more */
+	for (; !better && done < i; done++) {
+	    if (value[done] > bound[done])
+		return FcTrue;
+	    if (value[done] < bound[done])
+		better = FcTrue;
 	}
-	if (fe->object == FC_FAMILY_OBJECT ||
-	    fe->object == FC_STYLE_OBJECT ||
-	    fe->object == FC_FULLNAME_OBJECT) {
-	    FcPatternElt *fel, *pel;
+	elt_i2 = FcPatternObjectFindElt (fnt, elt_i1->object);
+	if (elt_i2 && !FcCompareElt (pat, elt_i1, fnt, elt_i2, value, result, data))
+	    return FcFalse;
+    }
+    return FcTrue;
+}
 
-	    FC_ASSERT_STATIC ((FC_FAMILY_OBJECT + 1) == FC_FAMILYLANG_OBJECT);
-	    FC_ASSERT_STATIC ((FC_STYLE_OBJECT + 1) == FC_STYLELANG_OBJECT);
-	    FC_ASSERT_STATIC ((FC_FULLNAME_OBJECT + 1) == FC_FULLNAMELANG_OBJECT);
+/* Lexicographic order of two scores, as in FcSortCompare */
+static int
+FcScoreCompare (const double *a, const double *b)
+{
+    int i;
 
-	    fel = FcPatternObjectFindElt (font, fe->object + 1);
-	    pel = FcPatternObjectFindElt (pat, fe->object + 1);
+    for (i = 0; i < PRI_END; i++) {
+	if (a[i] != b[i])
+	    return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
 
-	    if (fel && pel) {
-		/* The font has name languages, and pattern asks for specific language(s).
-		 * Match on language and and prefer that result.
-		 * Note:  Currently the code only give priority to first matching language.
-		 */
-		int              n = 1, j;
-		FcValueListPtr   l1, l2, ln = NULL, ll = NULL;
-		const FcMatcher *match = FcObjectToMatcher (pel->object, FcTrue);
+/*
+ * FcMatchIndex keeps the values of the most commonly matched objects
+ * of a config font set in flat per-object arrays, so scoring them
+ * doesn't have to walk every font's FcPatternElt array and value lists.
+ * Anything the columns can't represent exactly is marked complex and
+ * scored through FcCompareValueList as before.
+ */
 
-		if (!FcCompareValueList (pel->object, match,
-		                         FcPatternEltValues (pel),
-		                         FcPatternEltValues (fel), NULL, NULL, &n, &result)) {
-		    FcPatternDestroy (newp);
-		    return NULL;
-		}
+static void
+FcMatchIndexNamesFini (FcMatchIndexNames *names)
+{
+    if (names->table)
+	FcHashTableDestroy (names->table);
+    if (names->first)
+	free (names->first);
+    if (names->ids)
+	free (names->ids);
+}
 
-		for (j = 0, l1 = FcPatternEltValues (fe), l2 = FcPatternEltValues (fel);
-		     l1 != NULL || l2 != NULL;
-		     j++, l1 = l1 ? FcValueListNext (l1) : NULL, l2 = l2 ? FcValueListNext (l2) : NULL) {
-		    FcValueListPtr (*func) (FcValueListPtr, FcValue, FcValueBinding);
-		    FcValueBinding binding = FcValueBindingEnd;
+void
+FcMatchIndexDestroy (FcMatchIndex *index)
+{
+    int c;
+
+    if (!index)
+	return;
+    for (c = 0; c < FC_INDEX_END; c++) {
+	if (index->state[c])
+	    free (index->state[c]);
+	if (index->begin[c])
+	    free (index->begin[c]);
+	if (index->end[c])
+	    free (index->end[c]);
+    }
+    FcMatchIndexNamesFini (&index->names[FC_INDEX_FAMILY]);
+    FcMatchIndexNamesFini (&index->names[FC_INDEX_STYLE]);
+    if (index->lang)
+	free (index->lang);
+    if (index->family_rows) {
+	for (c = 0; c < index->sfamily_rows; c++) {
+	    if (index->family_rows[c].rows)
+		free (index->family_rows[c].rows);
+	}
+	free (index->family_rows);
+    }
+    free (index);
+}
 
-		    if (j == n) {
-			binding = FcValueBindingStrong;
-			func = FcValueListPrepend;
-		    } else
-			func = FcValueListAppend;
-		    if (l1) {
-			ln = func (ln,
-			           FcValueCanonicalize (&l1->value),
-			           l1->binding);
-		    }
-		    if (l2) {
-			if (binding == FcValueBindingEnd)
-			    binding = l2->binding;
-			ll = func (ll,
-			           FcValueCanonicalize (&l2->value),
-			           binding);
-		    }
-		}
-		FcPatternObjectListAdd (newp, fe->object, ln, FcFalse);
-		FcPatternObjectListAdd (newp, fel->object, ll, FcFalse);
+static FcMatchIndex *
+FcMatchIndexCreate (const FcFontSet *set)
+{
+    FcMatchIndex *index;
 
-		continue;
-	    } else if (fel) {
-		/* Pattern doesn't ask for specific language.  Copy all for name and
-		 * lang. */
-		FcValueListPtr l1, l2;
+    index = calloc (1, sizeof (FcMatchIndex));
+    if (!index)
+	return NULL;
+    index->set = set;
+    index->names[FC_INDEX_FAMILY].table = FcHashTableCreate ((FcHashFunc)FcStrHashIgnoreBlanksAndCase,
+                                                             (FcCompareFunc)FcStrCmpIgnoreBlanksAndCase,
+                                                             NULL, NULL, NULL, NULL);
+    index->names[FC_INDEX_STYLE].table = FcHashTableCreate ((FcHashFunc)FcStrHashIgnoreCase,
+                                                            (FcCompareFunc)FcStrCmpIgnoreCase,
+                                                            NULL, NULL, NULL, NULL);
+    if (!index->names[FC_INDEX_FAMILY].table ||
+        !index->names[FC_INDEX_STYLE].table) {
+	FcMatchIndexDestroy (index);
+	return NULL;
+    }
 
-		l1 = FcValueListDuplicate (FcPatternEltValues (fe));
-		l2 = FcValueListDuplicate (FcPatternEltValues (fel));
-		FcPatternObjectListAdd (newp, fe->object, l1, FcFalse);
-		FcPatternObjectListAdd (newp, fel->object, l2, FcFalse);
+    return index;
+}
 
-		continue;
-	    }
-	}
+static FcBool
+FcMatchIndexRealloc (void **ptr, size_t size)
+{
+    void *p = realloc (*ptr, size);
 
-	pe = FcPatternObjectFindElt (pat, fe->object);
-	if (pe) {
-	    const FcMatcher *match = FcObjectToMatcher (pe->object, FcFalse);
-	    if (!FcCompareValueList (pe->object, match,
-	                             FcPatternEltValues (pe),
-	                             FcPatternEltValues (fe), &v, NULL, NULL, &result)) {
-		FcPatternDestroy (newp);
-		return NULL;
-	    }
-	    FcPatternObjectAdd (newp, fe->object, v, FcFalse);
+    if (!p)
+	return FcFalse;
+    *ptr = p;
 
-	    /* Set font-variations settings for standard axes in variable fonts. */
-	    if (variable &&
-	        FcPatternEltValues (fe)->value.type == FcTypeRange &&
-	        (fe->object == FC_WEIGHT_OBJECT ||
-	         fe->object == FC_WIDTH_OBJECT ||
-	         fe->object == FC_SIZE_OBJECT)) {
-		double      num;
-		const char *tag = "    ";
+    return FcTrue;
+}
 
-		assert (v.type == FcTypeDouble);
-		num = v.u.d;
-		if (variations.len)
-		    FcStrBufChar (&variations, ',');
-		switch (fe->object) {
-		case FC_WEIGHT_OBJECT:
-		    tag = "wght";
-		    num = FcWeightToOpenType (num);
-		    break;
+static FcBool
+FcMatchIndexGrow (FcMatchIndex *index, int sfont)
+{
+    int c;
+
+    for (c = 0; c < FC_INDEX_END; c++) {
+	if (!FcMatchIndexRealloc ((void **)&index->state[c], sfont))
+	    return FcFalse;
+	if (c >= FC_INDEX_NUMBER_BEGIN &&
+	    (!FcMatchIndexRealloc ((void **)&index->begin[c], sfont * sizeof (double)) ||
+	     !FcMatchIndexRealloc ((void **)&index->end[c], sfont * sizeof (double))))
+	    return FcFalse;
+    }
+    if (!FcMatchIndexRealloc ((void **)&index->names[FC_INDEX_FAMILY].first, (sfont + 1) * sizeof (int)) ||
+        !FcMatchIndexRealloc ((void **)&index->names[FC_INDEX_STYLE].first, (sfont + 1) * sizeof (int)) ||
+        !FcMatchIndexRealloc ((void **)&index->lang, sfont * NUM_LANG_SET_MAP * sizeof (FcChar32)))
+	return FcFalse;
+    if (index->sfont == 0) {
+	index->names[FC_INDEX_FAMILY].first[0] = 0;
+	index->names[FC_INDEX_STYLE].first[0] = 0;
+    }
+    index->sfont = sfont;
 
-		case FC_WIDTH_OBJECT:
-		    tag = "wdth";
-		    break;
+    return FcTrue;
+}
 
-		case FC_SIZE_OBJECT:
-		    tag = "opsz";
-		    break;
-		}
-		FcStrBufFormat (&variations, "%4s=%g", tag, num);
-	    }
-	} else {
-	    FcPatternObjectListAdd (newp, fe->object,
-	                            FcValueListDuplicate (FcPatternEltValues (fe)),
-	                            FcTrue);
+static FcMatchIndexState
+FcMatchIndexAddNames (FcMatchIndexNames  *names,
+                      int                 row,
+                      const FcPatternElt *elt)
+{
+    FcValueListPtr l;
+    const FcChar8 *s;
+    void          *id;
+    int            first = names->first[row];
+
+    names->first[row + 1] = first;
+    if (!elt)
+	return FcMatchIndexAbsent;
+    l = FcPatternEltValues (elt);
+    if (!l)
+	return FcMatchIndexComplex;
+    for (; l; l = FcValueListNext (l)) {
+	if (l->value.type != FcTypeString)
+	    goto complex;
+	s = FcValueString (&l->value);
+	if (!FcHashTableFind (names->table, s, &id)) {
+	    id = (void *)(intptr_t)names->nname;
+	    if (!FcHashTableAdd (names->table, (void *)s, id))
+		goto complex;
+	    names->nname++;
 	}
-    }
-    for (i = 0; i < pat->num; i++) {
-	pe = &FcPatternElts (pat)[i];
-	fe = FcPatternObjectFindElt (font, pe->object);
-	if (!fe &&
-	    pe->object != FC_FAMILYLANG_OBJECT &&
-	    pe->object != FC_STYLELANG_OBJECT &&
-	    pe->object != FC_FULLNAMELANG_OBJECT) {
-	    FcPatternObjectListAdd (newp, pe->object,
-	                            FcValueListDuplicate (FcPatternEltValues (pe)),
-	                            FcFalse);
+	if (names->nid == names->sid) {
+	    int  sid = names->sid ? names->sid * 2 : 256;
+	    int *ids = realloc (names->ids, sid * sizeof (int));
+
+	    if (!ids)
+		goto complex;
+	    names->ids = ids;
+	    names->sid = sid;
 	}
+	names->ids[names->nid++] = (int)(intptr_t)id;
     }
+    names->first[row + 1] = names->nid;
 
-    if (variable && variations.len) {
-	FcChar8 *vars = NULL;
-	if (FcPatternObjectGetString (newp, FC_FONT_VARIATIONS_OBJECT, 0, &vars) == FcResultMatch) {
-	    FcStrBufChar (&variations, ',');
-	    FcStrBufString (&variations, vars);
-	    FcPatternObjectDel (newp, FC_FONT_VARIATIONS_OBJECT);
-	}
+    return FcMatchIndexSimple;
 
-	FcPatternObjectAddString (newp, FC_FONT_VARIATIONS_OBJECT, FcStrBufDoneStatic (&variations));
-	FcStrBufDestroy (&variations);
-    }
+complex:
+    names->nid = first;
 
-    FcConfigSubstituteWithPat (config, newp, pat, FcMatchFont);
-    return newp;
+    return FcMatchIndexComplex;
 }
 
-static FcPattern *
-FcFontSetMatchInternal (FcFontSet **sets,
-                        int         nsets,
-                        FcPattern  *p,
-                        FcResult   *result)
+/*
+ * Store a value of a numeric or boolean column as begin/end;
+ * numbers have begin == end.  Returns FcFalse if the column
+ * can't hold the value.
+ */
+static FcBool
+FcMatchIndexGetValue (int      column,
+                      FcValue *value,
+                      double  *begin,
+                      double  *end)
 {
-    double              score[PRI_END], bestscore[PRI_END];
-    int                 f;
-    FcFontSet          *s;
-    FcPattern          *best, *pat = NULL;
-    int                 i;
-    int                 set;
-    FcCompareData       data;
-    const FcPatternElt *elt;
+    FcValue v = FcValueCanonicalize (value);
 
-    for (i = 0; i < PRI_END; i++)
-	bestscore[i] = 0;
-    best = 0;
-    if (FcDebug() & FC_DBG_MATCH) {
-	printf ("Match ");
-	FcPatternPrint (p);
+    if (column >= FC_INDEX_BOOL_BEGIN) {
+	if (v.type != FcTypeBool)
+	    return FcFalse;
+	*begin = *end = v.u.b;
+	return FcTrue;
+    }
+    switch ((int)v.type) {
+    case FcTypeInteger:
+	*begin = *end = (double)v.u.i;
+	return FcTrue;
+    case FcTypeDouble:
+	*begin = *end = v.u.d;
+	return FcTrue;
+    case FcTypeRange:
+	/* Only FcCompareRange and FcCompareSize take ranges */
+	if (column != FC_INDEX_WEIGHT &&
+	    column != FC_INDEX_WIDTH &&
+	    column != FC_INDEX_SIZE)
+	    return FcFalse;
+	*begin = v.u.r->begin;
+	*end = v.u.r->end;
+	return FcTrue;
     }
+    return FcFalse;
+}
 
-    FcCompareDataInit (p, &data);
+static FcMatchIndexState
+FcMatchIndexAddValue (int                 column,
+                      const FcPatternElt *elt,
+                      double             *begin,
+                      double             *end)
+{
+    FcValueListPtr l;
 
-    for (set = 0; set < nsets; set++) {
-	s = sets[set];
-	if (!s)
-	    continue;
-	for (f = 0; f < s->nfont; f++) {
-	    if (FcDebug() & FC_DBG_MATCHV) {
-		printf ("Font %d ", f);
-		FcPatternPrint (s->fonts[f]);
-	    }
-	    if (!FcCompare (p, s->fonts[f], score, result, &data)) {
-		FcCompareDataClear (&data);
-		return 0;
+    *begin = *end = 0;
+    if (!elt)
+	return FcMatchIndexAbsent;
+    l = FcPatternEltValues (elt);
+    if (!l || FcValueListNext (l) ||
+        !FcMatchIndexGetValue (column, &l->value, begin, end))
+	return FcMatchIndexComplex;
+
+    return FcMatchIndexSimple;
+}
+
+static FcMatchIndexState
+FcMatchIndexAddLang (const FcPatternElt *elt,
+                     FcChar32           *map)
+{
+    FcValueListPtr   l;
+    const FcLangSet *ls;
+    int              i;
+
+    memset (map, 0, NUM_LANG_SET_MAP * sizeof (FcChar32));
+    if (!elt)
+	return FcMatchIndexAbsent;
+    l = FcPatternEltValues (elt);
+    if (!l || FcValueListNext (l) || l->value.type != FcTypeLangSet)
+	return FcMatchIndexComplex;
+    ls = FcValueLangSet (&l->value);
+    if (ls->extra)
+	return FcMatchIndexComplex;
+    for (i = 0; i < NUM_LANG_SET_MAP && i < (int)ls->map_size; i++)
+	map[i] = ls->map[i];
+
+    return FcMatchIndexSimple;
+}
+
+/*
+ * Append 'row' to the row lists of the family ids it was given by
+ * FcMatchIndexAddNames.
+ */
+static FcBool
+FcMatchIndexAddFamilyRows (FcMatchIndex *index, int row)
+{
+    const FcMatchIndexNames *names = &index->names[FC_INDEX_FAMILY];
+    FcMatchIndexRows        *r;
+    int                      k;
+
+    if (names->nname > index->sfamily_rows) {
+	int s = index->sfamily_rows ? index->sfamily_rows : 64;
+
+	while (s < names->nname)
+	    s *= 2;
+	if (!FcMatchIndexRealloc ((void **)&index->family_rows, s * sizeof (FcMatchIndexRows)))
+	    return FcFalse;
+	memset (index->family_rows + index->sfamily_rows, 0,
+	        (s - index->sfamily_rows) * sizeof (FcMatchIndexRows));
+	index->sfamily_rows = s;
+    }
+    for (k = names->first[row]; k < names->first[row + 1]; k++) {
+	r = &index->family_rows[names->ids[k]];
+	if (r->nrow && r->rows[r->nrow - 1] == row)
+	    continue;
+	if (r->nrow == r->srow) {
+	    int srow = r->srow ? r->srow * 2 : 4;
+
+	    if (!FcMatchIndexRealloc ((void **)&r->rows, srow * sizeof (int)))
+		return FcFalse;
+	    r->srow = srow;
+	}
+	r->rows[r->nrow++] = row;
+    }
+
+    return FcTrue;
+}
+
+static FcBool
+FcMatchIndexAddFont (FcMatchIndex *index, FcPattern *font)
+{
+    int                 row = index->nfont;
+    int                 c;
+    const FcPatternElt *elt;
+
+    if (row == index->sfont &&
+        !FcMatchIndexGrow (index, index->sfont ? index->sfont * 2 : 64))
+	return FcFalse;
+    for (c = 0; c < FC_INDEX_END; c++) {
+	elt = FcPatternObjectFindElt (font, _FcMatchIndexObjects[c]);
+	switch (c) {
+	case FC_INDEX_FAMILY:
+	case FC_INDEX_STYLE:
+	    index->state[c][row] = FcMatchIndexAddNames (&index->names[c], row, elt);
+	    if (c == FC_INDEX_FAMILY &&
+	        !FcMatchIndexAddFamilyRows (index, row))
+		return FcFalse;
+	    break;
+	case FC_INDEX_LANG:
+	    index->state[c][row] = FcMatchIndexAddLang (elt, &index->lang[row * NUM_LANG_SET_MAP]);
+	    break;
+	default:
+	    index->state[c][row] = FcMatchIndexAddValue (c, elt,
+	                                                 &index->begin[c][row],
+	                                                 &index->end[c][row]);
+	    break;
+	}
+    }
+    index->nfont++;
+
+    return FcTrue;
+}
+
+/*
+ * Bring the index of config->fonts[set] up to date with the fonts
+ * added since it was last updated.  If that fails, the index is
+ * dropped and matching falls back to scoring the patterns.
+ */
+void
+FcConfigUpdateMatchIndex (FcConfig *config, FcSetName set)
+{
+    FcFontSet    *fs = config->fonts[set];
+    FcMatchIndex *index = config->match_index[set];
+
+    if (index && index->set != fs) {
+	FcMatchIndexDestroy (index);
+	index = NULL;
+    }
+    if (fs && !index)
+	index = FcMatchIndexCreate (fs);
+    config->match_index[set] = index;
+    if (!index)
+	return;
+    while (index->nfont < fs->nfont) {
+	if (!FcMatchIndexAddFont (index, fs->fonts[index->nfont])) {
+	    FcMatchIndexDestroy (index);
+	    config->match_index[set] = NULL;
+	    return;
+	}
+    }
+}
+
+static const FcMatchIndex *
+FcConfigFindMatchIndex (FcConfig *config, const FcFontSet *s)
+{
+    FcSetName set;
+
+    /* The verbose output needs every value to go through FcCompareValueList */
+    if (!config || (FcDebug() & FC_DBG_MATCHV))
+	return NULL;
+    for (set = FcSetSystem; set <= FcSetApplication; set++) {
+	const FcMatchIndex *index = config->match_index[set];
+
+	if (index && index->set == s && index->nfont == s->nfont)
+	    return index;
+    }
+    return NULL;
+}
+
+static int
+FcMatchIndexFamilyCompare (const void *a, const void *b)
+{
+    return ((const FcMatchIndexFamily *)a)->id - ((const FcMatchIndexFamily *)b)->id;
+}
+
+/*
+ * Prepare the pattern values of 'data' for scoring the fonts of 'index'.
+ * Columns whose pattern values can't be scored from the index are left
+ * to FcCompareValueList.
+ */
+static FcBool
+FcCompareDataSetIndex (FcCompareData      *data,
+                       FcPattern          *pat,
+                       const FcMatchIndex *index)
+{
+    FcValueListPtr l;
+    size_t         size;
+    int            c, j, n, nvalue = 0;
+    char          *buf;
+
+    if (data->buffer) {
+	free (data->buffer);
+	data->buffer = NULL;
+    }
+    data->index = index;
+    data->skip = 0;
+    data->nfamily = 0;
+    for (c = 0; c < PRI_END; c++)
+	data->columns[c] = -1;
+    if (!index)
+	return FcTrue;
+
+    for (c = 0; c < FC_INDEX_END; c++) {
+	n = 0;
+	if (data->elts[c]) {
+	    for (l = FcPatternEltValues (data->elts[c]); l; l = FcValueListNext (l))
+		n++;
+	}
+	data->nvalue[c] = n;
+	nvalue += n;
+    }
+    size = nvalue * (2 * sizeof (double) + sizeof (FcMatchIndexFamily) + sizeof (int) +
+                     2 * NUM_LANG_SET_MAP * sizeof (FcChar32));
+    buf = data->buffer = malloc (size ? size : 1);
+    if (!buf)
+	return FcFalse;
+
+    for (c = FC_INDEX_NUMBER_BEGIN; c < FC_INDEX_END; c++) {
+	data->begin[c] = (double *)buf;
+	data->end[c] = data->begin[c] + data->nvalue[c];
+	buf += 2 * data->nvalue[c] * sizeof (double);
+	if (!data->nvalue[c])
+	    continue;
+	for (l = FcPatternEltValues (data->elts[c]), j = 0; l; l = FcValueListNext (l), j++) {
+	    if (!FcMatchIndexGetValue (c, &l->value, &data->begin[c][j], &data->end[c][j]))
+		break;
+	}
+	if (!l)
+	    data->skip |= 1U << c;
+    }
+
+    data->families = (FcMatchIndexFamily *)buf;
+    buf += data->nvalue[FC_INDEX_FAMILY] * sizeof (FcMatchIndexFamily);
+    if (data->nvalue[FC_INDEX_FAMILY] && data->family_hash) {
+	for (l = FcPatternEltValues (data->elts[FC_INDEX_FAMILY]), j = 0; l; l = FcValueListNext (l), j++) {
+	    void *id;
+	    int   i;
+
+	    if (!FcHashTableFind (index->names[FC_INDEX_FAMILY].table, FcValueString (&l->value), &id))
+		continue;
+	    for (i = 0; i < data->nfamily; i++)
+		if (data->families[i].id == (int)(intptr_t)id)
+		    break;
+	    if (i == data->nfamily) {
+		data->families[i].id = (int)(intptr_t)id;
+		data->families[i].strong_value = 1e99;
+		data->families[i].weak_value = 1e99;
+		data->nfamily++;
 	    }
-	    if (FcDebug() & FC_DBG_MATCHV) {
-		printf ("Score");
-		for (i = 0; i < PRI_END; i++) {
-		    printf (" %g", score[i]);
+	    /* Same as FcCompareDataInit */
+	    if (l->binding == FcValueBindingWeak) {
+		if (j < data->families[i].weak_value)
+		    data->families[i].weak_value = j;
+	    } else {
+		if (j < data->families[i].strong_value)
+		    data->families[i].strong_value = j;
+	    }
+	}
+	qsort (data->families, data->nfamily, sizeof (FcMatchIndexFamily),
+	       FcMatchIndexFamilyCompare);
+	data->skip |= 1U << FC_INDEX_FAMILY;
+    }
+
+    data->style_ids = (int *)buf;
+    buf += data->nvalue[FC_INDEX_STYLE] * sizeof (int);
+    if (data->nvalue[FC_INDEX_STYLE]) {
+	for (l = FcPatternEltValues (data->elts[FC_INDEX_STYLE]), j = 0; l; l = FcValueListNext (l), j++) {
+	    void *id;
+
+	    if (l->value.type != FcTypeString)
+		break;
+	    if (FcHashTableFind (index->names[FC_INDEX_STYLE].table, FcValueString (&l->value), &id))
+		data->style_ids[j] = (int)(intptr_t)id;
+	    else
+		data->style_ids[j] = -1;
+	}
+	if (!l)
+	    data->skip |= 1U << FC_INDEX_STYLE;
+    }
+
+    data->lang_equal = (FcChar32 *)buf;
+    data->lang_territory = data->lang_equal + data->nvalue[FC_INDEX_LANG] * NUM_LANG_SET_MAP;
+    if (data->nvalue[FC_INDEX_LANG]) {
+	for (l = FcPatternEltValues (data->elts[FC_INDEX_LANG]), j = 0; l; l = FcValueListNext (l), j++) {
+	    if (l->value.type != FcTypeString)
+		break;
+	    FcLangGetMatchMaps (FcValueString (&l->value),
+	                        &data->lang_equal[j * NUM_LANG_SET_MAP],
+	                        &data->lang_territory[j * NUM_LANG_SET_MAP]);
+	}
+	if (!l)
+	    data->skip |= 1U << FC_INDEX_LANG;
+    }
+    buf += 2 * data->nvalue[FC_INDEX_LANG] * NUM_LANG_SET_MAP * sizeof (FcChar32);
+
+    for (c = 0; c < FC_INDEX_END; c++) {
+	if (data->skip & (1U << c))
+	    data->columns[FcObjectToMatcher (_FcMatchIndexObjects[c], FcFalse)->strong] = c;
+    }
+    data->nrest = 0;
+    for (j = 0; j < FcPatternObjectCount (pat); j++) {
+	const FcPatternElt *elt = &FcPatternElts (pat)[j];
+	const FcMatcher    *match = FcObjectToMatcher (elt->object, FcFalse);
+
+	if (match && data->columns[match->strong] < 0)
+	    data->rest[data->nrest++] = elt;
+    }
+
+    return FcTrue;
+}
+
+/*
+ * Fully score the fonts of the indexed set that carry the pattern
+ * family ranking best, and lower 'bound' to the best of them.  The
+ * final match can't score worse than that, so FcCompareIndexed can
+ * reject most other fonts of the set on the family priorities alone,
+ * wherever the winner is in the set.
+ */
+static FcBool
+FcCompareFamilyBound (FcPattern     *pat,
+                      FcCompareData *data,
+                      double        *bound,
+                      FcBool        *bounded,
+                      FcResult      *result)
+{
+    const FcMatchIndex       *index = data->index;
+    const FcMatchIndexFamily *family = NULL;
+    const FcMatchIndexRows   *r;
+    double                    score[PRI_END];
+    int                       i;
+
+    for (i = 0; i < data->nfamily; i++) {
+	const FcMatchIndexFamily *e = &data->families[i];
+
+	if (!family ||
+	    e->strong_value < family->strong_value ||
+	    (e->strong_value == family->strong_value && e->weak_value < family->weak_value))
+	    family = e;
+    }
+    if (!family)
+	return FcTrue;
+    r = &index->family_rows[family->id];
+    for (i = 0; i < r->nrow; i++) {
+	FcPattern *fnt = index->set->fonts[r->rows[i]];
+
+	if (*bounded) {
+	    if (!FcCompareBounded (pat, fnt, score, bound, result, data))
+		return FcFalse;
+	} else if (!FcCompare (pat, fnt, score, result, data))
+	    return FcFalse;
+	if (!*bounded || FcScoreCompare (score, bound) < 0) {
+	    memcpy (bound, score, sizeof (score));
+	    *bounded = FcTrue;
+	}
+    }
+
+    return FcTrue;
+}
+
+/*
+ * Score column 'c' of fonts first + alive[0 .. nalive - 1] into 'nodes',
+ * producing exactly the values FcCompare would.  The scores are kept
+ * in the FcCompareValueList form: value * 1000 + j * 100 (+ k for
+ * string lists), stopping at the first one below 1000.  Only simple
+ * cells are scored here.
+ */
+static void
+FcCompareIndexedColumn (FcCompareData *data,
+                        int            c,
+                        int            first,
+                        const int     *alive,
+                        int            nalive,
+                        FcSortNode    *nodes)
+{
+    const FcMatchIndex *index = data->index;
+    const FcChar8      *state = index->state[c] + first;
+    double              v, best;
+    int                 i, j, k, n, f;
+    int                 pri = FcObjectToMatcher (_FcMatchIndexObjects[c], FcFalse)->strong;
+
+    switch (c) {
+    case FC_INDEX_FAMILY: {
+	const FcMatchIndexNames *names = &index->names[FC_INDEX_FAMILY];
+
+	for (n = 0; n < nalive; n++) {
+	    double strong_value = 1e99, weak_value = 1e99;
+
+	    i = alive[n];
+	    if (state[i] != FcMatchIndexSimple)
+		continue;
+	    f = first + i;
+	    for (k = names->first[f]; k < names->first[f + 1] && data->nfamily; k++) {
+		FcMatchIndexFamily key, *e;
+
+		key.id = names->ids[k];
+		e = bsearch (&key, data->families, data->nfamily, sizeof (FcMatchIndexFamily),
+		             FcMatchIndexFamilyCompare);
+		if (e) {
+		    if (e->strong_value < strong_value)
+			strong_value = e->strong_value;
+		    if (e->weak_value < weak_value)
+			weak_value = e->weak_value;
 		}
-		printf ("\n");
 	    }
-	    for (i = 0; i < PRI_END; i++) {
-		if (best && bestscore[i] < score[i])
+	    nodes[i].score[PRI_FAMILY_STRONG] = strong_value;
+	    nodes[i].score[PRI_FAMILY_WEAK] = weak_value;
+	}
+	break;
+    }
+    case FC_INDEX_STYLE: {
+	const FcMatchIndexNames *names = &index->names[FC_INDEX_STYLE];
+
+	for (n = 0; n < nalive; n++) {
+	    i = alive[n];
+	    if (state[i] != FcMatchIndexSimple)
+		continue;
+	    f = first + i;
+	    best = 1e99;
+	    for (j = 0; j < data->nvalue[FC_INDEX_STYLE]; j++) {
+		for (k = 0; k < names->first[f + 1] - names->first[f]; k++) {
+		    v = (data->style_ids[j] == names->ids[names->first[f] + k]) ? 0 : 1;
+		    v = v * 1000 + j * 100 + k;
+		    if (v < best)
+			best = v;
+		    if (best < 1000)
+			goto style_done;
+		}
+	    }
+	style_done:
+	    nodes[i].score[pri] += best;
+	}
+	break;
+    }
+    case FC_INDEX_LANG:
+	for (n = 0; n < nalive; n++) {
+	    const FcChar32 *map;
+
+	    i = alive[n];
+	    if (state[i] != FcMatchIndexSimple)
+		continue;
+	    map = &index->lang[(first + i) * NUM_LANG_SET_MAP];
+	    best = 1e99;
+	    for (j = 0; j < data->nvalue[FC_INDEX_LANG]; j++) {
+		const FcChar32 *equal = &data->lang_equal[j * NUM_LANG_SET_MAP];
+		const FcChar32 *territory = &data->lang_territory[j * NUM_LANG_SET_MAP];
+		FcChar32        eq = 0, terr = 0;
+
+		for (k = 0; k < NUM_LANG_SET_MAP; k++) {
+		    eq |= map[k] & equal[k];
+		    terr |= map[k] & territory[k];
+		}
+		/* FcLangEqual, FcLangDifferentTerritory or FcLangDifferentLang */
+		v = eq ? 0 : terr ? 1 : 2;
+		v = v * 1000 + j * 100;
+		if (v < best)
+		    best = v;
+		if (best < 1000)
 		    break;
-		if (!best || score[i] < bestscore[i]) {
-		    for (i = 0; i < PRI_END; i++)
-			bestscore[i] = score[i];
-		    best = s->fonts[f];
+	    }
+	    nodes[i].score[pri] += best;
+	}
+	break;
+    default: {
+	const double *b2 = index->begin[c] + first;
+	const double *e2 = index->end[c] + first;
+	const double *b1 = data->begin[c];
+	const double *e1 = data->end[c];
+
+	for (n = 0; n < nalive; n++) {
+	    i = alive[n];
+	    if (state[i] != FcMatchIndexSimple)
+		continue;
+	    best = 1e99;
+	    for (j = 0; j < data->nvalue[c]; j++) {
+		if (c >= FC_INDEX_BOOL_BEGIN) {
+		    /* FcCompareBool; FcDontCare matches either */
+		    v = (((int)b2[i] ^ (int)b1[j]) == 1);
+		} else {
+		    /* FcCompareNumber, FcCompareRange and FcCompareSize */
+		    if (e1[j] < b2[i] || e2[i] < b1[j])
+			v = FC_MIN (fabs (b2[i] - e1[j]), fabs (b1[j] - e2[i]));
+		    else if (c == FC_INDEX_SIZE && b2[i] != e2[i] && b1[j] == e2[i])
+			v = 1e-15;
+		    else
+			v = 0.0;
+		}
+		v = v * 1000 + j * 100;
+		if (v < best)
+		    best = v;
+		if (best < 1000)
 		    break;
+	    }
+	    nodes[i].score[pri] += best;
+	}
+	break;
+    }
+    }
+}
+
+/*
+ * Score fonts [first, first + count) of the indexed set into 'nodes'
+ * in priority order, using the index columns where possible and
+ * FcCompareValueList for everything else.  When 'bound' is given,
+ * fonts are dropped as soon as the priorities scored so far are worse
+ * than it, leaving their scores incomplete as in FcCompareBounded.
+ */
+static FcBool
+FcCompareIndexed (FcPattern     *pat,
+                  FcCompareData *data,
+                  int            first,
+                  int            count,
+                  FcSortNode    *nodes,
+                  const double  *bound,
+                  FcResult      *result)
+{
+    const FcMatchIndex *index = data->index;
+    const FcPatternElt *elt_i1, *elt_i2;
+    int                 alive[FC_MATCH_BLOCK];
+    FcBool              better[FC_MATCH_BLOCK];
+    int                 nalive, c, i, j, n, p, done = 0;
+
+    for (i = 0; i < count; i++) {
+	nodes[i].pattern = index->set->fonts[first + i];
+	for (j = 0; j < PRI_END; j++)
+	    nodes[i].score[j] = 0.0;
+	alive[i] = i;
+	better[i] = FcFalse;
+    }
+    nalive = count;
+
+    for (p = 0; p < PRI_END && nalive; p++) {
+	elt_i1 = data->priority_elts[p];
+	if (!elt_i1)
+	    continue;
+	if (bound) {
+	    /* Priorities below p can't change any more */
+	    for (n = 0, j = 0; n < nalive; n++) {
+		FcBool worse = FcFalse;
+		int    k;
+
+		i = alive[n];
+		for (k = done; !better[i] && k < p; k++) {
+		    if (nodes[i].score[k] > bound[k])
+			worse = FcTrue;
+		    if (nodes[i].score[k] != bound[k])
+			break;
 		}
+		if (k < p && !worse)
+		    better[i] = FcTrue;
+		if (!worse)
+		    alive[j++] = i;
+	    }
+	    nalive = j;
+	    done = p;
+	}
+
+	c = data->columns[p];
+	if (c < 0 && !bound)
+	    continue;
+	if (c >= 0)
+	    FcCompareIndexedColumn (data, c, first, alive, nalive, nodes);
+	for (n = 0; n < nalive; n++) {
+	    i = alive[n];
+	    if (c >= 0 && index->state[c][first + i] != FcMatchIndexComplex)
+		continue;
+	    elt_i2 = FcPatternObjectFindElt (nodes[i].pattern, elt_i1->object);
+	    if (elt_i2 &&
+	        !FcCompareElt (pat, elt_i1, nodes[i].pattern, elt_i2, nodes[i].score, result, data))
+		return FcFalse;
+	}
+    }
+    if (bound)
+	return FcTrue;
+
+    /* Without a bound, score the elements without a column in one walk, as FcCompare */
+    for (i = 0; i < count; i++) {
+	FcPattern          *fnt = nodes[i].pattern;
+	const FcPatternElt *elt = FcPatternElts (fnt);
+	int                 k;
+
+	for (j = 0, k = 0; j < data->nrest && k < fnt->num;) {
+	    int cmp = FcObjectCompare (data->rest[j]->object, elt[k].object);
+
+	    if (cmp > 0)
+		k++;
+	    else if (cmp < 0)
+		j++;
+	    else {
+		if (!FcCompareElt (pat, data->rest[j], fnt, &elt[k], nodes[i].score, result, data))
+		    return FcFalse;
+		j++;
+		k++;
 	    }
 	}
     }
-
+
+    return FcTrue;
+}
+
+FcPattern *
+FcFontRenderPrepare (FcConfig  *config,
+                     FcPattern *pat,
+                     FcPattern *font)
+{
+    FcPattern    *newp;
+    int           i;
+    FcPatternElt *fe, *pe;
+    FcValue       v;
+    FcResult      result;
+    FcBool        variable = FcFalse;
+    FcStrBuf      variations;
+
+    assert (pat != NULL);
+    assert (font != NULL);
+
+    FcPatternObjectGetBool (font, FC_VARIABLE_OBJECT, 0, &variable);
+    assert (variable != FcDontCare);
+    if (variable)
+	FcStrBufInit (&variations, NULL, 0);
+
+    newp = FcPatternCreate();
+    if (!newp)
+	return NULL;
+    for (i = 0; i < font->num; i++) {
+	fe = &FcPatternElts (font)[i];
+	if (fe->object == FC_FAMILYLANG_OBJECT ||
+	    fe->object == FC_STYLELANG_OBJECT ||
+	    fe->object == FC_FULLNAMELANG_OBJECT) {
+	    /* ignore those objects. we need to deal with them
+	     * another way */
+	    continue;
+	}
+	if (fe->object == FC_FAMILY_OBJECT ||
+	    fe->object == FC_STYLE_OBJECT ||
+	    fe->object == FC_FULLNAME_OBJECT) {
+	    FcPatternElt *fel, *pel;
+
+	    FC_ASSERT_STATIC ((FC_FAMILY_OBJECT + 1) == FC_FAMILYLANG_OBJECT);
+	    FC_ASSERT_STATIC ((FC_STYLE_OBJECT + 1) == FC_STYLELANG_OBJECT);
+	    FC_ASSERT_STATIC ((FC_FULLNAME_OBJECT + 1) == FC_FULLNAMELANG_OBJECT);
+
+	    fel = FcPatternObjectFindElt (font, fe->object + 1);
+	    pel = FcPatternObjectFindElt (pat, fe->object + 1);
+
+	    if (fel && pel) {
+		/* The font has name languages, and pattern asks for specific language(s).
+		 * Match on language and and prefer that result.
+		 * Note:  Currently the code only give priority to first matching language.
+		 */
+		int              n = 1, j;
+		FcValueListPtr   l1, l2, ln = NULL, ll = NULL;
+		const FcMatcher *match = FcObjectToMatcher (pel->object, FcTrue);
+
+		if (!FcCompareValueList (pel->object, match,
+		                         FcPatternEltValues (pel),
+		                         FcPatternEltValues (fel), NULL, NULL, &n, &result)) {
+		    FcPatternDestroy (newp);
+		    return NULL;
+		}
+
+		for (j = 0, l1 = FcPatternEltValues (fe), l2 = FcPatternEltValues (fel);
+		     l1 != NULL || l2 != NULL;
+		     j++, l1 = l1 ? FcValueListNext (l1) : NULL, l2 = l2 ? FcValueListNext (l2) : NULL) {
+		    FcValueListPtr (*func) (FcValueListPtr, FcValue, FcValueBinding);
+		    FcValueBinding binding = FcValueBindingEnd;
+
+		    if (j == n) {
+			binding = FcValueBindingStrong;
+			func = FcValueListPrepend;
+		    } else
+			func = FcValueListAppend;
+		    if (l1) {
+			ln = func (ln,
+			           FcValueCanonicalize (&l1->value),
+			           l1->binding);
+		    }
+		    if (l2) {
+			if (binding == FcValueBindingEnd)
+			    binding = l2->binding;
+			ll = func (ll,
+			           FcValueCanonicalize (&l2->value),
+			           binding);
+		    }
+		}
+		FcPatternObjectListAdd (newp, fe->object, ln, FcFalse);
+		FcPatternObjectListAdd (newp, fel->object, ll, FcFalse);
+
+		continue;
+	    } else if (fel) {
+		/* Pattern doesn't ask for specific language.  Copy all for name and
+		 * lang. */
+		FcValueListPtr l1, l2;
+
+		l1 = FcValueListDuplicate (FcPatternEltValues (fe));
+		l2 = FcValueListDuplicate (FcPatternEltValues (fel));
+		FcPatternObjectListAdd (newp, fe->object, l1, FcFalse);
+		FcPatternObjectListAdd (newp, fel->object, l2, FcFalse);
+
+		continue;
+	    }
+	}
+
+	pe = FcPatternObjectFindElt (pat, fe->object);
+	if (pe) {
+	    const FcMatcher *match = FcObjectToMatcher (pe->object, FcFalse);
+	    if (!FcCompareValueList (pe->object, match,
+	                             FcPatternEltValues (pe),
+	                             FcPatternEltValues (fe), &v, NULL, NULL, &result)) {
+		FcPatternDestroy (newp);
+		return NULL;
+	    }
+	    FcPatternObjectAdd (newp, fe->object, v, FcFalse);
+
+	    /* Set font-variations settings for standard axes in variable fonts. */
+	    if (variable &&
+	        FcPatternEltValues (fe)->value.type == FcTypeRange &&
+	        (fe->object == FC_WEIGHT_OBJECT ||
+	         fe->object == FC_WIDTH_OBJECT ||
+	         fe->object == FC_SIZE_OBJECT)) {
+		double      num;
+		const char *tag = "    ";
+
+		assert (v.type == FcTypeDouble);
+		num = v.u.d;
+		if (variations.len)
+		    FcStrBufChar (&variations, ',');
+		switch (fe->object) {
+		case FC_WEIGHT_OBJECT:
+		    tag = "wght";
+		    num = FcWeightToOpenType (num);
+		    break;
+
+		case FC_WIDTH_OBJECT:
+		    tag = "wdth";
+		    break;
+
+		case FC_SIZE_OBJECT:
+		    tag = "opsz";
+		    break;
+		}
+		FcStrBufFormat (&variations, "%4s=%g", tag, num);
+	    }
+	} else {
+	    FcPatternObjectListAdd (newp, fe->object,
+	                            FcValueListDuplicate (FcPatternEltValues (fe)),
+	                            FcTrue);
+	}
+    }
+    for (i = 0; i < pat->num; i++) {
+	pe = &FcPatternElts (pat)[i];
+	fe = FcPatternObjectFindElt (font, pe->object);
+	if (!fe &&
+	    pe->object != FC_FAMILYLANG_OBJECT &&
+	    pe->object != FC_STYLELANG_OBJECT &&
+	    pe->object != FC_FULLNAMELANG_OBJECT) {
+	    FcPatternObjectListAdd (newp, pe->object,
+	                            FcValueListDuplicate (FcPatternEltValues (pe)),
+	                            FcFalse);
+	}
+    }
+
+    if (variable && variations.len) {
+	FcChar8 *vars = NULL;
+	if (FcPatternObjectGetString (newp, FC_FONT_VARIATIONS_OBJECT, 0, &vars) == FcResultMatch) {
+	    FcStrBufChar (&variations, ',');
+	    FcStrBufString (&variations, vars);
+	    FcPatternObjectDel (newp, FC_FONT_VARIATIONS_OBJECT);
+	}
+
+	FcPatternObjectAddString (newp, FC_FONT_VARIATIONS_OBJECT, FcStrBufDoneStatic (&variations));
+	FcStrBufDestroy (&variations);
+    }
+
+    FcConfigSubstituteWithPat (config, newp, pat, FcMatchFont);
+    return newp;
+}
+
+/* The state of matching one pattern against the fonts */
+typedef struct _FcMatchState {
+    FcCompareData data;
+    double        bestscore[PRI_END];
+    double        boundscore[PRI_END];
+    FcBool        bounded;
+    FcPattern    *best;
+    int           best_set;   /* index into the sets of the best font */
+    int           best_index; /* and its index in that set */
+    int           set;        /* the set being scored */
+} FcMatchState;
+
+static void
+FcMatchStateInit (FcPattern *p, FcMatchState *state)
+{
+    int i;
+
+    for (i = 0; i < PRI_END; i++)
+	state->bestscore[i] = 0;
+    state->bounded = FcFalse;
+    state->best = 0;
+    state->best_set = -1;
+    state->best_index = -1;
+    state->set = -1;
+    if (FcDebug() & FC_DBG_MATCH) {
+	printf ("Match ");
+	FcPatternPrint (p);
+    }
+
+    FcCompareDataInit (p, &state->data);
+}
+
+/*
+ * Get ready to score the fonts of 's', set number 'set'.
+ */
+static FcBool
+FcMatchStateSetFonts (FcConfig     *config,
+                      FcPattern    *p,
+                      FcMatchState *state,
+                      FcFontSet    *s,
+                      int           set,
+                      FcResult     *result)
+{
+    state->set = set;
+    if (!FcCompareDataSetIndex (&state->data, p, FcConfigFindMatchIndex (config, s)))
+	FcCompareDataSetIndex (&state->data, p, NULL);
+    if (state->data.index &&
+        !FcCompareFamilyBound (p, &state->data, state->boundscore, &state->bounded, result))
+	return FcFalse;
+
+    return FcTrue;
+}
+
+/*
+ * Score fonts [first, first + count) of 's', keeping the best one.
+ * 'first' has to be a multiple of FC_MATCH_BLOCK and 'count' at most
+ * FC_MATCH_BLOCK, unless the whole set is scored at once.
+ */
+static FcBool
+FcMatchStateScore (FcPattern    *p,
+                   FcMatchState *state,
+                   FcFontSet    *s,
+                   int           first,
+                   int           count,
+                   FcResult     *result)
+{
+    double      scorebuf[PRI_END], *score;
+    double     *bestscore = state->bestscore;
+    double     *boundscore = state->boundscore;
+    int         f, i;
+    FcSortNode  block[FC_MATCH_BLOCK];
+
+    for (f = first; f < first + count; f++) {
+	if (FcDebug() & FC_DBG_MATCHV) {
+	    printf ("Font %d ", f);
+	    FcPatternPrint (s->fonts[f]);
+	}
+	if (state->data.index) {
+	    if (f % FC_MATCH_BLOCK == 0 &&
+	        !FcCompareIndexed (p, &state->data, f, FC_MIN (FC_MATCH_BLOCK, first + count - f),
+	                           block, state->bounded ? boundscore : NULL, result))
+		return FcFalse;
+	    score = block[f % FC_MATCH_BLOCK].score;
+	} else if (state->bounded && !(FcDebug() & FC_DBG_MATCHV)) {
+	    score = scorebuf;
+	    if (!FcCompareBounded (p, s->fonts[f], score, boundscore, result, &state->data))
+		return FcFalse;
+	} else {
+	    score = scorebuf;
+	    if (!FcCompare (p, s->fonts[f], score, result, &state->data))
+		return FcFalse;
+	}
+	if (FcDebug() & FC_DBG_MATCHV) {
+	    printf ("Score");
+	    for (i = 0; i < PRI_END; i++) {
+		printf (" %g", score[i]);
+	    }
+	    printf ("\n");
+	}
+	for (i = 0; i < PRI_END; i++) {
+	    if (state->best && bestscore[i] < score[i])
+		break;
+	    if (!state->best || score[i] < bestscore[i]) {
+		for (i = 0; i < PRI_END; i++)
+		    bestscore[i] = score[i];
+		state->best = s->fonts[f];
+		state->best_set = state->set;
+		state->best_index = f;
+		if (!state->bounded || FcScoreCompare (bestscore, boundscore) < 0) {
+		    memcpy (boundscore, bestscore, sizeof (state->boundscore));
+		    state->bounded = FcTrue;
+		}
+		break;
+	    }
+	}
+    }
+
+    return FcTrue;
+}
+
+/*
+ * Copy 'best', updating the binding according to the score to indicate
+ * how exactly values matches on.
+ */
+static FcPattern *
+FcMatchBindBest (FcPattern *best, const double *bestscore)
+{
+    FcPattern          *pat;
+    const FcPatternElt *elt;
+    int                 i;
+
+    pat = FcPatternCreate();
+    if (!pat)
+	return NULL;
+    elt = FcPatternElts (best);
+    for (i = 0; i < FcPatternObjectCount (best); i++) {
+	const FcMatcher *match = FcObjectToMatcher (elt[i].object, FcFalse);
+	FcValueListPtr   l = FcPatternEltValues (&elt[i]);
+
+	if (!match)
+	    FcPatternObjectListAdd (pat, elt[i].object,
+	                            FcValueListDuplicate (l), FcTrue);
+	else {
+	    FcValueBinding binding = FcValueBindingWeak;
+	    FcValueListPtr newp = NULL, ll, t = NULL;
+	    FcValue        v;
+
+	    /* If the value was matched exactly, update the binding to Strong. */
+	    if (bestscore[match->strong] < 1000)
+		binding = FcValueBindingStrong;
+
+	    for (ll = l; ll != NULL; ll = FcValueListNext (ll)) {
+		if (!newp) {
+		    t = newp = FcValueListCreate();
+		} else {
+		    t->next = FcValueListCreate();
+		    t = FcValueListNext (t);
+		}
+		v = FcValueCanonicalize (&ll->value);
+		t->value = FcValueSave (v);
+		t->binding = binding;
+		t->next = NULL;
+	    }
+	    FcPatternObjectListAdd (pat, elt[i].object, newp, FcTrue);
+	}
+    }
+
+    return pat;
+}
+
+/*
+ * Done scoring, return the best font with its bindings updated.
+ */
+static FcPattern *
+FcMatchStateFinish (FcPattern    *p,
+                    FcMatchState *state,
+                    FcResult     *result)
+{
+    double    *bestscore = state->bestscore;
+    FcPattern *best = state->best, *pat = NULL;
+    int        i;
+
+    FcCompareDataClear (&state->data);
+
+    if (best)
+	pat = FcMatchBindBest (best, bestscore);
+    if (FcDebug() & FC_DBG_MATCH) {
+	printf ("Best score");
+	for (i = 0; i < PRI_END; i++)
+	    printf (" %g", bestscore[i]);
+	printf ("\n");
+	FcPatternPrint (pat);
+    }
+    if (FcDebug() & FC_DBG_MATCH2) {
+	char        *env = getenv ("FC_DBG_MATCH_FILTER");
+	FcObjectSet *os = NULL;
+
+	if (env) {
+	    char  *ss, *s;
+	    char  *p;
+	    FcBool f = FcTrue;
+
+	    ss = s = (char *)FcStrCopy ((const FcChar8 *)env);
+	    os = FcObjectSetCreate();
+	    while (f) {
+		size_t len;
+		char  *x;
+
+		if (!(p = strchr (s, ','))) {
+		    f = FcFalse;
+		    len = strlen (s);
+		} else {
+		    len = (p - s);
+		}
+		x = malloc (sizeof (char) * (len + 1));
+		if (x) {
+		    strcpy (x, s);
+		    if (FcObjectFromName (x) > 0)
+			FcObjectSetAdd (os, x);
+		    s = p + 1;
+		    free (x);
+		}
+	    }
+	    free (ss);
+	}
+	FcPatternPrint2 (p, pat, os);
+	if (os)
+	    FcObjectSetDestroy (os);
+    }
+    /* assuming that 'result' is initialized with FcResultNoMatch
+     * outside this function */
+    if (pat)
+	*result = FcResultMatch;
+
+    return pat;
+}
+
+static FcPattern *
+FcFontSetMatchInternal (FcConfig   *config,
+                        FcFontSet **sets,
+                        int         nsets,
+                        FcPattern  *p,
+                        FcResult   *result)
+{
+    FcMatchState state;
+    FcFontSet   *s;
+    int          set;
+
+    FcMatchStateInit (p, &state);
+    for (set = 0; set < nsets; set++) {
+	s = sets[set];
+	if (!s)
+	    continue;
+	if (!FcMatchStateSetFonts (config, p, &state, s, set, result) ||
+	    !FcMatchStateScore (p, &state, s, 0, s->nfont, result)) {
+	    FcCompareDataClear (&state.data);
+	    return 0;
+	}
+    }
+
+    return FcMatchStateFinish (p, &state, result);
+}
+
+/*
+ * Match all of 'patterns' in one pass over the fonts, scoring each
+ * block of fonts against every pattern while it is still in cache.
+ * The best font for each pattern is stored in 'bests', or NULL.
+ */
+static FcBool
+FcFontSetMatchBatchInternal (FcConfig   *config,
+                             FcFontSet **sets,
+                             int         nsets,
+                             FcPattern **patterns,
+                             int         npattern,
+                             FcPattern **bests,
+                             FcResult   *results)
+{
+    FcMatchState *states;
+    FcFontSet    *s;
+    int           set, f, n, i;
+
+    states = malloc (npattern * sizeof (FcMatchState));
+    if (!states)
+	return FcFalse;
+    for (i = 0; i < npattern; i++)
+	FcMatchStateInit (patterns[i], &states[i]);
+
+    for (set = 0; set < nsets; set++) {
+	s = sets[set];
+	if (!s)
+	    continue;
+	for (i = 0; i < npattern; i++) {
+	    if (!FcMatchStateSetFonts (config, patterns[i], &states[i], s, set, &results[i]))
+		goto bail;
+	}
+	for (f = 0; f < s->nfont; f += n) {
+	    n = FC_MIN (FC_MATCH_BLOCK, s->nfont - f);
+	    for (i = 0; i < npattern; i++) {
+		if (!FcMatchStateScore (patterns[i], &states[i], s, f, n, &results[i]))
+		    goto bail;
+	    }
+	}
+    }
+
+    for (i = 0; i < npattern; i++)
+	bests[i] = FcMatchStateFinish (patterns[i], &states[i], &results[i]);
+    free (states);
+
+    return FcTrue;
+
+bail:
+    for (i = 0; i < npattern; i++)
+	FcCompareDataClear (&states[i].data);
+    free (states);
+
+    return FcFalse;
+}
+
+/*
+ * Cache of FcFontMatch results, keyed by the (already substituted)
+ * request pattern.  The cached value is the best font as returned by
+ * FcFontSetMatchInternal, before FcFontRenderPrepare is applied, so
+ * a hit only skips the scoring loop over config->fonts.
+ *
+ * FcConfigSubstitute keeps its results in a cache of its own, with
+ * the pattern substituted as value.
+ */
+typedef struct _FcMatchCacheEntry FcMatchCacheEntry;
+
+struct _FcMatchCacheEntry {
+    FcMatchCacheEntry *prev; /* towards the most recently used entry */
+    FcMatchCacheEntry *next; /* towards the least recently used entry */
+    FcChar32           hash;
+    FcPattern         *pattern;
+    FcPattern         *best;
+};
+
+struct _FcMatchCache {
+    FcMutex           lock;
+    int               size;   /* maximum number of entries, 0 disables */
+    int               count;  /* current number of entries */
+    unsigned int      serial; /* bumped whenever the cache is cleared */
+    unsigned long     hits;
+    unsigned long     misses;
+    FcHashTable      *table;
+    FcMatchCacheEntry lru; /* list head; lru.next is the most recent */
+};
+
+static FcChar32
+FcMatchCacheEntryHash (const FcChar8 *data)
+{
+    return ((const FcMatchCacheEntry *)data)->hash;
+}
+
+/*
+ * FcPatternEqual ignores value bindings, but strong and weak
+ * family bindings score differently, so compare those too.
+ */
+static int
+FcMatchCacheEntryCompare (const FcChar8 *v1, const FcChar8 *v2)
+{
+    const FcMatchCacheEntry *a = (const FcMatchCacheEntry *)v1;
+    const FcMatchCacheEntry *b = (const FcMatchCacheEntry *)v2;
+    FcPatternElt            *ea, *eb;
+    FcValueListPtr           la, lb;
+    int                      i;
+
+    if (a->hash != b->hash || !FcPatternEqual (a->pattern, b->pattern))
+	return 1;
+    ea = FcPatternElts (a->pattern);
+    eb = FcPatternElts (b->pattern);
+    for (i = 0; i < FcPatternObjectCount (a->pattern); i++) {
+	for (la = FcPatternEltValues (&ea[i]), lb = FcPatternEltValues (&eb[i]);
+	     la && lb;
+	     la = FcValueListNext (la), lb = FcValueListNext (lb)) {
+	    if (la->binding != lb->binding)
+		return 1;
+	}
+    }
+    return 0;
+}
+
+static void
+FcMatchCacheEntryDestroy (FcMatchCacheEntry *entry)
+{
+    FcPatternDestroy (entry->pattern);
+    FcPatternDestroy (entry->best);
+    free (entry);
+}
+
+static void
+FcMatchCacheUnlink (FcMatchCacheEntry *entry)
+{
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+}
+
+static void
+FcMatchCacheLinkFirst (FcMatchCache *cache, FcMatchCacheEntry *entry)
+{
+    entry->prev = &cache->lru;
+    entry->next = cache->lru.next;
+    cache->lru.next->prev = entry;
+    cache->lru.next = entry;
+}
+
+/* Must be called with cache->lock held */
+static void
+FcMatchCacheTrim (FcMatchCache *cache, int size)
+{
+    while (cache->count > size) {
+	FcMatchCacheEntry *entry = cache->lru.prev;
+
+	FcMatchCacheUnlink (entry);
+	FcHashTableRemove (cache->table, entry);
+	FcMatchCacheEntryDestroy (entry);
+	cache->count--;
+    }
+}
+
+static FcMatchCache *
+FcMatchCacheCreate (void)
+{
+    FcMatchCache *cache = malloc (sizeof (FcMatchCache));
+
+    if (!cache)
+	return NULL;
+    cache->table = FcHashTableCreate (FcMatchCacheEntryHash,
+                                      FcMatchCacheEntryCompare,
+                                      NULL, NULL, NULL, NULL);
+    if (!cache->table) {
+	free (cache);
+	return NULL;
+    }
+    FcMutexInit (&cache->lock);
+    cache->size = 0;
+    cache->count = 0;
+    cache->serial = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->lru.prev = cache->lru.next = &cache->lru;
+
+    return cache;
+}
+
+void
+FcMatchCacheDestroy (FcMatchCache *cache)
+{
+    if (!cache)
+	return;
+    FcMatchCacheTrim (cache, 0);
+    FcHashTableDestroy (cache->table);
+    FcMutexFinish (&cache->lock);
+    free (cache);
+}
+
+void
+FcMatchCacheClear (FcMatchCache *cache)
+{
+    if (!cache)
+	return;
+    FcMutexLock (&cache->lock);
+    FcMatchCacheTrim (cache, 0);
+    cache->serial++;
+    FcMutexUnlock (&cache->lock);
+}
+
+/*
+ * Look up 'p' in the cache.  On a hit, the cached best font is
+ * returned with an extra reference.  On a miss, NULL is returned
+ * and *serial is set so FcMatchCacheInsert can tell whether the
+ * cache was invalidated while the match was computed.
+ */
+FcPattern *
+FcMatchCacheLookup (FcMatchCache *cache, FcPattern *p, unsigned int *serial)
+{
+    FcMatchCacheEntry key, *entry;
+    FcPattern        *best = NULL;
+
+    key.hash = FcPatternHash (p);
+    key.pattern = p;
+    FcMutexLock (&cache->lock);
+    if (cache->size > 0) {
+	if (FcHashTableFind (cache->table, &key, (void **)&entry)) {
+	    FcMatchCacheUnlink (entry);
+	    FcMatchCacheLinkFirst (cache, entry);
+	    best = entry->best;
+	    FcPatternReference (best);
+	    cache->hits++;
+	} else
+	    cache->misses++;
+    }
+    *serial = cache->serial;
+    FcMutexUnlock (&cache->lock);
+
+    return best;
+}
+
+/*
+ * Add 'best' for 'key', a copy of the pattern looked up, which the
+ * cache takes over either way
+ */
+void
+FcMatchCacheInsertKey (FcMatchCache *cache, FcPattern *key, FcPattern *best, unsigned int serial)
+{
+    FcMatchCacheEntry *entry = malloc (sizeof (FcMatchCacheEntry));
+
+    if (!entry) {
+	FcPatternDestroy (key);
+	return;
+    }
+    entry->hash = FcPatternHash (key);
+    entry->pattern = key;
+    entry->best = best;
+    FcPatternReference (best);
+
+    FcMutexLock (&cache->lock);
+    if (cache->size > 0 && cache->serial == serial &&
+        FcHashTableAdd (cache->table, entry, entry)) {
+	FcMatchCacheLinkFirst (cache, entry);
+	cache->count++;
+	FcMatchCacheTrim (cache, cache->size);
+	entry = NULL;
+    }
+    FcMutexUnlock (&cache->lock);
+
+    /* Disabled, invalidated meanwhile or already added by another thread */
+    if (entry)
+	FcMatchCacheEntryDestroy (entry);
+}
+
+void
+FcMatchCacheInsert (FcMatchCache *cache, FcPattern *p, FcPattern *best, unsigned int serial)
+{
+    FcPattern *key = FcPatternDuplicate (p);
+
+    if (key)
+	FcMatchCacheInsertKey (cache, key, best, serial);
+}
+
+/*
+ * Resize the cache in '*cachep', creating it unless 'size' is 0
+ */
+FcBool
+FcMatchCacheSetSize (FcMatchCache **cachep, int size)
+{
+    FcMatchCache *cache;
+
+    if (size < 0)
+	size = 0;
+retry:
+    cache = fc_atomic_ptr_get (cachep);
+    if (!cache) {
+	if (size == 0)
+	    return FcTrue;
+	cache = FcMatchCacheCreate();
+	if (!cache)
+	    return FcFalse;
+	if (!fc_atomic_ptr_cmpexch (cachep, NULL, cache)) {
+	    FcMatchCacheDestroy (cache);
+	    goto retry;
+	}
+    }
+    FcMutexLock (&cache->lock);
+    cache->size = size;
+    FcMatchCacheTrim (cache, size);
+    FcMutexUnlock (&cache->lock);
+
+    return FcTrue;
+}
+
+void
+FcMatchCacheGetStats (FcMatchCache  *cache,
+                      unsigned long *hits,
+                      unsigned long *misses)
+{
+    unsigned long h = 0, m = 0;
+
+    if (cache) {
+	FcMutexLock (&cache->lock);
+	h = cache->hits;
+	m = cache->misses;
+	FcMutexUnlock (&cache->lock);
+    }
+    if (hits)
+	*hits = h;
+    if (misses)
+	*misses = m;
+}
+
+FcBool
+FcConfigSetMatchCacheSize (FcConfig *config, int size)
+{
+    FcBool ret;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return FcFalse;
+    ret = FcMatchCacheSetSize (&config->match_cache, size);
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+void
+FcConfigGetMatchCacheStats (FcConfig      *config,
+                            unsigned long *hits,
+                            unsigned long *misses)
+{
+    config = FcConfigReference (config);
+    FcMatchCacheGetStats (config ? fc_atomic_ptr_get (&config->match_cache) : NULL,
+                          hits, misses);
+    if (config)
+	FcConfigDestroy (config);
+}
+
+FcPattern *
+FcFontSetMatch (FcConfig   *config,
+                FcFontSet **sets,
+                int         nsets,
+                FcPattern  *p,
+                FcResult   *result)
+{
+    FcPattern *best, *ret = NULL;
+
+    assert (sets != NULL);
+    assert (p != NULL);
+    assert (result != NULL);
+
+    *result = FcResultNoMatch;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return NULL;
+    best = FcFontSetMatchInternal (config, sets, nsets, p, result);
+    if (best) {
+	ret = FcFontRenderPrepare (config, p, best);
+	FcPatternDestroy (best);
+    }
+
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+FcPattern *
+FcFontMatch (FcConfig  *config,
+             FcPattern *p,
+             FcResult  *result)
+{
+    FcFontSet    *sets[2];
+    int           nsets;
+    FcPattern    *best, *ret = NULL;
+    FcMatchCache *cache;
+    unsigned int  serial = 0;
+
+    assert (p != NULL);
+    assert (result != NULL);
+
+    *result = FcResultNoMatch;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return NULL;
+
+    cache = fc_atomic_ptr_get (&config->match_cache);
+    if (cache && (best = FcMatchCacheLookup (cache, p, &serial))) {
+	if (FcDebug() & FC_DBG_MATCH) {
+	    printf ("Match (cached) ");
+	    FcPatternPrint (p);
+	}
+	*result = FcResultMatch;
+	goto prepare;
+    }
+
+    nsets = 0;
+    if (config->fonts[FcSetSystem])
+	sets[nsets++] = config->fonts[FcSetSystem];
+    if (config->fonts[FcSetApplication])
+	sets[nsets++] = config->fonts[FcSetApplication];
+
+    best = FcFontSetMatchInternal (config, sets, nsets, p, result);
+    if (best && cache)
+	FcMatchCacheInsert (cache, p, best, serial);
+prepare:
+    if (best) {
+	ret = FcFontRenderPrepare (config, p, best);
+	FcPatternDestroy (best);
+    }
+
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+FcBool
+FcFontSetMatchBatch (FcConfig   *config,
+                     FcFontSet **sets,
+                     int         nsets,
+                     FcPattern **patterns,
+                     int         npattern,
+                     FcPattern **matches,
+                     FcResult   *results)
+{
+    FcBool ret = FcFalse;
+    int    i;
+
+    assert (sets != NULL);
+    assert (npattern == 0 || (patterns != NULL && matches != NULL && results != NULL));
+
+    for (i = 0; i < npattern; i++) {
+	matches[i] = NULL;
+	results[i] = FcResultNoMatch;
+    }
+
+    config = FcConfigReference (config);
+    if (!config)
+	return FcFalse;
+    if (!FcFontSetMatchBatchInternal (config, sets, nsets, patterns, npattern,
+                                      matches, results))
+	goto bail;
+    for (i = 0; i < npattern; i++) {
+	FcPattern *best = matches[i];
+
+	if (best) {
+	    matches[i] = FcFontRenderPrepare (config, patterns[i], best);
+	    FcPatternDestroy (best);
+	}
+    }
+    ret = FcTrue;
+bail:
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+FcBool
+FcFontMatchBatch (FcConfig   *config,
+                  FcPattern **patterns,
+                  int         npattern,
+                  FcPattern **matches,
+                  FcResult   *results)
+{
+    FcFontSet    *sets[2];
+    int           nsets;
+    FcPattern   **todo = NULL;
+    int          *todo_index;
+    unsigned int *serial;
+    int           ntodo = 0, i, j;
+    FcMatchCache *cache;
+    FcBool        ret = FcFalse;
+
+    assert (npattern == 0 || (patterns != NULL && matches != NULL && results != NULL));
+
+    for (i = 0; i < npattern; i++) {
+	matches[i] = NULL;
+	results[i] = FcResultNoMatch;
+    }
+
+    config = FcConfigReference (config);
+    if (!config)
+	return FcFalse;
+
+    /* freed below */
+    todo = malloc (npattern * (sizeof (FcPattern *) + sizeof (int) + sizeof (unsigned int)) + 1);
+    if (!todo)
+	goto bail;
+    todo_index = (int *)(todo + npattern);
+    serial = (unsigned int *)(todo_index + npattern);
+
+    /* Only the patterns missing from the match cache are scored */
+    cache = fc_atomic_ptr_get (&config->match_cache);
+    for (i = 0; i < npattern; i++) {
+	unsigned int cache_serial = 0;
+
+	if (cache && (matches[i] = FcMatchCacheLookup (cache, patterns[i], &cache_serial))) {
+	    if (FcDebug() & FC_DBG_MATCH) {
+		printf ("Match (cached) ");
+		FcPatternPrint (patterns[i]);
+	    }
+	    results[i] = FcResultMatch;
+	    continue;
+	}
+	serial[ntodo] = cache_serial;
+	todo_index[ntodo] = i;
+	todo[ntodo++] = patterns[i];
+    }
+
+    nsets = 0;
+    if (config->fonts[FcSetSystem])
+	sets[nsets++] = config->fonts[FcSetSystem];
+    if (config->fonts[FcSetApplication])
+	sets[nsets++] = config->fonts[FcSetApplication];
+
+    /* The matches of the patterns left are collected at the front of 'todo' */
+    if (ntodo) {
+	FcPattern **bests = todo;
+	FcResult   *todo_results;
+
+	todo_results = malloc (ntodo * sizeof (FcResult));
+	if (!todo_results)
+	    goto bail;
+	if (!FcFontSetMatchBatchInternal (config, sets, nsets, todo, ntodo,
+	                                  bests, todo_results)) {
+	    free (todo_results);
+	    goto bail;
+	}
+	for (j = 0; j < ntodo; j++) {
+	    i = todo_index[j];
+	    matches[i] = bests[j];
+	    results[i] = todo_results[j];
+	    if (matches[i] && cache)
+		FcMatchCacheInsert (cache, patterns[i], matches[i], serial[j]);
+	}
+	free (todo_results);
+    }
+    for (i = 0; i < npattern; i++) {
+	FcPattern *best = matches[i];
+
+	if (best) {
+	    matches[i] = FcFontRenderPrepare (config, patterns[i], best);
+	    FcPatternDestroy (best);
+	}
+    }
+    ret = FcTrue;
+bail:
+    if (!ret) {
+	for (i = 0; i < npattern; i++) {
+	    if (matches[i])
+		FcPatternDestroy (matches[i]);
+	    matches[i] = NULL;
+	}
+    }
+    free (todo);
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+/*
+ * FcMatchHandle is allocated by the caller, FcMatchPrivateHandle is
+ * what it holds.
+ */
+typedef struct _FcMatchPrivateHandle {
+    FcPattern *font;
+    int        set;
+    int        index;
+    double     score[PRI_END];
+} FcMatchPrivateHandle;
+
+FC_ASSERT_STATIC (sizeof (FcMatchPrivateHandle) <= sizeof (FcMatchHandle));
+
+static FcBool
+FcFontSetMatchLookupInternal (FcConfig      *config,
+                              FcFontSet    **sets,
+                              int            nsets,
+                              FcPattern     *p,
+                              FcMatchHandle *handle,
+                              FcResult      *result)
+{
+    FcMatchPrivateHandle *priv = (FcMatchPrivateHandle *)handle;
+    FcMatchState          state;
+    FcFontSet            *s;
+    int                   set, i;
+
+    FcMatchStateInit (p, &state);
+    for (set = 0; set < nsets; set++) {
+	s = sets[set];
+	if (!s)
+	    continue;
+	if (!FcMatchStateSetFonts (config, p, &state, s, set, result) ||
+	    !FcMatchStateScore (p, &state, s, 0, s->nfont, result)) {
+	    FcCompareDataClear (&state.data);
+	    return FcFalse;
+	}
+    }
+    FcCompareDataClear (&state.data);
+
+    if (FcDebug() & FC_DBG_MATCH) {
+	printf ("Best score");
+	for (i = 0; i < PRI_END; i++)
+	    printf (" %g", state.bestscore[i]);
+	printf ("\n");
+	if (state.best)
+	    FcPatternPrint (state.best);
+    }
+    if (state.best) {
+	FcPatternReference (state.best);
+	priv->font = state.best;
+	priv->set = state.best_set;
+	priv->index = state.best_index;
+	memcpy (priv->score, state.bestscore, sizeof (priv->score));
+	*result = FcResultMatch;
+    }
+
+    return FcTrue;
+}
+
+FcBool
+FcFontSetMatchLookup (FcConfig      *config,
+                      FcFontSet    **sets,
+                      int            nsets,
+                      FcPattern     *p,
+                      FcMatchHandle *handle,
+                      FcResult      *result)
+{
+    FcMatchPrivateHandle *priv = (FcMatchPrivateHandle *)handle;
+    FcBool                ret;
+
+    assert (sets != NULL);
+    assert (p != NULL);
+    assert (handle != NULL);
+    assert (result != NULL);
+
+    *result = FcResultNoMatch;
+    priv->font = NULL;
+    priv->set = priv->index = -1;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return FcFalse;
+    ret = FcFontSetMatchLookupInternal (config, sets, nsets, p, handle, result);
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+FcBool
+FcFontMatchLookup (FcConfig      *config,
+                   FcPattern     *p,
+                   FcMatchHandle *handle,
+                   FcResult      *result)
+{
+    FcMatchPrivateHandle *priv = (FcMatchPrivateHandle *)handle;
+    FcFontSet            *sets[2];
+    FcSetName             names[2];
+    int                   nsets;
+    FcBool                ret;
+
+    assert (p != NULL);
+    assert (handle != NULL);
+    assert (result != NULL);
+
+    *result = FcResultNoMatch;
+    priv->font = NULL;
+    priv->set = priv->index = -1;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return FcFalse;
+    nsets = 0;
+    if (config->fonts[FcSetSystem]) {
+	names[nsets] = FcSetSystem;
+	sets[nsets++] = config->fonts[FcSetSystem];
+    }
+    if (config->fonts[FcSetApplication]) {
+	names[nsets] = FcSetApplication;
+	sets[nsets++] = config->fonts[FcSetApplication];
+    }
+    ret = FcFontSetMatchLookupInternal (config, sets, nsets, p, handle, result);
+    if (priv->font)
+	priv->set = names[priv->set];
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+FcPattern *
+FcMatchHandleGetFont (const FcMatchHandle *handle)
+{
+    const FcMatchPrivateHandle *priv = (const FcMatchPrivateHandle *)handle;
+
+    return priv->font;
+}
+
+int
+FcMatchHandleGetSet (const FcMatchHandle *handle)
+{
+    const FcMatchPrivateHandle *priv = (const FcMatchPrivateHandle *)handle;
+
+    return priv->set;
+}
+
+int
+FcMatchHandleGetIndex (const FcMatchHandle *handle)
+{
+    const FcMatchPrivateHandle *priv = (const FcMatchPrivateHandle *)handle;
+
+    return priv->index;
+}
+
+int
+FcMatchHandleGetScore (const FcMatchHandle *handle,
+                       double              *score,
+                       int                  nscore)
+{
+    const FcMatchPrivateHandle *priv = (const FcMatchPrivateHandle *)handle;
+    int                         i;
+
+    if (!priv->font)
+	return 0;
+    for (i = 0; i < nscore && i < PRI_END; i++)
+	score[i] = priv->score[i];
+
+    return PRI_END;
+}
+
+FcValueBinding
+FcMatchHandleGetBinding (const FcMatchHandle *handle,
+                         const char          *object)
+{
+    const FcMatchPrivateHandle *priv = (const FcMatchPrivateHandle *)handle;
+    const FcMatcher            *match;
+    FcPatternElt               *e;
+    FcObject                    o = FcObjectFromName (object);
+
+    if (!priv->font)
+	return FcValueBindingEnd;
+    e = FcPatternObjectFindElt (priv->font, o);
+    if (!e)
+	return FcValueBindingEnd;
+    match = FcObjectToMatcher (o, FcFalse);
+    if (!match)
+	return FcPatternEltValues (e)->binding;
+
+    return priv->score[match->strong] < 1000 ? FcValueBindingStrong : FcValueBindingWeak;
+}
+
+FcPattern *
+FcMatchHandleRenderPrepare (FcConfig            *config,
+                            FcPattern           *p,
+                            const FcMatchHandle *handle)
+{
+    const FcMatchPrivateHandle *priv = (const FcMatchPrivateHandle *)handle;
+    FcPattern                  *best, *ret = NULL;
+
+    assert (p != NULL);
+
+    if (!priv->font)
+	return NULL;
+    config = FcConfigReference (config);
+    if (!config)
+	return NULL;
+    best = FcMatchBindBest (priv->font, priv->score);
+    if (best) {
+	ret = FcFontRenderPrepare (config, p, best);
+	FcPatternDestroy (best);
+    }
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+void
+FcMatchHandleClear (FcMatchHandle *handle)
+{
+    FcMatchPrivateHandle *priv = (FcMatchPrivateHandle *)handle;
+
+    if (priv->font)
+	FcPatternDestroy (priv->font);
+    priv->font = NULL;
+    priv->set = priv->index = -1;
+}
+
+static int
+FcSortCompare (const void *aa, const void *ab)
+{
+    FcSortNode *a = *(FcSortNode **)aa;
+    FcSortNode *b = *(FcSortNode **)ab;
+    double     *as = &a->score[0];
+    double     *bs = &b->score[0];
+    double      ad = 0, bd = 0;
+    int         i;
+
+    i = PRI_END;
+    while (i-- && (ad = *as++) == (bd = *bs++))
+	;
+    if (ad != bd)
+	return ad < bd ? -1 : 1;
+    /* Ties keep the order from before the language pass */
+    if (a->lang != b->lang)
+	return a->lang < b->lang ? -1 : 1;
+    return a->rank - b->rank;
+}
+
+/* Fonts scored by each FcSortScore task */
+#define FC_SORT_CHUNK 1024
+/* Below this many fonts FcFontSetSort doesn't bother with threads */
+#define FC_SORT_PARALLEL_MIN 4096
+
+/*
+ * Score fonts [first, first + count) of 's' into 'nodes', ranked from
+ * 'rank' on.
+ */
+static FcBool
+FcSortScore (FcConfig      *config,
+             FcPattern     *p,
+             FcCompareData *data,
+             FcFontSet     *s,
+             int            first,
+             int            count,
+             FcSortNode    *nodes,
+             int            rank,
+             FcResult      *result)
+{
+    FcSortNode *newp;
+    int         f, i;
+
+    for (f = first, newp = nodes; f < first + count; f++, newp++) {
+	if (FcDebug() & FC_DBG_MATCHV) {
+	    printf ("Font %d ", f);
+	    FcPatternPrint (s->fonts[f]);
+	}
+	if (data->index) {
+	    if ((f - first) % FC_MATCH_BLOCK == 0 &&
+	        !FcCompareIndexed (p, data, f, FC_MIN (FC_MATCH_BLOCK, first + count - f),
+	                           newp, NULL, result))
+		return FcFalse;
+	} else {
+	    newp->pattern = s->fonts[f];
+	    if (!FcCompare (p, newp->pattern, newp->score, result, data))
+		return FcFalse;
+	}
+	newp->rank = rank++;
+	/* TODO: Should we check a FcPattern in FcFontSet?
+	 * This way may not work if someone has own list of application fonts
+	 * That said, just to reduce the cost for lookup so far.
+	 */
+	if (config->prefer_app_fonts && s != config->fonts[FcSetApplication]) {
+	    newp->score[PRI_ORDER] += 1000;
+	}
+	newp->lang = newp->score[PRI_LANG];
+	if (FcDebug() & FC_DBG_MATCHV) {
+	    printf ("Score");
+	    for (i = 0; i < PRI_END; i++) {
+		printf (" %g", newp->score[i]);
+	    }
+	    printf ("\n");
+	}
+    }
+    return FcTrue;
+}
+
+typedef struct _FcSortTask {
+    FcFontSet *set;
+    int        first;
+    int        count;
+    int        node;
+} FcSortTask;
+
+typedef struct _FcSortWork {
+    FcConfig        *config;
+    FcPattern       *p;
+    FcSortNode      *nodes;
+    FcSortNode     **nodeps;
+    FcSortNode     **tmp;
+    FcSortTask      *tasks;
+    int              ntask;
+    int              width; /* length of the runs being merged */
+    int              nnode;
+    fc_atomic_int_t  next;
+    volatile FcBool  failed;
+    FcResult         result;
+} FcSortWork;
+
+static void
+FcSortScoreWorker (void *closure, int worker)
+{
+    FcSortWork    *w = closure;
+    FcCompareData  data;
+    FcFontSet     *current = NULL;
+    FcResult       result = FcResultMatch;
+    int            t;
+
+    FcCompareDataInit (w->p, &data);
+    while (!w->failed && (t = fc_atomic_int_add (w->next, 1)) < w->ntask) {
+	FcSortTask *task = &w->tasks[t];
+
+	if (task->set != current) {
+	    current = task->set;
+	    if (!FcCompareDataSetIndex (&data, w->p, FcConfigFindMatchIndex (w->config, current)))
+		FcCompareDataSetIndex (&data, w->p, NULL);
+	}
+	if (!FcSortScore (w->config, w->p, &data, task->set, task->first, task->count,
+	                  w->nodes + task->node, task->node, &result)) {
+	    w->result = result;
+	    w->failed = FcTrue;
+	}
+    }
+    FcCompareDataClear (&data);
+}
+
+/*
+ * Sort each run of 'width' nodes, or merge pairs of sorted runs of
+ * 'width' nodes into 'tmp'.
+ */
+static void
+FcSortMergeWorker (void *closure, int worker)
+{
+    FcSortWork  *w = closure;
+    FcSortNode **a, **b, **a_end, **b_end, **out;
+    int          t, first;
+
+    while ((t = fc_atomic_int_add (w->next, 1)) < w->ntask) {
+	if (!w->tmp) {
+	    first = t * w->width;
+	    qsort (w->nodeps + first, FC_MIN (w->width, w->nnode - first),
+	           sizeof (FcSortNode *), FcSortCompare);
+	    continue;
+	}
+	first = t * 2 * w->width;
+	a = w->nodeps + first;
+	a_end = b = w->nodeps + FC_MIN (first + w->width, w->nnode);
+	b_end = w->nodeps + FC_MIN (first + 2 * w->width, w->nnode);
+	out = w->tmp + first;
+	while (a < a_end && b < b_end)
+	    *out++ = FcSortCompare (a, b) <= 0 ? *a++ : *b++;
+	while (a < a_end)
+	    *out++ = *a++;
+	while (b < b_end)
+	    *out++ = *b++;
+    }
+}
+
+/*
+ * Sort 'nodeps' on 'nworker' threads: sort one run per worker, then
+ * merge the runs pairwise.  FcSortCompare is a total order, so this
+ * gives the same result as a single qsort.
+ */
+static void
+FcSortNodesParallel (FcSortNode **nodeps, int nnode, int nworker)
+{
+    FcSortWork w;
+
+    memset (&w, 0, sizeof (w));
+    w.nodeps = nodeps;
+    w.nnode = nnode;
+    w.width = (nnode + nworker - 1) / nworker;
+    w.ntask = nworker;
+    FcWorkersRun (nworker, FcSortMergeWorker, &w);
+
+    w.tmp = malloc (nnode * sizeof (FcSortNode *));
+    if (!w.tmp) {
+	qsort (nodeps, nnode, sizeof (FcSortNode *), FcSortCompare);
+	return;
+    }
+    for (; w.width < nnode; w.width *= 2) {
+	FcSortNode **swap;
+
+	w.ntask = (nnode + 2 * w.width - 1) / (2 * w.width);
+	w.next = 0;
+	FcWorkersRun (FC_MIN (nworker, w.ntask), FcSortMergeWorker, &w);
+	swap = w.nodeps;
+	w.nodeps = w.tmp;
+	w.tmp = swap;
+    }
+    if (w.nodeps != nodeps) {
+	memcpy (nodeps, w.nodeps, nnode * sizeof (FcSortNode *));
+	w.tmp = w.nodeps;
+    }
+    free (w.tmp);
+}
+
+/*
+ * Score all fonts of 'sets' into 'nodes' on 'nworker' threads, each
+ * with its own FcCompareData.
+ */
+static FcBool
+FcSortScoreParallel (FcConfig   *config,
+                     FcFontSet **sets,
+                     int         nsets,
+                     FcPattern  *p,
+                     FcSortNode *nodes,
+                     int         nnode,
+                     int         nworker,
+                     FcResult   *result)
+{
+    FcSortWork w;
+    int        set, f, node = 0;
+
+    memset (&w, 0, sizeof (w));
+    w.config = config;
+    w.p = p;
+    w.nodes = nodes;
+    w.tasks = malloc (((nnode + FC_SORT_CHUNK - 1) / FC_SORT_CHUNK + nsets) * sizeof (FcSortTask));
+    if (!w.tasks)
+	return FcFalse;
+    for (set = 0; set < nsets; set++) {
+	FcFontSet *s = sets[set];
+
+	if (!s)
+	    continue;
+	for (f = 0; f < s->nfont; f += FC_SORT_CHUNK) {
+	    FcSortTask *task = &w.tasks[w.ntask++];
+
+	    task->set = s;
+	    task->first = f;
+	    task->count = FC_MIN (FC_SORT_CHUNK, s->nfont - f);
+	    task->node = node;
+	    node += task->count;
+	}
+    }
+    FcWorkersRun (nworker, FcSortScoreWorker, &w);
+    free (w.tasks);
+    if (w.failed) {
+	*result = w.result;
+	return FcFalse;
+    }
+
+    return FcTrue;
+}
+
+static FcBool
+FcSortWalk (FcSortNode **n, int nnode, FcFontSet *fs, FcCharSet **csp, FcBool trim)
+{
+    FcBool     ret = FcFalse;
+    FcCharSet *cs;
+    int        i;
+
+    cs = 0;
+    if (trim || csp) {
+	cs = FcCharSetCreate();
+	if (cs == NULL)
+	    goto bail;
+    }
+
+    for (i = 0; i < nnode; i++) {
+	FcSortNode *node = *n++;
+	FcBool      adds_chars = FcFalse;
+
+	/*
+	 * Only fetch node charset if we'd need it
+	 */
+	if (cs) {
+	    FcCharSet *ncs;
+
+	    if (FcPatternGetCharSet (node->pattern, FC_CHARSET, 0, &ncs) !=
+	        FcResultMatch)
+		continue;
+
+	    if (!FcCharSetMerge (cs, ncs, &adds_chars))
+		goto bail;
+	}
+
+	/*
+	 * If this font isn't a subset of the previous fonts,
+	 * add it to the list
+	 */
+	if (!i || !trim || adds_chars) {
+	    FcPatternReference (node->pattern);
+	    if (FcDebug() & FC_DBG_MATCHV) {
+		printf ("Add ");
+		FcPatternPrint (node->pattern);
+	    }
+	    if (!FcFontSetAdd (fs, node->pattern)) {
+		FcPatternDestroy (node->pattern);
+		goto bail;
+	    }
+	}
+    }
+    if (csp) {
+	*csp = cs;
+	cs = 0;
+    }
+
+    ret = FcTrue;
+
+bail:
+    if (cs)
+	FcCharSetDestroy (cs);
+
+    return ret;
+}
+
+void
+FcFontSetSortDestroy (FcFontSet *fs)
+{
+    FcFontSetDestroy (fs);
+}
+
+/* Number of threads to sort 'nnode' fonts on */
+static int
+FcSortWorkers (FcConfig *config, int nnode)
+{
+    if (nnode < FC_SORT_PARALLEL_MIN || (FcDebug() & FC_DBG_MATCHV))
+	return 1;
+    return FC_MIN (config->nthreads, nnode / FC_SORT_CHUNK);
+}
+
+/*
+ * Score all fonts of 'sets' into 'nodes', on 'nworker' threads.
+ */
+static FcBool
+FcSortScoreSets (FcConfig   *config,
+                 FcFontSet **sets,
+                 int         nsets,
+                 FcPattern  *p,
+                 FcSortNode *nodes,
+                 int         nnode,
+                 int         nworker,
+                 FcResult   *result)
+{
+    FcCompareData data;
+    FcSortNode   *newp = nodes;
+    FcFontSet    *s;
+    int           set;
+
+    if (nworker > 1)
+	return FcSortScoreParallel (config, sets, nsets, p, nodes, nnode, nworker, result);
+
+    FcCompareDataInit (p, &data);
+    for (set = 0; set < nsets; set++) {
+	s = sets[set];
+	if (!s)
+	    continue;
+	if (!FcCompareDataSetIndex (&data, p, FcConfigFindMatchIndex (config, s)))
+	    FcCompareDataSetIndex (&data, p, NULL);
+	if (!FcSortScore (config, p, &data, s, 0, s->nfont, newp, newp - nodes, result)) {
+	    FcCompareDataClear (&data);
+	    return FcFalse;
+	}
+	newp += s->nfont;
+    }
     FcCompareDataClear (&data);
 
-    /* Update the binding according to the score to indicate how exactly values matches on. */
-    if (best) {
-	pat = FcPatternCreate();
-	elt = FcPatternElts (best);
-	for (i = 0; i < FcPatternObjectCount (best); i++) {
-	    const FcMatcher *match = FcObjectToMatcher (elt[i].object, FcFalse);
-	    FcValueListPtr   l = FcPatternEltValues (&elt[i]);
-
-	    if (!match)
-		FcPatternObjectListAdd (pat, elt[i].object,
-		                        FcValueListDuplicate (l), FcTrue);
-	    else {
-		FcValueBinding binding = FcValueBindingWeak;
-		FcValueListPtr newp = NULL, ll, t = NULL;
-		FcValue        v;
-
-		/* If the value was matched exactly, update the binding to Strong. */
-		if (bestscore[match->strong] < 1000)
-		    binding = FcValueBindingStrong;
-
-		for (ll = l; ll != NULL; ll = FcValueListNext (ll)) {
-		    if (!newp) {
-			t = newp = FcValueListCreate();
-		    } else {
-			t->next = FcValueListCreate();
-			t = FcValueListNext (t);
+    return FcTrue;
+}
+
+/*
+ * Check whether 'node' is the first in sort order to match one of the
+ * pattern languages not yet satisfied, and mark that one.
+ */
+static FcBool
+FcSortSatisfyLang (FcPattern  *p,
+                   FcSortNode *node,
+                   int         nPatternLang,
+                   FcBool     *patternLangSat)
+{
+    FcValue patternLang;
+    int     i;
+
+    /*
+     * If this node matches any language, go check
+     * which ones and satisfy those entries
+     */
+    if (node->score[PRI_LANG] < 2000) {
+	for (i = 0; i < nPatternLang; i++) {
+	    FcValue nodeLang;
+
+	    if (!patternLangSat[i] &&
+	        FcPatternGet (p, FC_LANG, i, &patternLang) == FcResultMatch &&
+	        FcPatternGet (node->pattern, FC_LANG, 0, &nodeLang) == FcResultMatch) {
+		FcValue matchValue;
+		double  compare = FcCompareLang (&patternLang, &nodeLang, &matchValue);
+		if (compare >= 0 && compare < 2) {
+		    if (FcDebug() & FC_DBG_MATCHV) {
+			FcChar8 *family;
+			FcChar8 *style;
+
+			if (FcPatternGetString (node->pattern, FC_FAMILY, 0, &family) == FcResultMatch &&
+			    FcPatternGetString (node->pattern, FC_STYLE, 0, &style) == FcResultMatch)
+			    printf ("Font %s:%s matches language %d\n", family, style, i);
 		    }
-		    v = FcValueCanonicalize (&ll->value);
-		    t->value = FcValueSave (v);
-		    t->binding = binding;
-		    t->next = NULL;
+		    patternLangSat[i] = FcTrue;
+		    return FcTrue;
 		}
-		FcPatternObjectListAdd (pat, elt[i].object, newp, FcTrue);
 	    }
 	}
     }
+    return FcFalse;
+}
+
+FcFontSet *
+FcFontSetSort (FcConfig   *config,
+               FcFontSet **sets,
+               int         nsets,
+               FcPattern  *p,
+               FcBool      trim,
+               FcCharSet **csp,
+               FcResult   *result)
+{
+    FcFontSet   *ret;
+    FcFontSet   *s;
+    FcSortNode  *nodes;
+    FcSortNode **nodeps;
+    int          nnodes;
+    int          set;
+    int          f;
+    int          i;
+    int          nworker;
+    int          nPatternLang;
+    FcBool      *patternLangSat;
+    FcValue      patternLang;
+
+    assert (sets != NULL);
+    assert (p != NULL);
+    assert (result != NULL);
+
+    /* There are some implementation that relying on the result of
+     * "result" to check if the return value of FcFontSetSort
+     * is valid or not.
+     * So we should initialize it to the conservative way since
+     * this function doesn't return NULL anymore.
+     */
+    if (result)
+	*result = FcResultNoMatch;
+
     if (FcDebug() & FC_DBG_MATCH) {
-	printf ("Best score");
-	for (i = 0; i < PRI_END; i++)
-	    printf (" %g", bestscore[i]);
-	printf ("\n");
-	FcPatternPrint (pat);
+	printf ("Sort ");
+	FcPatternPrint (p);
     }
-    if (FcDebug() & FC_DBG_MATCH2) {
-	char        *env = getenv ("FC_DBG_MATCH_FILTER");
-	FcObjectSet *os = NULL;
+    nnodes = 0;
+    for (set = 0; set < nsets; set++) {
+	s = sets[set];
+	if (!s)
+	    continue;
+	nnodes += s->nfont;
+    }
+    if (!nnodes)
+	return FcFontSetCreate();
 
-	if (env) {
-	    char  *ss, *s;
-	    char  *p;
-	    FcBool f = FcTrue;
+    if (!config)
+	config = FcConfigGetCurrent();
+    FcConfigReference (config);
 
-	    ss = s = (char *)FcStrCopy ((const FcChar8 *)env);
-	    os = FcObjectSetCreate();
-	    while (f) {
-		size_t len;
-		char  *x;
+    for (nPatternLang = 0;
+         FcPatternGet (p, FC_LANG, nPatternLang, &patternLang) == FcResultMatch;
+         nPatternLang++)
+	;
 
-		if (!(p = strchr (s, ','))) {
-		    f = FcFalse;
-		    len = strlen (s);
-		} else {
-		    len = (p - s);
-		}
-		x = malloc (sizeof (char) * (len + 1));
-		if (x) {
-		    strcpy (x, s);
-		    if (FcObjectFromName (x) > 0)
-			FcObjectSetAdd (os, x);
-		    s = p + 1;
-		    free (x);
-		}
-	    }
-	    free (ss);
-	}
-	FcPatternPrint2 (p, pat, os);
-	if (os)
-	    FcObjectSetDestroy (os);
+    /* freed below */
+    nodes = malloc (nnodes * sizeof (FcSortNode) +
+                    nnodes * sizeof (FcSortNode *) +
+                    nPatternLang * sizeof (FcBool));
+    if (!nodes)
+	goto bail0;
+    nodeps = (FcSortNode **)(nodes + nnodes);
+    patternLangSat = (FcBool *)(nodeps + nnodes);
+
+    nworker = FcSortWorkers (config, nnodes);
+    if (!FcSortScoreSets (config, sets, nsets, p, nodes, nnodes, nworker, result))
+	goto bail1;
+
+    for (f = 0; f < nnodes; f++)
+	nodeps[f] = &nodes[f];
+
+    if (nworker > 1)
+	FcSortNodesParallel (nodeps, nnodes, nworker);
+    else
+	qsort (nodeps, nnodes, sizeof (FcSortNode *),
+	       FcSortCompare);
+
+    for (i = 0; i < nPatternLang; i++)
+	patternLangSat[i] = FcFalse;
+
+    for (f = 0; f < nnodes; f++) {
+	if (!FcSortSatisfyLang (p, nodeps[f], nPatternLang, patternLangSat))
+	    nodeps[f]->score[PRI_LANG] = 10000.0;
     }
-    /* assuming that 'result' is initialized with FcResultNoMatch
-     * outside this function */
-    if (pat)
+
+    /*
+     * Re-sort once the language issues have been settled
+     */
+    if (nworker > 1)
+	FcSortNodesParallel (nodeps, nnodes, nworker);
+    else
+	qsort (nodeps, nnodes, sizeof (FcSortNode *),
+	       FcSortCompare);
+
+    ret = FcFontSetCreate();
+    if (!ret)
+	goto bail1;
+
+    if (!FcSortWalk (nodeps, nnodes, ret, csp, trim))
+	goto bail2;
+
+    free (nodes);
+
+    if (ret->nfont > 0) {
 	*result = FcResultMatch;
+	if (FcDebug() & FC_DBG_MATCH) {
+	    printf ("First font ");
+	    FcPatternPrint (ret->fonts[0]);
+	}
+    }
+    if (config)
+	FcConfigDestroy (config);
 
-    return pat;
+    return ret;
+
+bail2:
+    FcFontSetDestroy (ret);
+bail1:
+    free (nodes);
+bail0:
+    if (config)
+	FcConfigDestroy (config);
+    return 0;
 }
 
-FcPattern *
-FcFontSetMatch (FcConfig   *config,
-                FcFontSet **sets,
-                int         nsets,
-                FcPattern  *p,
-                FcResult   *result)
+FcFontSet *
+FcFontSort (FcConfig   *config,
+            FcPattern  *p,
+            FcBool      trim,
+            FcCharSet **csp,
+            FcResult   *result)
 {
-    FcPattern *best, *ret = NULL;
+    FcFontSet *sets[2], *ret;
+    int        nsets;
 
-    assert (sets != NULL);
     assert (p != NULL);
     assert (result != NULL);
 
@@ -1009,355 +3459,574 @@ FcFontSetMatch (FcConfig   *config,
     config = FcConfigReference (config);
     if (!config)
 	return NULL;
-    best = FcFontSetMatchInternal (sets, nsets, p, result);
-    if (best) {
-	ret = FcFontRenderPrepare (config, p, best);
-	FcPatternDestroy (best);
-    }
-
+    nsets = 0;
+    if (config->fonts[FcSetSystem])
+	sets[nsets++] = config->fonts[FcSetSystem];
+    if (config->fonts[FcSetApplication])
+	sets[nsets++] = config->fonts[FcSetApplication];
+    ret = FcFontSetSort (config, sets, nsets, p, trim, csp, result);
     FcConfigDestroy (config);
 
     return ret;
 }
 
-FcPattern *
-FcFontMatch (FcConfig  *config,
-             FcPattern *p,
-             FcResult  *result)
+/*
+ * FcFontSortIter yields the fonts of FcFontSort one at a time.  All
+ * fonts are scored up front, but instead of sorting them the nodes are
+ * kept in a binary heap and only popped as far as the caller asks.
+ */
+struct _FcFontSortIter {
+    FcConfig    *config;
+    FcSortNode  *nodes;
+    FcSortNode **heap;
+    int          nheap;
+    int          nvisited; /* nodes popped so far */
+    FcBool       trim;
+    FcCharSet   *cs;       /* coverage of the fonts visited, for trim */
+    FcFontSet   *fonts;    /* the fonts returned so far */
+};
+
+static void
+FcSortHeapDown (FcSortNode **heap, int nheap, int i)
 {
-    FcFontSet *sets[2];
-    int        nsets;
-    FcPattern *best, *ret = NULL;
+    FcSortNode *node = heap[i];
+    int         child;
+
+    while ((child = 2 * i + 1) < nheap) {
+	if (child + 1 < nheap && FcSortCompare (&heap[child + 1], &heap[child]) < 0)
+	    child++;
+	if (FcSortCompare (&heap[child], &node) >= 0)
+	    break;
+	heap[i] = heap[child];
+	i = child;
+    }
+    heap[i] = node;
+}
+
+static void
+FcSortHeapInit (FcSortNode **heap, int nheap)
+{
+    int i;
+
+    for (i = nheap / 2 - 1; i >= 0; i--)
+	FcSortHeapDown (heap, nheap, i);
+}
+
+static FcSortNode *
+FcSortHeapPop (FcSortNode **heap, int *nheap)
+{
+    FcSortNode *node = heap[0];
+
+    heap[0] = heap[--*nheap];
+    if (*nheap)
+	FcSortHeapDown (heap, *nheap, 0);
+
+    return node;
+}
+
+/*
+ * Settle the language scores like FcFontSetSort does, visiting only
+ * the nodes that can match a pattern language, in sort order, until
+ * every language is satisfied.
+ */
+static FcBool
+FcFontSortIterLangs (FcFontSortIter *iter, FcPattern *p, int nnode)
+{
+    FcSortNode **heap = iter->heap;
+    FcSortNode **satisfied;
+    FcBool      *patternLangSat;
+    FcValue      patternLang;
+    int          nPatternLang, nsat = 0, nheap = 0, f;
+
+    for (nPatternLang = 0;
+         FcPatternGet (p, FC_LANG, nPatternLang, &patternLang) == FcResultMatch;
+         nPatternLang++)
+	;
+    satisfied = malloc (nPatternLang * sizeof (FcSortNode *) +
+                        nPatternLang * sizeof (FcBool) + 1);
+    if (!satisfied)
+	return FcFalse;
+    patternLangSat = (FcBool *)(satisfied + nPatternLang);
+    for (f = 0; f < nPatternLang; f++)
+	patternLangSat[f] = FcFalse;
+
+    for (f = 0; f < nnode; f++) {
+	if (iter->nodes[f].score[PRI_LANG] < 2000)
+	    heap[nheap++] = &iter->nodes[f];
+    }
+    FcSortHeapInit (heap, nheap);
+    while (nheap && nsat < nPatternLang) {
+	FcSortNode *node = FcSortHeapPop (heap, &nheap);
+
+	if (FcSortSatisfyLang (p, node, nPatternLang, patternLangSat))
+	    satisfied[nsat++] = node;
+    }
+    for (f = 0; f < nnode; f++)
+	iter->nodes[f].score[PRI_LANG] = 10000.0;
+    for (f = 0; f < nsat; f++)
+	satisfied[f]->score[PRI_LANG] = satisfied[f]->lang;
+    free (satisfied);
+
+    return FcTrue;
+}
+
+/*
+ * Create an iterator, keeping track of the coverage of the fonts
+ * visited when 'charsets' is set.
+ */
+static FcFontSortIter *
+FcSortIterCreate (FcConfig  *config,
+                  FcPattern *p,
+                  FcBool     trim,
+                  FcBool     charsets,
+                  FcResult  *result)
+{
+    FcFontSortIter *iter;
+    FcFontSet      *sets[2];
+    int             nsets = 0, set, nnode = 0, f;
 
     assert (p != NULL);
     assert (result != NULL);
 
     *result = FcResultNoMatch;
 
-    config = FcConfigReference (config);
-    if (!config)
+    iter = calloc (1, sizeof (FcFontSortIter));
+    if (!iter)
 	return NULL;
-    nsets = 0;
+    iter->trim = trim;
+    iter->config = FcConfigReference (config);
+    if (!iter->config)
+	goto bail;
+    config = iter->config;
     if (config->fonts[FcSetSystem])
 	sets[nsets++] = config->fonts[FcSetSystem];
     if (config->fonts[FcSetApplication])
 	sets[nsets++] = config->fonts[FcSetApplication];
-
-    best = FcFontSetMatchInternal (sets, nsets, p, result);
-    if (best) {
-	ret = FcFontRenderPrepare (config, p, best);
-	FcPatternDestroy (best);
+    for (set = 0; set < nsets; set++)
+	nnode += sets[set]->nfont;
+
+    iter->fonts = FcFontSetCreate();
+    if (!iter->fonts)
+	goto bail;
+    if (charsets) {
+	iter->cs = FcCharSetCreate();
+	if (!iter->cs)
+	    goto bail;
     }
+    if (!nnode)
+	return iter;
 
-    FcConfigDestroy (config);
+    if (FcDebug() & FC_DBG_MATCH) {
+	printf ("Sort ");
+	FcPatternPrint (p);
+    }
+    iter->nodes = malloc (nnode * (sizeof (FcSortNode) + sizeof (FcSortNode *)));
+    if (!iter->nodes)
+	goto bail;
+    iter->heap = (FcSortNode **)(iter->nodes + nnode);
 
-    return ret;
-}
+    if (!FcSortScoreSets (config, sets, nsets, p, iter->nodes, nnode,
+                          FcSortWorkers (config, nnode), result) ||
+        !FcFontSortIterLangs (iter, p, nnode))
+	goto bail;
 
-typedef struct _FcSortNode {
-    FcPattern *pattern;
-    double     score[PRI_END];
-} FcSortNode;
+    for (f = 0; f < nnode; f++)
+	iter->heap[f] = &iter->nodes[f];
+    iter->nheap = nnode;
+    FcSortHeapInit (iter->heap, iter->nheap);
+    *result = FcResultMatch;
 
-static int
-FcSortCompare (const void *aa, const void *ab)
-{
-    FcSortNode *a = *(FcSortNode **)aa;
-    FcSortNode *b = *(FcSortNode **)ab;
-    double     *as = &a->score[0];
-    double     *bs = &b->score[0];
-    double      ad = 0, bd = 0;
-    int         i;
+    return iter;
 
-    i = PRI_END;
-    while (i-- && (ad = *as++) == (bd = *bs++))
-	;
-    return ad < bd ? -1 : ad > bd ? 1
-                                  : 0;
+bail:
+    FcFontSortIterDestroy (iter);
+
+    return NULL;
 }
 
-static FcBool
-FcSortWalk (FcSortNode **n, int nnode, FcFontSet *fs, FcCharSet **csp, FcBool trim)
+FcFontSortIter *
+FcFontSortIterCreate (FcConfig  *config,
+                      FcPattern *p,
+                      FcBool     trim,
+                      FcResult  *result)
 {
-    FcBool     ret = FcFalse;
-    FcCharSet *cs;
-    int        i;
+    assert (p != NULL);
+    assert (result != NULL);
 
-    cs = 0;
-    if (trim || csp) {
-	cs = FcCharSetCreate();
-	if (cs == NULL)
-	    goto bail;
-    }
+    return FcSortIterCreate (config, p, trim, trim, result);
+}
 
-    for (i = 0; i < nnode; i++) {
-	FcSortNode *node = *n++;
+FcPattern *
+FcFontSortIterNext (FcFontSortIter *iter)
+{
+    while (iter && iter->nheap) {
+	FcSortNode *node = FcSortHeapPop (iter->heap, &iter->nheap);
+	FcBool      first = iter->nvisited++ == 0;
 	FcBool      adds_chars = FcFalse;
 
-	/*
-	 * Only fetch node charset if we'd need it
-	 */
-	if (cs) {
+	/* Same as FcSortWalk */
+	if (iter->cs) {
 	    FcCharSet *ncs;
 
 	    if (FcPatternGetCharSet (node->pattern, FC_CHARSET, 0, &ncs) !=
 	        FcResultMatch)
 		continue;
 
-	    if (!FcCharSetMerge (cs, ncs, &adds_chars))
-		goto bail;
+	    if (!FcCharSetMerge (iter->cs, ncs, &adds_chars))
+		return NULL;
 	}
 
-	/*
-	 * If this font isn't a subset of the previous fonts,
-	 * add it to the list
-	 */
-	if (!i || !trim || adds_chars) {
+	if (first || !iter->trim || adds_chars) {
 	    FcPatternReference (node->pattern);
 	    if (FcDebug() & FC_DBG_MATCHV) {
 		printf ("Add ");
 		FcPatternPrint (node->pattern);
 	    }
-	    if (!FcFontSetAdd (fs, node->pattern)) {
+	    if (!FcFontSetAdd (iter->fonts, node->pattern)) {
 		FcPatternDestroy (node->pattern);
-		goto bail;
+		return NULL;
 	    }
+	    return node->pattern;
 	}
     }
-    if (csp) {
-	*csp = cs;
-	cs = 0;
-    }
-
-    ret = FcTrue;
-
-bail:
-    if (cs)
-	FcCharSetDestroy (cs);
-
-    return ret;
+    return NULL;
 }
 
 void
-FcFontSetSortDestroy (FcFontSet *fs)
+FcFontSortIterDestroy (FcFontSortIter *iter)
 {
-    FcFontSetDestroy (fs);
+    if (!iter)
+	return;
+    if (iter->fonts)
+	FcFontSetDestroy (iter->fonts);
+    if (iter->cs)
+	FcCharSetDestroy (iter->cs);
+    if (iter->nodes)
+	free (iter->nodes);
+    if (iter->config)
+	FcConfigDestroy (iter->config);
+    free (iter);
 }
 
-FcFontSet *
-FcFontSetSort (FcConfig   *config,
-               FcFontSet **sets,
-               int         nsets,
-               FcPattern  *p,
-               FcBool      trim,
-               FcCharSet **csp,
-               FcResult   *result)
-{
-    FcFontSet    *ret;
-    FcFontSet    *s;
-    FcSortNode   *nodes;
-    FcSortNode  **nodeps, **nodep;
-    int           nnodes;
-    FcSortNode   *newp;
-    int           set;
-    int           f;
-    int           i;
-    int           nPatternLang;
-    FcBool       *patternLangSat;
-    FcValue       patternLang;
-    FcCompareData data;
-
-    assert (sets != NULL);
-    assert (p != NULL);
-    assert (result != NULL);
+/*
+ * The best 'size' nodes added so far.  Once full, the nodes are kept
+ * in a heap with the worst one on top, to be replaced by better ones.
+ */
+typedef struct _FcSortTop {
+    FcSortNode  *nodes;
+    FcSortNode **heap;
+    int          nheap;
+    int          size;
+} FcSortTop;
 
-    /* There are some implementation that relying on the result of
-     * "result" to check if the return value of FcFontSetSort
-     * is valid or not.
-     * So we should initialize it to the conservative way since
-     * this function doesn't return NULL anymore.
-     */
-    if (result)
-	*result = FcResultNoMatch;
+static void
+FcSortTopDown (FcSortNode **heap, int nheap, int i)
+{
+    FcSortNode *node = heap[i];
+    int         child;
 
-    if (FcDebug() & FC_DBG_MATCH) {
-	printf ("Sort ");
-	FcPatternPrint (p);
-    }
-    nnodes = 0;
-    for (set = 0; set < nsets; set++) {
-	s = sets[set];
-	if (!s)
-	    continue;
-	nnodes += s->nfont;
+    while ((child = 2 * i + 1) < nheap) {
+	if (child + 1 < nheap && FcSortCompare (&heap[child + 1], &heap[child]) > 0)
+	    child++;
+	if (FcSortCompare (&heap[child], &node) <= 0)
+	    break;
+	heap[i] = heap[child];
+	i = child;
     }
-    if (!nnodes)
-	return FcFontSetCreate();
+    heap[i] = node;
+}
 
-    if (!config)
-	config = FcConfigGetCurrent();
-    FcConfigReference (config);
+static void
+FcSortTopAdd (FcSortTop *top, FcSortNode *node)
+{
+    int i;
+
+    if (top->nheap < top->size) {
+	top->heap[top->nheap] = &top->nodes[top->nheap];
+	*top->heap[top->nheap++] = *node;
+	if (top->nheap == top->size) {
+	    for (i = top->nheap / 2 - 1; i >= 0; i--)
+		FcSortTopDown (top->heap, top->nheap, i);
+	}
+    } else if (top->size && FcSortCompare (&node, &top->heap[0]) < 0) {
+	*top->heap[0] = *node;
+	FcSortTopDown (top->heap, top->nheap, 0);
+    }
+}
 
-    for (nPatternLang = 0;
-         FcPatternGet (p, FC_LANG, nPatternLang, &patternLang) == FcResultMatch;
-         nPatternLang++)
-	;
+/*
+ * Collect the best 'size' fonts of 'sets' in final sort order into
+ * 'nodeps', returning their number.
+ *
+ * The language pass of FcFontSetSort needs the whole sort order, but
+ * only the first fonts matching each pattern language can satisfy it:
+ * with 'nlang' languages, every font matching a language ahead of the
+ * first 'nlang' ones finds all the languages it could satisfy taken.
+ * So besides the best fonts with their language score demoted, as all
+ * fonts but those satisfying a language end up, the best 'nlang' fonts
+ * of each language are kept to settle the languages with.
+ *
+ * With 'charsets', fonts without a charset, which FcSortWalk skips, are
+ * only kept as language candidates, so that the fonts with a charset
+ * are the right ones as far as 'size' of them go.
+ */
+static int
+FcSortTopNodes (FcConfig      *config,
+                FcFontSet    **sets,
+                int            nsets,
+                FcPattern     *p,
+                const FcValue *langs,
+                int            nlang,
+                FcBool         charsets,
+                FcSortNode    *nodes,
+                FcSortNode   **nodeps,
+                int            size,
+                FcResult      *result)
+{
+    FcCompareData data;
+    FcSortNode    block[FC_MATCH_BLOCK];
+    FcSortTop     top, *langtop;
+    FcSortNode  **cand;
+    FcBool       *patternLangSat;
+    FcFontSet    *s;
+    FcCharSet    *ncs;
+    FcValue       nodeLang, matchValue;
+    double        compare;
+    int           set, f, i, j, n, ncand, nsat, rank = 0, nnode = 0;
 
-    /* freed below */
-    nodes = malloc (nnodes * sizeof (FcSortNode) +
-                    nnodes * sizeof (FcSortNode *) +
-                    nPatternLang * sizeof (FcBool));
-    if (!nodes)
-	goto bail0;
-    nodeps = (FcSortNode **)(nodes + nnodes);
-    patternLangSat = (FcBool *)(nodeps + nnodes);
+    langtop = malloc (nlang * sizeof (FcSortTop) + nlang * sizeof (FcBool) + 1);
+    if (!langtop)
+	return -1;
+    patternLangSat = (FcBool *)(langtop + nlang);
+    top.nodes = nodes;
+    top.heap = nodeps;
+    top.nheap = 0;
+    top.size = size + nlang;
+    cand = nodeps + top.size;
+    for (i = 0; i < nlang; i++) {
+	langtop[i].nodes = nodes + top.size + i * nlang;
+	langtop[i].heap = cand + i * nlang;
+	langtop[i].nheap = 0;
+	langtop[i].size = nlang;
+	patternLangSat[i] = FcFalse;
+    }
 
     FcCompareDataInit (p, &data);
-
-    newp = nodes;
-    nodep = nodeps;
     for (set = 0; set < nsets; set++) {
 	s = sets[set];
 	if (!s)
 	    continue;
-	for (f = 0; f < s->nfont; f++) {
-	    if (FcDebug() & FC_DBG_MATCHV) {
-		printf ("Font %d ", f);
-		FcPatternPrint (s->fonts[f]);
-	    }
-	    newp->pattern = s->fonts[f];
-	    if (!FcCompare (p, newp->pattern, newp->score, result, &data))
-		goto bail1;
-	    /* TODO: Should we check a FcPattern in FcFontSet?
-	     * This way may not work if someone has own list of application fonts
-	     * That said, just to reduce the cost for lookup so far.
-	     */
-	    if (config->prefer_app_fonts && s != config->fonts[FcSetApplication]) {
-		newp->score[PRI_ORDER] += 1000;
+	if (!FcCompareDataSetIndex (&data, p, FcConfigFindMatchIndex (config, s)))
+	    FcCompareDataSetIndex (&data, p, NULL);
+	for (f = 0; f < s->nfont; f += n) {
+	    n = FC_MIN (FC_MATCH_BLOCK, s->nfont - f);
+	    if (!FcSortScore (config, p, &data, s, f, n, block, rank, result)) {
+		FcCompareDataClear (&data);
+		free (langtop);
+		return -1;
 	    }
-	    if (FcDebug() & FC_DBG_MATCHV) {
-		printf ("Score");
-		for (i = 0; i < PRI_END; i++) {
-		    printf (" %g", newp->score[i]);
+	    rank += n;
+	    for (j = 0; j < n; j++) {
+		if (block[j].score[PRI_LANG] < 2000 &&
+		    FcPatternGet (block[j].pattern, FC_LANG, 0, &nodeLang) == FcResultMatch) {
+		    for (i = 0; i < nlang; i++) {
+			compare = FcCompareLang (&langs[i], &nodeLang, &matchValue);
+			if (compare >= 0 && compare < 2)
+			    FcSortTopAdd (&langtop[i], &block[j]);
+		    }
 		}
-		printf ("\n");
+		if (charsets &&
+		    FcPatternGetCharSet (block[j].pattern, FC_CHARSET, 0, &ncs) != FcResultMatch)
+		    continue;
+		block[j].score[PRI_LANG] = 10000.0;
+		FcSortTopAdd (&top, &block[j]);
 	    }
-	    *nodep = newp;
-	    newp++;
-	    nodep++;
 	}
     }
-
     FcCompareDataClear (&data);
 
-    nnodes = newp - nodes;
-
-    qsort (nodeps, nnodes, sizeof (FcSortNode *),
-           FcSortCompare);
-
-    for (i = 0; i < nPatternLang; i++)
-	patternLangSat[i] = FcFalse;
-
-    for (f = 0; f < nnodes; f++) {
-	FcBool satisfies = FcFalse;
-	/*
-	 * If this node matches any language, go check
-	 * which ones and satisfy those entries
-	 */
-	if (nodeps[f]->score[PRI_LANG] < 2000) {
-	    for (i = 0; i < nPatternLang; i++) {
-		FcValue nodeLang;
-
-		if (!patternLangSat[i] &&
-		    FcPatternGet (p, FC_LANG, i, &patternLang) == FcResultMatch &&
-		    FcPatternGet (nodeps[f]->pattern, FC_LANG, 0, &nodeLang) == FcResultMatch) {
-		    FcValue matchValue;
-		    double  compare = FcCompareLang (&patternLang, &nodeLang, &matchValue);
-		    if (compare >= 0 && compare < 2) {
-			if (FcDebug() & FC_DBG_MATCHV) {
-			    FcChar8 *family;
-			    FcChar8 *style;
-
-			    if (FcPatternGetString (nodeps[f]->pattern, FC_FAMILY, 0, &family) == FcResultMatch &&
-			        FcPatternGetString (nodeps[f]->pattern, FC_STYLE, 0, &style) == FcResultMatch)
-				printf ("Font %s:%s matches language %d\n", family, style, i);
-			}
-			patternLangSat[i] = FcTrue;
-			satisfies = FcTrue;
-			break;
-		    }
-		}
-	    }
-	}
-	if (!satisfies) {
-	    nodeps[f]->score[PRI_LANG] = 10000.0;
-	}
+    /* Settle the languages in sort order, each candidate only once */
+    ncand = 0;
+    for (i = 0; i < nlang; i++) {
+	for (j = 0; j < langtop[i].nheap; j++)
+	    cand[ncand++] = langtop[i].heap[j];
+    }
+    qsort (cand, ncand, sizeof (FcSortNode *), FcSortCompare);
+    nsat = 0;
+    for (i = 0; i < ncand; i++) {
+	if (i && cand[i]->rank == cand[i - 1]->rank)
+	    continue;
+	if (FcSortSatisfyLang (p, cand[i], nlang, patternLangSat))
+	    cand[nsat++] = cand[i];
     }
 
-    /*
-     * Re-sort once the language issues have been settled
-     */
-    qsort (nodeps, nnodes, sizeof (FcSortNode *),
-           FcSortCompare);
-
-    ret = FcFontSetCreate();
-    if (!ret)
-	goto bail1;
-
-    if (!FcSortWalk (nodeps, nnodes, ret, csp, trim))
-	goto bail2;
-
-    free (nodes);
-
-    if (ret->nfont > 0) {
-	*result = FcResultMatch;
-	if (FcDebug() & FC_DBG_MATCH) {
-	    printf ("First font ");
-	    FcPatternPrint (ret->fonts[0]);
+    /* Satisfying fonts replace their demoted copies */
+    for (i = 0; i < top.nheap; i++) {
+	for (j = 0; j < nsat; j++) {
+	    if (top.heap[i]->rank == cand[j]->rank)
+		break;
 	}
+	if (j == nsat)
+	    nodeps[nnode++] = top.heap[i];
     }
-    if (config)
-	FcConfigDestroy (config);
-
-    return ret;
+    for (j = 0; j < nsat; j++)
+	nodeps[nnode++] = cand[j];
+    qsort (nodeps, nnode, sizeof (FcSortNode *), FcSortCompare);
+    free (langtop);
 
-bail2:
-    FcFontSetDestroy (ret);
-bail1:
-    free (nodes);
-bail0:
-    if (config)
-	FcConfigDestroy (config);
-    return 0;
+    return nnode;
 }
 
+/*
+ * Like FcFontSort, but only return the first 'k' fonts.  Instead of
+ * scoring every font into its own node and sorting them all, only the
+ * best ones are kept while scoring.  With trim there is no telling how
+ * many fonts add no characters and get dropped, so all the fonts are
+ * scored once into the heap of a FcFontSortIter and popped from there
+ * until 'k' are found, which still saves sorting the whole set.
+ */
 FcFontSet *
-FcFontSort (FcConfig   *config,
-            FcPattern  *p,
-            FcBool      trim,
-            FcCharSet **csp,
-            FcResult   *result)
+FcFontSortN (FcConfig   *config,
+             FcPattern  *p,
+             FcBool      trim,
+             int         k,
+             FcCharSet **csp,
+             FcResult   *result)
 {
-    FcFontSet *sets[2], *ret;
-    int        nsets;
+    FcFontSet      *sets[2], *ret = NULL;
+    FcFontSortIter *iter = NULL;
+    FcSortNode     *nodes = NULL;
+    FcSortNode    **nodeps;
+    FcCharSet      *cs = NULL;
+    FcValue        *langs = NULL;
+    FcValue         patternLang;
+    int             nsets = 0, nnodes = 0, nlang, size, nnode, set, i;
 
     assert (p != NULL);
     assert (result != NULL);
 
+    if (k <= 0)
+	return FcFontSort (config, p, trim, csp, result);
+
     *result = FcResultNoMatch;
 
     config = FcConfigReference (config);
     if (!config)
 	return NULL;
-    nsets = 0;
+    if (trim) {
+	iter = FcSortIterCreate (config, p, FcTrue, FcTrue, result);
+	if (!iter)
+	    goto bail;
+	while (iter->fonts->nfont < k && FcFontSortIterNext (iter))
+	    ;
+	ret = iter->fonts;
+	cs = iter->cs;
+	iter->fonts = NULL;
+	iter->cs = NULL;
+	FcFontSortIterDestroy (iter);
+	goto done;
+    }
     if (config->fonts[FcSetSystem])
 	sets[nsets++] = config->fonts[FcSetSystem];
     if (config->fonts[FcSetApplication])
 	sets[nsets++] = config->fonts[FcSetApplication];
-    ret = FcFontSetSort (config, sets, nsets, p, trim, csp, result);
+    for (set = 0; set < nsets; set++)
+	nnodes += sets[set]->nfont;
+
+    ret = FcFontSetCreate();
+    if (!ret)
+	goto bail;
+    if (!nnodes)
+	goto done;
+
+    if (FcDebug() & FC_DBG_MATCH) {
+	printf ("Sort %d ", k);
+	FcPatternPrint (p);
+    }
+    for (nlang = 0;
+         FcPatternGet (p, FC_LANG, nlang, &patternLang) == FcResultMatch;
+         nlang++)
+	;
+    langs = malloc (nlang * sizeof (FcValue) + 1);
+    if (!langs)
+	goto bail;
+    for (i = 0; i < nlang; i++)
+	FcPatternGet (p, FC_LANG, i, &langs[i]);
+
+    /* room for the best fonts, the language candidates and pointers to both */
+    size = FC_MIN (k, nnodes);
+    nnode = size + nlang + nlang * nlang;
+    nodes = malloc (nnode * (sizeof (FcSortNode) + sizeof (FcSortNode *)));
+    if (!nodes)
+	goto bail;
+    nodeps = (FcSortNode **)(nodes + nnode);
+    nnode = FcSortTopNodes (config, sets, nsets, p, langs, nlang, csp != NULL,
+                            nodes, nodeps, size, result);
+    if (nnode < 0)
+	goto bail;
+
+    /* Same as FcSortWalk, stopping after 'k' fonts */
+    if (csp) {
+	cs = FcCharSetCreate();
+	if (!cs)
+	    goto bail;
+    }
+    for (i = 0; i < nnode && ret->nfont < k; i++) {
+	FcSortNode *node = nodeps[i];
+
+	if (cs) {
+	    FcCharSet *ncs;
+
+	    if (FcPatternGetCharSet (node->pattern, FC_CHARSET, 0, &ncs) !=
+	        FcResultMatch)
+		continue;
+
+	    if (!FcCharSetMerge (cs, ncs, NULL))
+		goto bail;
+	}
+	FcPatternReference (node->pattern);
+	if (FcDebug() & FC_DBG_MATCHV) {
+	    printf ("Add ");
+	    FcPatternPrint (node->pattern);
+	}
+	if (!FcFontSetAdd (ret, node->pattern)) {
+	    FcPatternDestroy (node->pattern);
+	    goto bail;
+	}
+    }
+done:
+    free (nodes);
+    free (langs);
     FcConfigDestroy (config);
 
+    if (csp) {
+	*csp = cs;
+	cs = NULL;
+    }
+    if (cs)
+	FcCharSetDestroy (cs);
+    if (ret->nfont > 0) {
+	*result = FcResultMatch;
+	if (FcDebug() & FC_DBG_MATCH) {
+	    printf ("First font ");
+	    FcPatternPrint (ret->fonts[0]);
+	}
+    }
+
     return ret;
+
+bail:
+    if (ret)
+	FcFontSetDestroy (ret);
+    if (cs)
+	FcCharSetDestroy (cs);
+    if (iter)
+	FcFontSortIterDestroy (iter);
+    free (nodes);
+    free (langs);
+    FcConfigDestroy (config);
+
+    return NULL;
 }
 #define __fcmatch__
 #include "fcaliastail.h"
@@ -0,0 +1,1609 @@
+/* Copyright (C) 2026 fontconfig Authors */
+/* SPDX-License-Identifier: HPND */
+
+#include "fcint.h"
+
+#include "fcarch.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#if defined(HAVE_MMAP) || defined(__CYGWIN__)
+#  include <sys/mman.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+
+#ifndef O_BINARY
+#  define O_BINARY 0
+#endif
+
+/*
+ * A snapshot holds what the XML parser left in a configuration loaded
+ * by FcInitLoadConfig: the directory and file sets, the accept/reject
+ * globs and patterns, and the rule sets with their tests, edits and
+ * expressions.  FcConfigWriteSnapshot stores it next to the font caches,
+ * and later FcInitLoadConfig calls decode it instead of parsing
+ * fonts.conf and conf.d again, as long as
+ *
+ *  - the environment variables steering the parser have the same values,
+ *  - every configuration file and directory the parser looked for still
+ *    resolves to the same place, with the same modification time and
+ *    size, and
+ *  - the working directory is the same, if relative paths were used.
+ *
+ * Everything is stored in host byte order; the file name carries
+ * FC_ARCHITECTURE like the cache files do.
+ */
+
+#define FC_SNAPSHOT_MAGIC   0xFC5A7A01
+#define FC_SNAPSHOT_VERSION 1
+#define FC_SNAPSHOT_SUFFIX  ".snapshot"
+
+typedef struct _FcSnapshotSource {
+    FcChar8 *name; /* as given to the parser, NULL for the default file */
+    FcChar8 *path; /* what it resolved to, NULL if it didn't exist */
+    int64_t  mtime;
+    int64_t  mtime_nsec;
+    int64_t  size;
+} FcSnapshotSource;
+
+struct _FcSnapshotSources {
+    FcChar8          *key;
+    FcSnapshotSource *sources;
+    int               nsource;
+    int               nsource_alloc;
+    FcBool            cwd;   /* relative paths were resolved against the cwd */
+    FcBool            done;  /* FcInitLoadOwnConfig is done parsing */
+    FcBool            valid; /* nothing else was loaded into the config */
+    int               ncache_dir;
+    int               rescan_before;
+    int               warns_before;
+    FcBool            rescan_set;
+    int               rescan_interval;
+    FcBool            warns_set;
+    int               warns;
+};
+
+static const char *snapshot_env[] = {
+    "FONTCONFIG_FILE",
+    "FONTCONFIG_PATH",
+    "FONTCONFIG_WARN_INVALID_ATTRS",
+    "HOME",
+    "USERPROFILE",
+    "XDG_CACHE_HOME",
+    "XDG_CONFIG_HOME",
+    "XDG_DATA_HOME",
+    "XDG_DATA_DIRS",
+};
+
+void
+FcSnapshotSourcesDestroy (FcSnapshotSources *sources)
+{
+    int i;
+
+    if (!sources)
+	return;
+    for (i = 0; i < sources->nsource; i++) {
+	if (sources->sources[i].name)
+	    FcStrFree (sources->sources[i].name);
+	if (sources->sources[i].path)
+	    FcStrFree (sources->sources[i].path);
+    }
+    if (sources->sources)
+	free (sources->sources);
+    if (sources->key)
+	FcStrFree (sources->key);
+    free (sources);
+}
+
+static FcSnapshotSources *
+FcSnapshotSourcesCreate (FcChar8 *key)
+{
+    FcSnapshotSources *sources = calloc (1, sizeof (FcSnapshotSources));
+
+    if (!sources) {
+	FcStrFree (key);
+	return NULL;
+    }
+    sources->key = key;
+    sources->valid = FcTrue;
+
+    return sources;
+}
+
+static FcSnapshotSource *
+FcSnapshotSourcesAppend (FcSnapshotSources *sources)
+{
+    FcSnapshotSource *s;
+
+    if (sources->nsource == sources->nsource_alloc) {
+	int alloc = sources->nsource_alloc ? sources->nsource_alloc * 2 : 64;
+
+	s = realloc (sources->sources, alloc * sizeof (FcSnapshotSource));
+	if (!s)
+	    return NULL;
+	sources->sources = s;
+	sources->nsource_alloc = alloc;
+    }
+    s = &sources->sources[sources->nsource++];
+    memset (s, 0, sizeof (*s));
+
+    return s;
+}
+
+static void
+FcSnapshotStat (const FcChar8 *path, FcSnapshotSource *s)
+{
+    struct stat statb;
+
+    s->mtime = s->mtime_nsec = s->size = -1;
+    if (!path || FcStat (path, &statb) < 0)
+	return;
+    /* Pipes and the like can't be told apart by their times */
+    if (!S_ISREG (statb.st_mode) && !S_ISDIR (statb.st_mode))
+	return;
+    s->mtime = statb.st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    s->mtime_nsec = statb.st_mtim.tv_nsec;
+#else
+    s->mtime_nsec = 0;
+#endif
+    s->size = S_ISDIR (statb.st_mode) ? 0 : statb.st_size;
+}
+
+/* The environment the parser depends on, compared verbatim */
+static FcChar8 *
+FcSnapshotKey (FcConfig *config)
+{
+    FcStrBuf       buf;
+    const FcChar8 *sysroot = FcConfigGetSysRoot (config);
+    const char    *env;
+    unsigned int   i;
+
+    FcStrBufInit (&buf, NULL, 0);
+    FcStrBufFormat (&buf, "fontconfig %d\n", FC_VERSION);
+    for (i = 0; i < sizeof (snapshot_env) / sizeof (snapshot_env[0]); i++) {
+	env = getenv (snapshot_env[i]);
+	if (env)
+	    FcStrBufFormat (&buf, "%s=%s\n", snapshot_env[i], env);
+	else
+	    FcStrBufFormat (&buf, "%s unset\n", snapshot_env[i]);
+    }
+    FcStrBufFormat (&buf, "home %s\n", FcConfigHome() ? "enabled" : "disabled");
+    FcStrBufFormat (&buf, "sysroot %s\n", sysroot ? (const char *)sysroot : "");
+
+    return FcStrBufDone (&buf);
+}
+
+/* Snapshots are looked for in the default cache directories only, as the
+ * configured ones aren't known before the configuration is loaded.
+ */
+static FcStrSet *
+FcSnapshotDirs (void)
+{
+    FcStrSet *dirs = FcStrSetCreate();
+    FcChar8  *xdg, *dir;
+
+    if (!dirs)
+	return NULL;
+    FcStrSetAddFilename (dirs, (const FcChar8 *)FC_CACHEDIR);
+    xdg = FcConfigXdgCacheHome();
+    if (xdg) {
+	dir = FcStrBuildFilename (xdg, (const FcChar8 *)"fontconfig", NULL);
+	if (dir) {
+	    FcStrSetAddFilename (dirs, dir);
+	    FcStrFree (dir);
+	}
+	FcStrFree (xdg);
+    }
+
+    return dirs;
+}
+
+static FcChar8 *
+FcSnapshotFilename (FcConfig *config, const FcChar8 *dir, const FcChar8 *key)
+{
+    const FcChar8 *sysroot = FcConfigGetSysRoot (config);
+    uint64_t       hash = 0xcbf29ce484222325ULL;
+    char           base[32 + sizeof (FC_ARCHITECTURE) + sizeof (FC_SNAPSHOT_SUFFIX)];
+    const FcChar8 *s;
+
+    /* FNV-1a; the key itself is compared when loading */
+    for (s = key; *s; s++) {
+	hash ^= *s;
+	hash *= 0x100000001b3ULL;
+    }
+    snprintf (base, sizeof (base), "config-%08x%08x-" FC_ARCHITECTURE FC_SNAPSHOT_SUFFIX,
+              (unsigned int)(hash >> 32), (unsigned int)hash);
+    if (sysroot)
+	return FcStrBuildFilename (sysroot, dir, (const FcChar8 *)base, NULL);
+    return FcStrBuildFilename (dir, (const FcChar8 *)base, NULL);
+}
+
+static FcBool
+FcSnapshotConfigIsEmpty (FcConfig *config)
+{
+    FcPtrListIter iter;
+
+    if (config->configDirs->num || config->fontDirs->num ||
+        config->cacheDirs->num || config->configFiles->num ||
+        config->availConfigFiles->num ||
+        config->acceptGlobs->num || config->rejectGlobs->num ||
+        config->acceptPatterns->nfont || config->rejectPatterns->nfont)
+	return FcFalse;
+    FcPtrListIterInit (config->rulesetList, &iter);
+
+    return !FcPtrListIterIsValid (config->rulesetList, &iter);
+}
+
+void
+FcConfigSnapshotBegin (FcConfig *config)
+{
+    FcSnapshotSources *sources;
+    FcChar8           *key;
+
+    if (config->snapshot || !FcSnapshotConfigIsEmpty (config))
+	return;
+    key = FcSnapshotKey (config);
+    if (!key)
+	return;
+    sources = FcSnapshotSourcesCreate (key);
+    if (!sources)
+	return;
+    sources->rescan_before = config->rescanInterval;
+    sources->warns_before = config->warns;
+    config->snapshot = sources;
+}
+
+void
+FcConfigSnapshotAddSource (FcConfig      *config,
+                           const FcChar8 *name,
+                           const FcChar8 *path)
+{
+    FcSnapshotSources *sources = config->snapshot;
+    FcSnapshotSource  *s;
+
+    if (!sources || !sources->valid)
+	return;
+    if (sources->done) {
+	sources->valid = FcFalse;
+	return;
+    }
+    s = FcSnapshotSourcesAppend (sources);
+    if (!s) {
+	sources->valid = FcFalse;
+	return;
+    }
+    s->name = name ? FcStrCopy (name) : NULL;
+    s->path = path ? FcStrCopy (path) : NULL;
+    if ((name && !s->name) || (path && !s->path))
+	sources->valid = FcFalse;
+    FcSnapshotStat (path, s);
+}
+
+void
+FcConfigSnapshotUsesCwd (FcConfig *config)
+{
+    if (config->snapshot)
+	config->snapshot->cwd = FcTrue;
+}
+
+void
+FcConfigSnapshotInvalidate (FcConfig *config)
+{
+    if (config->snapshot)
+	config->snapshot->valid = FcFalse;
+}
+
+/*
+ * A configuration one file is parsed into on a worker thread records
+ * its sources separately; they are appended once it is spliced in.
+ */
+void
+FcConfigSnapshotFork (FcConfig *config, FcConfig *scratch)
+{
+    FcSnapshotSources *sources = config->snapshot;
+    FcChar8           *key;
+
+    if (!sources || sources->done || scratch->snapshot)
+	return;
+    key = FcStrCopy (sources->key);
+    if (!key || !(scratch->snapshot = FcSnapshotSourcesCreate (key)))
+	sources->valid = FcFalse;
+}
+
+void
+FcConfigSnapshotJoin (FcConfig *config, FcConfig *scratch)
+{
+    FcSnapshotSources *sources = config->snapshot;
+    FcSnapshotSources *from = scratch->snapshot;
+    FcSnapshotSource  *s;
+    int                i;
+
+    if (!sources || !sources->valid)
+	return;
+    if (sources->done || !from || !from->valid) {
+	sources->valid = FcFalse;
+	return;
+    }
+    for (i = 0; i < from->nsource; i++) {
+	s = FcSnapshotSourcesAppend (sources);
+	if (!s) {
+	    sources->valid = FcFalse;
+	    return;
+	}
+	*s = from->sources[i];
+	from->sources[i].name = from->sources[i].path = NULL;
+    }
+    if (from->cwd)
+	sources->cwd = FcTrue;
+}
+
+void
+FcConfigSnapshotEnd (FcConfig *config)
+{
+    FcSnapshotSources *sources = config->snapshot;
+
+    if (!sources || sources->done)
+	return;
+    sources->done = FcTrue;
+    sources->ncache_dir = config->cacheDirs->num;
+    sources->rescan_set = config->rescanInterval != sources->rescan_before;
+    sources->rescan_interval = config->rescanInterval;
+    sources->warns_set = config->warns != sources->warns_before;
+    sources->warns = config->warns;
+}
+
+/*
+ * Writing
+ */
+
+static void
+FcSnapshotPutInt (FcStrBuf *buf, int v)
+{
+    FcStrBufData (buf, (const FcChar8 *)&v, sizeof (v));
+}
+
+static void
+FcSnapshotPutInt64 (FcStrBuf *buf, int64_t v)
+{
+    FcStrBufData (buf, (const FcChar8 *)&v, sizeof (v));
+}
+
+static void
+FcSnapshotPutDouble (FcStrBuf *buf, double v)
+{
+    FcStrBufData (buf, (const FcChar8 *)&v, sizeof (v));
+}
+
+/* Length including the terminating NUL, 0 for NULL */
+static void
+FcSnapshotPutString (FcStrBuf *buf, const FcChar8 *s)
+{
+    int len = s ? strlen ((const char *)s) + 1 : 0;
+
+    FcSnapshotPutInt (buf, len);
+    if (len)
+	FcStrBufData (buf, s, len);
+}
+
+static void
+FcSnapshotPutStrSet (FcStrBuf *buf, const FcStrSet *set, int num)
+{
+    int i;
+
+    FcSnapshotPutInt (buf, num);
+    for (i = 0; i < num; i++)
+	FcSnapshotPutString (buf, set->strs[i]);
+}
+
+static void
+FcSnapshotPutCharSet (FcStrBuf *buf, const FcCharSet *cs)
+{
+    FcChar32 map[FC_CHARSET_MAP_SIZE], next, page;
+
+    for (page = FcCharSetFirstPage (cs, map, &next);
+         page != FC_CHARSET_DONE;
+         page = FcCharSetNextPage (cs, map, &next)) {
+	FcSnapshotPutInt (buf, 1);
+	FcStrBufData (buf, (const FcChar8 *)&page, sizeof (page));
+	FcStrBufData (buf, (const FcChar8 *)map, sizeof (map));
+    }
+    FcSnapshotPutInt (buf, 0);
+}
+
+static FcBool
+FcSnapshotPutLangSet (FcStrBuf *buf, const FcLangSet *ls)
+{
+    FcStrSet *langs = FcLangSetGetLangs (ls);
+
+    if (!langs)
+	return FcFalse;
+    FcSnapshotPutStrSet (buf, langs, langs->num);
+    FcStrSetDestroy (langs);
+
+    return FcTrue;
+}
+
+static FcBool
+FcSnapshotPutValue (FcStrBuf *buf, const FcValue *v)
+{
+    double begin, end;
+
+    FcSnapshotPutInt (buf, v->type);
+    switch (v->type) {
+    case FcTypeUnknown:
+    case FcTypeVoid:
+	break;
+    case FcTypeInteger:
+	FcSnapshotPutInt (buf, v->u.i);
+	break;
+    case FcTypeDouble:
+	FcSnapshotPutDouble (buf, v->u.d);
+	break;
+    case FcTypeString:
+	FcSnapshotPutString (buf, v->u.s);
+	break;
+    case FcTypeBool:
+	FcSnapshotPutInt (buf, v->u.b);
+	break;
+    case FcTypeMatrix:
+	FcSnapshotPutDouble (buf, v->u.m->xx);
+	FcSnapshotPutDouble (buf, v->u.m->xy);
+	FcSnapshotPutDouble (buf, v->u.m->yx);
+	FcSnapshotPutDouble (buf, v->u.m->yy);
+	break;
+    case FcTypeCharSet:
+	FcSnapshotPutCharSet (buf, v->u.c);
+	break;
+    case FcTypeLangSet:
+	return FcSnapshotPutLangSet (buf, v->u.l);
+    case FcTypeRange:
+	FcRangeGetDouble (v->u.r, &begin, &end);
+	FcSnapshotPutDouble (buf, begin);
+	FcSnapshotPutDouble (buf, end);
+	break;
+    case FcTypeFTFace:
+	return FcFalse;
+    }
+
+    return FcTrue;
+}
+
+static FcBool
+FcSnapshotPutPatterns (FcStrBuf *buf, const FcFontSet *fs)
+{
+    FcPatternIter iter;
+    FcValue       v;
+    FcValueBinding binding;
+    int           i, j, n;
+
+    FcSnapshotPutInt (buf, fs->nfont);
+    for (i = 0; i < fs->nfont; i++) {
+	FcSnapshotPutInt (buf, FcPatternObjectCount (fs->fonts[i]));
+	FcPatternIterStart (fs->fonts[i], &iter);
+	do {
+	    if (!FcPatternIterIsValid (fs->fonts[i], &iter))
+		break;
+	    n = FcPatternIterValueCount (fs->fonts[i], &iter);
+	    FcSnapshotPutString (buf, (const FcChar8 *)FcPatternIterGetObject (fs->fonts[i], &iter));
+	    FcSnapshotPutInt (buf, n);
+	    for (j = 0; j < n; j++) {
+		FcPatternIterGetValue (fs->fonts[i], &iter, j, &v, &binding);
+		FcSnapshotPutInt (buf, binding);
+		if (!FcSnapshotPutValue (buf, &v))
+		    return FcFalse;
+	    }
+	} while (FcPatternIterNext (fs->fonts[i], &iter));
+    }
+
+    return FcTrue;
+}
+
+static void
+FcSnapshotPutExpr (FcStrBuf *buf, const FcExpr *e)
+{
+    if (!e) {
+	FcSnapshotPutInt (buf, -1);
+	return;
+    }
+    FcSnapshotPutInt (buf, e->op);
+    switch (FC_OP_GET_OP (e->op)) {
+    case FcOpInteger:
+	FcSnapshotPutInt (buf, e->u.ival);
+	break;
+    case FcOpDouble:
+	FcSnapshotPutDouble (buf, e->u.dval);
+	break;
+    case FcOpString:
+	FcSnapshotPutString (buf, e->u.sval);
+	break;
+    case FcOpMatrix:
+	FcSnapshotPutExpr (buf, e->u.mexpr->xx);
+	FcSnapshotPutExpr (buf, e->u.mexpr->xy);
+	FcSnapshotPutExpr (buf, e->u.mexpr->yx);
+	FcSnapshotPutExpr (buf, e->u.mexpr->yy);
+	break;
+    case FcOpRange:
+	FcSnapshotPutDouble (buf, e->u.rval->begin);
+	FcSnapshotPutDouble (buf, e->u.rval->end);
+	break;
+    case FcOpBool:
+	FcSnapshotPutInt (buf, e->u.bval);
+	break;
+    case FcOpCharSet:
+	FcSnapshotPutCharSet (buf, e->u.cval);
+	break;
+    case FcOpLangSet:
+	FcSnapshotPutLangSet (buf, e->u.lval);
+	break;
+    case FcOpField:
+	FcSnapshotPutString (buf, (const FcChar8 *)FcObjectName (e->u.name.object));
+	FcSnapshotPutInt (buf, e->u.name.kind);
+	break;
+    case FcOpConst:
+	FcSnapshotPutString (buf, e->u.constant);
+	break;
+    case FcOpOr:
+    case FcOpAnd:
+    case FcOpEqual:
+    case FcOpNotEqual:
+    case FcOpLess:
+    case FcOpLessEqual:
+    case FcOpMore:
+    case FcOpMoreEqual:
+    case FcOpContains:
+    case FcOpListing:
+    case FcOpNotContains:
+    case FcOpPlus:
+    case FcOpMinus:
+    case FcOpTimes:
+    case FcOpDivide:
+    case FcOpQuest:
+    case FcOpComma:
+	FcSnapshotPutExpr (buf, e->u.tree.left);
+	FcSnapshotPutExpr (buf, e->u.tree.right);
+	break;
+    case FcOpNot:
+    case FcOpFloor:
+    case FcOpCeil:
+    case FcOpRound:
+    case FcOpTrunc:
+	FcSnapshotPutExpr (buf, e->u.tree.left);
+	break;
+    default:
+	break;
+    }
+}
+
+static void
+FcSnapshotPutRules (FcStrBuf *buf, const FcRule *rule)
+{
+    const FcRule *r;
+    int           n = 0;
+
+    for (r = rule; r; r = r->next)
+	n++;
+    FcSnapshotPutInt (buf, n);
+    for (r = rule; r; r = r->next) {
+	FcSnapshotPutInt (buf, r->type);
+	switch (r->type) {
+	case FcRuleTest:
+	    FcSnapshotPutInt (buf, r->u.test->kind);
+	    FcSnapshotPutInt (buf, r->u.test->qual);
+	    FcSnapshotPutString (buf, (const FcChar8 *)FcObjectName (r->u.test->object));
+	    FcSnapshotPutInt (buf, r->u.test->op);
+	    FcSnapshotPutExpr (buf, r->u.test->expr);
+	    break;
+	case FcRuleEdit:
+	    FcSnapshotPutString (buf, (const FcChar8 *)FcObjectName (r->u.edit->object));
+	    FcSnapshotPutInt (buf, r->u.edit->op);
+	    FcSnapshotPutExpr (buf, r->u.edit->expr);
+	    FcSnapshotPutInt (buf, r->u.edit->binding);
+	    break;
+	default:
+	    break;
+	}
+    }
+}
+
+static int
+FcSnapshotPtrListCount (const FcPtrList *list)
+{
+    FcPtrListIter iter;
+    int           n = 0;
+
+    for (FcPtrListIterInit (list, &iter);
+         FcPtrListIterIsValid (list, &iter);
+         FcPtrListIterNext (list, &iter))
+	n++;
+
+    return n;
+}
+
+static int
+FcSnapshotRuleSetIndex (FcRuleSet **rulesets, int n, const FcRuleSet *rs)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+	if (rulesets[i] == rs)
+	    return i;
+    return -1;
+}
+
+static FcBool
+FcSnapshotPutRuleSets (FcStrBuf *buf, FcConfig *config)
+{
+    FcPtrListIter iter, riter;
+    FcRuleSet   **rulesets;
+    FcRuleSet    *rs;
+    FcMatchKind   k;
+    int           i, n, nlisted, nalloc;
+
+    /* Rule sets flushed by an <include> are only referenced from the
+     * substitution lists, so number them after those of rulesetList */
+    nalloc = nlisted = FcSnapshotPtrListCount (config->rulesetList);
+    for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++)
+	nalloc += FcSnapshotPtrListCount (config->subst[k]);
+    rulesets = malloc ((nalloc ? nalloc : 1) * sizeof (FcRuleSet *));
+    if (!rulesets)
+	return FcFalse;
+    n = 0;
+    for (FcPtrListIterInit (config->rulesetList, &iter);
+         FcPtrListIterIsValid (config->rulesetList, &iter);
+         FcPtrListIterNext (config->rulesetList, &iter))
+	rulesets[n++] = (FcRuleSet *)FcPtrListIterGetValue (config->rulesetList, &iter);
+    for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++) {
+	for (FcPtrListIterInit (config->subst[k], &iter);
+	     FcPtrListIterIsValid (config->subst[k], &iter);
+	     FcPtrListIterNext (config->subst[k], &iter)) {
+	    rs = (FcRuleSet *)FcPtrListIterGetValue (config->subst[k], &iter);
+	    if (FcSnapshotRuleSetIndex (rulesets, n, rs) < 0)
+		rulesets[n++] = rs;
+	}
+    }
+
+    FcSnapshotPutInt (buf, n);
+    FcSnapshotPutInt (buf, nlisted);
+    for (i = 0; i < n; i++) {
+	rs = rulesets[i];
+	FcSnapshotPutString (buf, rs->name);
+	FcSnapshotPutString (buf, rs->description);
+	FcSnapshotPutString (buf, rs->domain);
+	FcSnapshotPutInt (buf, rs->enabled);
+	for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++) {
+	    FcSnapshotPutInt (buf, FcSnapshotPtrListCount (rs->subst[k]));
+	    for (FcPtrListIterInit (rs->subst[k], &riter);
+	         FcPtrListIterIsValid (rs->subst[k], &riter);
+	         FcPtrListIterNext (rs->subst[k], &riter))
+		FcSnapshotPutRules (buf, (const FcRule *)FcPtrListIterGetValue (rs->subst[k], &riter));
+	}
+    }
+    /* The rule sets in use, as indices into the ones above */
+    for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++) {
+	FcSnapshotPutInt (buf, FcSnapshotPtrListCount (config->subst[k]));
+	for (FcPtrListIterInit (config->subst[k], &iter);
+	     FcPtrListIterIsValid (config->subst[k], &iter);
+	     FcPtrListIterNext (config->subst[k], &iter)) {
+	    rs = (FcRuleSet *)FcPtrListIterGetValue (config->subst[k], &iter);
+	    FcSnapshotPutInt (buf, FcSnapshotRuleSetIndex (rulesets, n, rs));
+	}
+    }
+    free (rulesets);
+
+    return FcTrue;
+}
+
+static FcBool
+FcSnapshotEncode (FcStrBuf *buf, FcConfig *config)
+{
+    FcSnapshotSources *sources = config->snapshot;
+    FcChar8           *cwd = NULL;
+    int                i;
+
+    FcSnapshotPutInt (buf, FC_SNAPSHOT_MAGIC);
+    FcSnapshotPutInt (buf, FC_SNAPSHOT_VERSION);
+    FcSnapshotPutString (buf, sources->key);
+
+    FcSnapshotPutInt (buf, sources->nsource);
+    for (i = 0; i < sources->nsource; i++) {
+	FcSnapshotPutString (buf, sources->sources[i].name);
+	FcSnapshotPutString (buf, sources->sources[i].path);
+	FcSnapshotPutInt64 (buf, sources->sources[i].mtime);
+	FcSnapshotPutInt64 (buf, sources->sources[i].mtime_nsec);
+	FcSnapshotPutInt64 (buf, sources->sources[i].size);
+    }
+    if (sources->cwd) {
+	cwd = FcStrCopyFilename ((const FcChar8 *)".");
+	if (!cwd)
+	    return FcFalse;
+    }
+    FcSnapshotPutString (buf, cwd);
+    if (cwd)
+	FcStrFree (cwd);
+
+    FcSnapshotPutStrSet (buf, config->configDirs, config->configDirs->num);
+    /* Font directories are triples of the directory, its mapping and salt */
+    FcSnapshotPutInt (buf, config->fontDirs->num);
+    for (i = 0; i < config->fontDirs->num; i++) {
+	FcSnapshotPutString (buf, config->fontDirs->strs[i]);
+	FcSnapshotPutString (buf, FcStrTripleSecond (config->fontDirs->strs[i]));
+	FcSnapshotPutString (buf, FcStrTripleThird (config->fontDirs->strs[i]));
+    }
+    FcSnapshotPutStrSet (buf, config->cacheDirs, sources->ncache_dir);
+    FcSnapshotPutStrSet (buf, config->configFiles, config->configFiles->num);
+    FcSnapshotPutStrSet (buf, config->availConfigFiles, config->availConfigFiles->num);
+    FcSnapshotPutStrSet (buf, config->acceptGlobs, config->acceptGlobs->num);
+    FcSnapshotPutStrSet (buf, config->rejectGlobs, config->rejectGlobs->num);
+    if (!FcSnapshotPutPatterns (buf, config->acceptPatterns) ||
+        !FcSnapshotPutPatterns (buf, config->rejectPatterns))
+	return FcFalse;
+    if (!FcSnapshotPutRuleSets (buf, config))
+	return FcFalse;
+    FcSnapshotPutInt (buf, config->maxObjects);
+    FcSnapshotPutInt (buf, sources->rescan_set);
+    FcSnapshotPutInt (buf, sources->rescan_interval);
+    FcSnapshotPutInt (buf, sources->warns_set);
+    FcSnapshotPutInt (buf, sources->warns);
+
+    return !buf->failed;
+}
+
+static FcBool
+FcSnapshotWriteFile (const FcChar8 *file, const FcChar8 *data, int len)
+{
+    FcAtomic *atomic;
+    FcBool    ret = FcFalse;
+    int       fd;
+
+    atomic = FcAtomicCreate (file);
+    if (!atomic)
+	return FcFalse;
+    if (!FcAtomicLock (atomic))
+	goto bail0;
+    fd = FcOpen ((char *)FcAtomicNewFile (atomic), O_RDWR | O_CREAT | O_BINARY, 0666);
+    if (fd == -1)
+	goto bail1;
+    if (write (fd, data, len) != len) {
+	close (fd);
+	goto bail1;
+    }
+    close (fd);
+    ret = FcAtomicReplaceOrig (atomic);
+bail1:
+    FcAtomicUnlock (atomic);
+bail0:
+    FcAtomicDestroy (atomic);
+
+    return ret;
+}
+
+FcBool
+FcConfigWriteSnapshot (FcConfig *config)
+{
+    FcSnapshotSources *sources;
+    FcStrSet          *dirs = NULL;
+    FcStrBuf           buf;
+    FcChar8           *dir, *file, *d;
+    const FcChar8     *sysroot;
+    FcBool             ret = FcFalse;
+    int                i;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return FcFalse;
+    sources = config->snapshot;
+    if (!sources || !sources->done || !sources->valid)
+	goto bail0;
+
+    FcStrBufInit (&buf, NULL, 0);
+    if (!FcSnapshotEncode (&buf, config))
+	goto bail1;
+    dirs = FcSnapshotDirs();
+    if (!dirs)
+	goto bail1;
+    sysroot = FcConfigGetSysRoot (config);
+    /* Go for the first default cache directory the configuration uses */
+    for (i = 0; i < sources->ncache_dir && !ret; i++) {
+	dir = config->cacheDirs->strs[i];
+	if (!FcStrSetMember (dirs, dir))
+	    continue;
+	d = sysroot ? FcStrBuildFilename (sysroot, dir, NULL) : FcStrCopy (dir);
+	if (!d)
+	    continue;
+	if (access ((char *)d, W_OK) == 0 ||
+	    (access ((char *)d, F_OK) == -1 && FcMakeDirectory (d))) {
+	    file = FcSnapshotFilename (config, dir, sources->key);
+	    if (file) {
+		ret = FcSnapshotWriteFile (file, buf.buf, buf.len);
+		if (FcDebug() & FC_DBG_CACHE)
+		    printf ("FcConfigWriteSnapshot file \"%s\"%s\n", file, ret ? "" : " failed");
+		FcStrFree (file);
+	    }
+	}
+	FcStrFree (d);
+    }
+    FcStrSetDestroy (dirs);
+bail1:
+    FcStrBufDestroy (&buf);
+bail0:
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+/*
+ * Reading
+ */
+
+typedef struct _FcSnapshotReader {
+    const FcChar8 *p;
+    const FcChar8 *end;
+    FcBool         failed;
+} FcSnapshotReader;
+
+static void
+FcSnapshotGet (FcSnapshotReader *r, void *v, size_t len)
+{
+    if (r->failed || (size_t)(r->end - r->p) < len) {
+	r->failed = FcTrue;
+	memset (v, 0, len);
+	return;
+    }
+    memcpy (v, r->p, len);
+    r->p += len;
+}
+
+static int
+FcSnapshotGetInt (FcSnapshotReader *r)
+{
+    int v;
+
+    FcSnapshotGet (r, &v, sizeof (v));
+    return v;
+}
+
+static int64_t
+FcSnapshotGetInt64 (FcSnapshotReader *r)
+{
+    int64_t v;
+
+    FcSnapshotGet (r, &v, sizeof (v));
+    return v;
+}
+
+static double
+FcSnapshotGetDouble (FcSnapshotReader *r)
+{
+    double v;
+
+    FcSnapshotGet (r, &v, sizeof (v));
+    return v;
+}
+
+/* A count of items taking at least one int each */
+static int
+FcSnapshotGetCount (FcSnapshotReader *r)
+{
+    int n = FcSnapshotGetInt (r);
+
+    if (n < 0 || (size_t)n > (size_t)(r->end - r->p) / sizeof (int)) {
+	r->failed = FcTrue;
+	return 0;
+    }
+    return n;
+}
+
+/* Points into the snapshot, so copy it to keep it */
+static const FcChar8 *
+FcSnapshotGetString (FcSnapshotReader *r)
+{
+    const FcChar8 *s;
+    int            len = FcSnapshotGetInt (r);
+
+    if (r->failed || len == 0)
+	return NULL;
+    if (len < 0 || len > r->end - r->p || r->p[len - 1] != 0) {
+	r->failed = FcTrue;
+	return NULL;
+    }
+    s = r->p;
+    r->p += len;
+
+    return s;
+}
+
+static void
+FcSnapshotGetStrSet (FcSnapshotReader *r, FcStrSet *set)
+{
+    const FcChar8 *s;
+    int            i, n = FcSnapshotGetCount (r);
+
+    for (i = 0; i < n && !r->failed; i++) {
+	s = FcSnapshotGetString (r);
+	if (!s || !FcStrSetAdd (set, s))
+	    r->failed = FcTrue;
+    }
+}
+
+static FcCharSet *
+FcSnapshotGetCharSet (FcSnapshotReader *r)
+{
+    FcCharSet  *cs = FcCharSetCreate();
+    FcCharLeaf *leaf;
+    FcChar32    page, map[FC_CHARSET_MAP_SIZE];
+
+    if (!cs) {
+	r->failed = FcTrue;
+	return NULL;
+    }
+    while (FcSnapshotGetInt (r) == 1) {
+	FcSnapshotGet (r, &page, sizeof (page));
+	FcSnapshotGet (r, map, sizeof (map));
+	if (r->failed)
+	    break;
+	leaf = FcCharSetFindLeafCreate (cs, page);
+	if (!leaf) {
+	    r->failed = FcTrue;
+	    break;
+	}
+	memcpy (leaf->map, map, sizeof (map));
+    }
+    if (r->failed) {
+	FcCharSetDestroy (cs);
+	return NULL;
+    }
+    return cs;
+}
+
+static FcLangSet *
+FcSnapshotGetLangSet (FcSnapshotReader *r)
+{
+    FcLangSet     *ls = FcLangSetCreate();
+    const FcChar8 *s;
+    int            i, n = FcSnapshotGetCount (r);
+
+    if (!ls) {
+	r->failed = FcTrue;
+	return NULL;
+    }
+    for (i = 0; i < n && !r->failed; i++) {
+	s = FcSnapshotGetString (r);
+	if (!s || !FcLangSetAdd (ls, s))
+	    r->failed = FcTrue;
+    }
+    if (r->failed) {
+	FcLangSetDestroy (ls);
+	return NULL;
+    }
+    return ls;
+}
+
+/* Fills in v with values to be released by FcValueDestroy */
+static void
+FcSnapshotGetValue (FcSnapshotReader *r, FcValue *v)
+{
+    FcMatrix       m;
+    const FcChar8 *s;
+    double         begin, end;
+
+    v->type = FcSnapshotGetInt (r);
+    switch (v->type) {
+    case FcTypeUnknown:
+    case FcTypeVoid:
+	break;
+    case FcTypeInteger:
+	v->u.i = FcSnapshotGetInt (r);
+	break;
+    case FcTypeDouble:
+	v->u.d = FcSnapshotGetDouble (r);
+	break;
+    case FcTypeString:
+	s = FcSnapshotGetString (r);
+	v->u.s = s ? FcStrCopy (s) : NULL;
+	break;
+    case FcTypeBool:
+	v->u.b = FcSnapshotGetInt (r);
+	break;
+    case FcTypeMatrix:
+	m.xx = FcSnapshotGetDouble (r);
+	m.xy = FcSnapshotGetDouble (r);
+	m.yx = FcSnapshotGetDouble (r);
+	m.yy = FcSnapshotGetDouble (r);
+	v->u.m = FcMatrixCopy (&m);
+	break;
+    case FcTypeCharSet:
+	v->u.c = FcSnapshotGetCharSet (r);
+	break;
+    case FcTypeLangSet:
+	v->u.l = FcSnapshotGetLangSet (r);
+	break;
+    case FcTypeRange:
+	begin = FcSnapshotGetDouble (r);
+	end = FcSnapshotGetDouble (r);
+	v->u.r = FcRangeCreateDouble (begin, end);
+	break;
+    default:
+	r->failed = FcTrue;
+	v->type = FcTypeVoid;
+	return;
+    }
+    if (v->type >= FcTypeString && v->type != FcTypeBool && !v->u.f) {
+	r->failed = FcTrue;
+	v->type = FcTypeVoid;
+    }
+}
+
+static void
+FcSnapshotGetPatterns (FcSnapshotReader *r, FcFontSet *fs)
+{
+    FcPattern     *p;
+    FcObject       object;
+    FcValue        v;
+    FcValueBinding binding;
+    const FcChar8 *name;
+    int            i, j, k, n, nobject, nvalue;
+
+    n = FcSnapshotGetCount (r);
+    for (i = 0; i < n && !r->failed; i++) {
+	p = FcPatternCreate();
+	if (!p) {
+	    r->failed = FcTrue;
+	    return;
+	}
+	nobject = FcSnapshotGetCount (r);
+	for (j = 0; j < nobject && !r->failed; j++) {
+	    name = FcSnapshotGetString (r);
+	    if (!name) {
+		r->failed = FcTrue;
+		break;
+	    }
+	    object = FcObjectFromName ((const char *)name);
+	    nvalue = FcSnapshotGetCount (r);
+	    for (k = 0; k < nvalue && !r->failed; k++) {
+		binding = FcSnapshotGetInt (r);
+		FcSnapshotGetValue (r, &v);
+		if (!r->failed &&
+		    !FcPatternObjectAddWithBinding (p, object, v, binding, FcTrue))
+		    r->failed = FcTrue;
+		FcValueDestroy (v);
+	    }
+	}
+	if (r->failed || !FcFontSetAdd (fs, p)) {
+	    r->failed = FcTrue;
+	    FcPatternDestroy (p);
+	}
+    }
+}
+
+/* Returns what could be read even on failure, with the op only set once
+ * its payload is there, so the rule it ends up in can be destroyed.
+ */
+static FcExpr *
+FcSnapshotGetExpr (FcSnapshotReader *r, FcConfig *config, int depth)
+{
+    FcExpr        *e;
+    const FcChar8 *s;
+    int            op = FcSnapshotGetInt (r);
+
+    if (r->failed || op == -1)
+	return NULL;
+    /* Deeper than any sane configuration, so likely corrupt */
+    if (depth > 1000) {
+	r->failed = FcTrue;
+	return NULL;
+    }
+    e = FcConfigAllocExpr (config);
+    if (!e) {
+	r->failed = FcTrue;
+	return NULL;
+    }
+    e->op = FcOpNil;
+    switch (FC_OP_GET_OP (op)) {
+    case FcOpInteger:
+	e->u.ival = FcSnapshotGetInt (r);
+	e->op = op;
+	break;
+    case FcOpDouble:
+	e->u.dval = FcSnapshotGetDouble (r);
+	e->op = op;
+	break;
+    case FcOpString:
+	s = FcSnapshotGetString (r);
+	e->u.sval = s ? FcStrCopy (s) : NULL;
+	if (e->u.sval)
+	    e->op = op;
+	else
+	    r->failed = FcTrue;
+	break;
+    case FcOpMatrix:
+	e->u.mexpr = calloc (1, sizeof (FcExprMatrix));
+	if (!e->u.mexpr) {
+	    r->failed = FcTrue;
+	    break;
+	}
+	e->op = op;
+	e->u.mexpr->xx = FcSnapshotGetExpr (r, config, depth + 1);
+	e->u.mexpr->xy = FcSnapshotGetExpr (r, config, depth + 1);
+	e->u.mexpr->yx = FcSnapshotGetExpr (r, config, depth + 1);
+	e->u.mexpr->yy = FcSnapshotGetExpr (r, config, depth + 1);
+	break;
+    case FcOpRange:
+	e->u.rval = FcRangeCreateDouble (0, 0);
+	if (!e->u.rval) {
+	    r->failed = FcTrue;
+	    break;
+	}
+	e->op = op;
+	e->u.rval->begin = FcSnapshotGetDouble (r);
+	e->u.rval->end = FcSnapshotGetDouble (r);
+	break;
+    case FcOpBool:
+	e->u.bval = FcSnapshotGetInt (r);
+	e->op = op;
+	break;
+    case FcOpCharSet:
+	e->u.cval = FcSnapshotGetCharSet (r);
+	if (e->u.cval)
+	    e->op = op;
+	break;
+    case FcOpLangSet:
+	e->u.lval = FcSnapshotGetLangSet (r);
+	if (e->u.lval)
+	    e->op = op;
+	break;
+    case FcOpField:
+	s = FcSnapshotGetString (r);
+	if (!s) {
+	    r->failed = FcTrue;
+	    break;
+	}
+	e->u.name.object = FcObjectFromName ((const char *)s);
+	e->u.name.kind = FcSnapshotGetInt (r);
+	e->op = op;
+	break;
+    case FcOpConst:
+	s = FcSnapshotGetString (r);
+	e->u.constant = s ? FcStrCopy (s) : NULL;
+	if (e->u.constant)
+	    e->op = op;
+	else
+	    r->failed = FcTrue;
+	break;
+    case FcOpOr:
+    case FcOpAnd:
+    case FcOpEqual:
+    case FcOpNotEqual:
+    case FcOpLess:
+    case FcOpLessEqual:
+    case FcOpMore:
+    case FcOpMoreEqual:
+    case FcOpContains:
+    case FcOpListing:
+    case FcOpNotContains:
+    case FcOpPlus:
+    case FcOpMinus:
+    case FcOpTimes:
+    case FcOpDivide:
+    case FcOpQuest:
+    case FcOpComma:
+	e->u.tree.left = e->u.tree.right = NULL;
+	e->op = op;
+	e->u.tree.left = FcSnapshotGetExpr (r, config, depth + 1);
+	e->u.tree.right = FcSnapshotGetExpr (r, config, depth + 1);
+	break;
+    case FcOpNot:
+    case FcOpFloor:
+    case FcOpCeil:
+    case FcOpRound:
+    case FcOpTrunc:
+	e->u.tree.left = e->u.tree.right = NULL;
+	e->op = op;
+	e->u.tree.left = FcSnapshotGetExpr (r, config, depth + 1);
+	break;
+    case FcOpNil:
+	break;
+    default:
+	r->failed = FcTrue;
+	break;
+    }
+
+    return e;
+}
+
+static FcRule *
+FcSnapshotGetRules (FcSnapshotReader *r, FcConfig *config)
+{
+    FcRule        *head = NULL, **prev = &head, *rule;
+    const FcChar8 *s;
+    int            i, n = FcSnapshotGetCount (r);
+
+    for (i = 0; i < n && !r->failed; i++) {
+	rule = calloc (1, sizeof (FcRule));
+	if (!rule) {
+	    r->failed = FcTrue;
+	    break;
+	}
+	*prev = rule;
+	prev = &rule->next;
+	rule->type = FcSnapshotGetInt (r);
+	switch (rule->type) {
+	case FcRuleTest:
+	    rule->u.test = calloc (1, sizeof (FcTest));
+	    if (!rule->u.test) {
+		rule->type = FcRuleUnknown;
+		r->failed = FcTrue;
+		break;
+	    }
+	    rule->u.test->kind = FcSnapshotGetInt (r);
+	    rule->u.test->qual = FcSnapshotGetInt (r);
+	    s = FcSnapshotGetString (r);
+	    if (!s) {
+		r->failed = FcTrue;
+		break;
+	    }
+	    rule->u.test->object = FcObjectFromName ((const char *)s);
+	    rule->u.test->op = FcSnapshotGetInt (r);
+	    rule->u.test->expr = FcSnapshotGetExpr (r, config, 0);
+	    break;
+	case FcRuleEdit:
+	    rule->u.edit = calloc (1, sizeof (FcEdit));
+	    if (!rule->u.edit) {
+		rule->type = FcRuleUnknown;
+		r->failed = FcTrue;
+		break;
+	    }
+	    s = FcSnapshotGetString (r);
+	    if (!s) {
+		r->failed = FcTrue;
+		break;
+	    }
+	    rule->u.edit->object = FcObjectFromName ((const char *)s);
+	    rule->u.edit->op = FcSnapshotGetInt (r);
+	    rule->u.edit->expr = FcSnapshotGetExpr (r, config, 0);
+	    rule->u.edit->binding = FcSnapshotGetInt (r);
+	    break;
+	default:
+	    rule->type = FcRuleUnknown;
+	    break;
+	}
+    }
+    if (r->failed && head) {
+	FcRuleDestroy (head);
+	head = NULL;
+    }
+    return head;
+}
+
+static void
+FcSnapshotGetRuleSets (FcSnapshotReader *r, FcConfig *config)
+{
+    FcRuleSet    **rulesets;
+    FcRuleSet     *rs;
+    FcRule        *rule;
+    FcPtrListIter  iter;
+    FcMatchKind    k;
+    const FcChar8 *description, *domain;
+    int            i, j, n, nlisted, nrules, index;
+
+    n = FcSnapshotGetCount (r);
+    nlisted = FcSnapshotGetInt (r);
+    if (nlisted < 0 || nlisted > n)
+	r->failed = FcTrue;
+    if (r->failed)
+	return;
+    rulesets = calloc (n ? n : 1, sizeof (FcRuleSet *));
+    if (!rulesets) {
+	r->failed = FcTrue;
+	return;
+    }
+    for (i = 0; i < n && !r->failed; i++) {
+	rs = FcRuleSetCreate (FcSnapshotGetString (r));
+	if (!rs) {
+	    r->failed = FcTrue;
+	    break;
+	}
+	rulesets[i] = rs;
+	description = FcSnapshotGetString (r);
+	domain = FcSnapshotGetString (r);
+	FcRuleSetAddDescription (rs, domain, description);
+	FcRuleSetEnable (rs, FcSnapshotGetInt (r));
+	for (k = FcMatchKindBegin; k < FcMatchKindEnd && !r->failed; k++) {
+	    nrules = FcSnapshotGetCount (r);
+	    for (j = 0; j < nrules && !r->failed; j++) {
+		rule = FcSnapshotGetRules (r, config);
+		if (!rule)
+		    continue;
+		if (FcRuleSetAdd (rs, rule, k) == -1) {
+		    FcRuleDestroy (rule);
+		    r->failed = FcTrue;
+		}
+	    }
+	}
+    }
+    for (i = 0; i < nlisted && !r->failed; i++) {
+	FcRuleSetReference (rulesets[i]);
+	FcPtrListIterInitAtLast (config->rulesetList, &iter);
+	if (!FcPtrListIterAdd (config->rulesetList, &iter, rulesets[i])) {
+	    FcRuleSetDestroy (rulesets[i]);
+	    r->failed = FcTrue;
+	}
+    }
+    for (k = FcMatchKindBegin; k < FcMatchKindEnd && !r->failed; k++) {
+	nrules = FcSnapshotGetCount (r);
+	for (j = 0; j < nrules && !r->failed; j++) {
+	    index = FcSnapshotGetInt (r);
+	    if (index < 0 || index >= n) {
+		r->failed = FcTrue;
+		break;
+	    }
+	    FcRuleSetReference (rulesets[index]);
+	    FcPtrListIterInitAtLast (config->subst[k], &iter);
+	    if (!FcPtrListIterAdd (config->subst[k], &iter, rulesets[index])) {
+		FcRuleSetDestroy (rulesets[index]);
+		r->failed = FcTrue;
+	    }
+	}
+    }
+    /* The lists hold their own references */
+    for (i = 0; i < n; i++)
+	FcRuleSetDestroy (rulesets[i]);
+    free (rulesets);
+}
+
+/* Checks the environment and every source still look the same */
+static FcSnapshotSources *
+FcSnapshotGetSources (FcSnapshotReader *r, FcConfig *config, const FcChar8 *key)
+{
+    FcSnapshotSources *sources;
+    FcSnapshotSource  *s, now;
+    const FcChar8     *stored, *name, *path;
+    FcChar8           *real, *cwd;
+    int                i, n;
+    FcBool             fresh;
+
+    if (FcSnapshotGetInt (r) != (int)FC_SNAPSHOT_MAGIC ||
+        FcSnapshotGetInt (r) != FC_SNAPSHOT_VERSION)
+	return NULL;
+    stored = FcSnapshotGetString (r);
+    if (!stored || strcmp ((const char *)stored, (const char *)key) != 0)
+	return NULL;
+    sources = FcSnapshotSourcesCreate (FcStrCopy (key));
+    if (!sources || !sources->key)
+	goto bail;
+
+    n = FcSnapshotGetCount (r);
+    for (i = 0; i < n && !r->failed; i++) {
+	name = FcSnapshotGetString (r);
+	path = FcSnapshotGetString (r);
+	s = FcSnapshotSourcesAppend (sources);
+	if (!s)
+	    goto bail;
+	s->mtime = FcSnapshotGetInt64 (r);
+	s->mtime_nsec = FcSnapshotGetInt64 (r);
+	s->size = FcSnapshotGetInt64 (r);
+	if (r->failed)
+	    goto bail;
+	s->name = name ? FcStrCopy (name) : NULL;
+	s->path = path ? FcStrCopy (path) : NULL;
+	if ((name && !s->name) || (path && !s->path))
+	    goto bail;
+
+	real = FcConfigRealFilename (config, name);
+	fresh = (!real && !path) ||
+	        (real && path && strcmp ((const char *)real, (const char *)path) == 0);
+	if (real)
+	    FcStrFree (real);
+	if (!fresh)
+	    goto bail;
+	if (path) {
+	    FcSnapshotStat (path, &now);
+	    if (now.mtime == -1 || now.mtime != s->mtime ||
+	        now.mtime_nsec != s->mtime_nsec || now.size != s->size)
+		goto bail;
+	}
+    }
+    stored = FcSnapshotGetString (r);
+    if (r->failed)
+	goto bail;
+    if (stored) {
+	cwd = FcStrCopyFilename ((const FcChar8 *)".");
+	fresh = cwd && strcmp ((const char *)cwd, (const char *)stored) == 0;
+	if (cwd)
+	    FcStrFree (cwd);
+	if (!fresh)
+	    goto bail;
+	sources->cwd = FcTrue;
+    }
+    return sources;
+
+bail:
+    FcSnapshotSourcesDestroy (sources);
+    return NULL;
+}
+
+static FcBool
+FcSnapshotDecode (FcSnapshotReader *r, FcConfig *config, FcSnapshotSources *sources)
+{
+    const FcChar8 *a, *b, *c;
+    int            i, n;
+
+    FcSnapshotGetStrSet (r, config->configDirs);
+    n = FcSnapshotGetCount (r);
+    for (i = 0; i < n && !r->failed; i++) {
+	a = FcSnapshotGetString (r);
+	b = FcSnapshotGetString (r);
+	c = FcSnapshotGetString (r);
+	if (r->failed || !FcStrSetAddTriple (config->fontDirs, a, b, c))
+	    r->failed = FcTrue;
+    }
+    FcSnapshotGetStrSet (r, config->cacheDirs);
+    FcSnapshotGetStrSet (r, config->configFiles);
+    FcSnapshotGetStrSet (r, config->availConfigFiles);
+    FcSnapshotGetStrSet (r, config->acceptGlobs);
+    FcSnapshotGetStrSet (r, config->rejectGlobs);
+    FcSnapshotGetPatterns (r, config->acceptPatterns);
+    FcSnapshotGetPatterns (r, config->rejectPatterns);
+    FcSnapshotGetRuleSets (r, config);
+    config->maxObjects = FcSnapshotGetInt (r);
+    sources->rescan_set = FcSnapshotGetInt (r);
+    sources->rescan_interval = FcSnapshotGetInt (r);
+    sources->warns_set = FcSnapshotGetInt (r);
+    sources->warns = FcSnapshotGetInt (r);
+    if (sources->rescan_set)
+	config->rescanInterval = sources->rescan_interval;
+    if (sources->warns_set)
+	config->warns = sources->warns;
+    sources->ncache_dir = config->cacheDirs->num;
+    sources->done = FcTrue;
+
+    return !r->failed && r->p == r->end;
+}
+
+/* Moves what the snapshot filled in over to the configuration being loaded */
+static void
+FcSnapshotSwap (FcConfig *a, FcConfig *b)
+{
+#define SWAP(field)            \
+    do {                       \
+	void *t = (void *)a->field; \
+	a->field = b->field;   \
+	b->field = t;          \
+    } while (0)
+    FcMatchKind k;
+    int         t;
+
+    SWAP (configDirs);
+    SWAP (fontDirs);
+    SWAP (cacheDirs);
+    SWAP (configFiles);
+    SWAP (availConfigFiles);
+    SWAP (acceptGlobs);
+    SWAP (rejectGlobs);
+    SWAP (acceptPatterns);
+    SWAP (rejectPatterns);
+    SWAP (glob_code);
+    SWAP (accept_filter);
+    SWAP (reject_filter);
+    SWAP (cache_aggregates);
+    SWAP (rulesetList);
+    SWAP (expr_pool);
+    SWAP (snapshot);
+    for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++)
+	SWAP (subst[k]);
+#undef SWAP
+    t = a->maxObjects;
+    a->maxObjects = b->maxObjects;
+    b->maxObjects = t;
+    t = a->rescanInterval;
+    a->rescanInterval = b->rescanInterval;
+    b->rescanInterval = t;
+    t = a->warns;
+    a->warns = b->warns;
+    b->warns = t;
+}
+
+static FcBool
+FcSnapshotLoadFile (FcConfig *config, const FcChar8 *file, const FcChar8 *key)
+{
+    FcSnapshotReader   r;
+    FcSnapshotSources *sources;
+    FcConfig          *loaded = NULL;
+    struct stat        statb;
+    FcChar8           *data;
+    FcBool             ret = FcFalse, mapped = FcFalse;
+    int                fd;
+
+    fd = FcOpen ((const char *)file, O_RDONLY | O_BINARY);
+    if (fd == -1)
+	return FcFalse;
+    if (fstat (fd, &statb) < 0 || statb.st_size <= 0 || statb.st_size > INT_MAX)
+	goto bail0;
+#if defined(HAVE_MMAP) || defined(__CYGWIN__)
+    data = mmap (0, statb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data != MAP_FAILED)
+	mapped = FcTrue;
+    else
+#endif
+    {
+	data = malloc (statb.st_size);
+	if (!data)
+	    goto bail0;
+	if (read (fd, data, statb.st_size) != statb.st_size)
+	    goto bail1;
+    }
+    r.p = data;
+    r.end = data + statb.st_size;
+    r.failed = FcFalse;
+
+    sources = FcSnapshotGetSources (&r, config, key);
+    if (!sources)
+	goto bail1;
+    loaded = FcConfigCreate();
+    if (!loaded) {
+	FcSnapshotSourcesDestroy (sources);
+	goto bail1;
+    }
+    loaded->snapshot = sources;
+    if (!FcSnapshotDecode (&r, loaded, sources))
+	goto bail2;
+    FcSnapshotSwap (config, loaded);
+    ret = FcTrue;
+    if (FcDebug() & FC_DBG_CACHE)
+	printf ("FcConfigLoadSnapshot file \"%s\"\n", file);
+bail2:
+    FcConfigDestroy (loaded);
+bail1:
+#if defined(HAVE_MMAP) || defined(__CYGWIN__)
+    if (mapped)
+	munmap (data, statb.st_size);
+    else
+#endif
+	free (data);
+bail0:
+    close (fd);
+
+    return ret;
+}
+
+FcBool
+FcConfigLoadSnapshot (FcConfig *config)
+{
+    FcStrSet *dirs;
+    FcChar8  *key, *file;
+    FcBool    ret = FcFalse;
+    int       i;
+
+    /* Let the configuration debug output show the files being parsed */
+    if ((FcDebug() & FC_DBG_CONFIG) || config->snapshot ||
+        !FcSnapshotConfigIsEmpty (config))
+	return FcFalse;
+    key = FcSnapshotKey (config);
+    if (!key)
+	return FcFalse;
+    dirs = FcSnapshotDirs();
+    for (i = 0; dirs && i < dirs->num && !ret; i++) {
+	file = FcSnapshotFilename (config, dirs->strs[i], key);
+	if (file) {
+	    ret = FcSnapshotLoadFile (config, file, key);
+	    FcStrFree (file);
+	}
+    }
+    if (dirs)
+	FcStrSetDestroy (dirs);
+    FcStrFree (key);
+    if (ret)
+	FcConfigCompileRules (config);
+
+    return ret;
+}
+
+#define __fcsnapshot__
+#include "fcaliastail.h"
+#undef __fcsnapshot__
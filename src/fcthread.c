@@ -0,0 +1,97 @@
+/* Copyright (C) 2026 fontconfig Authors */
+/* SPDX-License-Identifier: HPND */
+
+#include "fcint.h"
+
+#if !defined(FC_NO_MT) && defined(HAVE_PTHREAD)
+#  include <pthread.h>
+#  include <time.h>
+#  define FC_HAVE_WORKERS 1
+#endif
+
+/* Upper limit on the workers of a single FcWorkersRun */
+#define FC_MAX_WORKERS 64
+
+int
+FcWorkersDefault (void)
+{
+#if defined(FC_HAVE_WORKERS) && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+    if (n > 1)
+	return FC_MIN (n, FC_MAX_WORKERS);
+#endif
+    return 1;
+}
+
+#ifdef FC_HAVE_WORKERS
+typedef struct _FcWorker {
+    pthread_t  thread;
+    FcWorkFunc func;
+    void      *closure;
+    int        id;
+} FcWorker;
+
+static void *
+FcWorkerMain (void *arg)
+{
+    FcWorker *w = arg;
+
+    w->func (w->closure, w->id);
+
+    return NULL;
+}
+#endif
+
+/*
+ * Run 'func' on up to 'nworker' threads, the calling one included, and
+ * wait for all of them to return.  Each call gets a distinct worker id
+ * below 'nworker', the calling thread running worker 0.  Workers are
+ * expected to pull their share of the work from 'closure' until none is
+ * left, so getting fewer threads than asked for (when they can't be
+ * created, or without thread support) only means less parallelism.
+ * Returns the number of workers that ran.
+ */
+int
+FcWorkersRun (int        nworker,
+              FcWorkFunc func,
+              void      *closure)
+{
+#ifdef FC_HAVE_WORKERS
+    FcWorker workers[FC_MAX_WORKERS];
+    int      i, n = 1;
+
+    nworker = FC_MIN (nworker, FC_MAX_WORKERS);
+    for (i = 1; i < nworker; i++) {
+	workers[n].func = func;
+	workers[n].closure = closure;
+	workers[n].id = n;
+	if (pthread_create (&workers[n].thread, NULL, FcWorkerMain, &workers[n]) != 0)
+	    break;
+	n++;
+    }
+    func (closure, 0);
+    for (i = 1; i < n; i++)
+	pthread_join (workers[i].thread, NULL);
+
+    return n;
+#else
+    func (closure, 0);
+
+    return 1;
+#endif
+}
+
+/*
+ * Let a worker without anything to do right now wait a little for the
+ * others to find some more.
+ */
+void
+FcWorkersPause (void)
+{
+#ifdef FC_HAVE_WORKERS
+    struct timespec ts = { 0, 1000000 };
+
+    nanosleep (&ts, NULL);
+#endif
+}
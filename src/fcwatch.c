@@ -0,0 +1,720 @@
+/* Copyright (C) 2026 fontconfig Authors */
+/* SPDX-License-Identifier: HPND */
+
+#include "fcint.h"
+
+#include <errno.h>
+#include <fcntl.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#  include <sys/inotify.h>
+#  define FC_HAVE_INOTIFY 1
+#endif
+
+#if !defined(FC_NO_MT) && defined(HAVE_PTHREAD) && !defined(_WIN32)
+#  include <poll.h>
+#  include <pthread.h>
+#  define FC_HAVE_CHANGE_THREAD 1
+#endif
+
+/* How often paths are looked at for listeners when they can't be watched */
+#define FC_CHANGE_POLL_INTERVAL 30
+/* How long changes have to stop coming in before listeners are told */
+#define FC_CHANGE_SETTLE_MS 100
+#define FC_CHANGE_SETTLE_MAX 20
+
+/*
+ * Tells FcConfigUptoDate whether any of the files and directories whose
+ * times it compares may have changed, so they only need to be looked at
+ * again after something happened to them.  Without inotify, or when a
+ * path can't be watched reliably, they always do.
+ */
+struct _FcWatch {
+    FcMutex      lock;
+    int          fd;       /* -1 when the paths have to be polled */
+    FcBool       rebuild;  /* the watches may no longer cover every path */
+    int         *parents;  /* watches on the closest parents of missing paths */
+    int          nparent;
+    int          nparent_alloc;
+    unsigned int changes;  /* events seen */
+    unsigned int checked;  /* 'changes' when the paths were last found unchanged */
+};
+
+#ifdef FC_HAVE_INOTIFY
+
+/* Anything which may change the time of a file or directory */
+#  define FC_WATCH_EVENTS (IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | \
+                           IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+/* Anything which may make a missing path appear */
+#  define FC_WATCH_PARENT_EVENTS (IN_CREATE | IN_MOVED_TO | IN_ONLYDIR | IN_MASK_ADD)
+
+/* Changes made on other machines don't generate events */
+static FcBool
+FcWatchIsLocal (const FcChar8 *path)
+{
+    int    fd = FcOpen ((const char *)path, O_RDONLY);
+    FcBool ret;
+
+    if (fd == -1)
+	return FcFalse;
+    ret = FcIsFsMmapSafe (fd);
+    close (fd);
+
+    return ret;
+}
+
+static FcBool
+FcWatchAddParent (FcWatch *watch, int wd)
+{
+    int i;
+
+    for (i = 0; i < watch->nparent; i++) {
+	if (watch->parents[i] == wd)
+	    return FcTrue;
+    }
+    if (watch->nparent == watch->nparent_alloc) {
+	int  alloc = watch->nparent_alloc ? watch->nparent_alloc * 2 : 8;
+	int *p = realloc (watch->parents, alloc * sizeof (int));
+
+	if (!p)
+	    return FcFalse;
+	watch->parents = p;
+	watch->nparent_alloc = alloc;
+    }
+    watch->parents[watch->nparent++] = wd;
+
+    return FcTrue;
+}
+
+static FcBool
+FcWatchAddPath (FcWatch *watch, const FcChar8 *path)
+{
+    FcChar8 *dir, *parent;
+    FcBool   ret = FcFalse;
+    int      wd;
+
+    if (inotify_add_watch (watch->fd, (const char *)path, FC_WATCH_EVENTS) >= 0)
+	return FcWatchIsLocal (path);
+    if (errno != ENOENT && errno != ENOTDIR)
+	return FcFalse;
+    /*
+     * A path which doesn't exist yet is found newer once it does, so
+     * watch for it to be created in whatever part of it exists
+     */
+    dir = FcStrCopy (path);
+    while (dir) {
+	parent = FcStrDirname (dir);
+	if (!parent || !strcmp ((const char *)parent, (const char *)dir)) {
+	    FcStrFree (parent);
+	    break;
+	}
+	FcStrFree (dir);
+	dir = parent;
+	wd = inotify_add_watch (watch->fd, (const char *)dir, FC_WATCH_PARENT_EVENTS);
+	if (wd >= 0) {
+	    ret = FcWatchAddParent (watch, wd) && FcWatchIsLocal (dir);
+	    break;
+	}
+	if (errno != ENOENT && errno != ENOTDIR)
+	    break;
+    }
+    FcStrFree (dir);
+
+    return ret;
+}
+
+static void
+FcWatchBuild (FcWatch *watch, FcConfig *config)
+{
+    FcStrSet *sets[3];
+    int       i, j;
+
+    sets[0] = config->configFiles;
+    sets[1] = config->configDirs;
+    sets[2] = config->fontDirs;
+    if (watch->fd != -1)
+	close (watch->fd);
+    watch->rebuild = FcFalse;
+    watch->nparent = 0;
+    watch->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd == -1)
+	return;
+    for (i = 0; i < 3; i++) {
+	for (j = 0; j < sets[i]->num; j++) {
+	    if (!FcWatchAddPath (watch, sets[i]->strs[j])) {
+		/* Out of watches, most likely */
+		if (FcDebug() & FC_DBG_CACHE)
+		    printf ("FcWatchBuild: can't watch %s, polling instead\n", sets[i]->strs[j]);
+		close (watch->fd);
+		watch->fd = -1;
+		return;
+	    }
+	}
+    }
+}
+
+static void
+FcWatchRead (FcWatch *watch)
+{
+    union {
+	struct inotify_event event;
+	char                 buf[4096];
+    } u;
+    ssize_t len;
+    char   *p;
+    int     i;
+
+    while ((len = read (watch->fd, u.buf, sizeof (u.buf))) > 0) {
+	for (p = u.buf; p < u.buf + len; p += sizeof (struct inotify_event) + ((struct inotify_event *)p)->len) {
+	    struct inotify_event *event = (struct inotify_event *)p;
+
+	    watch->changes++;
+	    /* The path went away, or something appeared where one was missing */
+	    if (event->mask & IN_IGNORED)
+		watch->rebuild = FcTrue;
+	    for (i = 0; i < watch->nparent; i++) {
+		if (watch->parents[i] == event->wd)
+		    watch->rebuild = FcTrue;
+	    }
+	}
+    }
+    if (len == 0 || (errno != EAGAIN && errno != EINTR)) {
+	close (watch->fd);
+	watch->fd = -1;
+	watch->changes++;
+    }
+}
+
+#endif /* FC_HAVE_INOTIFY */
+
+static FcWatch *
+FcWatchCreate (void)
+{
+    FcWatch *watch = calloc (1, sizeof (FcWatch));
+
+    if (!watch)
+	return NULL;
+    FcMutexInit (&watch->lock);
+    watch->fd = -1;
+    /* Nothing is known until the paths have been looked at once */
+    watch->rebuild = FcTrue;
+    watch->changes = 1;
+
+    return watch;
+}
+
+void
+FcWatchDestroy (FcWatch *watch)
+{
+    if (!watch)
+	return;
+#ifdef FC_HAVE_INOTIFY
+    if (watch->fd != -1)
+	close (watch->fd);
+#endif
+    if (watch->parents)
+	free (watch->parents);
+    FcMutexFinish (&watch->lock);
+    free (watch);
+}
+
+static FcWatch *
+FcConfigGetWatch (FcConfig *config)
+{
+    FcWatch *watch = fc_atomic_ptr_get (&config->watch);
+
+    if (!watch) {
+	watch = FcWatchCreate();
+	if (!watch)
+	    return NULL;
+	if (!fc_atomic_ptr_cmpexch (&config->watch, NULL, watch)) {
+	    FcWatchDestroy (watch);
+	    watch = fc_atomic_ptr_get (&config->watch);
+	}
+    }
+    return watch;
+}
+
+/*
+ * Takes in what happened since the last call and sets '*serial' to a
+ * number which only stays the same while nothing did.  Returns FcFalse
+ * when the paths aren't watched, so the number doesn't tell.
+ */
+static FcBool
+FcWatchPoll (FcWatch *watch, FcConfig *config, unsigned int *serial)
+{
+    FcBool ret = FcFalse;
+
+    FcMutexLock (&watch->lock);
+#ifdef FC_HAVE_INOTIFY
+    if (watch->fd != -1)
+	FcWatchRead (watch);
+    if (watch->rebuild) {
+	FcWatchBuild (watch, config);
+	/* Anything could have happened while nothing was watched */
+	watch->changes++;
+    }
+    ret = watch->fd != -1;
+#endif
+    *serial = watch->changes;
+    FcMutexUnlock (&watch->lock);
+
+    return ret;
+}
+
+/*
+ * Returns FcTrue when none of the paths FcConfigUptoDate looks at can
+ * have changed since FcConfigWatchChecked was given the '*serial' this
+ * sets.  The first call sets up the watches.
+ */
+FcBool
+FcConfigWatchUnchanged (FcConfig *config, unsigned int *serial)
+{
+    FcWatch *watch = FcConfigGetWatch (config);
+    FcBool   ret;
+
+    *serial = 0;
+    if (!watch || !FcWatchPoll (watch, config, serial))
+	return FcFalse;
+    FcMutexLock (&watch->lock);
+    ret = *serial == watch->checked;
+    FcMutexUnlock (&watch->lock);
+
+    return ret;
+}
+
+/* The paths were found unchanged after FcConfigWatchUnchanged gave 'serial' */
+void
+FcConfigWatchChecked (FcConfig *config, unsigned int serial)
+{
+    FcWatch *watch = fc_atomic_ptr_get (&config->watch);
+
+    if (!watch)
+	return;
+    FcMutexLock (&watch->lock);
+    watch->checked = serial;
+    FcMutexUnlock (&watch->lock);
+}
+
+/*
+ * Change listeners.  A configuration someone asked about changes to
+ * gets its own watch, and a thread which waits on it to call the
+ * listeners.  What counts as a change is a different time, size or
+ * inode on any of the paths, or one appearing or going away.
+ */
+
+typedef struct _FcChangeListener {
+    FcConfigChangeFunc func;
+    void              *closure;
+} FcChangeListener;
+
+struct _FcChanges {
+    FcMutex           lock;
+    FcWatch          *watch;
+    unsigned int      serial;    /* of the watch, when the paths were last looked at */
+    time_t            polled;    /* when they were, without a watch */
+    uint64_t          signature; /* of what they looked like */
+    unsigned int      generation;
+    FcChangeListener *listeners;
+    int               nlistener;
+    int               nlistener_alloc;
+#ifdef FC_HAVE_CHANGE_THREAD
+    FcConfig *config;
+    pthread_t thread;
+    FcBool    running;
+    FcBool    orphaned;  /* the config was destroyed by one of the listeners */
+    int       wake[2];   /* written to to stop the thread */
+    FcMutex   fire_lock; /* held while listeners are called */
+#endif
+};
+
+/* Numbers the changes noticed on all configurations, so that a newer
+ * configuration never has an older generation */
+static fc_atomic_int_t fc_generation;
+
+static uint64_t
+FcChangesHash (uint64_t h, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    while (len--) {
+	h ^= *p++;
+	h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t
+FcChangesSignature (FcConfig *config)
+{
+    FcStrSet   *sets[3];
+    uint64_t    h = 0xcbf29ce484222325ULL;
+    struct stat statb;
+    int64_t     v[4];
+    int         i, j;
+
+    sets[0] = config->configFiles;
+    sets[1] = config->configDirs;
+    sets[2] = config->fontDirs;
+    for (i = 0; i < 3; i++) {
+	for (j = 0; j < sets[i]->num; j++) {
+	    memset (v, 0, sizeof (v));
+	    if (FcStat (sets[i]->strs[j], &statb) == 0) {
+		v[0] = statb.st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+		v[1] = statb.st_mtim.tv_nsec;
+#endif
+		v[2] = statb.st_size;
+		v[3] = statb.st_ino;
+	    } else
+		v[0] = -1;
+	    h = FcChangesHash (h, v, sizeof (v));
+	}
+    }
+    return h;
+}
+
+static int
+FcChangesInterval (FcConfig *config)
+{
+    return config->rescanInterval > 0 ? config->rescanInterval : FC_CHANGE_POLL_INTERVAL;
+}
+
+/*
+ * Looks for changes, with c->lock held.  Unless 'force', paths which
+ * aren't watched are only looked at once per rescan interval.  Returns
+ * FcTrue when there was a change, which got a new generation.
+ */
+static FcBool
+FcChangesCheck (FcChanges *c, FcConfig *config, FcBool force)
+{
+    unsigned int serial;
+    uint64_t     signature;
+    time_t       now;
+
+    if (FcWatchPoll (c->watch, config, &serial)) {
+	if (serial == c->serial)
+	    return FcFalse;
+    } else {
+	now = time (NULL);
+	if (!force && now - c->polled < FcChangesInterval (config))
+	    return FcFalse;
+	c->polled = now;
+    }
+    c->serial = serial;
+    signature = FcChangesSignature (config);
+    if (signature == c->signature)
+	return FcFalse;
+    c->signature = signature;
+    c->generation = fc_atomic_int_add (fc_generation, 1) + 1;
+
+    return FcTrue;
+}
+
+static FcChanges *
+FcChangesCreate (FcConfig *config)
+{
+    FcChanges *c = calloc (1, sizeof (FcChanges));
+
+    if (!c)
+	return NULL;
+    c->watch = FcWatchCreate();
+    if (!c->watch) {
+	free (c);
+	return NULL;
+    }
+    FcMutexInit (&c->lock);
+    FcWatchPoll (c->watch, config, &c->serial);
+    c->polled = time (NULL);
+    c->signature = FcChangesSignature (config);
+    c->generation = fc_atomic_int_add (fc_generation, 0);
+#ifdef FC_HAVE_CHANGE_THREAD
+    FcMutexInit (&c->fire_lock);
+    c->config = config;
+    c->wake[0] = c->wake[1] = -1;
+#endif
+
+    return c;
+}
+
+static void
+FcChangesFree (FcChanges *c)
+{
+#ifdef FC_HAVE_CHANGE_THREAD
+    if (c->wake[0] != -1) {
+	close (c->wake[0]);
+	close (c->wake[1]);
+    }
+    FcMutexFinish (&c->fire_lock);
+#endif
+    if (c->listeners)
+	free (c->listeners);
+    FcWatchDestroy (c->watch);
+    FcMutexFinish (&c->lock);
+    free (c);
+}
+
+static FcChanges *
+FcConfigGetChanges (FcConfig *config)
+{
+    FcChanges *c = fc_atomic_ptr_get (&config->changes);
+
+    if (!c) {
+	c = FcChangesCreate (config);
+	if (!c)
+	    return NULL;
+	if (!fc_atomic_ptr_cmpexch (&config->changes, NULL, c)) {
+	    FcChangesFree (c);
+	    c = fc_atomic_ptr_get (&config->changes);
+	}
+    }
+    return c;
+}
+
+#ifdef FC_HAVE_CHANGE_THREAD
+static int
+FcChangesFd (FcChanges *c)
+{
+    int fd = -1;
+
+    FcMutexLock (&c->watch->lock);
+#  ifdef FC_HAVE_INOTIFY
+    fd = c->watch->fd;
+#  endif
+    FcMutexUnlock (&c->watch->lock);
+
+    return fd;
+}
+
+/* Waits for something to happen; returns FcFalse when asked to stop */
+static FcBool
+FcChangesWait (FcChanges *c, FcConfig *config)
+{
+    struct pollfd fds[2];
+    int           n, settle;
+
+    fds[0].fd = c->wake[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = FcChangesFd (c);
+    fds[1].events = POLLIN;
+    if (fds[1].fd == -1)
+	n = poll (fds, 1, FcChangesInterval (config) * 1000);
+    else
+	n = poll (fds, 2, -1);
+    if (n > 0 && fds[0].revents)
+	return FcFalse;
+    if (n <= 0 || fds[1].fd == -1)
+	return FcTrue;
+    /* Let a burst of changes, like a package being installed, finish */
+    for (settle = 0; settle < FC_CHANGE_SETTLE_MAX; settle++) {
+	unsigned int serial;
+
+	FcMutexLock (&c->lock);
+	FcWatchPoll (c->watch, config, &serial);
+	FcMutexUnlock (&c->lock);
+	fds[1].fd = FcChangesFd (c);
+	if (fds[1].fd == -1)
+	    break;
+	n = poll (fds, 2, FC_CHANGE_SETTLE_MS);
+	if (n > 0 && fds[0].revents)
+	    return FcFalse;
+	if (n <= 0)
+	    break;
+    }
+    return FcTrue;
+}
+
+static void *
+FcChangesMain (void *arg)
+{
+    FcChanges        *c = arg;
+    FcConfig         *config = c->config;
+    FcChangeListener *listeners = NULL;
+    int               nlistener = 0, i;
+    FcBool            changed;
+
+    while (FcChangesWait (c, config)) {
+	FcMutexLock (&c->lock);
+	changed = FcChangesCheck (c, config, FcTrue);
+	if (changed && c->nlistener) {
+	    listeners = malloc (c->nlistener * sizeof (FcChangeListener));
+	    if (listeners) {
+		memcpy (listeners, c->listeners, c->nlistener * sizeof (FcChangeListener));
+		nlistener = c->nlistener;
+	    }
+	}
+	FcMutexUnlock (&c->lock);
+	if (!listeners)
+	    continue;
+
+	FcMutexLock (&c->fire_lock);
+	for (i = 0; i < nlistener && !c->orphaned; i++)
+	    listeners[i].func (config, listeners[i].closure);
+	FcMutexUnlock (&c->fire_lock);
+	free (listeners);
+	listeners = NULL;
+	if (c->orphaned) {
+	    FcChangesFree (c);
+	    break;
+	}
+    }
+    return NULL;
+}
+
+static FcBool
+FcChangesStart (FcChanges *c)
+{
+    int i;
+
+    if (c->running)
+	return FcTrue;
+    if (pipe (c->wake) == -1) {
+	c->wake[0] = c->wake[1] = -1;
+	return FcFalse;
+    }
+    for (i = 0; i < 2; i++)
+	fcntl (c->wake[i], F_SETFD, FD_CLOEXEC);
+    if (pthread_create (&c->thread, NULL, FcChangesMain, c) != 0) {
+	close (c->wake[0]);
+	close (c->wake[1]);
+	c->wake[0] = c->wake[1] = -1;
+	return FcFalse;
+    }
+    c->running = FcTrue;
+
+    return FcTrue;
+}
+#endif /* FC_HAVE_CHANGE_THREAD */
+
+void
+FcChangesDestroy (FcChanges *c)
+{
+    if (!c)
+	return;
+#ifdef FC_HAVE_CHANGE_THREAD
+    if (c->running) {
+	/* A listener let go of the configuration; the thread cleans up */
+	if (pthread_equal (pthread_self(), c->thread)) {
+	    c->orphaned = FcTrue;
+	    pthread_detach (c->thread);
+	    return;
+	}
+	while (write (c->wake[1], "", 1) == -1 && errno == EINTR)
+	    ;
+	pthread_join (c->thread, NULL);
+    }
+#endif
+    FcChangesFree (c);
+}
+
+FcBool
+FcConfigAddChangeListener (FcConfig          *config,
+                           FcConfigChangeFunc func,
+                           void              *closure)
+{
+    FcBool ret = FcFalse;
+#ifdef FC_HAVE_CHANGE_THREAD
+    FcChanges *c;
+
+    if (!func)
+	return FcFalse;
+    config = FcConfigReference (config);
+    if (!config)
+	return FcFalse;
+    c = FcConfigGetChanges (config);
+    if (!c)
+	goto bail;
+    FcMutexLock (&c->lock);
+    if (c->nlistener == c->nlistener_alloc) {
+	int               alloc = c->nlistener_alloc ? c->nlistener_alloc * 2 : 4;
+	FcChangeListener *l = realloc (c->listeners, alloc * sizeof (FcChangeListener));
+
+	if (!l)
+	    goto bail1;
+	c->listeners = l;
+	c->nlistener_alloc = alloc;
+    }
+    if (!FcChangesStart (c))
+	goto bail1;
+    c->listeners[c->nlistener].func = func;
+    c->listeners[c->nlistener].closure = closure;
+    c->nlistener++;
+    ret = FcTrue;
+bail1:
+    FcMutexUnlock (&c->lock);
+bail:
+    FcConfigDestroy (config);
+#endif
+
+    return ret;
+}
+
+FcBool
+FcConfigRemoveChangeListener (FcConfig          *config,
+                              FcConfigChangeFunc func,
+                              void              *closure)
+{
+    FcBool ret = FcFalse;
+#ifdef FC_HAVE_CHANGE_THREAD
+    FcChanges *c;
+    FcBool     wait = FcFalse;
+    int        i;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return FcFalse;
+    c = fc_atomic_ptr_get (&config->changes);
+    if (!c)
+	goto bail;
+    FcMutexLock (&c->lock);
+    for (i = 0; i < c->nlistener; i++) {
+	if (c->listeners[i].func == func && c->listeners[i].closure == closure) {
+	    memmove (c->listeners + i, c->listeners + i + 1,
+	             (c->nlistener - i - 1) * sizeof (FcChangeListener));
+	    c->nlistener--;
+	    ret = FcTrue;
+	    wait = c->running && !pthread_equal (pthread_self(), c->thread);
+	    break;
+	}
+    }
+    FcMutexUnlock (&c->lock);
+    /* Wait for the listener to return if it's being called */
+    if (wait) {
+	FcMutexLock (&c->fire_lock);
+	FcMutexUnlock (&c->fire_lock);
+    }
+bail:
+    FcConfigDestroy (config);
+#endif
+
+    return ret;
+}
+
+unsigned int
+FcConfigGetGeneration (FcConfig *config)
+{
+    FcChanges   *c;
+    unsigned int ret = 0;
+
+    config = FcConfigReference (config);
+    if (!config)
+	return 0;
+    c = FcConfigGetChanges (config);
+    if (c) {
+	FcMutexLock (&c->lock);
+	/* The thread keeps it current when there is one */
+#ifdef FC_HAVE_CHANGE_THREAD
+	if (!c->running)
+#endif
+	    FcChangesCheck (c, config, FcFalse);
+	ret = c->generation;
+	FcMutexUnlock (&c->lock);
+    }
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+#define __fcwatch__
+#include "fcaliastail.h"
+#undef __fcwatch__
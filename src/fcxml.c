@@ -594,32 +594,82 @@ typedef enum _FcConfigSeverity {
 static FcBool
 FcConfigLexBool (FcConfigParse *parse, const FcChar8 *bool_);
 
+/*
+ * A file of a config directory being parsed on a worker thread, into a
+ * configuration of its own which is spliced into the real one once the
+ * files before it are in.
+ */
+struct _FcParseJob {
+    const FcChar8 *file;
+    FcConfig      *config;   /* what the file is parsed into */
+    FcStrBuf       messages; /* held back until the file is spliced in */
+    int            rescan;   /* config->rescanInterval before parsing */
+    FcBool         serial;   /* the file has to be parsed in place instead */
+    FcBool         ret;
+};
+
 static void
-FcConfigMessage (FcConfigParse *parse, FcConfigSeverity severe, const char *fmt, ...)
+FcConfigVMessage (FcConfig         *config,
+                  FcConfigParse    *parse,
+                  FcConfigSeverity  severe,
+                  const char       *fmt,
+                  va_list           args)
 {
     const char *s = "unknown";
-    va_list     args;
-
-    va_start (args, fmt);
+    FcStrBuf    buf;
+    FcBool      ret;
 
     switch (severe) {
     case FcSevereInfo: s = "info"; break;
     case FcSevereWarning: s = "warning"; break;
     case FcSevereError: s = "error"; break;
     }
+    FcStrBufInit (&buf, NULL, 0);
     if (parse) {
 	if (parse->name)
-	    fprintf (stderr, "Fontconfig %s: \"%s\", line %d: ", s,
-	             parse->name, (int)XML_GetCurrentLineNumber (parse->parser));
+	    FcStrBufFormat (&buf, "Fontconfig %s: \"%s\", line %d: ", s,
+	                    parse->name, (int)XML_GetCurrentLineNumber (parse->parser));
 	else
-	    fprintf (stderr, "Fontconfig %s: line %d: ", s,
-	             (int)XML_GetCurrentLineNumber (parse->parser));
+	    FcStrBufFormat (&buf, "Fontconfig %s: line %d: ", s,
+	                    (int)XML_GetCurrentLineNumber (parse->parser));
 	if (severe >= FcSevereError)
 	    parse->error = FcTrue;
     } else
-	fprintf (stderr, "Fontconfig %s: ", s);
-    vfprintf (stderr, fmt, args);
-    fprintf (stderr, "\n");
+	FcStrBufFormat (&buf, "Fontconfig %s: ", s);
+    FcStrBufVapFormat (ret, &buf, fmt, args);
+    (void)ret;
+    FcStrBufChar (&buf, '\n');
+    if (config) {
+	/* Parse again next time, so the message isn't lost */
+	FcConfigSnapshotInvalidate (config);
+	if (config->parse_job) {
+	    FcStrBufString (&config->parse_job->messages, FcStrBufDoneStatic (&buf));
+	    FcStrBufDestroy (&buf);
+	    return;
+	}
+    }
+    fputs ((const char *)FcStrBufDoneStatic (&buf), stderr);
+    FcStrBufDestroy (&buf);
+}
+
+static void
+FcConfigMessage (FcConfigParse *parse, FcConfigSeverity severe, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start (args, fmt);
+    FcConfigVMessage (parse ? parse->config : NULL, parse, severe, fmt, args);
+    va_end (args);
+}
+
+/* For messages about a whole file rather than a line of it */
+static void
+FcConfigReport (FcConfig *config, FcConfigSeverity severe, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start (args, fmt);
+    FcConfigVMessage (config, NULL, severe, fmt, args);
     va_end (args);
 }
 
@@ -1191,13 +1241,28 @@ FcPStackPush (FcConfigParse *parse, FcElement element, const XML_Char **attr)
     return FcTrue;
 }
 
-static FcBool
-FcPStackPop (FcConfigParse *parse)
+static void
+FcConfigRetrieveWarnings (FcConfig *config)
 {
-    FcPStack     *old;
     static FcBool retrieved = FcFalse;
     const char   *env = NULL;
 
+    if (!retrieved) {
+	FcBool flag = FcFalse;
+
+	env = getenv ("FONTCONFIG_WARN_INVALID_ATTRS");
+	if (env && FcNameBool ((const FcChar8 *)env, &flag)) {
+	    retrieved = FcTrue;
+	    FcConfigSetWarningFlags (config, FC_WARN_INVALID_ATTR, flag);
+	}
+    }
+}
+
+static FcBool
+FcPStackPop (FcConfigParse *parse)
+{
+    FcPStack *old;
+
     if (!parse->pstack) {
 	FcConfigMessage (parse, FcSevereError, "mismatching element");
 	return FcFalse;
@@ -1206,15 +1271,7 @@ FcPStackPop (FcConfigParse *parse)
     /* Don't check the attributes for FcElementNone */
     if (parse->pstack->element != FcElementNone &&
         parse->pstack->attr) {
-	if (!retrieved) {
-	    FcBool flag = FcFalse;
-
-	    env = getenv ("FONTCONFIG_WARN_INVALID_ATTRS");
-	    if (env && FcNameBool ((const FcChar8 *)env, &flag)) {
-		retrieved = FcTrue;
-		FcConfigSetWarningFlags (parse->config, FC_WARN_INVALID_ATTR, flag);
-	    }
-	}
+	FcConfigRetrieveWarnings (parse->config);
 	/* Warn only when a flag is turned on */
 	if (FcConfigGetWarningFlags (parse->config) & FC_WARN_INVALID_ATTR) {
 	    /* Warn about unused attrs. */
@@ -1396,6 +1453,9 @@ _get_real_paths_from_prefix (FcConfigParse *parse, const FcChar8 *path, const Fc
 	FcStrFree (parent);
     } else {
 	retval = FcStrCopy (path);
+	/* Left for FcStrCopyFilename to resolve against the cwd */
+	if (!FcStrIsAbsoluteFilename (path) && path[0] != '~')
+	    FcConfigSnapshotUsesCwd (parse->config);
     }
     if (!e)
 	e = FcStrSetCreate();
@@ -2037,6 +2097,9 @@ FcParseRemapDir (FcConfigParse *parse)
 static void
 FcParseResetDirs (FcConfigParse *parse)
 {
+    /* Can't be done without the directories of the files before it */
+    if (parse->config->parse_job)
+	parse->config->parse_job->serial = FcTrue;
     if (!parse->scanOnly) {
 	if (!FcConfigResetFontDirs (parse->config))
 	    FcConfigMessage (parse, FcSevereError, "Unable to reset fonts dirs");
@@ -2382,6 +2445,7 @@ FcParseInclude (FcConfigParse *parse)
 	    FcPtrListIterInitAtLast (parse->config->subst[k], &iter);
 	    FcRuleSetReference (ruleset);
 	    FcPtrListIterAdd (parse->config->subst[k], &iter, ruleset);
+	    FcConfigClearRuleCode (parse->config);
 	}
     }
     FcRuleSetDestroy (ruleset);
@@ -3053,6 +3117,240 @@ FcSortCmpStr (const void *a, const void *b)
     return FcStrCmp (as, bs);
 }
 
+typedef struct _FcParseDirWork {
+    FcParseJob     *jobs;
+    int             njob;
+    FcBool          complain;
+    FcBool          load;
+    fc_atomic_int_t next;
+} FcParseDirWork;
+
+static void
+FcParseDirWorker (void *closure, int worker FC_UNUSED)
+{
+    FcParseDirWork *dir = closure;
+    int             j;
+
+    while ((j = fc_atomic_int_add (dir->next, 1)) < dir->njob) {
+	FcParseJob *job = &dir->jobs[j];
+
+	if (job->config)
+	    job->ret = _FcConfigParse (job->config, job->file, dir->complain, dir->load);
+    }
+}
+
+static FcBool
+FcConfigParseJobSetup (FcConfig *config, FcParseJob *job)
+{
+    FcConfig *scratch = FcConfigCreate();
+
+    if (!scratch)
+	return FcFalse;
+    if (config->sysRoot) {
+	scratch->sysRoot = FcStrCopy (config->sysRoot);
+	if (!scratch->sysRoot) {
+	    FcConfigDestroy (scratch);
+	    return FcFalse;
+	}
+    }
+    scratch->warns = config->warns;
+    scratch->parse_job = job;
+    FcConfigSnapshotFork (config, scratch);
+    job->config = scratch;
+    job->rescan = scratch->rescanInterval;
+
+    return FcTrue;
+}
+
+static FcBool
+FcStrSetAppend (FcStrSet *set, FcStrSet *from)
+{
+    int i;
+
+    for (i = 0; i < from->num; i++) {
+	if (!FcStrSetAdd (set, from->strs[i]))
+	    return FcFalse;
+    }
+    return FcTrue;
+}
+
+/* Moves the patterns, which belong to 'set' afterwards */
+static FcBool
+FcFontSetAppend (FcFontSet *set, FcFontSet *from)
+{
+    int i;
+
+    for (i = 0; i < from->nfont; i++) {
+	if (!FcFontSetAdd (set, from->fonts[i]))
+	    break;
+    }
+    if (i) {
+	memmove (from->fonts, from->fonts + i, (from->nfont - i) * sizeof (FcPattern *));
+	from->nfont -= i;
+    }
+
+    return from->nfont == 0;
+}
+
+static FcBool
+FcPtrListAppend (FcPtrList *list, FcPtrList *from)
+{
+    FcPtrListIter iter, liter;
+
+    FcPtrListIterInit (from, &iter);
+    for (; FcPtrListIterIsValid (from, &iter); FcPtrListIterNext (from, &iter)) {
+	FcRuleSet *rs = FcPtrListIterGetValue (from, &iter);
+
+	FcPtrListIterInitAtLast (list, &liter);
+	FcRuleSetReference (rs);
+	if (!FcPtrListIterAdd (list, &liter, rs)) {
+	    FcRuleSetDestroy (rs);
+	    return FcFalse;
+	}
+    }
+    return FcTrue;
+}
+
+/*
+ * Moves what parsing one file put into its own configuration into the
+ * one it would have been parsed into, as though it had been.
+ */
+static FcBool
+FcConfigParseJobSplice (FcConfig *config, FcParseJob *job)
+{
+    FcConfig   *scratch = job->config;
+    FcExprPage *page;
+    FcMatchKind k;
+    int         i;
+
+    if (!FcStrSetAppend (config->configFiles, scratch->configFiles) ||
+        !FcStrSetAppend (config->availConfigFiles, scratch->availConfigFiles) ||
+        !FcStrSetAppend (config->configDirs, scratch->configDirs) ||
+        !FcStrSetAppend (config->cacheDirs, scratch->cacheDirs) ||
+        !FcStrSetAppend (config->acceptGlobs, scratch->acceptGlobs) ||
+        !FcStrSetAppend (config->rejectGlobs, scratch->rejectGlobs))
+	return FcFalse;
+    FcConfigClearGlobCode (config);
+    FcConfigClearCacheAggregates (config);
+    for (i = 0; i < scratch->fontDirs->num; i++) {
+	FcChar8 *s = scratch->fontDirs->strs[i];
+
+	if (!FcStrSetAddTriple (config->fontDirs, s, FcStrTripleSecond (s), FcStrTripleThird (s)))
+	    return FcFalse;
+    }
+    if (!FcFontSetAppend (config->acceptPatterns, scratch->acceptPatterns) ||
+        !FcFontSetAppend (config->rejectPatterns, scratch->rejectPatterns))
+	return FcFalse;
+    FcConfigClearListFilters (config);
+    for (k = FcMatchKindBegin; k < FcMatchKindEnd; k++) {
+	if (!FcPtrListAppend (config->subst[k], scratch->subst[k]))
+	    return FcFalse;
+    }
+    FcConfigClearRuleCode (config);
+    if (!FcPtrListAppend (config->rulesetList, scratch->rulesetList))
+	return FcFalse;
+    if (config->maxObjects < scratch->maxObjects)
+	config->maxObjects = scratch->maxObjects;
+    if (scratch->rescanInterval != job->rescan)
+	config->rescanInterval = scratch->rescanInterval;
+    config->warns = scratch->warns;
+
+    /* The rules point into the expressions allocated for them */
+    if (scratch->expr_pool) {
+	for (page = scratch->expr_pool; page->next_page; page = page->next_page)
+	    ;
+	if (config->expr_pool) {
+	    page->next_page = config->expr_pool->next_page;
+	    config->expr_pool->next_page = scratch->expr_pool;
+	} else
+	    config->expr_pool = scratch->expr_pool;
+	scratch->expr_pool = NULL;
+    }
+    FcConfigSnapshotJoin (config, scratch);
+
+    return FcTrue;
+}
+
+/*
+ * Whether the file has to be parsed again in place, because parsing it
+ * by itself may have come out differently.
+ */
+static FcBool
+FcConfigParseJobIsSerial (FcConfig *config, FcParseJob *job)
+{
+    int i;
+
+    if (!job->config || job->serial)
+	return FcTrue;
+    /* Includes of files which were already loaded are skipped */
+    for (i = 0; i < job->config->availConfigFiles->num; i++) {
+	if (FcStrSetMember (config->availConfigFiles, job->config->availConfigFiles->strs[i]))
+	    return FcTrue;
+    }
+    return FcFalse;
+}
+
+/*
+ * Parses the files of a config dir in order.  With more than one thread
+ * allowed, each file is parsed into a configuration of its own on a
+ * worker first, and those are spliced in order into this one, their
+ * messages printed as they are.
+ */
+static FcBool
+FcConfigParseFiles (FcConfig *config,
+                    FcStrSet *files,
+                    FcBool    complain,
+                    FcBool    load)
+{
+    FcParseDirWork dir;
+    FcBool         ret = FcTrue;
+    int            i;
+
+    if (config->nthreads <= 1 || config->parse_job || files->num <= 1 ||
+        (FcDebug() & FC_DBG_CONFIG) ||
+        !(dir.jobs = calloc (files->num, sizeof (FcParseJob)))) {
+	for (i = 0; ret && i < files->num; i++)
+	    ret = _FcConfigParse (config, files->strs[i], complain, load);
+	return ret;
+    }
+    dir.njob = files->num;
+    dir.complain = complain;
+    dir.load = load;
+    dir.next = 0;
+    FcConfigRetrieveWarnings (config);
+#ifdef ENABLE_LIBXML2
+    xmlInitParser();
+#endif
+    for (i = 0; i < dir.njob; i++) {
+	dir.jobs[i].file = files->strs[i];
+	FcStrBufInit (&dir.jobs[i].messages, NULL, 0);
+	if (!FcConfigParseJobSetup (config, &dir.jobs[i]))
+	    dir.jobs[i].serial = FcTrue;
+    }
+    FcWorkersRun (FC_MIN (config->nthreads, dir.njob), FcParseDirWorker, &dir);
+
+    for (i = 0; ret && i < dir.njob; i++) {
+	FcParseJob *job = &dir.jobs[i];
+
+	if (FcConfigParseJobIsSerial (config, job))
+	    ret = _FcConfigParse (config, job->file, complain, load);
+	else if (!FcConfigParseJobSplice (config, job))
+	    ret = FcFalse;
+	else {
+	    fputs ((const char *)FcStrBufDoneStatic (&job->messages), stderr);
+	    ret = job->ret;
+	}
+    }
+    for (i = 0; i < dir.njob; i++) {
+	if (dir.jobs[i].config)
+	    FcConfigDestroy (dir.jobs[i].config);
+	FcStrBufDestroy (&dir.jobs[i].messages);
+    }
+    free (dir.jobs);
+
+    return ret;
+}
+
 static FcBool
 FcConfigParseAndLoadDir (FcConfig      *config,
                          const FcChar8 *name,
@@ -3070,8 +3368,8 @@ FcConfigParseAndLoadDir (FcConfig      *config,
     d = opendir ((char *)dir);
     if (!d) {
 	if (complain)
-	    FcConfigMessage (0, FcSevereError, "Cannot open config dir \"%s\"",
-	                     name);
+	    FcConfigReport (config, FcSevereError, "Cannot open config dir \"%s\"",
+	                    name);
 	ret = FcFalse;
 	goto bail0;
     }
@@ -3117,11 +3415,9 @@ FcConfigParseAndLoadDir (FcConfig      *config,
 	}
     }
     if (ret && files->num > 0) {
-	int i;
 	qsort (files->strs, files->num, sizeof (FcChar8 *),
 	       (int (*) (const void *, const void *))FcSortCmpStr);
-	for (i = 0; ret && i < files->num; i++)
-	    ret = _FcConfigParse (config, files->strs[i], complain, load);
+	ret = FcConfigParseFiles (config, files, complain, load);
     }
 bail3:
     FcStrSetDestroy (files);
@@ -3235,6 +3531,7 @@ FcConfigParseAndLoadFromMemoryInternal (FcConfig      *config,
 		FcPtrListIterInitAtLast (parse.config->subst[k], &iter);
 		FcRuleSetReference (parse.ruleset);
 		FcPtrListIterAdd (parse.config->subst[k], &iter, parse.ruleset);
+		FcConfigClearRuleCode (parse.config);
 	    }
 	}
     }
@@ -3247,7 +3544,7 @@ bail2:
     XML_ParserFree (p);
 bail1:
     if (error && complain) {
-	FcConfigMessage (0, FcSevereError, "Cannot %s config file from %s", load ? "load" : "scan", filename);
+	FcConfigReport (config, FcSevereError, "Cannot %s config file from %s", load ? "load" : "scan", filename);
 	return FcFalse;
     }
     if (FcDebug() & FC_DBG_CONFIG)
@@ -3276,6 +3573,7 @@ _FcConfigParse (FcConfig      *config,
 
     filename = FcConfigGetFilename (config, name);
     if (!filename) {
+	FcConfigSnapshotAddSource (config, name, NULL);
 	FcStrBufString (&reason, (FcChar8 *)"File not found");
 	if (name) {
 	    FcStrBufString (&reason, (FcChar8 *)": ");
@@ -3290,6 +3588,7 @@ _FcConfigParse (FcConfig      *config,
 	goto bail0;
     }
     realfilename = FcConfigRealFilename (config, name);
+    FcConfigSnapshotAddSource (config, name, realfilename);
     if (!realfilename) {
 	FcStrBufString (&reason, (FcChar8 *)"No such realfile: ");
 	FcStrBufString (&reason, name ? name : (FcChar8 *)"(null)");
@@ -3340,7 +3639,7 @@ _FcConfigParse (FcConfig      *config,
 #else
 	    ebuf[0] = 0;
 #endif
-	    FcConfigMessage (0, FcSevereError, "failed reading config file: %s: %s (errno %d)", realfilename, ebuf, errno_);
+	    FcConfigReport (config, FcSevereError, "failed reading config file: %s: %s (errno %d)", realfilename, ebuf, errno_);
 	    close (fd);
 	    goto bail1;
 	}
@@ -3363,9 +3662,9 @@ bail0:
     }
     if (!ret && complain_again) {
 	if (name)
-	    FcConfigMessage (0, FcSevereError, "Cannot %s config file \"%s\": %s", load ? "load" : "scan", name, FcStrBufDoneStatic (&reason));
+	    FcConfigReport (config, FcSevereError, "Cannot %s config file \"%s\": %s", load ? "load" : "scan", name, FcStrBufDoneStatic (&reason));
 	else
-	    FcConfigMessage (0, FcSevereError, "Cannot %s default config file: %s", load ? "load" : "scan", FcStrBufDoneStatic (&reason));
+	    FcConfigReport (config, FcSevereError, "Cannot %s default config file: %s", load ? "load" : "scan", FcStrBufDoneStatic (&reason));
 	FcStrBufDestroy (&reason);
 	return FcFalse;
     }
@@ -3386,7 +3685,10 @@ FcConfigParseAndLoad (FcConfig      *config,
                       const FcChar8 *name,
                       FcBool         complain)
 {
-    return _FcConfigParse (config, name, complain, FcTrue);
+    FcBool ret = _FcConfigParse (config, name, complain, FcTrue);
+
+    FcConfigCompileRules (config);
+    return ret;
 }
 
 FcBool
@@ -3394,7 +3696,11 @@ FcConfigParseAndLoadFromMemory (FcConfig      *config,
                                 const FcChar8 *buffer,
                                 FcBool         complain)
 {
-    return FcConfigParseAndLoadFromMemoryInternal (config, (const FcChar8 *)"memory", buffer, complain, FcTrue);
+    FcBool ret = FcConfigParseAndLoadFromMemoryInternal (config, (const FcChar8 *)"memory", buffer, complain, FcTrue);
+
+    FcConfigSnapshotInvalidate (config);
+    FcConfigCompileRules (config);
+    return ret;
 }
 
 #ifdef _WIN32
@@ -0,0 +1,209 @@
+/*
+ * fontconfig/test/bench-cache-reference.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "cache-fixture.h"
+
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * Times referencing and releasing a font pattern and its charset held
+ * in a cache from a growing number of threads, which looks the cache
+ * up by address every time, once on its own and once while another
+ * thread keeps loading and unloading the cache of another directory.
+ * Times are per thread and iteration, so flat numbers mean linear scaling.
+ */
+
+#define ITERATIONS  200000
+#define MAX_THREADS 64
+
+typedef struct {
+    FcPattern *font;
+    int        iterations;
+    int        errors;
+} ThreadArg;
+
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static int             done;
+
+static int
+is_done (void)
+{
+    int ret;
+
+    pthread_mutex_lock (&done_lock);
+    ret = done;
+    pthread_mutex_unlock (&done_lock);
+
+    return ret;
+}
+
+static void
+set_done (int value)
+{
+    pthread_mutex_lock (&done_lock);
+    done = value;
+    pthread_mutex_unlock (&done_lock);
+}
+
+static double
+now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *
+run_reader (void *arg)
+{
+    ThreadArg *thr_arg = (ThreadArg *)arg;
+    FcCharSet *charset, *copy;
+    int        i;
+
+    if (FcPatternGetCharSet (thr_arg->font, FC_CHARSET, 0, &charset) != FcResultMatch) {
+	thr_arg->errors++;
+	return NULL;
+    }
+    for (i = 0; i < thr_arg->iterations; i++) {
+	FcPatternReference (thr_arg->font);
+	copy = FcCharSetCopy (charset);
+	if (copy != charset)
+	    thr_arg->errors++;
+	FcCharSetDestroy (copy);
+	FcPatternDestroy (thr_arg->font);
+    }
+
+    return NULL;
+}
+
+static void *
+run_writer (void *arg)
+{
+    FcConfig *config = (FcConfig *)arg;
+    FcCache  *cache;
+    char      dir[1024];
+
+    snprintf (dir, sizeof (dir), "%s/other", basedir);
+    while (!is_done()) {
+	cache = FcDirCacheRead ((const FcChar8 *)dir, FcFalse, config);
+	if (cache)
+	    FcDirCacheUnload (cache);
+    }
+
+    return NULL;
+}
+
+static int
+run (FcConfig *config, FcPattern *font, int nthreads, FcBool writer, double *ns)
+{
+    pthread_t threads[MAX_THREADS], writer_thread;
+    ThreadArg args[MAX_THREADS];
+    double    start;
+    int       i, n, errors = 0;
+
+    set_done (0);
+    if (writer && pthread_create (&writer_thread, NULL, run_writer, config) != 0) {
+	fprintf (stderr, "E: cannot create the writer thread\n");
+	return -1;
+    }
+    start = now();
+    for (n = 0; n < nthreads; n++) {
+	args[n].font = font;
+	args[n].iterations = ITERATIONS;
+	args[n].errors = 0;
+	if (pthread_create (&threads[n], NULL, run_reader, &args[n]) != 0) {
+	    fprintf (stderr, "E: cannot create thread %d\n", n);
+	    break;
+	}
+    }
+    for (i = 0; i < n; i++) {
+	pthread_join (threads[i], NULL);
+	errors += args[i].errors;
+    }
+    *ns = (now() - start) / ITERATIONS;
+    set_done (1);
+    if (writer)
+	pthread_join (writer_thread, NULL);
+
+    return n == nthreads ? errors : -1;
+}
+
+int
+main (int argc, char **argv)
+{
+    FcConfig  *config = NULL;
+    FcFontSet *fonts;
+    int        max_threads = argc > 1 ? atoi (argv[1]) : 16;
+    int        nthreads, errors, ret = 1;
+    double     ns, ns_writer;
+
+    if (max_threads < 1 || max_threads > MAX_THREADS) {
+	fprintf (stderr, "usage: %s [1-%d]\n", argv[0], MAX_THREADS);
+	return 1;
+    }
+    if (setup_basedir ("/tmp/fccachebench-XXXXXX"))
+	return 1;
+    if (!mkdir_p (path ("fonts")) ||
+        !mkdir_p (path ("other")) ||
+        copy_font ("fonts/a.pcf") ||
+        copy_font ("other/b.pcf"))
+	goto bail;
+    config = create_config ("");
+    if (!config)
+	goto bail;
+    if (!FcConfigBuildFonts (config)) {
+	fprintf (stderr, "E: unable to load the fonts\n");
+	goto bail;
+    }
+    /* Written once, mapped or read again by the writer thread */
+    FcDirCacheUnload (FcDirCacheRead ((const FcChar8 *)path ("other"), FcFalse, config));
+    fonts = FcConfigGetFonts (config, FcSetSystem);
+    if (!fonts || fonts->nfont != 1) {
+	fprintf (stderr, "E: no font loaded\n");
+	goto bail;
+    }
+
+    ret = 0;
+    printf ("%-8s %12s %12s\n", "threads", "ns/iter", "w/ writer");
+    for (nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+	errors = run (config, fonts->fonts[0], nthreads, FcFalse, &ns);
+	if (errors == 0)
+	    errors = run (config, fonts->fonts[0], nthreads, FcTrue, &ns_writer);
+	if (errors != 0) {
+	    fprintf (stderr, "E: %d threads: %d errors\n", nthreads, errors);
+	    ret = 1;
+	    break;
+	}
+	printf ("%-8d %12.1f %12.1f\n", nthreads, ns, ns_writer);
+    }
+
+bail:
+    if (config)
+	FcConfigDestroy (config);
+    unlink_dirs (basedir);
+    FcFini();
+
+    return ret;
+}
@@ -0,0 +1,228 @@
+/*
+ * fontconfig/test/bench-charset.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include <fontconfig/fontconfig.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Times the FcCharSet operations used while matching on CJK-sized
+ * coverage, once per leaf kernel.  Every kernel runs in its own child
+ * process since the library picks the kernel the first time a charset
+ * operation happens.
+ */
+
+#define ITERATIONS 2000
+
+enum {
+    OP_COUNT,
+    OP_INTERSECT_COUNT,
+    OP_SUBTRACT_COUNT,
+    OP_IS_SUBSET,
+    OP_INTERSECT,
+    OP_UNION,
+    OP_MERGE,
+    OP_END
+};
+
+static const char *op_names[OP_END] = {
+    "FcCharSetCount",
+    "FcCharSetIntersectCount",
+    "FcCharSetSubtractCount",
+    "FcCharSetIsSubset",
+    "FcCharSetIntersect",
+    "FcCharSetUnion",
+    "FcCharSetMerge",
+};
+
+typedef struct {
+    double   ns[OP_END];
+    FcChar32 check[OP_END];
+} Result;
+
+/* Latin plus the CJK Unified Ideographs block, with every step'th
+ * codepoint left out so the two fonts differ in most leaves */
+static FcCharSet *
+make_charset (int step, int phase)
+{
+    FcCharSet *cs = FcCharSetCreate();
+    FcChar32   ucs4;
+
+    for (ucs4 = 0x20; ucs4 < 0x250; ucs4++)
+	FcCharSetAddChar (cs, ucs4);
+    for (ucs4 = 0x3000; ucs4 < 0x3100; ucs4++)
+	FcCharSetAddChar (cs, ucs4);
+    for (ucs4 = 0x4e00; ucs4 < 0xa000; ucs4++) {
+	if ((ucs4 + phase) % step)
+	    FcCharSetAddChar (cs, ucs4);
+    }
+    return cs;
+}
+
+static double
+now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+run (Result *r)
+{
+    FcCharSet *a = make_charset (7, 0);
+    FcCharSet *b = make_charset (5, 3);
+    FcCharSet *sub = FcCharSetIntersect (a, b);
+    FcCharSet *merged = FcCharSetCreate();
+    FcCharSet *cs;
+    double     start;
+    int        op, i;
+
+    memset (r, 0, sizeof (*r));
+    FcCharSetMerge (merged, a, NULL);
+
+    for (op = 0; op < OP_END; op++) {
+	start = now();
+	for (i = 0; i < ITERATIONS; i++) {
+	    switch (op) {
+	    case OP_COUNT:
+		r->check[op] += FcCharSetCount (a);
+		break;
+	    case OP_INTERSECT_COUNT:
+		r->check[op] += FcCharSetIntersectCount (a, b);
+		break;
+	    case OP_SUBTRACT_COUNT:
+		r->check[op] += FcCharSetSubtractCount (a, b);
+		break;
+	    case OP_IS_SUBSET:
+		r->check[op] += FcCharSetIsSubset (sub, a) + FcCharSetIsSubset (a, b);
+		break;
+	    case OP_INTERSECT:
+		cs = FcCharSetIntersect (a, b);
+		r->check[op] += FcCharSetCount (cs);
+		FcCharSetDestroy (cs);
+		break;
+	    case OP_UNION:
+		cs = FcCharSetUnion (a, b);
+		r->check[op] += FcCharSetCount (cs);
+		FcCharSetDestroy (cs);
+		break;
+	    case OP_MERGE:
+		FcCharSetMerge (merged, b, NULL);
+		break;
+	    }
+	}
+	r->ns[op] = (now() - start) / ITERATIONS;
+    }
+    r->check[OP_MERGE] = FcCharSetCount (merged);
+
+    FcCharSetDestroy (merged);
+    FcCharSetDestroy (sub);
+    FcCharSetDestroy (b);
+    FcCharSetDestroy (a);
+}
+
+static int
+run_kernel (const char *kernel, Result *r)
+{
+    int   fds[2], status, ok;
+    pid_t pid;
+
+    if (pipe (fds) < 0)
+	return 0;
+    pid = fork();
+    if (pid < 0) {
+	close (fds[0]);
+	close (fds[1]);
+	return 0;
+    }
+    if (pid == 0) {
+	close (fds[0]);
+	setenv ("FC_CHARSET_KERNEL", kernel, 1);
+	run (r);
+	if (write (fds[1], r, sizeof (*r)) != sizeof (*r))
+	    _exit (1);
+	_exit (0);
+    }
+    close (fds[1]);
+    ok = read (fds[0], r, sizeof (*r)) == sizeof (*r);
+    close (fds[0]);
+    if (waitpid (pid, &status, 0) < 0 || !WIFEXITED (status) || WEXITSTATUS (status))
+	return 0;
+
+    return ok;
+}
+
+int
+main (void)
+{
+    const char *kernels[4];
+    Result      results[4];
+    int         nkernel = 0, k, op, ret = 0;
+
+    kernels[nkernel++] = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports ("sse2"))
+	kernels[nkernel++] = "sse2";
+    if (__builtin_cpu_supports ("avx2"))
+	kernels[nkernel++] = "avx2";
+#elif defined(__aarch64__)
+    kernels[nkernel++] = "neon";
+#endif
+
+    for (k = 0; k < nkernel; k++) {
+	if (!run_kernel (kernels[k], &results[k])) {
+	    fprintf (stderr, "E: %s kernel failed to run\n", kernels[k]);
+	    return 1;
+	}
+    }
+
+    printf ("%-24s", "ns/op");
+    for (k = 0; k < nkernel; k++)
+	printf (" %10s", kernels[k]);
+    printf ("\n");
+    for (op = 0; op < OP_END; op++) {
+	printf ("%-24s", op_names[op]);
+	for (k = 0; k < nkernel; k++) {
+	    printf (" %10.1f", results[k].ns[op]);
+	    if (results[k].check[op] != results[0].check[op]) {
+		fprintf (stderr, "E: %s differs between scalar and %s\n",
+		         op_names[op], kernels[k]);
+		ret = 1;
+	    }
+	}
+	printf ("  (x%.2f)\n", results[0].ns[op] / results[nkernel - 1].ns[op]);
+    }
+
+    return ret;
+}
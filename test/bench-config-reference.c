@@ -0,0 +1,193 @@
+/*
+ * fontconfig/test/bench-config-reference.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include <fontconfig/fontconfig.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Times FcConfigReference (NULL) / FcConfigDestroy and FcConfigGetCurrent
+ * from a growing number of threads, once on its own and once while
+ * another thread keeps replacing the current configuration with
+ * FcConfigSetCurrent.  Every reader checks it got a live configuration.
+ * Times are per thread and iteration, so flat numbers mean linear scaling.
+ */
+
+#define ITERATIONS      200000
+#define MAX_THREADS     64
+#define RESCAN_INTERVAL 30
+
+typedef struct {
+    int iterations;
+    int errors;
+} ThreadArg;
+
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static int             done;
+
+static int
+is_done (void)
+{
+    int ret;
+
+    pthread_mutex_lock (&done_lock);
+    ret = done;
+    pthread_mutex_unlock (&done_lock);
+
+    return ret;
+}
+
+static void
+set_done (int value)
+{
+    pthread_mutex_lock (&done_lock);
+    done = value;
+    pthread_mutex_unlock (&done_lock);
+}
+
+static FcConfig *
+make_config (void)
+{
+    FcConfig *config = FcConfigCreate();
+
+    FcConfigSetRescanInterval (config, RESCAN_INTERVAL);
+    return config;
+}
+
+static double
+now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *
+run_reader (void *arg)
+{
+    ThreadArg *thr_arg = (ThreadArg *)arg;
+    FcConfig  *config;
+    int        i;
+
+    for (i = 0; i < thr_arg->iterations; i++) {
+	config = FcConfigReference (NULL);
+	if (FcConfigGetRescanInterval (config) != RESCAN_INTERVAL)
+	    thr_arg->errors++;
+	FcConfigDestroy (config);
+	if (!FcConfigGetCurrent())
+	    thr_arg->errors++;
+    }
+
+    return NULL;
+}
+
+static void *
+run_writer (void *arg)
+{
+    int      *swaps = (int *)arg;
+    FcConfig *config;
+
+    while (!is_done()) {
+	config = make_config();
+	FcConfigSetCurrent (config);
+	FcConfigDestroy (config);
+	(*swaps)++;
+    }
+
+    return NULL;
+}
+
+static int
+run (int nthreads, FcBool writer, double *ns, int *swaps)
+{
+    pthread_t threads[MAX_THREADS], writer_thread;
+    ThreadArg args[MAX_THREADS];
+    double    start;
+    int       i, n, errors = 0;
+
+    set_done (0);
+    *swaps = 0;
+    if (writer && pthread_create (&writer_thread, NULL, run_writer, swaps) != 0) {
+	fprintf (stderr, "E: cannot create the writer thread\n");
+	return -1;
+    }
+    start = now();
+    for (n = 0; n < nthreads; n++) {
+	args[n].iterations = ITERATIONS;
+	args[n].errors = 0;
+	if (pthread_create (&threads[n], NULL, run_reader, &args[n]) != 0) {
+	    fprintf (stderr, "E: cannot create thread %d\n", n);
+	    break;
+	}
+    }
+    for (i = 0; i < n; i++) {
+	pthread_join (threads[i], NULL);
+	errors += args[i].errors;
+    }
+    *ns = (now() - start) / ITERATIONS;
+    set_done (1);
+    if (writer)
+	pthread_join (writer_thread, NULL);
+
+    return n == nthreads ? errors : -1;
+}
+
+int
+main (int argc, char **argv)
+{
+    FcConfig *config;
+    int       max_threads = argc > 1 ? atoi (argv[1]) : 16;
+    int       nthreads, swaps, errors, ret = 0;
+    double    ns, ns_writer;
+
+    if (max_threads < 1 || max_threads > MAX_THREADS) {
+	fprintf (stderr, "usage: %s [1-%d]\n", argv[0], MAX_THREADS);
+	return 1;
+    }
+    config = make_config();
+    FcConfigSetCurrent (config);
+    FcConfigDestroy (config);
+
+    printf ("%-8s %12s %12s %10s\n", "threads", "ns/iter", "w/ writer", "swaps");
+    for (nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+	errors = run (nthreads, FcFalse, &ns, &swaps);
+	if (errors == 0)
+	    errors = run (nthreads, FcTrue, &ns_writer, &swaps);
+	if (errors != 0) {
+	    fprintf (stderr, "E: %d threads: %d errors\n", nthreads, errors);
+	    ret = 1;
+	    break;
+	}
+	printf ("%-8d %12.1f %12.1f %10d\n", nthreads, ns, ns_writer, swaps);
+    }
+    FcFini();
+
+    return ret;
+}
@@ -0,0 +1,245 @@
+/*
+ * fontconfig/test/cache-fixture.h
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef _CACHE_FIXTURE_H_
+#define _CACHE_FIXTURE_H_
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+#include <fontconfig/fontconfig.h>
+
+/*
+ * What the cache tests share: a temporary directory, named by path(),
+ * which they fill with copies of FONTFILE and remove once done.
+ */
+
+#ifndef FONTFILE
+#  error "FONTFILE is not defined"
+#endif
+
+#ifdef _WIN32
+#  define FC_DIR_SEPARATOR   '\\'
+#  define FC_DIR_SEPARATOR_S "\\"
+#else
+#  define FC_DIR_SEPARATOR   '/'
+#  define FC_DIR_SEPARATOR_S "/"
+#endif
+
+#ifdef _WIN32
+#  include <direct.h>
+#  define mkdir(path, mode) _mkdir (path)
+#endif
+
+#ifdef HAVE_MKDTEMP
+#  define fc_mkdtemp mkdtemp
+#else
+static char *
+fc_mkdtemp (char *template)
+{
+    if (!mktemp (template) || mkdir (template, 0700))
+	return NULL;
+
+    return template;
+}
+#endif
+
+static FcBool
+mkdir_p (const char *dir)
+{
+    char  *parent;
+    FcBool ret;
+
+    if (strlen (dir) == 0)
+	return FcFalse;
+    parent = (char *)FcStrDirname ((const FcChar8 *)dir);
+    if (!parent)
+	return FcFalse;
+    if (access (parent, F_OK) == 0)
+	ret = mkdir (dir, 0755) == 0 && chmod (dir, 0755) == 0;
+    else if (access (parent, F_OK) == -1)
+	ret = mkdir_p (parent) && (mkdir (dir, 0755) == 0) && chmod (dir, 0755) == 0;
+    else
+	ret = FcFalse;
+    free (parent);
+
+    return ret;
+}
+
+static FcBool
+unlink_dirs (const char *dir)
+{
+    DIR           *d = opendir (dir);
+    struct dirent *e;
+    size_t         len = strlen (dir);
+    char          *n = NULL;
+    FcBool         ret = FcTrue;
+#ifndef HAVE_STRUCT_DIRENT_D_TYPE
+    struct stat statb;
+#endif
+
+    if (!d)
+	return FcFalse;
+    while ((e = readdir (d)) != NULL) {
+	size_t l;
+
+	if (strcmp (e->d_name, ".") == 0 ||
+	    strcmp (e->d_name, "..") == 0)
+	    continue;
+	l = strlen (e->d_name) + 1;
+	if (n)
+	    free (n);
+	n = malloc (l + len + 1);
+	if (!n) {
+	    ret = FcFalse;
+	    break;
+	}
+	strcpy (n, dir);
+	n[len] = FC_DIR_SEPARATOR;
+	strcpy (&n[len + 1], e->d_name);
+#ifdef HAVE_STRUCT_DIRENT_D_TYPE
+	if (e->d_type == DT_DIR)
+#else
+	if (stat (n, &statb) == -1) {
+	    fprintf (stderr, "E: %s\n", n);
+	    ret = FcFalse;
+	    break;
+	}
+	if (S_ISDIR (statb.st_mode))
+#endif
+	{
+	    if (!unlink_dirs (n)) {
+		fprintf (stderr, "E: %s\n", n);
+		ret = FcFalse;
+		break;
+	    }
+	} else {
+	    if (unlink (n) == -1) {
+		fprintf (stderr, "E: %s\n", n);
+		ret = FcFalse;
+		break;
+	    }
+	}
+    }
+    if (n)
+	free (n);
+    closedir (d);
+
+    if (rmdir (dir) == -1) {
+	fprintf (stderr, "E: %s\n", dir);
+	return FcFalse;
+    }
+
+    return ret;
+}
+
+static char basedir[512];
+
+static char *
+path (const char *name)
+{
+    static char buf[4][sizeof (basedir) + 1024];
+    static int  i;
+
+    i = (i + 1) % 4;
+    snprintf (buf[i], sizeof (buf[i]), "%s/%s", basedir, name);
+    return buf[i];
+}
+
+static int
+copy_font (const char *name)
+{
+    FILE  *in, *out;
+    char   buf[4096];
+    size_t n;
+    int    ret = 0;
+
+    in = fopen (FONTFILE, "rb");
+    out = fopen (path (name), "wb");
+    if (!in || !out) {
+	fprintf (stderr, "E: unable to copy %s to %s: %s\n", FONTFILE, name, strerror (errno));
+	ret = 1;
+	goto bail;
+    }
+    while ((n = fread (buf, 1, sizeof (buf), in)) > 0)
+	if (fwrite (buf, 1, n, out) != n) {
+	    fprintf (stderr, "E: unable to write %s: %s\n", name, strerror (errno));
+	    ret = 1;
+	    break;
+	}
+bail:
+    if (in)
+	fclose (in);
+    if (out && fclose (out) == EOF)
+	ret = 1;
+
+    return ret;
+}
+
+/* Creates the directory the test works in from 'template' */
+static int
+setup_basedir (const char *template)
+{
+    snprintf (basedir, sizeof (basedir), "%s", template);
+    if (!fc_mkdtemp (basedir)) {
+	fprintf (stderr, "E: unable to create a temporary directory: %s\n", strerror (errno));
+	return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Loads a configuration with 'rules', scanning the fonts directory
+ * of the test and writing caches to its cache directory
+ */
+static FcConfig *
+create_config (const char *rules)
+{
+    FcConfig *config;
+    char      conf[2048];
+
+    snprintf (conf, sizeof (conf),
+              "<fontconfig><dir>%s/fonts</dir><cachedir>%s/cache</cachedir>%s</fontconfig>",
+              basedir, basedir, rules);
+    config = FcConfigCreate();
+    if (!config || !FcConfigParseAndLoadFromMemory (config, (const FcChar8 *)conf, FcTrue)) {
+	fprintf (stderr, "E: unable to load the configuration\n");
+	if (config)
+	    FcConfigDestroy (config);
+	return NULL;
+    }
+
+    return config;
+}
+
+#endif /* _CACHE_FIXTURE_H_ */
@@ -0,0 +1,138 @@
+/*
+ * fontconfig/test/test-cache-aggregate.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "cache-fixture.h"
+
+/*
+ * Fonts load from the aggregate cache file without the cache files of
+ * their directories, which are only read again for directories that
+ * changed since the aggregate cache file was written.
+ */
+
+/* Counts the cache files of single directories, or removes them */
+static int
+dir_caches (FcBool remove)
+{
+    DIR           *d = opendir (path ("cache"));
+    struct dirent *e;
+    char           n[1024];
+    int            count = 0;
+
+    if (!d)
+	return -1;
+    while ((e = readdir (d)) != NULL) {
+	if (!strstr (e->d_name, ".cache-"))
+	    continue;
+	count++;
+	snprintf (n, sizeof (n), "cache/%s", e->d_name);
+	if (remove && unlink (path (n)) == -1)
+	    fprintf (stderr, "W: unable to remove %s\n", n);
+    }
+    closedir (d);
+
+    return count;
+}
+
+static FcConfig *
+load_config (int nfont)
+{
+    FcConfig  *config = create_config ("");
+    FcFontSet *fonts;
+
+    if (!config)
+	return NULL;
+    if (!FcConfigBuildFonts (config)) {
+	fprintf (stderr, "E: unable to build the fonts\n");
+	FcConfigDestroy (config);
+	return NULL;
+    }
+    fonts = FcConfigGetFonts (config, FcSetSystem);
+    if (!fonts || fonts->nfont != nfont) {
+	fprintf (stderr, "E: %d fonts loaded rather than %d\n", fonts ? fonts->nfont : 0, nfont);
+	FcConfigDestroy (config);
+	return NULL;
+    }
+
+    return config;
+}
+
+int
+main (void)
+{
+    FcConfig *config;
+    int       ret = 1;
+
+    if (setup_basedir ("/tmp/fcaggregate-XXXXXX"))
+	return 1;
+    if (!mkdir_p (path ("fonts")) ||
+        !mkdir_p (path ("fonts/sub")) ||
+        copy_font ("fonts/a.pcf") ||
+        copy_font ("fonts/sub/b.pcf"))
+	goto bail;
+
+    /* Scanning writes one cache file per directory */
+    config = load_config (2);
+    if (!config)
+	goto bail;
+    if (dir_caches (FcFalse) != 2) {
+	fprintf (stderr, "E: %d cache files written rather than 2\n", dir_caches (FcFalse));
+	FcConfigDestroy (config);
+	goto bail;
+    }
+    if (!FcCacheWriteAggregate (config)) {
+	fprintf (stderr, "E: unable to write the aggregate cache file\n");
+	FcConfigDestroy (config);
+	goto bail;
+    }
+    FcConfigDestroy (config);
+
+    /* Nothing is scanned again without the cache files of the directories */
+    dir_caches (FcTrue);
+    config = load_config (2);
+    if (!config)
+	goto bail;
+    FcConfigDestroy (config);
+    if (dir_caches (FcFalse) != 0) {
+	fprintf (stderr, "E: fonts scanned despite the aggregate cache file\n");
+	goto bail;
+    }
+
+    /* Only the changed directory is */
+    sleep (1);
+    if (copy_font ("fonts/sub/c.pcf"))
+	goto bail;
+    config = load_config (3);
+    if (!config)
+	goto bail;
+    FcConfigDestroy (config);
+    if (dir_caches (FcFalse) != 1) {
+	fprintf (stderr, "E: %d directories scanned rather than 1\n", dir_caches (FcFalse));
+	goto bail;
+    }
+    ret = 0;
+
+bail:
+    unlink_dirs (basedir);
+
+    return ret;
+}
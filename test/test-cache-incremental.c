@@ -0,0 +1,118 @@
+/*
+ * fontconfig/test/test-cache-incremental.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "cache-fixture.h"
+
+#include <fcntl.h>
+
+/*
+ * Scanning a directory again only queries the files that changed
+ * since its cache was written.  A file overwritten without changing
+ * its size or time keeps its fonts, unless the scan is forced.
+ */
+
+/* Overwrites a font with zeros, keeping its size and times */
+static int
+break_font (const char *name)
+{
+    struct stat     statb;
+    struct timespec times[2];
+    char            zeros[4096] = { 0 };
+    FILE           *f;
+    off_t           n;
+    int             ret = 0;
+
+    if (stat (path (name), &statb) == -1 || !(f = fopen (path (name), "r+b")))
+	ret = 1;
+    for (n = 0; !ret && n < statb.st_size; n += sizeof (zeros))
+	if (fwrite (zeros, 1, statb.st_size - n < (off_t)sizeof (zeros) ? (size_t)(statb.st_size - n) : sizeof (zeros), f) == 0)
+	    ret = 1;
+    if (!ret && fclose (f) == EOF)
+	ret = 1;
+    if (!ret) {
+	times[0] = statb.st_atim;
+	times[1] = statb.st_mtim;
+	if (utimensat (AT_FDCWD, path (name), times, 0) == -1)
+	    ret = 1;
+    }
+    if (ret)
+	fprintf (stderr, "E: unable to overwrite %s: %s\n", name, strerror (errno));
+
+    return ret;
+}
+
+static int
+check_fonts (FcConfig *config, FcBool force, int nfont, const char *what)
+{
+    FcCache *cache;
+    int      ret = 0;
+
+    cache = FcDirCacheRead ((const FcChar8 *)path ("fonts"), force, config);
+    if (!cache) {
+	fprintf (stderr, "E: %s: unable to scan the fonts\n", what);
+	return 1;
+    }
+    if (FcCacheNumFont (cache) != nfont) {
+	fprintf (stderr, "E: %s: %d fonts rather than %d\n", what, FcCacheNumFont (cache), nfont);
+	ret = 1;
+    }
+    FcDirCacheUnload (cache);
+
+    return ret;
+}
+
+int
+main (void)
+{
+    FcConfig *config = NULL;
+    int       ret = 1;
+
+    if (setup_basedir ("/tmp/fcincremental-XXXXXX"))
+	return 1;
+    if (!mkdir_p (path ("fonts")) ||
+        copy_font ("fonts/a.pcf") ||
+        copy_font ("fonts/b.pcf"))
+	goto bail;
+    config = create_config ("");
+    if (!config)
+	goto bail;
+    if (check_fonts (config, FcFalse, 2, "first scan"))
+	goto bail;
+
+    /* Times only tell seconds apart on some file systems */
+    sleep (1);
+    if (break_font ("fonts/a.pcf") || copy_font ("fonts/c.pcf"))
+	goto bail;
+    if (check_fonts (config, FcFalse, 3, "scan of the changes"))
+	goto bail;
+    if (check_fonts (config, FcTrue, 2, "forced scan"))
+	goto bail;
+    ret = 0;
+
+bail:
+    if (config)
+	FcConfigDestroy (config);
+    unlink_dirs (basedir);
+
+    return ret;
+}
@@ -0,0 +1,123 @@
+/*
+ * fontconfig/test/test-cache-read-dirs.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "cache-fixture.h"
+
+/*
+ * Reading the caches of a tree of directories on several threads
+ * builds each missing cache once and skips the directories the
+ * configuration rejects.
+ */
+
+#define NDIR 8
+
+static int
+check_dirs (FcConfig *config, FcBool force, int nrebuilt, const char *what)
+{
+    FcStrSet  *dirs = FcStrSetCreate(), *rebuilt;
+    FcStrList *list;
+    FcChar8   *dir;
+    FcCache   *cache;
+    int        n = 0, ret = 0;
+
+    FcStrSetAdd (dirs, (const FcChar8 *)path ("fonts"));
+    rebuilt = FcDirCacheReadDirs (dirs, force, config);
+    FcStrSetDestroy (dirs);
+    if (!rebuilt) {
+	fprintf (stderr, "E: %s: unable to read the caches\n", what);
+	return 1;
+    }
+    list = FcStrListCreate (rebuilt);
+    while ((dir = FcStrListNext (list))) {
+	if (strstr ((const char *)dir, "/d7")) {
+	    fprintf (stderr, "E: %s: rejected %s scanned\n", what, dir);
+	    ret = 1;
+	}
+	cache = FcDirCacheLoad (dir, config, NULL);
+	if (!cache) {
+	    fprintf (stderr, "E: %s: no cache written for %s\n", what, dir);
+	    ret = 1;
+	    continue;
+	}
+	FcDirCacheUnload (cache);
+	n++;
+    }
+    FcStrListDone (list);
+    if (n != nrebuilt) {
+	fprintf (stderr, "E: %s: %d caches built rather than %d\n", what, n, nrebuilt);
+	ret = 1;
+    }
+    FcStrSetDestroy (rebuilt);
+
+    return ret;
+}
+
+int
+main (void)
+{
+    FcConfig *config = NULL;
+    char      rules[128], name[64];
+    int       i, ret = 1;
+
+    if (setup_basedir ("/tmp/fcreaddirs-XXXXXX"))
+	return 1;
+    if (!mkdir_p (path ("fonts")))
+	goto bail;
+    for (i = 0; i < NDIR; i++) {
+	snprintf (name, sizeof (name), "fonts/d%d", i);
+	if (!mkdir_p (path (name)))
+	    goto bail;
+	snprintf (name, sizeof (name), "fonts/d%d/sub", i);
+	if (!mkdir_p (path (name)))
+	    goto bail;
+	snprintf (name, sizeof (name), "fonts/d%d/a.pcf", i);
+	if (copy_font (name))
+	    goto bail;
+	snprintf (name, sizeof (name), "fonts/d%d/sub/b.pcf", i);
+	if (copy_font (name))
+	    goto bail;
+    }
+    snprintf (rules, sizeof (rules),
+              "<selectfont><rejectfont><glob>*/d%d*</glob></rejectfont></selectfont>",
+              NDIR - 1);
+    config = create_config (rules);
+    if (!config)
+	goto bail;
+    FcConfigSetThreads (config, 4);
+
+    /* The top directory, and the others but the rejected ones */
+    if (check_dirs (config, FcFalse, 1 + (NDIR - 1) * 2, "first read"))
+	goto bail;
+    if (check_dirs (config, FcFalse, 0, "second read"))
+	goto bail;
+    if (check_dirs (config, FcTrue, 1 + (NDIR - 1) * 2, "forced read"))
+	goto bail;
+    ret = 0;
+
+bail:
+    if (config)
+	FcConfigDestroy (config);
+    unlink_dirs (basedir);
+
+    return ret;
+}
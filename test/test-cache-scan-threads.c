@@ -0,0 +1,154 @@
+/*
+ * fontconfig/test/test-cache-scan-threads.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "cache-fixture.h"
+
+/*
+ * The fonts of a directory queried on several threads make the same
+ * cache file, byte for byte, as when queried one after the other.
+ */
+
+#define NFILE 24
+
+static char cache_file[1024];
+
+/* Scans the fonts and returns the contents of the cache file written */
+static char *
+scan (FcConfig *config, int nthreads, FcBool force, long *size)
+{
+    FcCache *cache;
+    FcChar8 *file = NULL;
+    FILE    *f = NULL;
+    char    *data = NULL;
+
+    FcConfigSetThreads (config, nthreads);
+    cache = FcDirCacheRead ((const FcChar8 *)path ("fonts"), force, config);
+    if (!cache) {
+	fprintf (stderr, "E: unable to scan the fonts on %d threads\n", nthreads);
+	return NULL;
+    }
+    FcDirCacheUnload (cache);
+    cache = FcDirCacheLoad ((const FcChar8 *)path ("fonts"), config, &file);
+    if (cache)
+	FcDirCacheUnload (cache);
+    if (file) {
+	snprintf (cache_file, sizeof (cache_file), "%s", file);
+	FcStrFree (file);
+	f = fopen (cache_file, "rb");
+    }
+    if (f && fseek (f, 0, SEEK_END) == 0 && (*size = ftell (f)) > 0 &&
+        (data = malloc (*size)) && fseek (f, 0, SEEK_SET) == 0 &&
+        fread (data, 1, *size, f) != (size_t)*size) {
+	free (data);
+	data = NULL;
+    }
+    if (!data)
+	fprintf (stderr, "E: unable to read the cache written on %d threads\n", nthreads);
+    if (f)
+	fclose (f);
+
+    return data;
+}
+
+/* Puts back a cache file, for the next scan to start from it */
+static int
+restore (const char *data, long size)
+{
+    FILE *f = fopen (cache_file, "wb");
+    int   ret = 0;
+
+    if (!f || fwrite (data, 1, size, f) != (size_t)size)
+	ret = 1;
+    if (f && fclose (f) == EOF)
+	ret = 1;
+    if (ret)
+	fprintf (stderr, "E: unable to restore %s\n", cache_file);
+
+    return ret;
+}
+
+static int
+compare (const char *serial, long serial_size, const char *threaded, long threaded_size, const char *what)
+{
+    if (serial_size != threaded_size || memcmp (serial, threaded, serial_size) != 0) {
+	fprintf (stderr, "E: %s: the caches differ\n", what);
+	return 1;
+    }
+
+    return 0;
+}
+
+int
+main (void)
+{
+    FcConfig *config = NULL;
+    FILE     *f;
+    char      name[64];
+    char     *serial = NULL, *threaded = NULL, *first = NULL;
+    long      serial_size, threaded_size, first_size;
+    int       i, ret = 1;
+
+    if (setup_basedir ("/tmp/fcscanthreads-XXXXXX"))
+	return 1;
+    if (!mkdir_p (path ("fonts")) || !mkdir_p (path ("fonts/sub")))
+	goto bail;
+    for (i = 0; i < NFILE; i++) {
+	snprintf (name, sizeof (name), "fonts/%02d.pcf", i);
+	if (copy_font (name))
+	    goto bail;
+    }
+    /* Files giving no fonts are recorded in order too */
+    if (!(f = fopen (path ("fonts/junk.pcf"), "w")))
+	goto bail;
+    fputs ("not a font\n", f);
+    fclose (f);
+    config = create_config ("<match target=\"scan\"><edit name=\"family\" mode=\"append\"><string>Scanned</string></edit></match>");
+    if (!config)
+	goto bail;
+    if (!(threaded = scan (config, 4, FcTrue, &threaded_size)) ||
+        !(first = scan (config, 1, FcTrue, &first_size)) ||
+        compare (first, first_size, threaded, threaded_size, "forced scan"))
+	goto bail;
+    free (threaded);
+    threaded = NULL;
+
+    /* Only the new file is queried, the others taken from the first cache */
+    sleep (1);
+    if (copy_font ("fonts/new.pcf") ||
+        !(threaded = scan (config, 4, FcFalse, &threaded_size)) ||
+        restore (first, first_size) ||
+        !(serial = scan (config, 1, FcFalse, &serial_size)) ||
+        compare (serial, serial_size, threaded, threaded_size, "scan of the changes"))
+	goto bail;
+    ret = 0;
+
+bail:
+    free (first);
+    free (serial);
+    free (threaded);
+    if (config)
+	FcConfigDestroy (config);
+    unlink_dirs (basedir);
+
+    return ret;
+}
@@ -0,0 +1,230 @@
+/*
+ * fontconfig/test/test-config-changes.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include <fontconfig/fontconfig.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char basedir[512];
+
+typedef struct {
+    int       fd;
+    FcConfig *destroy; /* released by the listener when set */
+} Listener;
+
+static char *
+path (const char *name)
+{
+    static char buf[4][1024];
+    static int  i;
+
+    i = (i + 1) % 4;
+    snprintf (buf[i], sizeof (buf[i]), "%s/%s", basedir, name);
+    return buf[i];
+}
+
+static int
+touch (const char *name)
+{
+    FILE *f = fopen (path (name), "w");
+
+    if (!f || fclose (f) == EOF) {
+	fprintf (stderr, "E: unable to create %s: %s\n", name, strerror (errno));
+	return 1;
+    }
+    return 0;
+}
+
+static int
+remove_dir (const char *dir)
+{
+    DIR           *d = opendir (dir);
+    struct dirent *e;
+    char           n[1024];
+
+    if (!d)
+	return 1;
+    while ((e = readdir (d)) != NULL) {
+	if (strcmp (e->d_name, ".") == 0 || strcmp (e->d_name, "..") == 0)
+	    continue;
+	snprintf (n, sizeof (n), "%s/%s", dir, e->d_name);
+	if (unlink (n) == -1 && remove_dir (n))
+	    fprintf (stderr, "W: unable to remove %s\n", n);
+    }
+    closedir (d);
+
+    return rmdir (dir) == -1;
+}
+
+static FcConfig *
+load (const char *dir)
+{
+    FcConfig *config = FcConfigCreate();
+    char      conf[1024];
+
+    snprintf (conf, sizeof (conf),
+              "<fontconfig><dir>%s/%s</dir></fontconfig>", basedir, dir);
+    if (mkdir (path (dir), 0755) == -1 ||
+        !FcConfigParseAndLoadFromMemory (config, (const FcChar8 *)conf, FcTrue)) {
+	fprintf (stderr, "E: unable to set up %s\n", dir);
+	FcConfigDestroy (config);
+	return NULL;
+    }
+    return config;
+}
+
+static void
+changed (FcConfig *config, void *closure)
+{
+    Listener *l = closure;
+
+    if (l->destroy == config)
+	FcConfigDestroy (config);
+    if (write (l->fd, "", 1) != 1)
+	abort();
+}
+
+/* Whether a listener wrote to 'fd' within 'ms' */
+static FcBool
+called (int fd, int ms)
+{
+    struct pollfd p;
+    char          c;
+
+    p.fd = fd;
+    p.events = POLLIN;
+    if (poll (&p, 1, ms) != 1)
+	return FcFalse;
+    while (poll (&p, 1, 300) == 1)
+	if (read (fd, &c, 1) != 1)
+	    break;
+    return FcTrue;
+}
+
+int
+main (void)
+{
+    FcConfig    *config = NULL, *other = NULL;
+    Listener     l, lo;
+    unsigned int gen, gen2;
+    int          fds[2] = { -1, -1 };
+    int          ret = 1;
+
+    strcpy (basedir, "/tmp/fcchanges-XXXXXX");
+    if (!mkdtemp (basedir) || pipe (fds) == -1) {
+	fprintf (stderr, "E: unable to set up: %s\n", strerror (errno));
+	return 1;
+    }
+    config = load ("fonts");
+    other = load ("other");
+    if (!config || !other)
+	goto bail;
+
+    /* Without a listener, asking is what looks */
+    gen = FcConfigGetGeneration (config);
+    if (FcConfigGetGeneration (config) != gen) {
+	fprintf (stderr, "E: generation changed without any change\n");
+	goto bail;
+    }
+    if (touch ("fonts/a.pcf"))
+	goto bail;
+    gen2 = FcConfigGetGeneration (config);
+    if (gen2 <= gen) {
+	fprintf (stderr, "E: generation %u after a change, was %u\n", gen2, gen);
+	goto bail;
+    }
+    gen = gen2;
+
+    l.fd = fds[1];
+    l.destroy = NULL;
+    if (!FcConfigAddChangeListener (config, changed, &l)) {
+	fprintf (stderr, "E: unable to add a listener\n");
+	goto bail;
+    }
+    if (touch ("fonts/b.pcf"))
+	goto bail;
+    if (!called (fds[0], 10000)) {
+	fprintf (stderr, "E: listener wasn't called\n");
+	goto bail;
+    }
+    if (FcConfigGetGeneration (config) <= gen) {
+	fprintf (stderr, "E: generation didn't change along with the listener call\n");
+	goto bail;
+    }
+    /* Changes to other configurations don't count */
+    if (touch ("other/a.pcf"))
+	goto bail;
+    if (called (fds[0], 500)) {
+	fprintf (stderr, "E: listener called for another configuration\n");
+	goto bail;
+    }
+
+    if (!FcConfigRemoveChangeListener (config, changed, &l) ||
+        FcConfigRemoveChangeListener (config, changed, &l)) {
+	fprintf (stderr, "E: unable to remove the listener once\n");
+	goto bail;
+    }
+    if (touch ("fonts/c.pcf"))
+	goto bail;
+    if (called (fds[0], 500)) {
+	fprintf (stderr, "E: removed listener was called\n");
+	goto bail;
+    }
+
+    /* A listener may let go of the configuration it's told about */
+    lo.fd = fds[1];
+    lo.destroy = other;
+    if (!FcConfigAddChangeListener (other, changed, &lo)) {
+	fprintf (stderr, "E: unable to add a listener\n");
+	goto bail;
+    }
+    if (touch ("other/b.pcf"))
+	goto bail;
+    if (!called (fds[0], 10000)) {
+	fprintf (stderr, "E: listener destroying the configuration wasn't called\n");
+	goto bail;
+    }
+    other = NULL;
+    ret = 0;
+
+bail:
+    if (other)
+	FcConfigDestroy (other);
+    if (config)
+	FcConfigDestroy (config);
+    close (fds[0]);
+    close (fds[1]);
+    remove_dir (basedir);
+
+    return ret;
+}
@@ -0,0 +1,278 @@
+/*
+ * fontconfig/test/test-config-snapshot.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include <fontconfig/fontconfig.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+static char basedir[512];
+
+static const char *fonts_conf =
+    "<fontconfig>\n"
+    "  <dir prefix=\"relative\">fonts</dir>\n"
+    "  <cachedir prefix=\"xdg\">fontconfig</cachedir>\n"
+    "  <match>\n"
+    "    <test name=\"family\"><string>Alpha</string></test>\n"
+    "    <edit name=\"style\"><string>Top</string></edit>\n"
+    "  </match>\n"
+    "  <include ignore_missing=\"yes\">%s/missing.conf</include>\n"
+    "  <include>%s/conf.d</include>\n"
+    "</fontconfig>\n";
+
+/* Same size as old_rules, so only the time tells them apart */
+static const char *old_rules =
+    "<fontconfig>\n"
+    "  <match>\n"
+    "    <test name=\"family\"><string>Alpha</string></test>\n"
+    "    <edit name=\"family\" mode=\"append\" binding=\"strong\"><string>Old</string></edit>\n"
+    "    <edit name=\"matrix\"><times><name>matrix</name>\n"
+    "      <matrix><double>1</double><double>0.2</double><double>0</double><double>1</double></matrix>\n"
+    "    </times></edit>\n"
+    "    <edit name=\"size\"><if><less><name>size</name><int>8</int></less><int>8</int><name>size</name></if></edit>\n"
+    "  </match>\n"
+    "</fontconfig>\n";
+
+static const char *new_rules =
+    "<fontconfig>\n"
+    "  <match>\n"
+    "    <test name=\"family\"><string>Alpha</string></test>\n"
+    "    <edit name=\"family\" mode=\"append\" binding=\"strong\"><string>New</string></edit>\n"
+    "    <edit name=\"matrix\"><times><name>matrix</name>\n"
+    "      <matrix><double>1</double><double>0.2</double><double>0</double><double>1</double></matrix>\n"
+    "    </times></edit>\n"
+    "    <edit name=\"size\"><if><less><name>size</name><int>8</int></less><int>8</int><name>size</name></if></edit>\n"
+    "  </match>\n"
+    "</fontconfig>\n";
+
+static const char *more_rules =
+    "<fontconfig>\n"
+    "  <match target=\"font\">\n"
+    "    <edit name=\"embolden\"><bool>true</bool></edit>\n"
+    "  </match>\n"
+    "  <match>\n"
+    "    <test name=\"lang\" compare=\"contains\"><string>ja</string></test>\n"
+    "    <edit name=\"family\" mode=\"prepend\"><string>Gamma</string></edit>\n"
+    "  </match>\n"
+    "</fontconfig>\n";
+
+static char *
+path (const char *name)
+{
+    static char buf[4][1024];
+    static int  i;
+
+    i = (i + 1) % 4;
+    snprintf (buf[i], sizeof (buf[i]), "%s/%s", basedir, name);
+    return buf[i];
+}
+
+static int
+write_file (const char *name, const char *content, time_t mtime)
+{
+    FILE          *f = fopen (path (name), "w");
+    struct utimbuf t;
+
+    if (!f || fputs (content, f) == EOF || fclose (f) == EOF) {
+	fprintf (stderr, "E: unable to write %s: %s\n", name, strerror (errno));
+	return 1;
+    }
+    t.actime = t.modtime = mtime;
+    if (utime (path (name), &t) == -1) {
+	fprintf (stderr, "E: unable to set the time of %s: %s\n", name, strerror (errno));
+	return 1;
+    }
+    return 0;
+}
+
+static int
+remove_dir (const char *dir)
+{
+    DIR           *d = opendir (dir);
+    struct dirent *e;
+    char           n[1024];
+
+    if (!d)
+	return 1;
+    while ((e = readdir (d)) != NULL) {
+	if (strcmp (e->d_name, ".") == 0 || strcmp (e->d_name, "..") == 0)
+	    continue;
+	snprintf (n, sizeof (n), "%s/%s", dir, e->d_name);
+	if (unlink (n) == -1 && remove_dir (n))
+	    fprintf (stderr, "W: unable to remove %s\n", n);
+    }
+    closedir (d);
+
+    return rmdir (dir) == -1;
+}
+
+static int
+check (const char *what, const char *name, const char *expected)
+{
+    FcConfig  *config = FcInitLoadConfig();
+    FcPattern *pat = FcNameParse ((const FcChar8 *)name);
+    FcChar8   *s = NULL;
+    int        ret = 1;
+
+    if (!config || !pat) {
+	fprintf (stderr, "E: %s: unable to load the configuration\n", what);
+	goto bail;
+    }
+    FcConfigSubstitute (config, pat, FcMatchPattern);
+    FcPatternDel (pat, FC_LANG);
+    FcPatternDel (pat, FC_PRGNAME);
+    s = FcNameUnparse (pat);
+    if (!s || strcmp ((const char *)s, expected)) {
+	fprintf (stderr, "E: %s: %s substituted to %s, expected %s\n",
+	         what, name, s ? (const char *)s : "(null)", expected);
+	goto bail;
+    }
+    /* Keeps the snapshot current for the next check */
+    FcConfigWriteSnapshot (config);
+    ret = 0;
+bail:
+    if (s)
+	FcStrFree (s);
+    if (pat)
+	FcPatternDestroy (pat);
+    if (config)
+	FcConfigDestroy (config);
+
+    return ret;
+}
+
+int
+main (void)
+{
+    FcConfig  *config;
+    FcStrList *list;
+    FcChar8   *s;
+    char       conf[2048];
+    int        nfile = 0, ret = 0;
+
+    strcpy (basedir, "/tmp/fcsnapshot-XXXXXX");
+    if (!mkdtemp (basedir)) {
+	fprintf (stderr, "E: unable to create a temporary directory: %s\n", strerror (errno));
+	return 1;
+    }
+    if (mkdir (path ("conf.d"), 0755) == -1 || mkdir (path ("cache"), 0755) == -1) {
+	fprintf (stderr, "E: unable to create directories: %s\n", strerror (errno));
+	ret = 1;
+	goto bail;
+    }
+    setenv ("FONTCONFIG_FILE", path ("fonts.conf"), 1);
+    setenv ("XDG_CACHE_HOME", path ("cache"), 1);
+    snprintf (conf, sizeof (conf), fonts_conf, basedir, basedir);
+    if (write_file ("fonts.conf", conf, 1000000000) ||
+        write_file ("conf.d/10-rules.conf", old_rules, 1000000000)) {
+	ret = 1;
+	goto bail;
+    }
+
+    /* Only what FcInitLoadConfig parsed can be saved */
+    config = FcConfigCreate();
+    if (FcConfigWriteSnapshot (config)) {
+	fprintf (stderr, "E: saved an empty configuration\n");
+	ret = 1;
+    }
+    FcConfigDestroy (config);
+
+    config = FcInitLoadConfig();
+    if (!FcConfigWriteSnapshot (config)) {
+	fprintf (stderr, "E: unable to write the snapshot\n");
+	ret = 1;
+	goto bail;
+    }
+    FcConfigDestroy (config);
+
+    config = FcInitLoadConfig();
+    list = FcConfigGetConfigFiles (config);
+    while ((s = FcStrListNext (list)))
+	nfile++;
+    FcStrListDone (list);
+    if (nfile != 3) {
+	fprintf (stderr, "E: %d configuration files loaded from the snapshot, expected 3\n", nfile);
+	ret = 1;
+    }
+    list = FcConfigGetFontDirs (config);
+    s = FcStrListNext (list);
+    if (!s || strcmp ((const char *)s, path ("fonts"))) {
+	fprintf (stderr, "E: font directory %s, expected %s\n", s ? (const char *)s : "(null)", path ("fonts"));
+	ret = 1;
+    }
+    FcStrListDone (list);
+    FcConfigDestroy (config);
+
+    ret |= check ("snapshot", "Alpha:size=6:lang=en",
+                  "Alpha,Old-8:style=Top:matrix=1 0.2 0 1");
+
+    /* A change the file's time and size don't show goes unnoticed... */
+    if (write_file ("conf.d/10-rules.conf", new_rules, 1000000000)) {
+	ret = 1;
+	goto bail;
+    }
+    ret |= check ("same time", "Alpha:size=6:lang=en",
+                  "Alpha,Old-8:style=Top:matrix=1 0.2 0 1");
+    /* ...until it's touched */
+    if (write_file ("conf.d/10-rules.conf", new_rules, 1000000001)) {
+	ret = 1;
+	goto bail;
+    }
+    ret |= check ("modified file", "Alpha:size=6:lang=en",
+                  "Alpha,New-8:style=Top:matrix=1 0.2 0 1");
+    ret |= check ("new snapshot", "Alpha:size=6:lang=en",
+                  "Alpha,New-8:style=Top:matrix=1 0.2 0 1");
+
+    /* Files added to an included directory */
+    if (write_file ("conf.d/20-more.conf", more_rules, 1000000000)) {
+	ret = 1;
+	goto bail;
+    }
+    ret |= check ("added file", "Alpha:size=6:lang=ja",
+                  "Gamma,Alpha,New-8:style=Top:matrix=1 0.2 0 1");
+    ret |= check ("new snapshot", "Alpha:size=6:lang=ja",
+                  "Gamma,Alpha,New-8:style=Top:matrix=1 0.2 0 1");
+
+    /* A file which was missing */
+    if (write_file ("missing.conf", more_rules, 1000000000)) {
+	ret = 1;
+	goto bail;
+    }
+    ret |= check ("missing file", "Alpha:size=6:lang=ja",
+                  "Gamma,Gamma,Alpha,New-8:style=Top:matrix=1 0.2 0 1");
+
+
+bail:
+    remove_dir (basedir);
+
+    return ret;
+}
@@ -0,0 +1,178 @@
+/*
+ * fontconfig/test/test-config-watch.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include <fontconfig/fontconfig.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * FcConfigUptoDate has to notice the same changes whether it watches
+ * the paths or looks at their times.
+ */
+
+static char basedir[512];
+
+static const char *conf_format =
+    "<fontconfig>\n"
+    "  <dir>%s/%s</dir>\n"
+    "</fontconfig>\n";
+
+static const char *names[] = {
+    "file",    /* a file is added to the font dir */
+    "missing", /* the font dir is created */
+    "conf",    /* the config file is rewritten */
+    "same",    /* nothing changes */
+};
+
+#define NCONFIG (sizeof (names) / sizeof (names[0]))
+
+static char *
+path (const char *name)
+{
+    static char buf[4][1024];
+    static int  i;
+
+    i = (i + 1) % 4;
+    snprintf (buf[i], sizeof (buf[i]), "%s/%s", basedir, name);
+    return buf[i];
+}
+
+static int
+write_conf (const char *name)
+{
+    char  file[1024], dir[64];
+    FILE *f;
+
+    snprintf (file, sizeof (file), "%s/%s.conf", basedir, name);
+    snprintf (dir, sizeof (dir), strcmp (name, "missing") ? "fonts-%s" : "%s/fonts", name);
+    f = fopen (file, "w");
+    if (!f || fprintf (f, conf_format, basedir, dir) < 0 || fclose (f) == EOF) {
+	fprintf (stderr, "E: unable to write %s: %s\n", file, strerror (errno));
+	return 1;
+    }
+    return 0;
+}
+
+static int
+remove_dir (const char *dir)
+{
+    DIR           *d = opendir (dir);
+    struct dirent *e;
+    char           n[1024];
+
+    if (!d)
+	return 1;
+    while ((e = readdir (d)) != NULL) {
+	if (strcmp (e->d_name, ".") == 0 || strcmp (e->d_name, "..") == 0)
+	    continue;
+	snprintf (n, sizeof (n), "%s/%s", dir, e->d_name);
+	if (unlink (n) == -1 && remove_dir (n))
+	    fprintf (stderr, "W: unable to remove %s\n", n);
+    }
+    closedir (d);
+
+    return rmdir (dir) == -1;
+}
+
+int
+main (void)
+{
+    FcConfig    *configs[NCONFIG] = { NULL };
+    char         file[1024];
+    unsigned int i;
+    int          ret = 0;
+    FILE        *f;
+
+    strcpy (basedir, "/tmp/fcwatch-XXXXXX");
+    if (!mkdtemp (basedir)) {
+	fprintf (stderr, "E: unable to create a temporary directory: %s\n", strerror (errno));
+	return 1;
+    }
+    for (i = 0; i < NCONFIG; i++) {
+	snprintf (file, sizeof (file), "fonts-%s", names[i]);
+	if (strcmp (names[i], "missing") && mkdir (path (file), 0755) == -1) {
+	    fprintf (stderr, "E: unable to create %s: %s\n", file, strerror (errno));
+	    ret = 1;
+	    goto bail;
+	}
+	if (write_conf (names[i])) {
+	    ret = 1;
+	    goto bail;
+	}
+	snprintf (file, sizeof (file), "%s/%s.conf", basedir, names[i]);
+	configs[i] = FcConfigCreate();
+	if (!FcConfigParseAndLoad (configs[i], (const FcChar8 *)file, FcTrue)) {
+	    fprintf (stderr, "E: unable to load %s\n", file);
+	    ret = 1;
+	    goto bail;
+	}
+    }
+    for (i = 0; i < NCONFIG; i++) {
+	if (!FcConfigUptoDate (configs[i]) || !FcConfigUptoDate (configs[i])) {
+	    fprintf (stderr, "E: %s: out of date before any change\n", names[i]);
+	    ret = 1;
+	}
+    }
+    if (ret)
+	goto bail;
+
+    /* Times only tell seconds apart */
+    sleep (2);
+
+    f = fopen (path ("fonts-file/new.pcf"), "w");
+    if (!f || fclose (f) == EOF ||
+        mkdir (path ("missing"), 0755) == -1 ||
+        mkdir (path ("missing/fonts"), 0755) == -1 ||
+        write_conf ("conf")) {
+	fprintf (stderr, "E: unable to change files: %s\n", strerror (errno));
+	ret = 1;
+	goto bail;
+    }
+    for (i = 0; i < NCONFIG; i++) {
+	FcBool expected = !strcmp (names[i], "same");
+
+	if (FcConfigUptoDate (configs[i]) != expected) {
+	    fprintf (stderr, "E: %s: %s after the change\n", names[i],
+	             expected ? "out of date" : "still up to date");
+	    ret = 1;
+	}
+    }
+
+bail:
+    for (i = 0; i < NCONFIG; i++) {
+	if (configs[i])
+	    FcConfigDestroy (configs[i]);
+    }
+    remove_dir (basedir);
+
+    return ret;
+}
@@ -0,0 +1,129 @@
+/* Copyright (C) 2026 fontconfig Authors */
+/* SPDX-License-Identifier: HPND */
+
+/* Internal API test case */
+#include "fcint.h"
+#include <stdio.h>
+
+static unsigned int seed = 1;
+
+static int
+next (int n)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % n;
+}
+
+static void
+random_string (char *s, const char *chars, int max)
+{
+    int i, n = next (max + 1);
+
+    for (i = 0; i < n; i++)
+	s[i] = chars[next (strlen (chars))];
+    s[n] = 0;
+}
+
+static FcBool
+expected (const FcStrSet *accept, const FcStrSet *reject, const FcChar8 *name)
+{
+    int i;
+
+    for (i = 0; i < accept->num; i++)
+	if (FcStrGlobMatch (accept->strs[i], name))
+	    return FcTrue;
+    for (i = 0; i < reject->num; i++)
+	if (FcStrGlobMatch (reject->strs[i], name))
+	    return FcFalse;
+    return FcTrue;
+}
+
+static int
+check (const FcStrSet *accept, const FcStrSet *reject, const char *name)
+{
+    FcGlobCode *code = FcGlobCodeCreate (accept, reject);
+    FcBool      result;
+    int         ret = 0;
+
+    if (!code) {
+	printf ("unable to compile the globs\n");
+	return 1;
+    }
+    if (!FcGlobCodeAccept (code, (const FcChar8 *)name, &result))
+	result = expected (accept, reject, (const FcChar8 *)name);
+    if (result != expected (accept, reject, (const FcChar8 *)name)) {
+	printf ("%s %s\n", name, result ? "accepted" : "rejected");
+	ret = 1;
+    }
+    FcGlobCodeDestroy (code);
+
+    return ret;
+}
+
+int
+main (void)
+{
+    FcStrSet   *accept = FcStrSetCreate(), *reject = FcStrSetCreate();
+    FcGlobCode *code;
+    FcBool      result;
+    char        glob[16], name[32];
+    int         i, j, n, ret = 0;
+
+    /* Nothing is rejected without globs */
+    ret |= check (accept, reject, "/usr/share/fonts/a.pcf");
+    ret |= check (accept, reject, "");
+
+    FcStrSetAdd (reject, (const FcChar8 *)"*.pcf*");
+    FcStrSetAdd (reject, (const FcChar8 *)"/usr/share/fonts/X11/*");
+    FcStrSetAdd (accept, (const FcChar8 *)"/usr/share/fonts/X11/misc/?x??.pcf.gz");
+    ret |= check (accept, reject, "/usr/share/fonts/a.pcf");
+    ret |= check (accept, reject, "/usr/share/fonts/a.pcf.gz");
+    ret |= check (accept, reject, "/usr/share/fonts/a.ttf");
+    ret |= check (accept, reject, "/usr/share/fonts/X11/misc/4x6.pcf.gz");
+    ret |= check (accept, reject, "/usr/share/fonts/X11/misc/10x20.pcf.gz");
+    ret |= check (accept, reject, "/usr/share/fonts/X11/Type1/c0648bt_.pfb");
+
+    /* Several '*' ending a glob need something to match */
+    FcStrSetAdd (reject, (const FcChar8 *)"*.ttf**");
+    ret |= check (accept, reject, "/usr/share/fonts/a.ttf");
+    ret |= check (accept, reject, "/usr/share/fonts/a.ttf2");
+
+    /* Random globs against random names */
+    for (i = 0; i < 200; i++) {
+	FcStrSetDestroy (accept);
+	FcStrSetDestroy (reject);
+	accept = FcStrSetCreate();
+	reject = FcStrSetCreate();
+	n = next (6);
+	for (j = 0; j < n; j++) {
+	    random_string (glob, "ab/.*?", 8);
+	    FcStrSetAdd (next (2) ? accept : reject, (const FcChar8 *)glob);
+	}
+	for (j = 0; j < 50; j++) {
+	    random_string (name, "ab/.c", 16);
+	    ret |= check (accept, reject, name);
+	}
+    }
+
+    /* Globs too many to compile are left to FcStrGlobMatch */
+    FcStrSetDestroy (accept);
+    FcStrSetDestroy (reject);
+    accept = FcStrSetCreate();
+    reject = FcStrSetCreate();
+    for (i = 0; i < 16; i++) {
+	snprintf (glob, sizeof (glob), "*%c*%c*%c*", 'a' + i, 'b' + i, 'c' + i);
+	FcStrSetAdd (reject, (const FcChar8 *)glob);
+    }
+    code = FcGlobCodeCreate (accept, reject);
+    if (!code || FcGlobCodeAccept (code, (const FcChar8 *)"abc", &result)) {
+	printf ("compiled %d globs with too many states\n", reject->num);
+	ret = 1;
+    }
+    FcGlobCodeDestroy (code);
+    ret |= check (accept, reject, "abc");
+
+    FcStrSetDestroy (accept);
+    FcStrSetDestroy (reject);
+
+    return ret;
+}
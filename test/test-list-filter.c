@@ -0,0 +1,81 @@
+/* Copyright (C) 2026 fontconfig Authors */
+/* SPDX-License-Identifier: HPND */
+
+/* Internal API test case */
+#include "fcint.h"
+#include <stdio.h>
+
+static const char *families[] = {
+    "DejaVu Sans", "dejavusans", "Fixed", "Misc Fixed", "Noto Sans", "Courier"
+};
+static const char *formats[] = { "TrueType", "PCF", "Type 1" };
+static const char *styles[] = { "Regular", "Bold" };
+
+static unsigned int seed = 1;
+
+static int
+next (int n)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % n;
+}
+
+static FcPattern *
+random_pattern (FcBool font)
+{
+    FcPattern *p = FcPatternCreate();
+    int        i, n;
+
+    n = font ? 1 + next (2) : next (2);
+    for (i = 0; i < n; i++)
+	FcPatternAddString (p, FC_FAMILY, (const FcChar8 *)families[next (6)]);
+    if (font || !next (3))
+	FcPatternAddString (p, FC_FONTFORMAT, (const FcChar8 *)formats[next (3)]);
+    if (font || !next (3))
+	FcPatternAddBool (p, FC_SCALABLE, next (2));
+    if (font || !next (4))
+	FcPatternAddString (p, FC_STYLE, (const FcChar8 *)styles[next (2)]);
+    if (!font && !next (5))
+	FcPatternAddString (p, FC_NAMELANG, (const FcChar8 *)"en");
+
+    return p;
+}
+
+int
+main (void)
+{
+    FcFontSet    *patterns;
+    FcListFilter *filter;
+    FcPattern    *font;
+    FcBool        expected;
+    int           i, j, k, ret = 0;
+
+    for (i = 0; i < 100; i++) {
+	patterns = FcFontSetCreate();
+	for (j = next (8); j > 0; j--)
+	    FcFontSetAdd (patterns, random_pattern (FcFalse));
+	filter = FcListFilterCreate (patterns);
+	if (!filter) {
+	    printf ("unable to index the patterns\n");
+	    return 1;
+	}
+	for (j = 0; j < 50; j++) {
+	    font = random_pattern (FcTrue);
+	    expected = FcFalse;
+	    for (k = 0; k < patterns->nfont && !expected; k++)
+		expected = FcListPatternMatchAny (patterns->fonts[k], font);
+	    if (FcListFilterMatchAny (filter, font) != expected) {
+		FcChar8 *s = FcNameUnparse (font);
+
+		printf ("%s %s\n", s, expected ? "not matched" : "matched");
+		FcStrFree (s);
+		ret = 1;
+	    }
+	    FcPatternDestroy (font);
+	}
+	FcListFilterDestroy (filter);
+	FcFontSetDestroy (patterns);
+    }
+
+    return ret;
+}
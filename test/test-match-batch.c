@@ -0,0 +1,103 @@
+/*
+ * fontconfig/test/test-match-batch.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <fontconfig/fontconfig.h>
+
+#include <stdio.h>
+
+#define NPAT 4
+
+static const double sizes[NPAT] = { 6, 16, 12, 6 };
+
+static int
+check (FcConfig *config)
+{
+    FcPattern *pats[NPAT], *matches[NPAT], *match;
+    FcResult   results[NPAT], result;
+    int        i, ret = 0;
+
+    for (i = 0; i < NPAT; i++) {
+	pats[i] = FcPatternBuild (NULL,
+	                          FC_PIXEL_SIZE, FcTypeDouble, sizes[i],
+	                          NULL);
+    }
+    if (!FcFontMatchBatch (config, pats, NPAT, matches, results)) {
+	fprintf (stderr, "E: batch match failed\n");
+	ret = 1;
+	goto bail;
+    }
+    for (i = 0; i < NPAT; i++) {
+	match = FcFontMatch (config, pats[i], &result);
+	if (result != results[i] || !match || !matches[i] ||
+	    !FcPatternEqual (match, matches[i])) {
+	    fprintf (stderr, "E: batch match differs for pixelsize %g\n", sizes[i]);
+	    ret = 1;
+	}
+	if (match)
+	    FcPatternDestroy (match);
+	if (matches[i])
+	    FcPatternDestroy (matches[i]);
+    }
+bail:
+    for (i = 0; i < NPAT; i++)
+	FcPatternDestroy (pats[i]);
+
+    return ret;
+}
+
+int
+main (void)
+{
+    FcConfig     *config = FcConfigCreate();
+    unsigned long hits, misses;
+    int           ret = 0;
+
+    if (!FcConfigAppFontAddFile (config, (const FcChar8 *)SRCDIR "/4x6.pcf") ||
+        !FcConfigAppFontAddFile (config, (const FcChar8 *)SRCDIR "/8x16.pcf"))
+	return 1;
+
+    ret |= check (config);
+
+    /* Batch matches fill the cache, FcFontMatch then finds them there */
+    if (!FcConfigSetMatchCacheSize (config, 8))
+	return 1;
+    ret |= check (config);
+    FcConfigGetMatchCacheStats (config, &hits, &misses);
+    if (hits != 4 || misses != 4) {
+	fprintf (stderr, "E: cache stats hits=%lu misses=%lu, expected 4/4\n",
+	         hits, misses);
+	ret = 1;
+    }
+    /* and so does the next batch */
+    ret |= check (config);
+    FcConfigGetMatchCacheStats (config, &hits, &misses);
+    if (hits != 12 || misses != 4) {
+	fprintf (stderr, "E: cache stats hits=%lu misses=%lu, expected 12/4\n",
+	         hits, misses);
+	ret = 1;
+    }
+
+    FcConfigDestroy (config);
+
+    return ret;
+}
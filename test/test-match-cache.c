@@ -0,0 +1,121 @@
+/*
+ * fontconfig/test/test-match-cache.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <fontconfig/fontconfig.h>
+
+#include <stdio.h>
+#include <string.h>
+
+static int
+match_file (FcConfig *config, double pixelsize, const char *expected)
+{
+    FcPattern *pat, *match;
+    FcResult   result;
+    FcChar8   *file;
+    int        ret = 1;
+
+    pat = FcPatternBuild (NULL,
+                          FC_PIXEL_SIZE, FcTypeDouble, pixelsize,
+                          NULL);
+    match = FcFontMatch (config, pat, &result);
+    if (!match || result != FcResultMatch) {
+	fprintf (stderr, "E: no match for pixelsize %g\n", pixelsize);
+	goto bail;
+    }
+    if (FcPatternGetString (match, FC_FILE, 0, &file) != FcResultMatch ||
+        !strstr ((const char *)file, expected)) {
+	fprintf (stderr, "E: pixelsize %g matched %s, expected %s\n",
+	         pixelsize, file, expected);
+	goto bail;
+    }
+    ret = 0;
+bail:
+    if (match)
+	FcPatternDestroy (match);
+    FcPatternDestroy (pat);
+
+    return ret;
+}
+
+static int
+check_stats (FcConfig *config, unsigned long hits, unsigned long misses)
+{
+    unsigned long h, m;
+
+    FcConfigGetMatchCacheStats (config, &h, &m);
+    if (h != hits || m != misses) {
+	fprintf (stderr, "E: cache stats hits=%lu misses=%lu, expected %lu/%lu\n",
+	         h, m, hits, misses);
+	return 1;
+    }
+    return 0;
+}
+
+int
+main (void)
+{
+    FcConfig *config = FcConfigCreate();
+    int       ret = 0;
+
+    if (!FcConfigAppFontAddFile (config, (const FcChar8 *)SRCDIR "/4x6.pcf"))
+	return 1;
+
+    /* Disabled by default */
+    ret |= match_file (config, 6, "4x6.pcf");
+    ret |= check_stats (config, 0, 0);
+
+    if (!FcConfigSetMatchCacheSize (config, 2))
+	return 1;
+    ret |= match_file (config, 6, "4x6.pcf");
+    ret |= match_file (config, 6, "4x6.pcf");
+    ret |= check_stats (config, 1, 1);
+
+    /* Adding a font must invalidate the cached result */
+    if (!FcConfigAppFontAddFile (config, (const FcChar8 *)SRCDIR "/8x16.pcf"))
+	return 1;
+    ret |= match_file (config, 16, "8x16.pcf");
+    ret |= match_file (config, 6, "4x6.pcf");
+    ret |= match_file (config, 16, "8x16.pcf");
+    ret |= check_stats (config, 2, 3);
+
+    /* The least recently used entry is evicted */
+    ret |= match_file (config, 12, "8x16.pcf");
+    ret |= match_file (config, 16, "8x16.pcf");
+    ret |= match_file (config, 6, "4x6.pcf");
+    ret |= check_stats (config, 3, 5);
+
+    /* Clearing the application fonts leaves nothing to match */
+    FcConfigAppFontClear (config);
+    if (!FcConfigAppFontAddFile (config, (const FcChar8 *)SRCDIR "/8x16.pcf"))
+	return 1;
+    ret |= match_file (config, 6, "8x16.pcf");
+    ret |= check_stats (config, 3, 6);
+
+    FcConfigSetMatchCacheSize (config, 0);
+    ret |= match_file (config, 6, "8x16.pcf");
+    ret |= check_stats (config, 3, 6);
+
+    FcConfigDestroy (config);
+
+    return ret;
+}
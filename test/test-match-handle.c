@@ -0,0 +1,103 @@
+/*
+ * fontconfig/test/test-match-handle.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <fontconfig/fontconfig.h>
+
+#include <stdio.h>
+
+static int
+check (FcConfig *config, double pixelsize)
+{
+    FcPattern    *pat, *match = NULL, *prepared = NULL, *font;
+    FcFontSet    *fs;
+    FcMatchHandle handle;
+    FcResult      result;
+    FcChar8      *file;
+    double        score[64];
+    int           ret = 1;
+
+    pat = FcPatternBuild (NULL,
+                          FC_PIXEL_SIZE, FcTypeDouble, pixelsize,
+                          NULL);
+    if (!FcFontMatchLookup (config, pat, &handle, &result) || result != FcResultMatch) {
+	fprintf (stderr, "E: no match for pixelsize %g\n", pixelsize);
+	goto bail;
+    }
+    /* The handle refers to the font in the config, not to a copy */
+    font = FcMatchHandleGetFont (&handle);
+    fs = FcConfigGetFonts (config, FcMatchHandleGetSet (&handle));
+    if (!fs || FcMatchHandleGetIndex (&handle) < 0 ||
+        FcMatchHandleGetIndex (&handle) >= fs->nfont ||
+        fs->fonts[FcMatchHandleGetIndex (&handle)] != font) {
+	fprintf (stderr, "E: handle doesn't point at the matched font\n");
+	goto bail;
+    }
+    if (FcPatternGetString (font, FC_FILE, 0, &file) != FcResultMatch) {
+	fprintf (stderr, "E: matched font has no file\n");
+	goto bail;
+    }
+    if (FcMatchHandleGetScore (&handle, score, 64) <= 0) {
+	fprintf (stderr, "E: no score\n");
+	goto bail;
+    }
+    if (FcMatchHandleGetBinding (&handle, FC_FILE) == FcValueBindingEnd) {
+	fprintf (stderr, "E: no binding for the file\n");
+	goto bail;
+    }
+
+    match = FcFontMatch (config, pat, &result);
+    prepared = FcMatchHandleRenderPrepare (config, pat, &handle);
+    if (!match || !prepared || !FcPatternEqual (match, prepared)) {
+	fprintf (stderr, "E: prepared handle differs from FcFontMatch for pixelsize %g\n",
+	         pixelsize);
+	goto bail;
+    }
+    ret = 0;
+bail:
+    FcMatchHandleClear (&handle);
+    if (match)
+	FcPatternDestroy (match);
+    if (prepared)
+	FcPatternDestroy (prepared);
+    FcPatternDestroy (pat);
+
+    return ret;
+}
+
+int
+main (void)
+{
+    FcConfig *config = FcConfigCreate();
+    int       ret = 0;
+
+    if (!FcConfigAppFontAddFile (config, (const FcChar8 *)SRCDIR "/4x6.pcf") ||
+        !FcConfigAppFontAddFile (config, (const FcChar8 *)SRCDIR "/8x16.pcf"))
+	return 1;
+
+    ret |= check (config, 6);
+    ret |= check (config, 16);
+
+    FcConfigDestroy (config);
+
+    return ret;
+}
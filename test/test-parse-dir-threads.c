@@ -0,0 +1,320 @@
+/*
+ * fontconfig/test/test-parse-dir-threads.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include <fontconfig/fontconfig.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Parses a config dir on a single thread and on several, and checks
+ * that both give the same configuration and the same messages.
+ */
+
+static char basedir[512];
+
+static const char *fonts_conf =
+    "<fontconfig>\n"
+    "  <dir>%1$s/fonts</dir>\n"
+    "  <include>%1$s/conf.d</include>\n"
+    "  <match>\n"
+    "    <test name=\"family\"><string>Alpha</string></test>\n"
+    "    <edit name=\"style\"><string>Last</string></edit>\n"
+    "  </match>\n"
+    "</fontconfig>\n";
+
+static const char *files[][2] = {
+    { "conf.d/05-dirs.conf",
+      "<fontconfig>\n"
+      "  <description>Directories</description>\n"
+      "  <dir prefix=\"relative\">fonts-a</dir>\n"
+      "  <cachedir>%s/cache-a</cachedir>\n"
+      "</fontconfig>\n" },
+    { "conf.d/10-alias.conf",
+      "<fontconfig>\n"
+      "  <alias><family>Alpha</family><prefer><family>Beta</family></prefer></alias>\n"
+      "  <include>%s/shared.conf</include>\n"
+      "</fontconfig>\n" },
+    { "conf.d/20-warn.conf",
+      "<fontconfig>\n"
+      "  <bogus/>\n"
+      "  <match>\n"
+      "    <test name=\"family\"><string>Alpha</string></test>\n"
+      "    <edit name=\"weight\"><const>bold</const></edit>\n"
+      "  </match>\n"
+      "</fontconfig>\n" },
+    { "conf.d/30-shared-again.conf",
+      "<fontconfig>\n"
+      "  <include>%s/shared.conf</include>\n"
+      "  <match><edit name=\"family\" mode=\"append\"><string>Again</string></edit></match>\n"
+      "</fontconfig>\n" },
+    { "conf.d/40-rescan.conf",
+      "<fontconfig>\n"
+      "  <config><rescan><int>42</int></rescan></config>\n"
+      "</fontconfig>\n" },
+    { "conf.d/50-select.conf",
+      "<fontconfig>\n"
+      "  <selectfont>\n"
+      "    <acceptfont><glob>/accept/*</glob></acceptfont>\n"
+      "    <rejectfont><pattern><patelt name=\"family\"><string>Rejected</string></patelt></pattern></rejectfont>\n"
+      "  </selectfont>\n"
+      "  <match target=\"font\"><edit name=\"embolden\"><bool>true</bool></edit></match>\n"
+      "</fontconfig>\n" },
+    { "conf.d/60-reset.conf",
+      "<fontconfig>\n"
+      "  <reset-dirs/>\n"
+      "  <dir prefix=\"relative\">fonts-b</dir>\n"
+      "</fontconfig>\n" },
+    { "conf.d/70-nested.conf",
+      "<fontconfig>\n"
+      "  <include>%s/nested.d</include>\n"
+      "</fontconfig>\n" },
+    { "conf.d/80-broken.conf",
+      "<fontconfig>\n"
+      "  <match>\n"
+      "</fontconfig>\n" },
+    { "conf.d/90-after.conf",
+      "<fontconfig>\n"
+      "  <match><edit name=\"family\" mode=\"append\"><string>After</string></edit></match>\n"
+      "</fontconfig>\n" },
+    { "shared.conf",
+      "<fontconfig>\n"
+      "  <match><edit name=\"family\" mode=\"append\"><string>Shared</string></edit></match>\n"
+      "</fontconfig>\n" },
+    { "nested.d/10-one.conf",
+      "<fontconfig>\n"
+      "  <match><edit name=\"family\" mode=\"append\"><string>One</string></edit></match>\n"
+      "</fontconfig>\n" },
+    { "nested.d/20-two.conf",
+      "<fontconfig>\n"
+      "  <cachedir>%s/cache-b</cachedir>\n"
+      "  <match><edit name=\"family\" mode=\"append\"><string>Two</string></edit></match>\n"
+      "</fontconfig>\n" },
+};
+
+#define NRULES 24
+
+static char *
+path (const char *name)
+{
+    static char buf[4][1024];
+    static int  i;
+
+    i = (i + 1) % 4;
+    snprintf (buf[i], sizeof (buf[i]), "%s/%s", basedir, name);
+    return buf[i];
+}
+
+/* Any %s in 'content' is replaced by the directory the files are in */
+static int
+write_file (const char *name, const char *content)
+{
+    FILE *f = fopen (path (name), "w");
+
+    if (!f || fprintf (f, content, basedir) < 0 || fclose (f) == EOF) {
+	fprintf (stderr, "E: unable to write %s: %s\n", name, strerror (errno));
+	return 1;
+    }
+    return 0;
+}
+
+static int
+remove_dir (const char *dir)
+{
+    DIR           *d = opendir (dir);
+    struct dirent *e;
+    char           n[1024];
+
+    if (!d)
+	return 1;
+    while ((e = readdir (d)) != NULL) {
+	if (strcmp (e->d_name, ".") == 0 || strcmp (e->d_name, "..") == 0)
+	    continue;
+	snprintf (n, sizeof (n), "%s/%s", dir, e->d_name);
+	if (unlink (n) == -1 && remove_dir (n))
+	    fprintf (stderr, "W: unable to remove %s\n", n);
+    }
+    closedir (d);
+
+    return rmdir (dir) == -1;
+}
+
+/* Everything about the configuration that parsing sets, as text */
+static void
+describe (FcConfig *config, FcBool parsed, FILE *out)
+{
+    static const char *names[] = { "Alpha", "Rejected:file=/accept/x.ttf", "Gamma" };
+    FcStrList         *list;
+    FcChar8           *s;
+    FcConfigFileInfoIter iter;
+    unsigned int       i;
+
+    fprintf (out, "parsed %d rescan %d\n", parsed, FcConfigGetRescanInterval (config));
+    list = FcConfigGetConfigFiles (config);
+    while ((s = FcStrListNext (list)))
+	fprintf (out, "file %s\n", s);
+    FcStrListDone (list);
+    list = FcConfigGetConfigDirs (config);
+    while ((s = FcStrListNext (list)))
+	fprintf (out, "config dir %s\n", s);
+    FcStrListDone (list);
+    list = FcConfigGetFontDirs (config);
+    while ((s = FcStrListNext (list)))
+	fprintf (out, "font dir %s\n", s);
+    FcStrListDone (list);
+    list = FcConfigGetCacheDirs (config);
+    while ((s = FcStrListNext (list)))
+	fprintf (out, "cache dir %s\n", s);
+    FcStrListDone (list);
+    FcConfigFileInfoIterInit (config, &iter);
+    do {
+	FcChar8 *name, *desc;
+	FcBool   enabled;
+
+	if (FcConfigFileInfoIterGet (config, &iter, &name, &desc, &enabled)) {
+	    fprintf (out, "rules %s %s %d\n", name, desc, enabled);
+	    FcStrFree (name);
+	    FcStrFree (desc);
+	}
+    } while (FcConfigFileInfoIterNext (config, &iter));
+    for (i = 0; i < sizeof (names) / sizeof (names[0]); i++) {
+	FcPattern *p = FcNameParse ((const FcChar8 *)names[i]);
+
+	FcConfigSubstitute (config, p, FcMatchPattern);
+	FcConfigSubstitute (config, p, FcMatchFont);
+	FcPatternDel (p, FC_LANG);
+	FcPatternDel (p, FC_PRGNAME);
+	s = FcNameUnparse (p);
+	fprintf (out, "%s -> %s\n", names[i], s);
+	FcStrFree (s);
+	FcPatternDestroy (p);
+    }
+}
+
+static int
+parse (int nthreads, char **text)
+{
+    FcConfig *config = FcConfigCreate();
+    char      log[1024];
+    char      buf[4096];
+    FcBool    parsed;
+    FILE     *out;
+    size_t    size;
+    ssize_t   len;
+    int       fd, saved;
+
+    snprintf (log, sizeof (log), "%s/stderr-%d", basedir, nthreads);
+    fd = open (log, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (!config || fd == -1) {
+	fprintf (stderr, "E: unable to set up parsing: %s\n", strerror (errno));
+	return 1;
+    }
+    FcConfigSetThreads (config, nthreads);
+    fflush (stderr);
+    saved = dup (2);
+    dup2 (fd, 2);
+    parsed = FcConfigParseAndLoad (config, (const FcChar8 *)path ("fonts.conf"), FcTrue);
+    fflush (stderr);
+    dup2 (saved, 2);
+    close (saved);
+
+    out = open_memstream (text, &size);
+    describe (config, parsed, out);
+    fputs ("messages:\n", out);
+    lseek (fd, 0, SEEK_SET);
+    while ((len = read (fd, buf, sizeof (buf))) > 0)
+	fwrite (buf, 1, len, out);
+    fclose (out);
+    close (fd);
+    FcConfigDestroy (config);
+
+    return 0;
+}
+
+int
+main (void)
+{
+    char        *serial = NULL, *threaded = NULL;
+    char         name[64], rule[512];
+    unsigned int i;
+    int          ret = 0;
+
+    strcpy (basedir, "/tmp/fcparsedir-XXXXXX");
+    if (!mkdtemp (basedir)) {
+	fprintf (stderr, "E: unable to create a temporary directory: %s\n", strerror (errno));
+	return 1;
+    }
+    if (mkdir (path ("conf.d"), 0755) == -1 || mkdir (path ("nested.d"), 0755) == -1) {
+	fprintf (stderr, "E: unable to create directories: %s\n", strerror (errno));
+	ret = 1;
+	goto bail;
+    }
+    ret |= write_file ("fonts.conf", fonts_conf);
+    for (i = 0; i < sizeof (files) / sizeof (files[0]); i++)
+	ret |= write_file (files[i][0], files[i][1]);
+    for (i = 0; i < NRULES; i++) {
+	snprintf (name, sizeof (name), "conf.d/%02d-rule.conf", 10 + i * 3);
+	snprintf (rule, sizeof (rule),
+	          "<fontconfig>\n"
+	          "  <match>\n"
+	          "    <test name=\"family\"><string>Alpha</string></test>\n"
+	          "    <edit name=\"family\" mode=\"append\" binding=\"strong\"><string>Rule%d</string></edit>\n"
+	          "    <edit name=\"size\"><plus><name>size</name><int>%d</int></plus></edit>\n"
+	          "  </match>\n"
+	          "</fontconfig>\n",
+	          i, i);
+	ret |= write_file (name, rule);
+    }
+    if (ret)
+	goto bail;
+
+    ret |= parse (1, &serial);
+    ret |= parse (4, &threaded);
+    if (ret)
+	goto bail;
+    if (strcmp (serial, threaded)) {
+	fprintf (stderr, "E: parsing on threads differs; on one thread:\n%s\non four:\n%s\n",
+	         serial, threaded);
+	ret = 1;
+    }
+    if (!strstr (serial, "Rule23") || !strstr (serial, "bogus")) {
+	fprintf (stderr, "E: configuration wasn't parsed as expected:\n%s\n", serial);
+	ret = 1;
+    }
+
+bail:
+    free (serial);
+    free (threaded);
+    remove_dir (basedir);
+
+    return ret;
+}
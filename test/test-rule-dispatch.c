@@ -0,0 +1,118 @@
+/*
+ * fontconfig/test/test-rule-dispatch.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <fontconfig/fontconfig.h>
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Substitution only runs the rules whose first test may match the
+ * pattern; check that rules still run once earlier edits make them
+ * match.
+ */
+static const FcChar8 *rules = (const FcChar8 *)
+    "<fontconfig>\n"
+    "  <match>\n"
+    "    <test name=\"family\"><string>Alpha</string></test>\n"
+    "    <edit name=\"family\" mode=\"append\"><string>Beta Sans</string></edit>\n"
+    "  </match>\n"
+    "  <match>\n"
+    "    <test name=\"family\" ignore-blanks=\"true\"><string>betasans</string></test>\n"
+    "    <edit name=\"style\" mode=\"append\"><string>beta</string></edit>\n"
+    "  </match>\n"
+    "  <match>\n"
+    "    <test name=\"family\"><string>Gamma</string></test>\n"
+    "    <edit name=\"style\" mode=\"append\"><string>gamma</string></edit>\n"
+    "  </match>\n"
+    "  <match>\n"
+    "    <test name=\"family\" compare=\"contains\"><string>alp</string></test>\n"
+    "    <edit name=\"style\" mode=\"append\"><string>contains</string></edit>\n"
+    "  </match>\n"
+    "  <match>\n"
+    "    <test name=\"weight\" qual=\"all\" compare=\"more\"><int>100</int></test>\n"
+    "    <edit name=\"style\" mode=\"append\"><string>all</string></edit>\n"
+    "  </match>\n"
+    "  <match>\n"
+    "    <test name=\"style\"><string>beta</string></test>\n"
+    "    <edit name=\"style\" mode=\"append\"><string>chained</string></edit>\n"
+    "  </match>\n"
+    "  <match>\n"
+    "    <test name=\"fullname\"><string>Delta</string></test>\n"
+    "    <edit name=\"family\" mode=\"append\"><name>fullname</name></edit>\n"
+    "  </match>\n"
+    "  <match>\n"
+    "    <test name=\"family\"><string>DELTA</string></test>\n"
+    "    <edit name=\"style\" mode=\"append\"><string>delta</string></edit>\n"
+    "  </match>\n"
+    "</fontconfig>\n";
+
+static int
+check_styles (FcConfig *config, const char *name, const char *expected)
+{
+    FcPattern *pat = FcNameParse ((const FcChar8 *)name);
+    FcChar8   *style;
+    char       styles[256] = "";
+    int        i, ret = 1;
+
+    if (!pat)
+	return 1;
+    if (!FcConfigSubstitute (config, pat, FcMatchPattern)) {
+	fprintf (stderr, "E: unable to substitute %s\n", name);
+	goto bail;
+    }
+    for (i = 0; FcPatternGetString (pat, FC_STYLE, i, &style) == FcResultMatch; i++) {
+	if (i)
+	    strcat (styles, ",");
+	strncat (styles, (const char *)style, sizeof (styles) - strlen (styles) - 2);
+    }
+    if (strcmp (styles, expected)) {
+	fprintf (stderr, "E: %s got styles \"%s\", expected \"%s\"\n",
+	         name, styles, expected);
+	goto bail;
+    }
+    ret = 0;
+bail:
+    FcPatternDestroy (pat);
+
+    return ret;
+}
+
+int
+main (void)
+{
+    FcConfig *config = FcConfigCreate();
+    int       ret = 0;
+
+    if (!FcConfigParseAndLoadFromMemory (config, rules, FcTrue))
+	return 1;
+
+    ret |= check_styles (config, "Alpha", "beta,chained,contains,all");
+    ret |= check_styles (config, "Gamma:weight=200", "gamma,all");
+    ret |= check_styles (config, ":fullname=Delta:weight=50", "delta");
+    ret |= check_styles (config, "Epsilon", "all");
+
+    FcConfigDestroy (config);
+
+    return ret;
+}
@@ -0,0 +1,175 @@
+/*
+ * fontconfig/test/test-sort-iter.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <fontconfig/fontconfig.h>
+
+#include <stdio.h>
+
+static int
+check (FcConfig *config, double pixelsize, FcBool trim)
+{
+    FcPattern      *pat, *font;
+    FcFontSet      *fs;
+    FcFontSortIter *iter = NULL;
+    FcResult        result;
+    int             i = 0, ret = 1;
+
+    pat = FcPatternBuild (NULL,
+                          FC_PIXEL_SIZE, FcTypeDouble, pixelsize,
+                          NULL);
+    fs = FcFontSort (config, pat, trim, NULL, &result);
+    if (!fs || result != FcResultMatch) {
+	fprintf (stderr, "E: no fonts sorted for pixelsize %g\n", pixelsize);
+	goto bail;
+    }
+    iter = FcFontSortIterCreate (config, pat, trim, &result);
+    if (!iter || result != FcResultMatch) {
+	fprintf (stderr, "E: no iterator for pixelsize %g\n", pixelsize);
+	goto bail;
+    }
+    while ((font = FcFontSortIterNext (iter))) {
+	if (i >= fs->nfont || font != fs->fonts[i]) {
+	    fprintf (stderr, "E: iterator and sort differ at %d for pixelsize %g\n",
+	             i, pixelsize);
+	    goto bail;
+	}
+	i++;
+    }
+    if (i != fs->nfont) {
+	fprintf (stderr, "E: iterator returned %d fonts, sort %d\n", i, fs->nfont);
+	goto bail;
+    }
+    ret = 0;
+bail:
+    if (iter)
+	FcFontSortIterDestroy (iter);
+    if (fs)
+	FcFontSetDestroy (fs);
+    FcPatternDestroy (pat);
+
+    return ret;
+}
+
+static int
+check_top (FcConfig *config, double pixelsize, FcBool trim, int k)
+{
+    FcPattern *pat;
+    FcFontSet *fs, *top = NULL;
+    FcResult   result;
+    int        i, n, ret = 1;
+
+    pat = FcPatternBuild (NULL,
+                          FC_PIXEL_SIZE, FcTypeDouble, pixelsize,
+                          NULL);
+    fs = FcFontSort (config, pat, trim, NULL, &result);
+    top = FcFontSortN (config, pat, trim, k, NULL, &result);
+    if (!fs || !top || result != FcResultMatch) {
+	fprintf (stderr, "E: no fonts sorted for pixelsize %g\n", pixelsize);
+	goto bail;
+    }
+    n = k < fs->nfont ? k : fs->nfont;
+    if (top->nfont != n) {
+	fprintf (stderr, "E: got %d of the best %d fonts\n", top->nfont, n);
+	goto bail;
+    }
+    for (i = 0; i < n; i++) {
+	if (top->fonts[i] != fs->fonts[i]) {
+	    fprintf (stderr, "E: best %d fonts differ from sort at %d\n", k, i);
+	    goto bail;
+	}
+    }
+    ret = 0;
+bail:
+    if (top)
+	FcFontSetDestroy (top);
+    if (fs)
+	FcFontSetDestroy (fs);
+    FcPatternDestroy (pat);
+
+    return ret;
+}
+
+/*
+ * With trim, copies of one font add no characters after the first, so
+ * the best fonts found while scoring all get dropped but one.
+ */
+static int
+check_top_shared (void)
+{
+    FcConfig *config = FcConfigCreate();
+    int       i, ret = 0;
+
+    for (i = 0; i < 12; i++) {
+	if (!FcConfigAppFontAddFile (config, (const FcChar8 *)SRCDIR "/8x16.pcf"))
+	    return 1;
+    }
+    if (!FcConfigAppFontAddFile (config, (const FcChar8 *)SRCDIR "/4x6.pcf"))
+	return 1;
+
+    ret |= check_top (config, 16, FcTrue, 1);
+    ret |= check_top (config, 16, FcTrue, 2);
+    ret |= check_top (config, 16, FcTrue, 3);
+    ret |= check_top (config, 16, FcFalse, 3);
+
+    FcConfigDestroy (config);
+
+    return ret;
+}
+
+int
+main (void)
+{
+    FcConfig       *config = FcConfigCreate();
+    FcFontSortIter *iter;
+    FcPattern      *pat;
+    FcResult        result;
+    int             ret = 0;
+
+    if (!FcConfigAppFontAddFile (config, (const FcChar8 *)SRCDIR "/4x6.pcf") ||
+        !FcConfigAppFontAddFile (config, (const FcChar8 *)SRCDIR "/8x16.pcf"))
+	return 1;
+
+    ret |= check (config, 6, FcFalse);
+    ret |= check (config, 16, FcFalse);
+    ret |= check (config, 16, FcTrue);
+    ret |= check_top (config, 6, FcFalse, 1);
+    ret |= check_top (config, 16, FcFalse, 1);
+    ret |= check_top (config, 16, FcFalse, 5);
+    ret |= check_top (config, 16, FcTrue, 1);
+    ret |= check_top_shared();
+
+    /* Stopping early is fine, returned patterns stay valid until destroyed */
+    pat = FcPatternCreate();
+    iter = FcFontSortIterCreate (config, pat, FcFalse, &result);
+    if (!iter || !FcFontSortIterNext (iter)) {
+	fprintf (stderr, "E: iterator returned no font\n");
+	ret = 1;
+    }
+    if (iter)
+	FcFontSortIterDestroy (iter);
+    FcPatternDestroy (pat);
+
+    FcConfigDestroy (config);
+
+    return ret;
+}
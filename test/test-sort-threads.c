@@ -0,0 +1,128 @@
+/*
+ * fontconfig/test/test-sort-threads.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <fontconfig/fontconfig.h>
+
+#include <stdio.h>
+
+#define NFONT 20000
+
+static const char *families[] = {
+    "DejaVu Sans", "DejaVu Serif", "Noto Sans", "Noto Serif", "Liberation Mono"
+};
+static const char *styles[] = {
+    "Regular", "Bold", "Italic", "Bold Italic"
+};
+
+/* Plenty of fonts with equal scores, so ties have to be broken the same way */
+static FcFontSet *
+make_fonts (void)
+{
+    FcFontSet *fs = FcFontSetCreate();
+    char       file[32];
+    int        i;
+
+    for (i = 0; i < NFONT; i++) {
+	snprintf (file, sizeof (file), "/fonts/%d.ttf", i);
+	FcFontSetAdd (fs, FcPatternBuild (NULL,
+	                                  FC_FAMILY, FcTypeString, families[i % 5],
+	                                  FC_STYLE, FcTypeString, styles[(i / 5) % 4],
+	                                  FC_WEIGHT, FcTypeInteger, (i % 3) * 100,
+	                                  FC_SLANT, FcTypeInteger, (i / 7) % 2 ? 100 : 0,
+	                                  FC_FILE, FcTypeString, file,
+	                                  NULL));
+    }
+    return fs;
+}
+
+static FcFontSet *
+sort (FcConfig *config, FcFontSet *fs, FcPattern *pat, FcBool trim, int nthreads)
+{
+    FcResult result;
+
+    FcConfigSetThreads (config, nthreads);
+    return FcFontSetSort (config, &fs, 1, pat, trim, NULL, &result);
+}
+
+static int
+check (FcConfig *config, FcFontSet *fs, FcPattern *pat, FcBool trim)
+{
+    FcFontSet *serial, *parallel;
+    int        i, ret = 1;
+
+    serial = sort (config, fs, pat, trim, 1);
+    parallel = sort (config, fs, pat, trim, 4);
+    if (!serial || !parallel) {
+	fprintf (stderr, "E: sort failed\n");
+	goto bail;
+    }
+    if (serial->nfont != parallel->nfont) {
+	fprintf (stderr, "E: %d fonts sorted with threads, %d without\n",
+	         parallel->nfont, serial->nfont);
+	goto bail;
+    }
+    for (i = 0; i < serial->nfont; i++) {
+	if (!FcPatternEqual (serial->fonts[i], parallel->fonts[i])) {
+	    fprintf (stderr, "E: sort results differ at %d\n", i);
+	    goto bail;
+	}
+    }
+    ret = 0;
+bail:
+    if (serial)
+	FcFontSetDestroy (serial);
+    if (parallel)
+	FcFontSetDestroy (parallel);
+
+    return ret;
+}
+
+int
+main (void)
+{
+    FcConfig  *config = FcConfigCreate();
+    FcFontSet *fs = make_fonts();
+    FcPattern *pat;
+    int        ret = 0;
+
+    pat = FcPatternBuild (NULL,
+                          FC_FAMILY, FcTypeString, "Noto Sans",
+                          FC_FAMILY, FcTypeString, "DejaVu Serif",
+                          FC_WEIGHT, FcTypeInteger, 200,
+                          NULL);
+    ret |= check (config, fs, pat, FcFalse);
+    ret |= check (config, fs, pat, FcTrue);
+    FcPatternDestroy (pat);
+
+    pat = FcPatternBuild (NULL,
+                          FC_STYLE, FcTypeString, "Bold",
+                          FC_LANG, FcTypeString, "en",
+                          NULL);
+    ret |= check (config, fs, pat, FcFalse);
+    FcPatternDestroy (pat);
+
+    FcFontSetDestroy (fs);
+    FcConfigDestroy (config);
+
+    return ret;
+}
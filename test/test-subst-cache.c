@@ -0,0 +1,137 @@
+/*
+ * fontconfig/test/test-subst-cache.c
+ *
+ * Copyright © 2026 fontconfig Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the author(s) not be used in
+ * advertising or publicity pertaining to distribution of the software without
+ * specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any purpose.  It
+ * is provided "as is" without express or implied warranty.
+ *
+ * THE AUTHOR(S) DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <fontconfig/fontconfig.h>
+
+#include <stdio.h>
+#include <string.h>
+
+static const FcChar8 *rules = (const FcChar8 *)
+    "<fontconfig>\n"
+    "  <match>\n"
+    "    <test name=\"prgname\"><string>foo</string></test>\n"
+    "    <edit name=\"style\" mode=\"append\"><string>foo</string></edit>\n"
+    "  </match>\n"
+    "  <match>\n"
+    "    <test name=\"family\"><string>Alpha</string></test>\n"
+    "    <edit name=\"family\" mode=\"append\"><string>Beta</string></edit>\n"
+    "  </match>\n"
+    "</fontconfig>\n";
+
+static const FcChar8 *more_rules = (const FcChar8 *)
+    "<fontconfig>\n"
+    "  <match>\n"
+    "    <test name=\"family\"><string>Beta</string></test>\n"
+    "    <edit name=\"style\" mode=\"append\"><string>beta</string></edit>\n"
+    "  </match>\n"
+    "</fontconfig>\n";
+
+static int
+substitute (FcConfig *config, const char *name, const char *expected)
+{
+    FcPattern *pat = FcNameParse ((const FcChar8 *)name);
+    FcChar8   *s = NULL;
+    int        ret = 1;
+
+    if (!pat)
+	return 1;
+    if (!FcConfigSubstitute (config, pat, FcMatchPattern)) {
+	fprintf (stderr, "E: unable to substitute %s\n", name);
+	goto bail;
+    }
+    s = FcNameUnparse (pat);
+    if (!s)
+	goto bail;
+    if (strcmp ((const char *)s, expected)) {
+	fprintf (stderr, "E: %s substituted to %s, expected %s\n",
+	         name, s, expected);
+	goto bail;
+    }
+    ret = 0;
+bail:
+    if (s)
+	FcStrFree (s);
+    FcPatternDestroy (pat);
+
+    return ret;
+}
+
+static int
+check_stats (FcConfig *config, unsigned long hits, unsigned long misses)
+{
+    unsigned long h, m;
+
+    FcConfigGetSubstituteCacheStats (config, &h, &m);
+    if (h != hits || m != misses) {
+	fprintf (stderr, "E: cache stats hits=%lu misses=%lu, expected %lu/%lu\n",
+	         h, m, hits, misses);
+	return 1;
+    }
+    return 0;
+}
+
+int
+main (void)
+{
+    FcConfig *config = FcConfigCreate();
+    int       ret = 0;
+
+    if (!FcConfigParseAndLoadFromMemory (config, rules, FcTrue))
+	return 1;
+
+    /* Disabled by default */
+    ret |= substitute (config, "Alpha:prgname=foo:lang=en",
+                       "Alpha,Beta:style=foo:lang=en:prgname=foo");
+    ret |= check_stats (config, 0, 0);
+
+    if (!FcConfigSetSubstituteCacheSize (config, 2))
+	return 1;
+    ret |= substitute (config, "Alpha:prgname=foo:lang=en",
+                       "Alpha,Beta:style=foo:lang=en:prgname=foo");
+    ret |= substitute (config, "Alpha:prgname=foo:lang=en",
+                       "Alpha,Beta:style=foo:lang=en:prgname=foo");
+    ret |= check_stats (config, 1, 1);
+
+    /* The program name is part of the key */
+    ret |= substitute (config, "Alpha:prgname=bar:lang=en",
+                       "Alpha,Beta:lang=en:prgname=bar");
+    ret |= check_stats (config, 1, 2);
+
+    /* Adding rules must invalidate the cached results */
+    if (!FcConfigParseAndLoadFromMemory (config, more_rules, FcTrue))
+	return 1;
+    ret |= substitute (config, "Alpha:prgname=foo:lang=en",
+                       "Alpha,Beta:style=foo,beta:lang=en:prgname=foo");
+    ret |= substitute (config, "Alpha:prgname=foo:lang=en",
+                       "Alpha,Beta:style=foo,beta:lang=en:prgname=foo");
+    ret |= check_stats (config, 2, 3);
+
+    FcConfigSetSubstituteCacheSize (config, 0);
+    ret |= substitute (config, "Alpha:prgname=foo:lang=en",
+                       "Alpha,Beta:style=foo,beta:lang=en:prgname=foo");
+    ret |= check_stats (config, 2, 3);
+
+    FcConfigDestroy (config);
+
+    return ret;
+}